@@ -1,6 +1,8 @@
 #pragma once
 
 #include "pipeline.hpp"
+#include "parallel.hpp"
+#include "log.hpp"
 
 #include <glm/gtx/hash.hpp>
 
@@ -126,8 +128,199 @@ template< typename VALUE, class REVERSE_VALUE = SameValue< VALUE >, class COMBIN
 struct EmbeddedPlanarMap {
 	std::vector< IntegerEmbeddedVertex > vertices;
 
-	std::unordered_map< glm::uvec3, std::vector< uint32_t > > simplex_vertices;
-	std::unordered_map< glm::uvec3, std::vector< EmbeddedEdge< VALUE > > > simplex_edges;
+	//The map is built over a fixed mesh; every simplex of the mesh (vertex, edge, triangle) gets a "slot":
+	//  vertex v          -> slot v
+	//  edge (a,b)        -> slot vertex_count + edge id
+	//  triangle (a,b,c)  -> slot vertex_count + edge_count + triangle id
+	//edge/triangle ids are found with CSR tables over sorted simplices, built once in the constructor.
+	uint32_t vertex_count = 0;
+	std::vector< uint32_t > edge_offsets; //edge_offsets[a] .. edge_offsets[a+1] index edge_others for edges (a,b>a)
+	std::vector< uint32_t > edge_others;
+	std::vector< uint32_t > tri_offsets; //tri_offsets[e] .. tri_offsets[e+1] index tri_others for triangles (edge e, c>b)
+	std::vector< uint32_t > tri_others;
+	std::vector< uint32_t > tri_slot; //slot of each triangle passed to the constructor
+	std::vector< glm::uvec3 > slot_triangles; //(sorted) triangle simplex for each triangle slot
+
+	//vertices + edges in each slot are kept in insertion order as singly-linked lists through pooled arrays:
+	std::vector< uint32_t > slot_vertex_first, slot_vertex_last;
+	std::vector< uint32_t > vertex_next; //parallel to 'vertices'
+	std::vector< uint32_t > slot_edge_first, slot_edge_last;
+	std::vector< EmbeddedEdge< VALUE > > edge_pool;
+	std::vector< uint32_t > edge_next; //parallel to 'edge_pool'
+
+	EmbeddedPlanarMap(uint32_t vertex_count_, std::vector< glm::uvec3 > const &triangles) : vertex_count(vertex_count_) {
+		std::vector< glm::uvec3 > sorted;
+		sorted.reserve(triangles.size());
+		for (auto const &tri : triangles) {
+			glm::uvec3 s = tri;
+			if (s.x > s.y) std::swap(s.x, s.y);
+			if (s.y > s.z) std::swap(s.y, s.z);
+			if (s.x > s.y) std::swap(s.x, s.y);
+			assert(s.x < s.y && s.y < s.z && s.z < vertex_count);
+			sorted.emplace_back(s);
+		}
+		auto less = [](glm::uvec3 const &a, glm::uvec3 const &b) {
+			if (a.x != b.x) return a.x < b.x;
+			if (a.y != b.y) return a.y < b.y;
+			return a.z < b.z;
+		};
+
+		{ //edges:
+			std::vector< glm::uvec3 > edges; //(a,b,-1) so the same comparison can be used
+			edges.reserve(sorted.size() * 3);
+			for (auto const &s : sorted) {
+				edges.emplace_back(s.x, s.y, -1U);
+				edges.emplace_back(s.y, s.z, -1U);
+				edges.emplace_back(s.x, s.z, -1U);
+			}
+			std::sort(edges.begin(), edges.end(), less);
+			edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+			edge_offsets.assign(vertex_count + 1, 0);
+			edge_others.reserve(edges.size());
+			for (auto const &e : edges) {
+				edge_offsets[e.x + 1] += 1;
+				edge_others.emplace_back(e.y);
+			}
+			for (uint32_t v = 0; v < vertex_count; ++v) {
+				edge_offsets[v + 1] += edge_offsets[v];
+			}
+		}
+
+		{ //triangles:
+			std::vector< glm::uvec3 > tris = sorted;
+			std::sort(tris.begin(), tris.end(), less);
+			tris.erase(std::unique(tris.begin(), tris.end()), tris.end());
+			tri_offsets.assign(edge_others.size() + 1, 0);
+			tri_others.reserve(tris.size());
+			for (auto const &t : tris) {
+				uint32_t e = edge_id(t.x, t.y);
+				assert(e != -1U);
+				tri_offsets[e + 1] += 1;
+				tri_others.emplace_back(t.z);
+			}
+			for (uint32_t e = 0; e < edge_others.size(); ++e) {
+				tri_offsets[e + 1] += tri_offsets[e];
+			}
+			slot_triangles = std::move(tris);
+		}
+
+		tri_slot.reserve(sorted.size());
+		for (auto const &s : sorted) {
+			tri_slot.emplace_back(simplex_slot(s));
+		}
+
+		uint32_t slots = vertex_count + edge_others.size() + tri_others.size();
+		slot_vertex_first.assign(slots, -1U);
+		slot_vertex_last.assign(slots, -1U);
+		slot_edge_first.assign(slots, -1U);
+		slot_edge_last.assign(slots, -1U);
+	}
+
+	uint32_t slot_count() const {
+		return slot_vertex_first.size();
+	}
+
+	//index of edge (a,b) [a < b] or -1U if not in mesh:
+	uint32_t edge_id(uint32_t a, uint32_t b) const {
+		assert(a < b);
+		if (a >= vertex_count) return -1U;
+		auto begin = edge_others.begin() + edge_offsets[a];
+		auto end = edge_others.begin() + edge_offsets[a + 1];
+		auto f = std::lower_bound(begin, end, b);
+		if (f == end || *f != b) return -1U;
+		return f - edge_others.begin();
+	}
+
+	//slot of a (sorted, -1U-padded) simplex; throws if the simplex isn't part of the mesh:
+	uint32_t simplex_slot(glm::uvec3 const &simplex) const {
+		assert(simplex.x != -1U);
+		if (simplex.y == -1U) {
+			assert(simplex.z == -1U);
+			if (simplex.x < vertex_count) return simplex.x;
+		} else {
+			uint32_t e = edge_id(simplex.x, simplex.y);
+			if (e != -1U) {
+				if (simplex.z == -1U) return vertex_count + e;
+				assert(simplex.y < simplex.z);
+				auto begin = tri_others.begin() + tri_offsets[e];
+				auto end = tri_others.begin() + tri_offsets[e + 1];
+				auto f = std::lower_bound(begin, end, simplex.z);
+				if (f != end && *f == simplex.z) {
+					return vertex_count + edge_others.size() + (f - tri_others.begin());
+				}
+			}
+		}
+		throw std::runtime_error("EmbeddedPlanarMap: simplex is not part of the mesh.");
+	}
+
+	//iterate edges in a slot (in insertion order):
+	struct EdgeIterator {
+		EmbeddedPlanarMap *epm;
+		uint32_t at;
+		EmbeddedEdge< VALUE > &operator*() const { return epm->edge_pool[at]; }
+		EmbeddedEdge< VALUE > *operator->() const { return &epm->edge_pool[at]; }
+		EdgeIterator &operator++() { at = epm->edge_next[at]; return *this; }
+		bool operator!=(EdgeIterator const &o) const { return at != o.at; }
+	};
+	struct EdgeRange {
+		EdgeIterator first, last;
+		EdgeIterator begin() const { return first; }
+		EdgeIterator end() const { return last; }
+		bool empty() const { return !(first != last); }
+	};
+	EdgeRange edges_in(uint32_t slot) {
+		assert(slot < slot_count());
+		return EdgeRange{ EdgeIterator{this, slot_edge_first[slot]}, EdgeIterator{this, -1U} };
+	}
+
+	//stats (for debug output):
+	uint32_t simplices_with_vertices() const {
+		uint32_t count = 0;
+		for (auto f : slot_vertex_first) {
+			if (f != -1U) ++count;
+		}
+		return count;
+	}
+	uint32_t simplices_with_edges() const {
+		uint32_t count = 0;
+		for (auto f : slot_edge_first) {
+			if (f != -1U) ++count;
+		}
+		return count;
+	}
+	uint32_t edge_count() const {
+		uint32_t count = 0;
+		for (auto f : slot_edge_first) {
+			for (uint32_t e = f; e != -1U; e = edge_next[e]) ++count;
+		}
+		return count;
+	}
+
+	void append_edge(uint32_t slot, EmbeddedEdge< VALUE > const &edge) {
+		uint32_t idx = edge_pool.size();
+		edge_pool.emplace_back(edge);
+		edge_next.emplace_back(-1U);
+		if (slot_edge_last[slot] == -1U) {
+			assert(slot_edge_first[slot] == -1U);
+			slot_edge_first[slot] = idx;
+		} else {
+			edge_next[slot_edge_last[slot]] = idx;
+		}
+		slot_edge_last[slot] = idx;
+	}
+
+	//unlink edge 'e' (which comes after 'prev', or is first if prev is -1U) from a slot:
+	void remove_edge(uint32_t slot, uint32_t prev, uint32_t e) {
+		if (prev == -1U) {
+			assert(slot_edge_first[slot] == e);
+			slot_edge_first[slot] = edge_next[e];
+		} else {
+			assert(edge_next[prev] == e);
+			edge_next[prev] = edge_next[e];
+		}
+		if (slot_edge_last[slot] == e) slot_edge_last[slot] = prev;
+		edge_next[e] = -1U;
+	}
 
 	static inline void reverse_value(VALUE *value) { REVERSE_VALUE::reverse(value); }
 	static inline void combine_values(VALUE *value, VALUE const &incoming) { COMBINE_VALUES::combine(value, incoming); }
@@ -178,12 +371,11 @@ struct EmbeddedPlanarMap {
 		int32_t perp_a2 = (a2 - a).x * -(b - a).y + (a2 - a).y * (b - a).x;
 		int32_t perp_b2 = (b2 - a).x * -(b - a).y + (b2 - a).y * (b - a).x;
 		if (perp_a2 == perp_b2) {
-			//DEBUG:
-			std::cout << "a  = (" << a.x << ", " << a.y << ") b  = (" << b.x << ", " << b.y << ")\n";
-			std::cout << "a2 = (" << a2.x << ", " << a2.y << ") b2 = (" << b2.x << ", " << b2.y << ")\n";
-			std::cout << "perp_a2 is " << perp_a2 << "\n";
-			std::cout << "perp_b2 is " << perp_b2 << "\n";
-			std::cout.flush();
+			//DEBUG (as an error, so it is written before the assert below):
+			LOG(Error, Peel) << "a  = (" << a.x << ", " << a.y << ") b  = (" << b.x << ", " << b.y << ")\n"
+				<< "a2 = (" << a2.x << ", " << a2.y << ") b2 = (" << b2.x << ", " << b2.y << ")\n"
+				<< "perp_a2 is " << perp_a2 << "\n"
+				<< "perp_b2 is " << perp_b2;
 		}
 		assert(perp_a2 != perp_b2);
 
@@ -227,10 +419,9 @@ struct EmbeddedPlanarMap {
 	uint32_t add_vertex(const IntegerEmbeddedVertex &v_) {
 		IntegerEmbeddedVertex v = IntegerEmbeddedVertex::simplify(v_);
 
-		auto &verts = simplex_vertices[v.simplex];
-		auto &edges = simplex_edges[v.simplex];
+		uint32_t slot = simplex_slot(v.simplex);
 
-		for (auto i : verts) {
+		for (uint32_t i = slot_vertex_first[slot]; i != -1U; i = vertex_next[i]) {
 			if (vertices[i] == v) return i;
 		}
 		/* //PARANOIA:
@@ -243,17 +434,21 @@ struct EmbeddedPlanarMap {
 
 		uint32_t idx = vertices.size();
 		vertices.emplace_back(v);
-		verts.emplace_back(idx);
-
-		uint32_t old_size = edges.size();
-
-		for (uint32_t e = 0; e < old_size; ++e) {
-			if (point_in_segment(v, vertices[edges[e].first], vertices[edges[e].second])) {
-				auto second_half = edges[e];
+		vertex_next.emplace_back(-1U);
+		if (slot_vertex_last[slot] == -1U) slot_vertex_first[slot] = idx;
+		else vertex_next[slot_vertex_last[slot]] = idx;
+		slot_vertex_last[slot] = idx;
+
+		//split any existing edges (but not the new halves) that the vertex lands on:
+		uint32_t old_last = slot_edge_last[slot];
+		for (uint32_t e = slot_edge_first[slot]; old_last != -1U; e = edge_next[e]) {
+			if (point_in_segment(v, vertices[edge_pool[e].first], vertices[edge_pool[e].second])) {
+				auto second_half = edge_pool[e];
 				second_half.first = idx;
-				edges[e].second = idx;
-				edges.emplace_back(second_half);
+				edge_pool[e].second = idx;
+				append_edge(slot, second_half);
 			}
+			if (e == old_last) break;
 		}
 		return idx;
 	}
@@ -266,13 +461,13 @@ struct EmbeddedPlanarMap {
 		const auto &a_ = vertices[ai];
 		const auto &b_ = vertices[bi];
 		glm::uvec3 common = IntegerEmbeddedVertex::common_simplex(a_.simplex, b_.simplex);
+		uint32_t slot = simplex_slot(common);
 
 		glm::ivec2 a = glm::ivec2(a_.weights_on(common));
 		glm::ivec2 b = glm::ivec2(b_.weights_on(common));
 
 		//split edge at any vertices in simplex:
-		auto &verts = simplex_vertices[common];
-		for (auto vi : verts) {
+		for (uint32_t vi = slot_vertex_first[slot]; vi != -1U; vi = vertex_next[vi]) {
 			assert(vi < vertices.size());
 			glm::ivec2 v = glm::vec2(vertices[vi].weights_on(common));
 			if (point_in_segment(v, a, b)) {
@@ -285,39 +480,39 @@ struct EmbeddedPlanarMap {
 		}
 
 		//split edge (and add new vertex) if there is an intersection:
-		auto &edges = simplex_edges[common];
-		for (uint32_t e = 0; e < edges.size(); ++e) {
+		uint32_t prev = -1U;
+		for (uint32_t e = slot_edge_first[slot]; e != -1U; prev = e, e = edge_next[e]) {
 
 			//if it matches the edge, over-write value & done!
-			if (edges[e].first == ai && edges[e].second == bi) {
-				combine_values(&edges[e].value, value);
+			if (edge_pool[e].first == ai && edge_pool[e].second == bi) {
+				combine_values(&edge_pool[e].value, value);
 				return;
 			}
-			if (edges[e].first == bi && edges[e].second == ai) {
+			if (edge_pool[e].first == bi && edge_pool[e].second == ai) {
 				VALUE temp = value;
 				reverse_value(&temp);
-				combine_values(&edges[e].value, temp);
+				combine_values(&edge_pool[e].value, temp);
 				return;
 			}
 
-			glm::ivec2 a2 = glm::ivec2(vertices[edges[e].first].weights_on(common));
-			glm::ivec2 b2 = glm::ivec2(vertices[edges[e].second].weights_on(common));
+			glm::ivec2 a2 = glm::ivec2(vertices[edge_pool[e].first].weights_on(common));
+			glm::ivec2 b2 = glm::ivec2(vertices[edge_pool[e].second].weights_on(common));
 
 			//if endpoints are interior to an existing edge, split existing edge:
 			if (point_in_segment(a, a2, b2)) {
 				assert(false); //THIS SHOULD NEVER HAPPEN (should have been avoided by vertex insertion?)
-				auto second_half = edges[e];
+				auto second_half = edge_pool[e];
 				second_half.first = ai;
-				edges.emplace_back(second_half);
-				edges[e].second = ai;
+				append_edge(slot, second_half);
+				edge_pool[e].second = ai;
 				b2 = a;
 			}
 			if (point_in_segment(b, a2, b2)) {
 				assert(false); //THIS SHOULD NEVER HAPPEN (should have been avoided by vertex insertion?)
-				auto second_half = edges[e];
+				auto second_half = edge_pool[e];
 				second_half.first = bi;
-				edges.emplace_back(second_half);
-				edges[e].second = bi;
+				append_edge(slot, second_half);
+				edge_pool[e].second = bi;
 				b2 = b;
 			}
 
@@ -327,10 +522,10 @@ struct EmbeddedPlanarMap {
 				pt.z = WEIGHT_SUM - pt.x - pt.y;
 				uint32_t pti = add_vertex(IntegerEmbeddedVertex(common, pt));
 
-				float ai2 = edges[e].first;
-				float bi2 = edges[e].second;
-				VALUE value2 = edges[e].value;
-				edges.erase(edges.begin() + e);
+				uint32_t ai2 = edge_pool[e].first;
+				uint32_t bi2 = edge_pool[e].second;
+				VALUE value2 = edge_pool[e].value;
+				remove_edge(slot, prev, e);
 
 				VALUE value2_first, value2_second;
 				split_value(value2, &value2_first, &value2_second);
@@ -348,7 +543,7 @@ struct EmbeddedPlanarMap {
 		}
 
 		//if got to this point, no intersections:
-		edges.emplace_back(ai, bi, value);
+		append_edge(slot, EmbeddedEdge< VALUE >(ai, bi, value));
 	}
 	void add_edge(const ak::EmbeddedVertex &a, const ak::EmbeddedVertex &b, VALUE const &value) {
 		uint32_t ai = add_vertex(a);
@@ -356,6 +551,126 @@ struct EmbeddedPlanarMap {
 		add_edge(ai, bi, value);
 	}
 
+	//Bulk version of add_edge for many edges between existing vertices.
+	//Edges inside triangles only ever interact with other edges in the same triangle, so
+	// triangles are split into 'groups' (contiguous slot ranges with similar edge counts),
+	// and each group is resolved in a private map (over just its triangles) in parallel.
+	//Groups are then merged in order, so vertex ids don't depend on thread scheduling.
+	//Edges along mesh edges (shared by two triangles) are added sequentially afterward.
+	// enter_group(g) is called on the worker thread before group g's edges are added, and
+	//  enter_group(-1U) once they are done (so VALUE policies can keep per-group state);
+	// merge_value(g, &value) is called (in order) on every value from group g before it
+	//  is moved into this map.
+	//NOTE: result is the same planar map as add_edge() in sequence, though vertex ids may be numbered differently.
+	template< typename ENTER_GROUP, typename MERGE_VALUE >
+	void add_edges(
+		std::vector< EmbeddedEdge< VALUE > > const &new_edges,
+		ENTER_GROUP const &enter_group,
+		MERGE_VALUE const &merge_value,
+		uint32_t max_groups = 16
+	) {
+		uint32_t const first_tri_slot = vertex_count + edge_others.size();
+
+		//bucket by slot (counting sort keeps input order within a slot):
+		std::vector< uint32_t > slot_of(new_edges.size());
+		std::vector< uint32_t > bucket_offsets(slot_count() + 1, 0);
+		for (uint32_t i = 0; i < new_edges.size(); ++i) {
+			auto const &e = new_edges[i];
+			assert(e.first < vertices.size() && e.second < vertices.size());
+			if (e.first == e.second) {
+				slot_of[i] = -1U;
+				continue;
+			}
+			slot_of[i] = simplex_slot(IntegerEmbeddedVertex::common_simplex(vertices[e.first].simplex, vertices[e.second].simplex));
+			bucket_offsets[slot_of[i] + 1] += 1;
+		}
+		for (uint32_t s = 0; s < slot_count(); ++s) {
+			bucket_offsets[s + 1] += bucket_offsets[s];
+		}
+		std::vector< uint32_t > bucketed(bucket_offsets.back());
+		{
+			std::vector< uint32_t > fill(bucket_offsets.begin(), bucket_offsets.end() - 1);
+			for (uint32_t i = 0; i < new_edges.size(); ++i) {
+				if (slot_of[i] != -1U) bucketed[fill[slot_of[i]]++] = i;
+			}
+		}
+
+		//split triangle slots into groups of roughly equal edge counts:
+		uint32_t tri_edges = bucket_offsets.back() - bucket_offsets[first_tri_slot];
+		uint32_t groups = std::max(1U, std::min(max_groups, tri_edges / 64));
+		std::vector< uint32_t > group_begin; //in slots
+		group_begin.emplace_back(first_tri_slot);
+		for (uint32_t s = first_tri_slot; s < slot_count() && group_begin.size() < groups; ++s) {
+			uint32_t done = bucket_offsets[s] - bucket_offsets[first_tri_slot];
+			if (uint64_t(done) * groups >= uint64_t(tri_edges) * group_begin.size() && s > group_begin.back()) {
+				group_begin.emplace_back(s);
+			}
+		}
+		group_begin.emplace_back(slot_count());
+
+		struct Group {
+			std::vector< glm::uvec3 > triangles;
+			std::vector< EmbeddedPlanarMap > map; //(zero or one -- not default-constructible)
+		};
+		std::vector< Group > group_maps(group_begin.size() - 1);
+
+		ak::parallel_for(group_maps.size(), [&](uint32_t g) {
+			Group &group = group_maps[g];
+			for (uint32_t s = group_begin[g]; s < group_begin[g+1]; ++s) {
+				if (bucket_offsets[s] != bucket_offsets[s+1]) {
+					group.triangles.emplace_back(slot_triangles[s - first_tri_slot]);
+				}
+			}
+			if (group.triangles.empty()) return;
+			group.map.emplace_back(vertex_count, group.triangles);
+			EmbeddedPlanarMap &local = group.map.back();
+			enter_group(g);
+			std::vector< uint32_t > to_local(vertices.size(), -1U);
+			auto local_vertex = [&](uint32_t v) {
+				if (to_local[v] == -1U) to_local[v] = local.add_vertex(vertices[v]);
+				return to_local[v];
+			};
+			for (uint32_t i = bucket_offsets[group_begin[g]]; i < bucket_offsets[group_begin[g+1]]; ++i) {
+				auto const &e = new_edges[bucketed[i]];
+				local.add_edge(local_vertex(e.first), local_vertex(e.second), e.value);
+			}
+			enter_group(-1U);
+		});
+
+		//merge:
+		for (uint32_t g = 0; g < group_maps.size(); ++g) {
+			if (group_maps[g].map.empty()) continue;
+			EmbeddedPlanarMap &local = group_maps[g].map.back();
+			std::vector< uint32_t > to_global;
+			to_global.reserve(local.vertices.size());
+			for (auto const &v : local.vertices) {
+				to_global.emplace_back(add_vertex(v));
+			}
+			for (uint32_t ls = 0; ls < local.slot_count(); ++ls) {
+				for (uint32_t e = local.slot_edge_first[ls]; e != -1U; e = local.edge_next[e]) {
+					EmbeddedEdge< VALUE > edge = local.edge_pool[e];
+					edge.first = to_global[edge.first];
+					edge.second = to_global[edge.second];
+					merge_value(g, &edge.value);
+					uint32_t slot = simplex_slot(IntegerEmbeddedVertex::common_simplex(vertices[edge.first].simplex, vertices[edge.second].simplex));
+					if (slot >= first_tri_slot) {
+						//triangle interiors belong to just this group, so edges are already resolved:
+						append_edge(slot, edge);
+					} else {
+						//(piece of an) edge along a mesh edge -- may interact with other groups:
+						add_edge(edge.first, edge.second, edge.value);
+					}
+				}
+			}
+		}
+
+		//edges along mesh edges:
+		for (uint32_t i = 0; i < bucket_offsets[first_tri_slot]; ++i) {
+			auto const &e = new_edges[bucketed[i]];
+			add_edge(e.first, e.second, e.value);
+		}
+	}
+
 	void split_triangles(
 		std::vector< glm::vec3 > const &verts, //in: mesh vertices
 		std::vector< glm::uvec3 > const &tris, //in: mesh triangles
@@ -407,8 +722,12 @@ struct EmbeddedPlanarMap {
 
 		std::vector< glm::uvec3 > DEBUG_split_tris;
 
+		assert(tris.size() == tri_slot.size()); //should be the triangles the map was built over
+		uint32_t did_untouched = 0;
+
 		//now, for each triangle, locally triangulate the planar map:
 		for (const auto &tri : tris) {
+			uint32_t slot = tri_slot[&tri - &tris[0]];
 			glm::uvec3 simplex = tri;
 			bool need_flip = false;
 			if (simplex.x > simplex.y) {
@@ -425,6 +744,22 @@ struct EmbeddedPlanarMap {
 			}
 			assert(simplex.x < simplex.y && simplex.y < simplex.z);
 
+			uint32_t side_slots[3] = {
+				vertex_count + edge_id(simplex.x, simplex.y),
+				vertex_count + edge_id(simplex.y, simplex.z),
+				vertex_count + edge_id(simplex.x, simplex.z)
+			};
+
+			//most triangles aren't touched by the map at all:
+			if (slot_edge_first[slot] == -1U
+			 && slot_vertex_first[side_slots[0]] == -1U
+			 && slot_vertex_first[side_slots[1]] == -1U
+			 && slot_vertex_first[side_slots[2]] == -1U) {
+				split_tris.emplace_back(tri);
+				++did_untouched;
+				continue;
+			}
+
 			std::vector< uint32_t > source_verts; //in split_verts
 			std::vector< glm::ivec2 > coords; //[x,y] in weight space
 			std::unordered_multimap< uint32_t, uint32_t > half_edges; //relative to coords
@@ -443,14 +778,12 @@ struct EmbeddedPlanarMap {
 
 			//add two half-edges for all internal edges:
 			//std::cout << " ---- internal edges ---- " << std::endl; //DEBUG
-			auto f = simplex_edges.find(simplex);
-			if (f != simplex_edges.end()) {
-				for (const auto &edge : f->second) {
-					uint32_t a = ref_vert(epm_to_split[edge.first], vertices[edge.first].weights_on(simplex));
-					uint32_t b = ref_vert(epm_to_split[edge.second], vertices[edge.second].weights_on(simplex));
-					half_edges.insert(std::make_pair(a,b));
-					half_edges.insert(std::make_pair(b,a));
-				}
+			for (uint32_t e = slot_edge_first[slot]; e != -1U; e = edge_next[e]) {
+				const auto &edge = edge_pool[e];
+				uint32_t a = ref_vert(epm_to_split[edge.first], vertices[edge.first].weights_on(simplex));
+				uint32_t b = ref_vert(epm_to_split[edge.second], vertices[edge.second].weights_on(simplex));
+				half_edges.insert(std::make_pair(a,b));
+				half_edges.insert(std::make_pair(b,a));
 			}
 			//std::cout << " ---- sides ---- " << std::endl; //DEBUG
 			//add one half-edge along all sides:
@@ -469,13 +802,10 @@ struct EmbeddedPlanarMap {
 				}
 				
 				std::map< int32_t, uint32_t > weight_to_vert;
-				auto f = simplex_vertices.find(edge_simplex);
-				if (f != simplex_vertices.end()) {
-					for (auto sv : f->second) {
-						glm::ivec3 weights = vertices[sv].weights_on(simplex);
-						auto res = weight_to_vert.insert(std::make_pair(weights[ito], ref_vert(epm_to_split[sv], weights)));
-						assert(res.second);
-					}
+				for (uint32_t sv = slot_vertex_first[simplex_slot(edge_simplex)]; sv != -1U; sv = vertex_next[sv]) {
+					glm::ivec3 weights = vertices[sv].weights_on(simplex);
+					auto res = weight_to_vert.insert(std::make_pair(weights[ito], ref_vert(epm_to_split[sv], weights)));
+					assert(res.second);
 				}
 				weight_to_vert.insert(std::make_pair(0, from));
 				weight_to_vert.insert(std::make_pair(WEIGHT_SUM, to));
@@ -641,7 +971,7 @@ struct EmbeddedPlanarMap {
 			}
 		}
 
-		if (did_reflex) std::cout << "  Note: used reflex-vertex special-case code in " << did_reflex << " of " << (did_reflex + did_simple) << " cases." << std::endl;
+		if (did_reflex) LOG(Info, Peel) << "  Note: used reflex-vertex special-case code in " << did_reflex << " of " << (did_reflex + did_simple) << " cases (" << did_untouched << " triangles untouched).";
 
 	}
 };
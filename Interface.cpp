@@ -1,6 +1,8 @@
 #include "Interface.hpp"
 
 #include "Stitch.hpp"
+#include "binary_io.hpp"
+#include "log.hpp"
 
 #include <kit/GLProgram.hpp>
 #include <kit/GLTexture.hpp>
@@ -14,6 +16,8 @@
 #include <SDL.h>
 
 #include <algorithm>
+#include <cmath>
+#include <numeric>
 #include <unordered_set>
 
 float drawing_scale = 1.f;
@@ -378,7 +382,9 @@ kit::Load< GLVertexArray > empty_vertex_array(kit::LoadTagDefault);
 
 
 Interface::Interface() {
-	std::cout << "Setting up various buffer bindings." << std::endl; //DEBUG
+	setup_dataflow();
+
+	LOG(Debug, Interface) << "Setting up various buffer bindings.";
 
 	model_triangles_for_model_draw = GLVertexArray::make_binding(model_draw->program, {
 		{model_draw->getAttribLocation("Position", GLProgram::MissingIsError), model_triangles[0]},
@@ -468,14 +474,51 @@ void Interface::update(float elapsed) {
 		update_hovered();
 		mouse.moved = false;
 	}
-	if (constraints_dirty) {
-		update_constraints();
-	}
+	dataflow.update(constrained_node);
+}
+
+void Interface::setup_dataflow() {
+	model_node = dataflow.add_source("model");
+	constraints_node = dataflow.add_source("constraints");
+	rowcol_graph_node = dataflow.add_source("rowcol_graph");
+
+	constrained_node = dataflow.add_node("embed_constraints", {model_node, constraints_node}, [this]() {
+		return update_constraints();
+	});
+	times_node = dataflow.add_node("interpolate_values", {constrained_node}, [this]() {
+		return update_times();
+	});
+	//tracing reads the constrained model, and must wait for update_times() (which re-peels, changing the graph):
+	traced_node = dataflow.add_node("trace_graph", {constrained_node, times_node, rowcol_graph_node}, [this]() {
+		return update_traced();
+	});
+
+	//buffer uploads need the GL context, so happen on the main thread (alongside tracing, if it is running):
+	constraints_tristrip_node = dataflow.add_node("constraints_tristrip", {constraints_node, constrained_node}, [this]() {
+		update_constraints_tristrip();
+		return true;
+	}, true);
+	times_model_triangles_node = dataflow.add_node("times_model_triangles", {constrained_node, times_node}, [this]() {
+		update_times_model_triangles();
+		return true;
+	}, true);
+	traced_tristrip_node = dataflow.add_node("traced_tristrip", {traced_node}, [this]() {
+		update_traced_tristrip();
+		return true;
+	}, true);
 }
 
 void Interface::draw() {
 	if (fb_size != kit::display.size) alloc_fbs();
 
+	{ //bring shown buffers (and whatever they are built from) up to date:
+		std::vector< ak::Dataflow::Node > shown;
+		if (show & ShowTimesModel) shown.emplace_back(times_model_triangles_node);
+		if (show & ShowConstraints) shown.emplace_back(constraints_tristrip_node);
+		if (show & ShowTraced) shown.emplace_back(traced_tristrip_node);
+		dataflow.update(shown);
+	}
+
 	glViewport(0, 0, kit::display.size.x, kit::display.size.y);
 
 	glBindFramebuffer(GL_FRAMEBUFFER, color_id_fb);
@@ -515,7 +558,6 @@ void Interface::draw() {
 	}
 
 	if (show & ShowTimesModel) { //draw the constrained model:
-		if (times_model_triangles_dirty) update_times_model_triangles();
 		glUseProgram(textured_draw->program);
 
 		//Position-to-clip matrix:
@@ -629,7 +671,6 @@ void Interface::draw() {
 
 	//draw constraint paths:
 	if (show & ShowConstraints) {
-		if (constraints_tristrip_dirty) update_constraints_tristrip();
 
 		glm::mat4 p2c = camera.mvp();
 		glm::mat4x3 p2l = camera.mv();
@@ -799,7 +840,6 @@ void Interface::draw() {
 
 	//draw current traced stitches (tracing):
 	if (show & ShowTraced) {
-		if (traced_tristrip_dirty) update_traced_tristrip();
 
 		glm::mat4 p2c = camera.mvp();
 		glm::mat4x3 p2l = camera.mv();
@@ -878,7 +918,7 @@ void Interface::handle_event(SDL_Event const &evt) {
 			if (dragging.cons < constraints.size() && dragging.cons_pt < constraints[dragging.cons].chain.size()) {
 				if (hovered.vert < model.vertices.size()) {
 					constraints[dragging.cons].chain[dragging.cons_pt] = hovered.vert;
-					constraints_dirty = true; //TODO: only set when vert has changed.
+					dataflow.changed(constraints_node); //TODO: only set when vert has changed.
 				}
 			} else {
 				drag = DragNone;
@@ -888,7 +928,7 @@ void Interface::handle_event(SDL_Event const &evt) {
 			if (dragging.cons < constraints.size() && dragging.cons_pt < constraints[dragging.cons].chain.size()) {
 				if (hovered.tri < model.triangles.size()) {
 					constraints[dragging.cons].radius = glm::length(hovered.point - model.vertices[constraints[dragging.cons].chain[dragging.cons_pt]]);
-					constraints_dirty = true;
+					dataflow.changed(constraints_node);
 				}
 			} else {
 				drag = DragNone;
@@ -952,7 +992,7 @@ void Interface::handle_event(SDL_Event const &evt) {
 				step_peeling();
 			}
 		} else if (evt.key.keysym.scancode == SDL_SCANCODE_T) {
-			update_traced();
+			dataflow.update(traced_node);
 		} else if (evt.key.keysym.scancode == SDL_SCANCODE_C) {
 			if (hovered.cons < constraints.size()) {
 				if (drag == DragNone) {
@@ -965,7 +1005,7 @@ void Interface::handle_event(SDL_Event const &evt) {
 			} else if (hovered.vert < model.vertices.size()) {
 				constraints.emplace_back();
 				constraints.back().chain.emplace_back(hovered.vert);
-				constraints_dirty = true;
+				dataflow.changed(constraints_node);
 			}
 		} else if (evt.key.keysym.scancode == SDL_SCANCODE_R) {
 			if (hovered.cons < constraints.size()) {
@@ -976,7 +1016,7 @@ void Interface::handle_event(SDL_Event const &evt) {
 						dragging.cons_pt = hovered.cons_pt;
 					} else {
 						constraints[hovered.cons].radius = 0.0f;
-						constraints_dirty = true;
+						dataflow.changed(constraints_node);
 					}
 				}
 			}
@@ -989,27 +1029,27 @@ void Interface::handle_event(SDL_Event const &evt) {
 				if (cons.chain.empty()) {
 					constraints.erase(constraints.begin() + hovered.cons);
 				}
-				constraints_dirty = true;
+				dataflow.changed(constraints_node);
 			}
 			
 		} else if (evt.key.keysym.scancode == SDL_SCANCODE_EQUALS || evt.key.keysym.scancode == SDL_SCANCODE_KP_PLUS) {
 			if (hovered.cons < constraints.size()) {
 				constraints[hovered.cons].value += 0.1f;
-				constraints_dirty = true;
+				dataflow.changed(constraints_node);
 			}
 		} else if (evt.key.keysym.scancode == SDL_SCANCODE_MINUS || evt.key.keysym.scancode == SDL_SCANCODE_KP_MINUS) {
 			if (hovered.cons < constraints.size()) {
 				constraints[hovered.cons].value -= 0.1f;
-				constraints_dirty = true;
+				dataflow.changed(constraints_node);
 			}
 		} else if (evt.key.keysym.scancode == SDL_SCANCODE_UP){
 			drawing_scale += scale_inc;
-			constraints_tristrip_dirty = true;
+			dataflow.invalidate(constraints_tristrip_node);
 			rowcol_graph_tristrip_dirty = true;
 		} else if (evt.key.keysym.scancode == SDL_SCANCODE_DOWN){
 			drawing_scale -= scale_inc;
 			drawing_scale = std::max(scale_inc, drawing_scale); 
-			constraints_tristrip_dirty = true;
+			dataflow.invalidate(constraints_tristrip_node);
 			rowcol_graph_tristrip_dirty = true;
 		}
 	}
@@ -1148,6 +1188,7 @@ void Interface::alloc_fbs() {
 void Interface::set_model(ak::Model const &new_model) {
 	model = new_model;
 	model_triangles_dirty = true;
+	dataflow.changed(model_node);
 	set_constraints(std::vector< ak::Constraint >());
 
 	reset_camera();
@@ -1157,15 +1198,14 @@ void Interface::set_model(ak::Model const &new_model) {
 void Interface::clear_constraints() {
 	constraints.clear();
 	constrained_model.clear();
+	constrained_codec = ak::EmbeddedVertexCodec();
 	constrained_values.clear();
 	DEBUG_constraint_paths.clear();
 	DEBUG_constraint_loops.clear();
 
-	constraints_dirty = true;
-	constraints_tristrip_dirty = true;
-
-	DEBUG_constraint_paths.clear();
-	DEBUG_constraint_loops.clear();
+	dataflow.changed(constraints_node);
+	dataflow.invalidate(constrained_node);
+	dataflow.changed(constrained_node);
 
 	clear_times();
 }
@@ -1175,21 +1215,65 @@ void Interface::set_constraints(std::vector< ak::Constraint > const &constraints
 	constraints = constraints_;
 }
 
-void Interface::update_constraints() {
-	constraints_dirty = false;
-
+bool Interface::update_constraints() {
 	save_constraints();
 
-	constrained_model.clear();
-	constrained_values.clear();
-	DEBUG_constraint_paths.clear();
-	DEBUG_constraint_loops.clear();
+	//(to tell if anything downstream needs to change)
+	auto hash_constrained = [this]() {
+		ContentHash hash;
+		hash.add(constrained_model.vertices);
+		hash.add(constrained_model.triangles);
+		hash.add(constrained_values);
+		return hash.value;
+	};
+	uint64_t before = hash_constrained();
+
+	//embedding depends only on the model, the constraints, and the maximum edge length:
+	ContentHash key;
+	key.add(model.vertices);
+	key.add(model.triangles);
+	key.add(uint64_t(constraints.size()));
+	for (auto const &c : constraints) {
+		key.add(c.chain);
+		key.add(c.value);
+		key.add(c.radius);
+	}
+	key.add(parameters.get_max_edge_length());
+
+	bool cached = stage_cache.load("embed_constraints", key.value, [this](std::istream &in) {
+		read_vector(in, &constrained_model.vertices, "constrained vertices");
+		read_vector(in, &constrained_model.triangles, "constrained triangles");
+		read_vector(in, &constrained_values, "constrained values");
+		read_vectors(in, &DEBUG_constraint_paths, "constraint paths");
+		read_vectors(in, &DEBUG_constraint_loops, "constraint loops");
+		if (constrained_values.size() != constrained_model.vertices.size()) throw std::runtime_error("constrained values don't match vertices");
+		for (auto const &t : constrained_model.triangles) {
+			if (glm::any(glm::greaterThanEqual(t, glm::uvec3(constrained_model.vertices.size())))) throw std::runtime_error("constrained triangle out of range");
+		}
+	});
+	if (!cached) {
+		constrained_model.clear();
+		constrained_values.clear();
+		DEBUG_constraint_paths.clear();
+		DEBUG_constraint_loops.clear();
+
+		ak::embed_constraints(parameters, model, constraints, &constrained_model, &constrained_values, &DEBUG_constraint_paths, &DEBUG_constraint_loops);
+
+		stage_cache.save("embed_constraints", key.value, [this](std::ostream &out) {
+			write_vector(out, constrained_model.vertices, "constrained vertices");
+			write_vector(out, constrained_model.triangles, "constrained triangles");
+			write_vector(out, constrained_values, "constrained values");
+			write_vectors(out, DEBUG_constraint_paths, "constraint paths");
+			write_vectors(out, DEBUG_constraint_loops, "constraint loops");
+		});
+	}
 
-	ak::embed_constraints(parameters, model, constraints, &constrained_model, &constrained_values, &DEBUG_constraint_paths, &DEBUG_constraint_loops);
+	constrained_codec = ak::EmbeddedVertexCodec(constrained_model);
 
-	constraints_tristrip_dirty = true;
+	if (hash_constrained() == before) return false;
 
 	clear_times();
+	return true;
 }
 
 void Interface::save_constraints() {
@@ -1198,28 +1282,47 @@ void Interface::save_constraints() {
 }
 
 void Interface::clear_times() {
+	//set current peeling aside, so update_times can keep the parts the new times don't change:
+	if (!peel_rounds.empty()) {
+		peel_history.hash = peel_rounds_hash;
+		peel_history.times = std::move(times);
+		peel_history.graph = std::move(rowcol_graph);
+		peel_history.rounds = std::move(peel_rounds);
+	}
+
 	times.clear();
 
-	times_dirty = true;
-	times_model_triangles_dirty = true;
+	dataflow.invalidate(times_node);
+	dataflow.changed(times_node);
 
 	clear_peeling();
 }
 
-void Interface::update_times() {
-	if (constraints_dirty) update_constraints();
-	times_dirty = false;
+bool Interface::update_times() {
+	ContentHash key;
+	key.add(constrained_model.vertices);
+	key.add(constrained_model.triangles);
+	key.add(constrained_values);
 
-	try {
-		ak::interpolate_values(constrained_model, constrained_values, &times);
-	} catch (std::exception &e) {
-		std::cout << "ERROR during interpoation: " << e.what() << std::endl;
-		times.clear();
+	bool cached = stage_cache.load("interpolate_values", key.value, [this](std::istream &in) {
+		read_vector(in, &times, "times");
+		if (times.size() != constrained_model.vertices.size()) throw std::runtime_error("times don't match vertices");
+	});
+	if (!cached) {
+		try {
+			ak::interpolate_values(constrained_model, constrained_values, &times);
+			stage_cache.save("interpolate_values", key.value, [this](std::ostream &out) {
+				write_vector(out, times, "times");
+			});
+		} catch (std::exception &e) {
+			LOG(Error, Interface) << "ERROR during interpoation: " << e.what();
+			times.clear();
+		}
 	}
 
-	times_model_triangles_dirty = true;
+	restore_peel_history(); //(clears peeling, then keeps what it can)
 
-	clear_peeling();
+	return true;
 }
 
 void Interface::clear_peeling() {
@@ -1228,6 +1331,7 @@ void Interface::clear_peeling() {
 
 	rowcol_graph.clear();
 	rowcol_graph_tristrip_dirty = true;
+	dataflow.changed(rowcol_graph_node);
 
 	active_chains.clear();
 	active_stitches.clear();
@@ -1250,50 +1354,211 @@ void Interface::clear_peeling() {
 	next_active_stitches.clear();
 	next_active_chains_tristrip_dirty = true;
 
+	peel_rounds.clear();
+	peel_one_component = false;
+}
+
+void Interface::restore_peel_history() {
+	clear_peeling();
+
+	PeelHistory history = std::move(peel_history);
+	peel_history = PeelHistory();
+
+	if (history.rounds.empty()) return;
+	if (history.rounds[0].peel_step != 1) return; //(peeling didn't start from PeelBegin, e.g., it was resumed from a checkpoint)
+	if (times.empty() || times.size() != history.times.size()) return;
+	uint64_t hash = ak::hash_peel_inputs(parameters, constrained_model, std::vector< float >());
+	if (hash != history.hash) return;
+
+	//the first round starts from find_first_active_chains (and extract_rows), which look at times all over the model,
+	// so re-run them and check that they still produce the same thing:
+	{
+		std::vector< std::vector< ak::EmbeddedVertex > > chains;
+		std::vector< std::vector< ak::Stitch > > stitches;
+		ak::RowColGraph graph;
+		ak::find_first_active_chains(parameters, constrained_model, times, &chains, &stitches, &graph);
+		if (use_row_field) {
+			ak::extract_rows(parameters, constrained_model, times, &chains, &stitches, &graph);
+		}
+
+		PeelRound const &first = history.rounds[0];
+		std::vector< std::vector< ak::CompactEmbeddedVertex > > packed;
+		constrained_codec.pack(chains, &packed);
+		bool same = (packed == first.active_chains);
+		same = same && stitches.size() == first.active_stitches.size();
+		for (uint32_t c = 0; same && c < stitches.size(); ++c) {
+			same = stitches[c].size() == first.active_stitches[c].size();
+			for (uint32_t i = 0; same && i < stitches[c].size(); ++i) {
+				ak::Stitch const &a = stitches[c][i];
+				ak::Stitch const &b = first.active_stitches[c][i];
+				same = (a.t == b.t && a.vertex == b.vertex && a.flag == b.flag);
+			}
+		}
+		same = same && graph.size() == first.graph_size;
+		for (uint32_t v = 0; same && v < graph.size(); ++v) {
+			//(links added by later rounds don't count)
+			glm::uvec2 col_out = history.graph.col_out[v];
+			for (uint32_t o = 0; o < 2; ++o) {
+				if (col_out[o] != -1U && col_out[o] >= first.graph_size) col_out[o] = -1U;
+			}
+			same = graph.at[v] == history.graph.at[v]
+			    && graph.row_in[v] == history.graph.row_in[v]
+			    && graph.row_out[v] == history.graph.row_out[v]
+			    && graph.col_in[v] == history.graph.col_in[v]
+			    && graph.col_out[v] == col_out;
+		}
+		if (!same) {
+			LOG(Info, Interface) << "Times changed: first active chains changed, so peeling starts over.";
+			return;
+		}
+	}
+
+	//restart from the first round that read a changed time (or the last round):
+	auto changed = [&](uint32_t v) {
+		return !(std::abs(times[v] - history.times[v]) <= repeel_tolerance);
+	};
+	uint32_t r = 0;
+	while (r + 1 < history.rounds.size() && history.rounds[r].sliced) {
+		bool affected = false;
+		for (uint32_t v : history.rounds[r].times_used) {
+			if (changed(v)) {
+				affected = true;
+				break;
+			}
+		}
+		if (affected) break;
+		++r;
+	}
+
+	PeelRound &round = history.rounds[r];
+	history.graph.truncate(round.graph_size);
+	rowcol_graph = std::move(history.graph);
+	rowcol_graph_tristrip_dirty = true;
+	dataflow.changed(rowcol_graph_node);
+
+	peel_step = round.peel_step;
+	peel_action = PeelSlice;
+	constrained_codec.unpack(round.active_chains, &active_chains);
+	active_stitches = std::move(round.active_stitches);
+	active_chains_tristrip_dirty = true;
+	show = ShowTimesModel | ShowActiveChains;
+
+	//(round r will be peeled again, so is re-recorded from here)
+	uint32_t rounds = history.rounds.size();
+	history.rounds.resize(r + 1);
+	peel_rounds = std::move(history.rounds);
+	peel_rounds.back().active_stitches = active_stitches;
+	peel_rounds.back().sliced = false;
+	peel_rounds.back().times_used.clear();
+	peel_rounds_hash = hash;
+
+	LOG(Info, Interface) << "Times changed: re-peeling from step " << peel_step << " (" << r << " of " << rounds << " rounds unchanged).";
 }
 
 bool Interface::step_peeling() {
-	if (times_dirty) update_times();
+	dataflow.update(times_node);
 	if (times.empty()) return false; //can't step if no time info
 
 	if (peel_action == PeelBegin || peel_action == PeelRepeat) {
 		auto old_peel_step = peel_step;
 		auto old_peel_action = peel_action;
-		auto old_next_active_chains = next_active_chains;
-		auto old_next_active_stitches = next_active_stitches;
-		auto old_rowcol_graph = rowcol_graph;
+		//(moved, not copied: the graph can be large)
+		auto old_next_active_chains = std::move(next_active_chains);
+		auto old_next_active_stitches = std::move(next_active_stitches);
+		auto old_rowcol_graph = std::move(rowcol_graph);
 		auto old_rowcol_graph_tristrip_dirty = rowcol_graph_tristrip_dirty;
+		auto old_peel_rounds = std::move(peel_rounds);
+		auto old_peel_one_component = peel_one_component;
 		clear_peeling();
 		peel_step = old_peel_step;
 		peel_action = old_peel_action;
-		rowcol_graph = old_rowcol_graph;
+		rowcol_graph = std::move(old_rowcol_graph);
+		peel_rounds = std::move(old_peel_rounds);
+		peel_one_component = old_peel_one_component;
 		rowcol_graph_tristrip_dirty = old_rowcol_graph_tristrip_dirty;
 
 		if (peel_action == PeelBegin) {
-			std::cout << " -- peel begin [step " << peel_step << "]--" << std::endl;
+			LOG(Info, Interface) << " -- peel begin [step " << peel_step << "]--";
 			//read lower boundary:
 			ak::find_first_active_chains(parameters, constrained_model, times, &active_chains, &active_stitches, &rowcol_graph);
+			if (use_row_field) {
+				//pull out as many rows as possible directly, peel the rest:
+				ak::extract_rows(parameters, constrained_model, times, &active_chains, &active_stitches, &rowcol_graph);
+			}
 			rowcol_graph_tristrip_dirty = true;
+			dataflow.changed(rowcol_graph_node);
 
 			assert(peel_step == 0);
+			peel_rounds.clear();
+			peel_one_component = false;
+			peel_rounds_hash = ak::hash_peel_inputs(parameters, constrained_model, std::vector< float >());
 		} else { assert(peel_action == PeelRepeat);
-			std::cout << " -- repeat [step " << peel_step << "]--" << std::endl;
+			LOG(Info, Interface) << " -- repeat [step " << peel_step << "]--";
 			//copy active chains from next_active arrays:
-			active_chains = old_next_active_chains;
-			active_stitches = old_next_active_stitches;
+			active_chains = std::move(old_next_active_chains);
+			active_stitches = std::move(old_next_active_stitches);
+			if (use_row_field && !active_chains.empty()) {
+				//(trying row extraction reads times all over the model, so the round before counts as reading all of them)
+				if (!peel_rounds.empty()) {
+					auto &times_used = peel_rounds.back().times_used;
+					times_used.resize(times.size());
+					std::iota(times_used.begin(), times_used.end(), 0U);
+				}
+				//once peeling is past whatever stopped row extraction, extract rows again:
+				if (ak::extract_rows(parameters, constrained_model, times, &active_chains, &active_stitches, &rowcol_graph)) {
+					peel_one_component = false;
+					rowcol_graph_tristrip_dirty = true;
+					dataflow.changed(rowcol_graph_node);
+				}
+			}
 		}
 		show = ShowTimesModel | ShowActiveChains;
 		if (active_chains.empty()) return false;
 		peel_action = PeelSlice;
 		peel_step += 1;
 
+		//remember where this round started (for restore_peel_history):
+		peel_rounds.emplace_back();
+		peel_rounds.back().peel_step = peel_step;
+		peel_rounds.back().graph_size = rowcol_graph.size();
+		constrained_codec.pack(active_chains, &peel_rounds.back().active_chains);
+		peel_rounds.back().active_stitches = active_stitches;
+
+		//(every round is four steps, so this is round (peel_step - 1) / 4)
+		if (checkpoint_prefix != "" && checkpoint_every != 0 && ((peel_step - 1) / 4) % checkpoint_every == 0) {
+			std::string filename = checkpoint_prefix + "." + std::to_string(peel_step);
+			LOG(Info, Interface) << "Saving peel checkpoint to '" << filename << "'.";
+			ak::save_peel_checkpoint(make_peel_checkpoint(), filename);
+		}
+
 	} else if (peel_action == PeelSlice) {
-		std::cout << " -- slice [step " << peel_step << "]--" << std::endl;
+		std::vector< std::vector< uint32_t > > components;
+		if (!peel_one_component) {
+			ak::find_active_components(constrained_model, active_chains, &components);
+		}
+		peel_one_component = false;
+		if (components.size() > 1) {
+			//independent components are peeled all at once (in parallel), so there are no slice/link stages to show:
+			LOG(Info, Interface) << " -- slice+link+build " << components.size() << " components [step " << peel_step << "]--";
+			ak::peel_components(parameters, constrained_model, constrained_codec, times, active_chains, active_stitches, components, &next_active_chains, &next_active_stitches, &rowcol_graph, (peel_rounds.empty() ? nullptr : &peel_rounds.back().times_used));
+			if (!peel_rounds.empty()) peel_rounds.back().sliced = true;
+
+			rowcol_graph_tristrip_dirty = true;
+			dataflow.changed(rowcol_graph_node);
+			next_active_chains_tristrip_dirty = true;
+			show = ShowActiveChains | ShowNextActiveChains;
+
+			peel_action = PeelRepeat;
+			peel_step += 3;
+			return true;
+		}
+
+		LOG(Info, Interface) << " -- slice [step " << peel_step << "]--";
 		ak::peel_slice(parameters, constrained_model, active_chains, &slice, &slice_on_model, &slice_active_chains, &slice_next_chains, &slice_next_used_boundary);
-		slice_times.clear();
-		slice_times.reserve(slice_on_model.size());
-		for (auto &ev : slice_on_model) {
-			slice_times.emplace_back(ev.interpolate(times));
+		ak::interpolate_batch(slice_on_model, times, &slice_times);
+		if (!peel_rounds.empty()) {
+			ak::interpolated_vertices(slice_on_model, &peel_rounds.back().times_used);
+			peel_rounds.back().sliced = true;
 		}
 
 		slice_triangles_dirty = true;
@@ -1303,7 +1568,7 @@ bool Interface::step_peeling() {
 		peel_action = PeelLink;
 		peel_step += 1;
 	} else if (peel_action == PeelLink) {
-		std::cout << " -- link [step " << peel_step << "]--" << std::endl;
+		LOG(Info, Interface) << " -- link [step " << peel_step << "]--";
 		ak::link_chains(parameters, slice, slice_times, slice_active_chains, active_stitches, slice_next_chains, slice_next_used_boundary, &next_stitches, &links);
 
 		links_tristrip_dirty = true;
@@ -1312,10 +1577,12 @@ bool Interface::step_peeling() {
 		peel_action = PeelBuild;
 		peel_step += 1;
 	} else if (peel_action == PeelBuild) {
-		std::cout << " -- build [step " << peel_step << "]--" << std::endl;
-		ak::build_next_active_chains(parameters, slice, slice_on_model, slice_active_chains, active_stitches, slice_next_chains, next_stitches, slice_next_used_boundary, links, &next_active_chains, &next_active_stitches, &rowcol_graph);
+		LOG(Info, Interface) << " -- build [step " << peel_step << "]--";
+		ak::build_next_active_chains(slice, slice_on_model, constrained_codec, slice_active_chains, active_stitches, slice_next_chains, next_stitches, slice_next_used_boundary, links, &next_active_chains, &next_active_stitches, &rowcol_graph);
+		peel_one_component = ak::links_pair_chains(slice_active_chains.size(), slice_next_chains.size(), links);
 
 		rowcol_graph_tristrip_dirty = true;
+		dataflow.changed(rowcol_graph_node);
 		next_active_chains_tristrip_dirty = true;
 		show = ShowSlice | ShowNextActiveChains;
 
@@ -1326,30 +1593,85 @@ bool Interface::step_peeling() {
 	return true;
 }
 
+ak::PeelCheckpoint Interface::make_peel_checkpoint() const {
+	//only taken between rounds (when active chains are about to be sliced):
+	assert(peel_action == PeelSlice);
+	ak::PeelCheckpoint checkpoint;
+	checkpoint.peel_step = peel_step;
+	checkpoint.inputs_hash = ak::hash_peel_inputs(parameters, constrained_model, times);
+	constrained_codec.pack(active_chains, &checkpoint.active_chains);
+	checkpoint.active_stitches = active_stitches;
+	checkpoint.graph = rowcol_graph;
+	return checkpoint;
+}
+
+void Interface::restore_peel_checkpoint(ak::PeelCheckpoint &&checkpoint) {
+	clear_peeling();
+	peel_step = checkpoint.peel_step;
+	peel_action = PeelSlice;
+	constrained_codec.unpack(checkpoint.active_chains, &active_chains);
+	active_stitches = std::move(checkpoint.active_stitches);
+	rowcol_graph = std::move(checkpoint.graph);
+
+	active_chains_tristrip_dirty = true;
+	rowcol_graph_tristrip_dirty = true;
+	dataflow.changed(rowcol_graph_node);
+	show = ShowTimesModel | ShowActiveChains;
+}
+
+void Interface::resume_peeling(std::string const &filename) {
+	dataflow.update(times_node);
+
+	ak::PeelCheckpoint checkpoint;
+	ak::load_peel_checkpoint(filename, &checkpoint);
+	if (checkpoint.inputs_hash != ak::hash_peel_inputs(parameters, constrained_model, times)) {
+		throw std::runtime_error("Peel checkpoint '" + filename + "' was made with a different model, times, or parameters.");
+	}
+	LOG(Info, Interface) << "Resuming peeling from '" << filename << "' [step " << checkpoint.peel_step << "].";
+	restore_peel_checkpoint(std::move(checkpoint));
+}
+
 void Interface::clear_traced() {
 	traced.clear();
 
-	traced_dirty = true;
-	traced_tristrip_dirty = true;
+	dataflow.invalidate(traced_node);
+	dataflow.changed(traced_node);
 }
 
-void Interface::update_traced() {
+bool Interface::update_traced() {
 	//I guess just update from current rowcol graph, whatever that may be
-	traced_dirty = false;
 
-	ak::trace_graph(parameters, rowcol_graph, &traced, &constrained_model);
+	//tracing reads the graph, and the model and stitch height only to place stitches:
+	ContentHash key;
+	key.add(rowcol_graph.at);
+	key.add(rowcol_graph.row_in);
+	key.add(rowcol_graph.row_out);
+	key.add(rowcol_graph.col_in);
+	key.add(rowcol_graph.col_out);
+	key.add(constrained_model.vertices);
+	key.add(parameters.stitch_height_mm);
+
+	bool cached = stage_cache.load("trace_graph", key.value, [this](std::istream &in) {
+		ak::read_traced(in, &traced);
+	});
+	if (!cached) {
+		ak::trace_graph(parameters, rowcol_graph, &traced, &constrained_model);
+		stage_cache.save("trace_graph", key.value, [this](std::ostream &out) {
+			ak::write_traced(out, traced);
+		});
+	}
 
 	save_traced();
 
-	traced_tristrip_dirty = true;
-
 	show |= ShowTraced; //<-- slightly hack-y; should really have UI for this sort of stuff
+
+	return true;
 }
 
 
 void Interface::save_traced() {
 	if (save_traced_file == "") return;
-	std::cout << "Saving traced stitches to '" << save_traced_file << "'." << std::endl;
+	LOG(Info, Interface) << "Saving traced stitches to '" << save_traced_file << "'.";
 	std::vector< Stitch > stitches;
 	stitches.reserve(traced.size());
 	for (auto const &ts : traced) {
@@ -1395,7 +1717,7 @@ void Interface::update_model_triangles() {
 	}
 
 	model_triangles.set(attribs, GL_STATIC_DRAW);
-	std::cout << "Set model_triangles to have " << model_triangles.count << " vertices." << std::endl; //DEBUG
+	LOG(Debug, Interface) << "Set model_triangles to have " << model_triangles.count << " vertices.";
 	GL_ERRORS();
 }
 
@@ -1488,8 +1810,6 @@ static void make_tube(
 }
 
 void Interface::update_constraints_tristrip() {
-	constraints_tristrip_dirty = false;
-
 	assert(DEBUG_constraint_paths.size() == constraints.size());
 
 	std::vector< GLAttribBuffer< glm::vec3, glm::vec3, glm::u8vec4 >::Vertex > attribs;
@@ -1529,8 +1849,6 @@ void Interface::update_constraints_tristrip() {
 }
 
 void Interface::update_times_model_triangles() {
-	times_model_triangles_dirty = false;
-
 	std::vector< GLAttribBuffer< glm::vec3, glm::vec3, glm::u8vec4, glm::vec2 >::Vertex > attribs;
 	attribs.reserve(3 * constrained_model.triangles.size());
 
@@ -1676,10 +1994,7 @@ std::vector< std::vector< glm::vec3 > > interpolate_locations( ak::Model const &
 	locations.reserve(chains.size());
 	for (auto const &chain : chains) {
 		locations.emplace_back();
-		locations.back().reserve(chain.size());
-		for (auto const &ev : chain) {
-			locations.back().emplace_back(ev.interpolate(model.vertices));
-		}
+		ak::interpolate_batch(chain, model.vertices, &locations.back());
 	}
 	return locations;
 }
@@ -1703,61 +2018,66 @@ void Interface::update_rowcol_graph_tristrip() {
 	std::vector< GLAttribBuffer< glm::vec3, glm::vec3, glm::u8vec4 >::Vertex > attribs;
 
 	std::vector< glm::vec3 > locations;
-	locations.reserve(rowcol_graph.vertices.size());
-	for (auto const &v : rowcol_graph.vertices) {
-		locations.emplace_back(v.at.interpolate(constrained_model.vertices));
+	{
+		std::vector< ak::EmbeddedVertex > at;
+		constrained_codec.unpack(rowcol_graph.at, &at);
+		ak::interpolate_batch(at, constrained_model.vertices, &locations);
 	}
+
 	//vertices:
 	float row_r = 0.0075f * parameters.stitch_width_mm / parameters.model_units_mm;
 	float col_r = row_r;
 	float stitch_r = .15f * row_r;
 	#define COL(H) glm::u8vec4(uint32_t(H) >> 24, uint32_t(H) >> 16, uint32_t(H) >> 8, uint32_t(H))
-	for (uint32_t vi = 0; vi < rowcol_graph.vertices.size(); ++vi) {
+	for (uint32_t vi = 0; vi < rowcol_graph.size(); ++vi) {
 		make_sphere(&attribs,
 			locations[vi],
 			stitch_r, glm::u8vec4(0x80, 0x80, 0x80, 0xff)
 		);
-		auto const &v = rowcol_graph.vertices[vi];
-		if (v.row_in != -1U) {
+		uint32_t row_in = rowcol_graph.row_in[vi];
+		uint32_t row_out = rowcol_graph.row_out[vi];
+		glm::uvec2 col_in = rowcol_graph.col_in[vi];
+		glm::uvec2 col_out = rowcol_graph.col_out[vi];
+		if (row_in != -1U) {
 			make_tube(&attribs,
 				locations[vi],
-				0.5f * (locations[v.row_in] + locations[vi]),
+				0.5f * (locations[row_in] + locations[vi]),
 				row_r, COL(0xddd6bbff)
 			);
 		}
-		if (v.row_out != -1U) {
+		if (row_out != -1U) {
 			make_tube(&attribs,
 				locations[vi],
-				0.5f * (locations[v.row_out] + locations[vi]),
+				0.5f * (locations[row_out] + locations[vi]),
 				row_r, COL(0xd0cab1ff)
 			);
 		}
-		if (v.col_in[0] != -1U) {
+		if (col_in[0] != -1U) {
 			make_tube(&attribs,
 				locations[vi],
-				0.5f * (locations[v.col_in[0]] + locations[vi]),
-				col_r, (v.col_in[1] == -1U ? COL(0xe1cfe6ff) : COL(0xffdc6aff))
+				0.5f * (locations[col_in[0]] + locations[vi]),
+				col_r, (col_in[1] == -1U ? COL(0xe1cfe6ff) : COL(0xffdc6aff))
 			);
 		}
-		if (v.col_in[1] != -1U) {
+		if (col_in[1] != -1U) {
 			make_tube(&attribs,
 				locations[vi],
-				0.5f * (locations[v.col_in[1]] + locations[vi]),
+				0.5f * (locations[col_in[1]] + locations[vi]),
 				col_r, COL(0xffdc6aff)
 			);
 		}
 
-		if (v.col_out[0] != -1U) {
+		if (col_out[0] != -1U) {
 			make_tube(&attribs,
 				locations[vi],
-				0.5f * (locations[v.col_out[0]] + locations[vi]),
-				col_r, (v.col_out[1] == -1U ? COL(0xd2b7daff) : COL(0xfec200ff) )
+				0.5f * (locations[col_out[0]] + locations[vi]),
+				col_r, (col_out[1] == -1U ? COL(0xd2b7daff) : COL(0xfec200ff) )
 			);
 		}
-		if (v.col_out[1] != -1U) {
+		if (col_out[1] != -1U) {
 			make_tube(&attribs,
 				locations[vi],
-				0.5f * (locations[v.col_out[1]] + locations[vi]),
+				0.5f * (locations[col_out[1]] + locations[vi]),
 				col_r, COL(0xfec200ff)
 			);
 		}
@@ -1895,8 +2215,6 @@ void Interface::update_next_active_chains_tristrip() {
 }
 
 void Interface::update_traced_tristrip() {
-	traced_tristrip_dirty = false;
-
 	static std::vector< glm::u8vec4 > yarn_colors{
 		glm::u8vec4(0xee, 0xbb, 0x55, 0xff),
 		glm::u8vec4(0xbb, 0x55, 0xee, 0xff),
@@ -2018,7 +2336,7 @@ void Interface::DEBUG_test_linking(bool flip) {
 		}
 
 		if (start_votes == end_votes) {
-			std::cout << "Skipping constraint -- same number of start and end votes." << std::endl;
+			LOG(Debug, Interface) << "Skipping constraint -- same number of start and end votes.";
 		}
 
 		new_constraints.emplace_back();
@@ -2031,7 +2349,7 @@ void Interface::DEBUG_test_linking(bool flip) {
 		new_constraints.back().radius = 0.0f;
 	}
 
-	std::cout << "Made " << new_constraints.size() << " constraints." << std::endl;
+	LOG(Info, Interface) << "Made " << new_constraints.size() << " constraints.";
 
 	set_constraints(new_constraints);
 
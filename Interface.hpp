@@ -6,6 +6,8 @@
 #include <kit/GLVertexArray.hpp>
 
 #include "pipeline.hpp"
+#include "StageCache.hpp"
+#include "dataflow.hpp"
 
 struct Interface : public kit::Mode {
 	Interface();
@@ -131,6 +133,23 @@ struct Interface : public kit::Mode {
 	//parameters:
 	ak::Parameters parameters;
 
+	//on-disk cache of stage outputs (off unless a directory is set);
+	//update_constraints, update_times, and update_traced consult it, as does headless peeling in init.cpp:
+	StageCache stage_cache;
+
+	//pipeline stages (and the buffers drawn from them) as dataflow nodes, so each is recomputed only when
+	// something it reads has changed; see setup_dataflow() for the graph.
+	//NOTE: after changing a node's data from outside its compute function, call dataflow.changed() (or .invalidate()) on it.
+	ak::Dataflow dataflow;
+	ak::Dataflow::Node model_node; //(source) model
+	ak::Dataflow::Node constraints_node; //(source) constraints
+	ak::Dataflow::Node rowcol_graph_node; //(source) rowcol_graph, as changed by peeling
+	ak::Dataflow::Node constrained_node; //update_constraints()
+	ak::Dataflow::Node times_node; //update_times()
+	ak::Dataflow::Node traced_node; //update_traced()
+	ak::Dataflow::Node constraints_tristrip_node, times_model_triangles_node, traced_tristrip_node; //visualization
+	void setup_dataflow();
+
 	//-------------------------------
 	//original model:
 	ak::Model model;
@@ -147,14 +166,14 @@ struct Interface : public kit::Mode {
 	//constraints:
 	std::vector< ak::Constraint > constraints;
 	ak::Model constrained_model;
+	ak::EmbeddedVertexCodec constrained_codec; //(for constrained_model; packs rowcol_graph positions and saved active chains)
 	std::vector< float > constrained_values;
 	std::vector< std::vector< glm::vec3 > > DEBUG_constraint_paths;
 	std::vector< std::vector< glm::vec3 > > DEBUG_constraint_loops;
 	void clear_constraints();
 
 	void set_constraints(std::vector< ak::Constraint > const &constraints);
-	bool constraints_dirty = true;
-	void update_constraints();
+	bool update_constraints(); //(constrained_node; returns false if the constrained model and values didn't change)
 
 	//data wrangling:
 	std::string save_constraints_file = ""; //if not "", will save constraints to this file after every change
@@ -163,27 +182,25 @@ struct Interface : public kit::Mode {
 	//constraints paths/loops; position, normal, color:
 	GLAttribBuffer< glm::vec3, glm::vec3, glm::u8vec4 > constraints_tristrip;
 	GLVertexArray constraints_tristrip_for_path_draw;
-	bool constraints_tristrip_dirty = true;
 	void update_constraints_tristrip();
 
 	//-------------------------------
 	//interpolation:
 	std::vector< float > times;
 	void clear_times();
-	bool times_dirty = true;
-	void update_times();
+	bool update_times(); //(times_node)
 
 	//visualization: (constrained model colored with times)
 	//constrained model buffer: position, normal, id, texcoord
 	GLAttribBuffer< glm::vec3, glm::vec3, glm::u8vec4, glm::vec2 > times_model_triangles;
 	GLVertexArray times_model_triangles_for_textured_draw;
-	bool times_model_triangles_dirty = true;
 	void update_times_model_triangles();
 
 
 	//-------------------------------
 	//peeling:
 	uint32_t peel_step = 0;
+	bool use_row_field = false; //if set, peeling begins by extracting rows as isolines of the time field (see ak::extract_rows)
 	enum {
 		PeelBegin = 0,
 		PeelSlice = 1,
@@ -258,21 +275,51 @@ struct Interface : public kit::Mode {
 	//driver functions that step through the above:
 	void clear_peeling();
 	bool step_peeling();
+	bool peel_one_component = false; //active chains bound one component (set by the last round, lets PeelSlice skip find_active_components)
+
+	//checkpoints (see ak::PeelCheckpoint), taken between rounds of peeling:
+	std::string checkpoint_prefix = ""; //if not "", save a checkpoint to '<prefix>.<peel_step>' every 'checkpoint_every' rounds
+	uint32_t checkpoint_every = 1;
+	ak::PeelCheckpoint make_peel_checkpoint() const;
+	void restore_peel_checkpoint(ak::PeelCheckpoint &&checkpoint);
+	//load a checkpoint and continue peeling from it:
+	//NOTE: throws if the checkpoint was made with a different model, times, or parameters
+	void resume_peeling(std::string const &filename);
+
+	//incremental re-peeling: each round of peeling remembers where it started and which times it read,
+	// so after times change, peeling restarts from the first round that read a changed time:
+	struct PeelRound {
+		uint32_t peel_step = 0; //step at start of round
+		uint32_t graph_size = 0; //rowcol_graph.size() at start of round
+		std::vector< std::vector< ak::CompactEmbeddedVertex > > active_chains; //(packed with constrained_codec)
+		std::vector< std::vector< ak::Stitch > > active_stitches;
+		bool sliced = false; //(times_used is filled in)
+		std::vector< uint32_t > times_used; //constrained model vertices whose times the round read
+	};
+	std::vector< PeelRound > peel_rounds;
+	uint64_t peel_rounds_hash = 0; //hash_peel_inputs() of parameters and constrained model (no times) for peel_rounds
+	//peeling from before times were cleared (set aside by clear_times, used by update_times):
+	struct PeelHistory {
+		uint64_t hash = 0;
+		std::vector< float > times;
+		ak::RowColGraph graph;
+		std::vector< PeelRound > rounds;
+	} peel_history;
+	float repeel_tolerance = 0.0f; //time changes this small don't count (at 0, results are identical to peeling from scratch)
+	void restore_peel_history();
 
 	//-------------------------------
 	//tracing:
 
 	std::vector< ak::TracedStitch > traced;
 	void clear_traced();
-	bool traced_dirty = true;
-	void update_traced();
+	bool update_traced(); //(traced_node)
 
 
 	std::string save_traced_file = ""; //if not "", will save traced stitches to this file after every change
 	void save_traced();
 
 
-	bool traced_tristrip_dirty = true;
 	//traced yarns + stitches: position, normal, color:
 	GLAttribBuffer< glm::vec3, glm::vec3, glm::u8vec4 > traced_tristrip;
 	GLVertexArray traced_tristrip_for_path_draw;
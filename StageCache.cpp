@@ -0,0 +1,93 @@
+#include "StageCache.hpp"
+#include "binary_io.hpp"
+#include "log.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+
+#include <unistd.h>
+
+namespace {
+
+//"akst" + format version; bump the version whenever any stage's stored format changes:
+constexpr uint32_t EntryMagic = 0x74736b61;
+constexpr uint32_t EntryVersion = 2; //(2: peel graph positions are CompactEmbeddedVertex)
+
+std::string key_string(uint64_t key) {
+	std::ostringstream str;
+	str << std::hex << std::setw(16) << std::setfill('0') << key;
+	return str.str();
+}
+
+}
+
+std::string StageCache::entry_path(std::string const &stage, uint64_t key) const {
+	return directory + "/" + stage + "-" + key_string(key) + ".bin";
+}
+
+bool StageCache::load(std::string const &stage, uint64_t key, std::function< void(std::istream &) > const &read) {
+	if (!enabled()) return false;
+
+	std::string path = entry_path(stage, key);
+	std::ifstream in(path, std::ios::binary);
+	if (!in) {
+		misses += 1;
+		LOG(Info, Cache) << "Cache miss: " << stage << " " << key_string(key);
+		return false;
+	}
+
+	try {
+		uint32_t magic, version;
+		uint64_t stored_key;
+		read_scalar(in, &magic, "magic");
+		read_scalar(in, &version, "version");
+		read_scalar(in, &stored_key, "key");
+		if (magic != EntryMagic || version != EntryVersion || stored_key != key) {
+			throw std::runtime_error("entry has the wrong header");
+		}
+		read(in);
+		read_eof(in, "cache entry " + path);
+	} catch (std::exception &e) {
+		misses += 1;
+		LOG(Info, Cache) << "Cache miss: " << stage << " " << key_string(key) << " (ignoring '" << path << "': " << e.what() << ")";
+		return false;
+	}
+
+	hits += 1;
+	LOG(Info, Cache) << "Cache hit: " << stage << " " << key_string(key);
+	return true;
+}
+
+void StageCache::save(std::string const &stage, uint64_t key, std::function< void(std::ostream &) > const &write) {
+	if (!enabled()) return;
+
+	std::string path = entry_path(stage, key);
+	//temporary name unique to this process+thread+moment, so writers sharing a directory can't collide:
+	std::ostringstream tmp;
+	tmp << path << ".tmp-" << getpid() << "-" << std::hash< std::thread::id >()(std::this_thread::get_id())
+		<< "-" << std::chrono::steady_clock::now().time_since_epoch().count();
+	std::string tmp_path = tmp.str();
+
+	try {
+		{
+			std::ofstream out(tmp_path, std::ios::binary);
+			if (!out) throw std::runtime_error("failed to open '" + tmp_path + "' for writing");
+			write_scalar(out, EntryMagic, "magic");
+			write_scalar(out, EntryVersion, "version");
+			write_scalar(out, key, "key");
+			write(out);
+			out.close();
+			if (!out) throw std::runtime_error("failed to finish writing '" + tmp_path + "'");
+		}
+		if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+			throw std::runtime_error("failed to rename '" + tmp_path + "' to '" + path + "'");
+		}
+	} catch (std::exception &e) {
+		std::remove(tmp_path.c_str());
+		LOG(Warning, Cache) << "WARNING: not caching " << stage << " " << key_string(key) << ": " << e.what();
+	}
+}
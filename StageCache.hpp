@@ -0,0 +1,33 @@
+#pragma once
+
+//Content-addressed on-disk cache of pipeline stage outputs.
+//Each entry is named by its stage and a key that hashes everything the stage's output depends on
+// (inputs and the parameters it reads), so a later run with the same inputs can load the output
+// instead of recomputing it. Entries are never invalidated -- a changed input is just a different key.
+//NOTE: keys cover inputs, not code; clear the directory after changing what a stage computes.
+
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <cstdint>
+
+struct StageCache {
+	std::string directory; //where entries are kept; caching is off if this is empty
+	uint32_t hits = 0;
+	uint32_t misses = 0;
+
+	bool enabled() const { return !directory.empty(); }
+
+	//If an entry for (stage, key) exists, call 'read' on its contents and return true.
+	//A missing, stale-format, or unreadable entry counts as a miss (and returns false).
+	//NOTE: 'read' should throw std::runtime_error on malformed data; it may be called before
+	// a miss is detected, so callers must not rely on their outputs after a 'false' return.
+	bool load(std::string const &stage, uint64_t key, std::function< void(std::istream &) > const &read);
+
+	//Store an entry for (stage, key) written by 'write'.
+	//The entry is written to a temporary file and renamed into place, so concurrent jobs sharing a directory never see partial entries.
+	//NOTE: failure to store is reported but not fatal.
+	void save(std::string const &stage, uint64_t key, std::function< void(std::ostream &) > const &write);
+
+	std::string entry_path(std::string const &stage, uint64_t key) const;
+};
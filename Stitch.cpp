@@ -1,4 +1,6 @@
 #include "Stitch.hpp"
+#include "pipeline.hpp"
+#include "log.hpp"
 
 #include <iostream>
 #include <fstream>
@@ -20,7 +22,7 @@ bool load_stitches(std::string const &filename, std::vector< Stitch > *into_) {
 		int32_t out[2];
 
 		if (!(iss >> temp.yarn >> temp.type >> temp.direction >> in[0] >> in[1] >> out[0] >> out[1] >> temp.at.x >> temp.at.y >> temp.at.z)) {
-			std::cerr << "ERROR: Failed to read stitch." << std::endl;
+			LOG(Error, Load) << "ERROR: Failed to read stitch.";
 			return false;
 		}
 		temp.in[0] = in[0];
@@ -29,8 +31,8 @@ bool load_stitches(std::string const &filename, std::vector< Stitch > *into_) {
 		temp.out[1] = out[1];
 
 		if (!temp.check_type()) {
-			std::cerr << "ERROR: Stitch does not have proper in/out for type." << std::endl;
-			std::cerr << "  line: '" << line << "'" << std::endl;
+			LOG(Error, Load) << "ERROR: Stitch does not have proper in/out for type.\n"
+				<< "  line: '" << line << "'";
 			return false;
 		}
 
@@ -49,7 +51,7 @@ bool load_stitches(std::string const &filename, std::vector< Stitch > *into_) {
 			}
 		};
 		if (!check_in(s.in[0]) || !check_in(s.in[1])) {
-			std::cerr << "Stitch does not have proper 'in' array." << std::endl;
+			LOG(Error, Load) << "ERROR: Stitch does not have proper 'in' array.";
 			return false;
 		}
 		auto check_out = [&](uint32_t out_idx) -> bool {
@@ -63,7 +65,7 @@ bool load_stitches(std::string const &filename, std::vector< Stitch > *into_) {
 			}
 		};
 		if (!check_out(s.out[0]) || !check_out(s.out[1])) {
-			std::cerr << "Stitch does not have proper 'out' array." << std::endl;
+			LOG(Error, Load) << "ERROR: Stitch does not have proper 'out' array.";
 			return false;
 		}
 	}
@@ -71,15 +73,38 @@ bool load_stitches(std::string const &filename, std::vector< Stitch > *into_) {
 }
 
 void save_stitches(std::string const &filename, std::vector< Stitch > const &from) {
-	std::ofstream file(filename);
+	StitchWriter writer(filename);
 	for (auto const &s : from) {
-		file << s.yarn
-		<< ' ' << s.type
-		<< ' ' << s.direction
-		<< ' ' << (int32_t)s.in[0]
-		<< ' ' << (int32_t)s.in[1]
-		<< ' ' << (int32_t)s.out[0]
-		<< ' ' << (int32_t)s.out[1]
-		<< ' ' << s.at.x << ' ' << s.at.y << ' ' << s.at.z << '\n';
+		writer.write(s);
 	}
 }
+
+StitchWriter::StitchWriter(std::string const &filename) : file(filename) {
+	if (!file) {
+		LOG(Error, Load) << "ERROR: Failed to open '" << filename << "' for writing stitches.";
+	}
+}
+
+void StitchWriter::write(Stitch const &s) {
+	file << s.yarn
+	<< ' ' << s.type
+	<< ' ' << s.direction
+	<< ' ' << (int32_t)s.in[0]
+	<< ' ' << (int32_t)s.in[1]
+	<< ' ' << (int32_t)s.out[0]
+	<< ' ' << (int32_t)s.out[1]
+	<< ' ' << s.at.x << ' ' << s.at.y << ' ' << s.at.z << '\n';
+}
+
+void StitchWriter::write(ak::TracedStitch const &ts) {
+	Stitch s;
+	s.yarn = ts.yarn;
+	s.type = ts.type;
+	s.direction = ts.dir;
+	s.in[0] = ts.ins[0];
+	s.in[1] = ts.ins[1];
+	s.out[0] = ts.outs[0];
+	s.out[1] = ts.outs[1];
+	s.at = ts.at;
+	write(s);
+}
@@ -4,6 +4,9 @@
 
 #include <vector>
 #include <string>
+#include <fstream>
+
+namespace ak { struct TracedStitch; }
 
 struct Stitch {
 	//which yarn the stitch is being made with:
@@ -71,3 +74,12 @@ struct Stitch {
 
 bool load_stitches(std::string const &filename, std::vector< Stitch > *into);
 void save_stitches(std::string const &filename, std::vector< Stitch > const &from);
+
+//writes stitches one at a time, in the same format as save_stitches:
+struct StitchWriter {
+	StitchWriter(std::string const &filename);
+	void write(Stitch const &s);
+	//write a stitch from the pipeline's tracer (same fields as Interface::save_traced copies):
+	void write(ak::TracedStitch const &ts);
+	std::ofstream file;
+};
@@ -1,16 +1,17 @@
 #include "pipeline.hpp"
+#include "log.hpp"
 
-#include <iostream>
-#include <map>
-#include <unordered_set>
-#include <set>
+#include <sstream>
 #include <algorithm>
 
 
-inline std::ostream &operator<<(std::ostream &out, ak::EmbeddedVertex const &ev) {
+//(in namespace ak so LOG statements find it)
+namespace ak {
+inline std::ostream &operator<<(std::ostream &out, EmbeddedVertex const &ev) {
 	out << "(" << ev.weights.x << ", " << ev.weights.y << ", " << ev.weights.z << ")@[" << int32_t(ev.simplex.x) << ", " << int32_t(ev.simplex.y) << ", " << int32_t(ev.simplex.z) << "]";
 	return out;
 }
+}
 
 
 struct OnChainStitch {
@@ -31,6 +32,10 @@ struct OnChainStitch {
 	bool operator!=(OnChainStitch const &o) const {
 		return !(*this == o);
 	}
+	//same position in the ordering above (ignores type):
+	bool same_key(OnChainStitch const &o) const {
+		return on == o.on && chain == o.chain && stitch == o.stitch;
+	}
 };
 
 std::ostream &operator<<(std::ostream &out, OnChainStitch const &ocv) {
@@ -50,11 +55,79 @@ std::ostream &operator<<(std::ostream &out, OnChainStitch const &ocv) {
 	return out;
 };
 
+namespace {
+
+struct ChainStitch {
+	ChainStitch(uint32_t chain_, uint32_t stitch_) : chain(chain_), stitch(stitch_) { }
+	uint32_t chain;
+	uint32_t stitch;
+	bool operator==(ChainStitch const &o) const {
+		return chain == o.chain && stitch == o.stitch;
+	}
+	bool operator!=(ChainStitch const &o) const {
+		return !(*this == o);
+	}
+};
+
+//the links out of one stitch (in chain order):
+struct LinkRange {
+	ChainStitch const *first = nullptr;
+	ChainStitch const *last = nullptr;
+	bool empty() const { return first == last; }
+	uint32_t size() const { return uint32_t(last - first); }
+	ChainStitch const &operator[](uint32_t i) const { assert(i < size()); return first[i]; }
+	ChainStitch const &back() const { assert(!empty()); return *(last - 1); }
+};
+
+//edge of the next active chains: prev -> cur -> next
+struct Step {
+	OnChainStitch prev, cur, next;
+};
+
+//Per-call working memory; everything is indexed by flat stitch index (chain offset + stitch).
+//Buffers are cleared (not freed) at the end of each call, so repeated peeling steps don't allocate:
+struct Scratch {
+	std::vector< uint32_t > active_offsets, next_offsets; //first flat index of each chain's stitches (plus total)
+	std::vector< uint32_t > active_next_offsets, next_active_offsets; //links out of each stitch (compressed rows)
+	std::vector< ChainStitch > active_next, next_active;
+	std::vector< std::pair< bool, bool > > keep_adj; //by next stitch
+	std::vector< uint32_t > next_vertices; //by next stitch
+	std::vector< uint32_t > active_length_offsets, next_length_offsets; //first index of each chain's lengths (plus total)
+	std::vector< float > active_lengths, next_lengths; //length along chain at each chain vertex
+	std::vector< Step > steps;
+	std::vector< uint32_t > step_order, step_order_temp, step_counts; //steps sorted by (prev, cur)
+	std::vector< uint32_t > steps_at; //two step slots per stitch (steps with that stitch as cur)
+	std::vector< bool > step_used;
+	std::vector< uint32_t > partials_at; //two partial slots per stitch (partials with that stitch as [1])
+
+	void clear() {
+		active_offsets.clear(); next_offsets.clear();
+		active_next_offsets.clear(); next_active_offsets.clear();
+		active_next.clear(); next_active.clear();
+		keep_adj.clear();
+		next_vertices.clear();
+		active_length_offsets.clear(); next_length_offsets.clear();
+		active_lengths.clear(); next_lengths.clear();
+		steps.clear();
+		step_order.clear(); step_order_temp.clear(); step_counts.clear();
+		steps_at.clear();
+		step_used.clear();
+		partials_at.clear();
+	}
+};
+
+thread_local Scratch scratch_arena;
+
+struct ResetScratch {
+	~ResetScratch() { scratch_arena.clear(); }
+};
+
+} //namespace
 
 void ak::build_next_active_chains(
-	ak::Parameters const &parameters,
 	ak::Model const &slice,
 	std::vector< ak::EmbeddedVertex > const &slice_on_model, //in: vertices of slice (on model)
+	ak::EmbeddedVertexCodec const &codec, //in: codec for the model
 	std::vector< std::vector< uint32_t > > const &active_chains,  //in: current active chains (on slice)
 	std::vector< std::vector< ak::Stitch > > const &active_stitches, //in: current active stitches
 	std::vector< std::vector< uint32_t > > const &next_chains, //in: next chains (on slice)
@@ -109,7 +182,7 @@ void ak::build_next_active_chains(
 		for (auto const &stitches : active_stitches) {
 			for (auto const &s : stitches) {
 				assert(s.vertex != -1U);
-				assert(s.vertex < graph_->vertices.size());
+				assert(s.vertex < graph_->size());
 			}
 		}
 		for (auto const &stitches : next_stitches) {
@@ -121,6 +194,25 @@ void ak::build_next_active_chains(
 	}
 
 
+	Scratch &scratch = scratch_arena;
+	ResetScratch reset_scratch; //(clears scratch when this function exits)
+
+	//stitches are addressed by flat index (chain offset + stitch index):
+	auto &active_offsets = scratch.active_offsets;
+	active_offsets.reserve(active_stitches.size() + 1);
+	active_offsets.emplace_back(0);
+	for (auto const &stitches : active_stitches) {
+		active_offsets.emplace_back(active_offsets.back() + stitches.size());
+	}
+	auto &next_offsets = scratch.next_offsets;
+	next_offsets.reserve(next_stitches.size() + 1);
+	next_offsets.emplace_back(0);
+	for (auto const &stitches : next_stitches) {
+		next_offsets.emplace_back(next_offsets.back() + stitches.size());
+	}
+	uint32_t const active_total = active_offsets.back();
+	uint32_t const next_total = next_offsets.back();
+
 	//any active chain with no links out is considered inactive and discarded:
 	std::vector< bool > discard_active(active_chains.size(), true);
 	for (auto const &l : links_in) {
@@ -129,47 +221,72 @@ void ak::build_next_active_chains(
 
 	//filter to links that target non-discarded stitches only:
 	std::vector< ak::Link > links;
+	links.reserve(links_in.size());
 	for (auto const &l : links_in) {
 		if (next_stitches[l.to_chain][l.to_stitch].flag == ak::Stitch::FlagDiscard) continue;
 		links.emplace_back(l);
 	}
 
-	//build a lookup structure for links:
-	struct ChainStitch {
-		ChainStitch(uint32_t chain_, uint32_t stitch_) : chain(chain_), stitch(stitch_) { }
-		uint32_t chain;
-		uint32_t stitch;
-		bool operator<(ChainStitch const &o) const {
-			if (chain != o.chain) return chain < o.chain;
-			else return stitch < o.stitch;
+	//build a lookup structure for links (compressed rows by flat stitch index):
+	//NOTE: link_chains guarantees that links are in "direction of chain" order, so old sorting code removed:
+	auto &active_next_offsets = scratch.active_next_offsets;
+	auto &active_next = scratch.active_next;
+	auto &next_active_offsets = scratch.next_active_offsets;
+	auto &next_active = scratch.next_active;
+	active_next_offsets.assign(active_total + 1, 0);
+	next_active_offsets.assign(next_total + 1, 0);
+	for (auto const &l : links) {
+		active_next_offsets[active_offsets[l.from_chain] + l.from_stitch + 1] += 1;
+		next_active_offsets[next_offsets[l.to_chain] + l.to_stitch + 1] += 1;
+	}
+	for (uint32_t i = 0; i < active_total; ++i) {
+		active_next_offsets[i + 1] += active_next_offsets[i];
+	}
+	for (uint32_t i = 0; i < next_total; ++i) {
+		next_active_offsets[i + 1] += next_active_offsets[i];
+	}
+	active_next.assign(links.size(), ChainStitch(-1U, -1U));
+	next_active.assign(links.size(), ChainStitch(-1U, -1U));
+	{
+		//fill rows in link order (using the row starts as cursors, then shifting them back):
+		for (auto const &l : links) {
+			active_next[active_next_offsets[active_offsets[l.from_chain] + l.from_stitch]++] = ChainStitch(l.to_chain, l.to_stitch);
+			next_active[next_active_offsets[next_offsets[l.to_chain] + l.to_stitch]++] = ChainStitch(l.from_chain, l.from_stitch);
 		}
-		bool operator==(ChainStitch const &o) const {
-			return chain == o.chain && stitch == o.stitch;
+		for (uint32_t i = active_total; i > 0; --i) {
+			active_next_offsets[i] = active_next_offsets[i-1];
 		}
-		bool operator!=(ChainStitch const &o) const {
-			return !(*this == o);
+		active_next_offsets[0] = 0;
+		for (uint32_t i = next_total; i > 0; --i) {
+			next_active_offsets[i] = next_active_offsets[i-1];
 		}
-	};
-
-	std::map< ChainStitch, std::vector< ChainStitch > > active_next;
-	std::map< ChainStitch, std::vector< ChainStitch > > next_active;
-
-	//NOTE: link_chains guarantees that links are in "direction of chain" order, so old sorting code removed:
-	for (auto const &l : links) {
-		active_next[ ChainStitch(l.from_chain, l.from_stitch) ]
-			.emplace_back(l.to_chain, l.to_stitch);
-		next_active[ ChainStitch(l.to_chain, l.to_stitch) ]
-			.emplace_back(l.from_chain, l.from_stitch);
+		next_active_offsets[0] = 0;
 	}
+	auto find_active_next = [&](ChainStitch const &a) {
+		assert(a.chain < active_stitches.size() && a.stitch < active_stitches[a.chain].size());
+		uint32_t i = active_offsets[a.chain] + a.stitch;
+		LinkRange ret;
+		ret.first = active_next.data() + active_next_offsets[i];
+		ret.last = active_next.data() + active_next_offsets[i+1];
+		return ret;
+	};
+	auto find_next_active = [&](ChainStitch const &n) {
+		assert(n.chain < next_stitches.size() && n.stitch < next_stitches[n.chain].size());
+		uint32_t i = next_offsets[n.chain] + n.stitch;
+		LinkRange ret;
+		ret.first = next_active.data() + next_active_offsets[i];
+		ret.last = next_active.data() + next_active_offsets[i+1];
+		return ret;
+	};
 
 	//record whether the segments adjacent to every next stitch is are marked as "discard" or "keep":
-	std::vector< std::vector< std::pair< bool, bool > > > keep_adj(next_chains.size());
+	auto &keep_adj = scratch.keep_adj;
+	keep_adj.assign(next_total, std::make_pair(true, true));
 	for (uint32_t nc = 0; nc < next_chains.size(); ++nc) {
 		auto const &chain = next_chains[nc];
 		bool is_loop = (chain[0] == chain.back());
 		auto const &stitches = next_stitches[nc];
-		auto &ka = keep_adj[nc];
-		ka.assign(stitches.size(), std::make_pair(true, true));
+		auto ka = keep_adj.begin() + next_offsets[nc];
 		for (uint32_t ns = 0; ns < stitches.size(); ++ns) {
 			bool discard_before = false;
 			bool discard_after = false;
@@ -189,33 +306,32 @@ void ak::build_next_active_chains(
 			//stitches with a link to an active stitch whose next stitch doesn't have a link are marked discard-adj:
 			discard_before = discard_before || [&]() -> bool {
 				//okay, which active stitch is linked to this?
-				auto fa = next_active.find(ChainStitch(nc, ns));
-				if (fa == next_active.end()) return false; //nothing? no reason to discard before (though weird, I guess)
+				auto fa = find_next_active(ChainStitch(nc, ns));
+				if (fa.empty()) return false; //nothing? no reason to discard before (though weird, I guess)
 				//something? take earlier something:
-				ChainStitch a = fa->second[0];
+				ChainStitch a = fa[0];
 				auto const &a_chain = active_chains[a.chain];
 				bool a_is_loop = (a_chain[0] == a_chain.back());
 				auto const &a_stitches = active_stitches[a.chain];
 				assert(a.stitch < a_stitches.size());
 				{ //check for the case where a has an earlier non-discard link:
-					auto fn = active_next.find(a);
-					assert(fn != active_next.end());
-					assert(fn->second.size() == 1 || fn->second.size() == 2);
-					if (fn->second.size() == 2 && fn->second.back() == ChainStitch(nc, ns)) {
+					auto fn = find_active_next(a);
+					assert(!fn.empty());
+					assert(fn.size() == 1 || fn.size() == 2);
+					if (fn.size() == 2 && fn.back() == ChainStitch(nc, ns)) {
 						// p -- n
 						//  \  /
 						//   a
 						return false;
 					} else {
-						assert(fn->second[0] == ChainStitch(nc, ns));
+						assert(fn[0] == ChainStitch(nc, ns));
 					}
 				}
 				//check previous stitch:
 				if (a.stitch == 0 && !a_is_loop) return false; //no previous stitch
 				{
 					ChainStitch pa(a.chain, (a.stitch > 0 ? a.stitch - 1 : a_stitches.size() - 1));
-					auto fn = active_next.find(pa);
-					if (fn == active_next.end()) {
+					if (find_active_next(pa).empty()) {
 						//        n  
 						//   x    | /
 						//  pa -- a
@@ -226,34 +342,33 @@ void ak::build_next_active_chains(
 			}();
 			discard_after = discard_after || [&]() -> bool {
 				//okay, which active stitch is linked to this?
-				auto fa = next_active.find(ChainStitch(nc, ns));
-				if (fa == next_active.end()) return false; //nothing? no reason to discard after (though weird, I guess)
+				auto fa = find_next_active(ChainStitch(nc, ns));
+				if (fa.empty()) return false; //nothing? no reason to discard after (though weird, I guess)
 				//something? take later something:
-				ChainStitch a = fa->second.back();
+				ChainStitch a = fa.back();
 				auto const &a_chain = active_chains[a.chain];
 				bool a_is_loop = (a_chain[0] == a_chain.back());
 				auto const &a_stitches = active_stitches[a.chain];
 				assert(a.stitch < a_stitches.size());
 				{ //check for the case where a has a later non-discard link:
-					auto fn = active_next.find(a);
-					assert(fn != active_next.end());
-					assert(fn->second.size() == 1 || fn->second.size() == 2);
-					if (fn->second.size() == 2 && fn->second[0] == ChainStitch(nc, ns)) {
+					auto fn = find_active_next(a);
+					assert(!fn.empty());
+					assert(fn.size() == 1 || fn.size() == 2);
+					if (fn.size() == 2 && fn[0] == ChainStitch(nc, ns)) {
 						// n -- nn
 						//  \  /
 						//   a
 						return false;
 					} else {
-						assert((fn->second.size() == 1 && fn->second[0] == ChainStitch(nc, ns))
-							|| (fn->second.size() == 2 && fn->second.back() == ChainStitch(nc, ns)) );
+						assert((fn.size() == 1 && fn[0] == ChainStitch(nc, ns))
+							|| (fn.size() == 2 && fn.back() == ChainStitch(nc, ns)) );
 					}
 				}
 				//check next stitch:
 				if (a.stitch + 1 == a_stitches.size() && !a_is_loop) return false; //no next stitch
 				{
 					ChainStitch na(a.chain, (a.stitch + 1 < a_stitches.size() ? a.stitch + 1 : 0));
-					auto fn = active_next.find(na);
-					if (fn == active_next.end()) {
+					if (find_active_next(na).empty()) {
 						//   n  
 						// \ |     x
 						//   a --- na
@@ -265,7 +380,7 @@ void ak::build_next_active_chains(
 
 			if (discard_before) {
 				if (ns > 0) ka[ns-1].second = false;
-				else if (is_loop) ka.back().second = false;
+				else if (is_loop) ka[stitches.size()-1].second = false;
 				ka[ns].first = false;
 			}
 
@@ -276,16 +391,23 @@ void ak::build_next_active_chains(
 			}
 		}
 	}
+	auto keep_adj_at = [&](ChainStitch const &n) -> std::pair< bool, bool > const & {
+		assert(n.chain < next_stitches.size() && n.stitch < next_stitches[n.chain].size());
+		return keep_adj[next_offsets[n.chain] + n.stitch];
+	};
 
 	//need lengths to figure out where stitches are on chains:
 	//(duplicated, inelegantly, from link-chains)
-	auto make_lengths = [&slice](std::vector< std::vector< uint32_t > > const &chains) {
-		std::vector< std::vector< float > > all_lengths;
-		all_lengths.reserve(chains.size());
+	auto make_lengths = [&slice](std::vector< std::vector< uint32_t > > const &chains, std::vector< uint32_t > *offsets_, std::vector< float > *lengths_) {
+		auto &offsets = *offsets_;
+		auto &lengths = *lengths_;
+		offsets.reserve(chains.size() + 1);
+		offsets.emplace_back(0);
+		for (auto const &chain : chains) {
+			offsets.emplace_back(offsets.back() + chain.size());
+		}
+		lengths.reserve(offsets.back());
 		for (auto const &chain : chains) {
-			all_lengths.emplace_back();
-			std::vector< float > &lengths = all_lengths.back();
-			lengths.reserve(chain.size());
 			float total_length = 0.0f;
 			lengths.emplace_back(total_length);
 			for (uint32_t vi = 1; vi < chain.size(); ++vi) {
@@ -295,69 +417,58 @@ void ak::build_next_active_chains(
 				lengths.emplace_back(total_length);
 			}
 		}
-		return all_lengths;
 	};
-	std::vector< std::vector< float > > active_lengths = make_lengths(active_chains);
-	std::vector< std::vector< float > > next_lengths = make_lengths(next_chains);
+	make_lengths(active_chains, &scratch.active_length_offsets, &scratch.active_lengths);
+	make_lengths(next_chains, &scratch.next_length_offsets, &scratch.next_lengths);
 
-	std::vector< std::vector< uint32_t > > next_vertices;
-	next_vertices.reserve(next_chains.size());
+	auto &next_vertices = scratch.next_vertices;
+	//blank vertex info if no graph:
+	next_vertices.assign(next_total, -1U);
 	//build graph info if requested:
-	if (!graph_) {
-		//blank vertex info if no graph:
-		for (auto const &stitches : next_stitches) {
-			next_vertices.emplace_back(stitches.size(), -1U);
-		}
-	} else { assert(graph_);
+	if (graph_) {
 		//for non-discard stitches on next chains, write down vertices:
 		for (uint32_t nc = 0; nc < next_chains.size(); ++nc) {
 			auto const &chain = next_chains[nc];
 			bool is_loop = (chain[0] == chain.back());
 			auto const &stitches = next_stitches[nc];
-			auto const &ka = keep_adj[nc];
+			auto ka = keep_adj.begin() + next_offsets[nc];
 
-			auto const &lengths = next_lengths[nc];
+			float const *lengths_begin = scratch.next_lengths.data() + scratch.next_length_offsets[nc];
+			float const *lengths_end = scratch.next_lengths.data() + scratch.next_length_offsets[nc+1];
 
-			next_vertices.emplace_back();
-			auto &vertices = next_vertices.back();
-			vertices.reserve(stitches.size());
+			auto vertices = next_vertices.begin() + next_offsets[nc];
 
-			auto li = lengths.begin();
+			auto li = lengths_begin;
 			for (uint32_t ns = 0; ns < stitches.size(); ++ns) {
 				assert(stitches[ns].vertex == -1U);
 				if (stitches[ns].flag == ak::Stitch::FlagDiscard) {
-					vertices.emplace_back(-1U);
 					continue;
 				} else {
-					float l = lengths.back() * stitches[ns].t;
+					float l = *(lengths_end-1) * stitches[ns].t;
 
-					while (li != lengths.end() && *li <= l) ++li;
-					assert(li != lengths.begin());
-					assert(li != lengths.end());
+					while (li != lengths_end && *li <= l) ++li;
+					assert(li != lengths_begin);
+					assert(li != lengths_end);
 					float m = (l - *(li-1)) / (*li - *(li -1));
-					uint32_t i = li - lengths.begin();
+					uint32_t i = li - lengths_begin;
 
-					vertices.emplace_back(graph_->vertices.size());
-					graph_->vertices.emplace_back();
-					graph_->vertices.back().at = ak::EmbeddedVertex::mix(
+					vertices[ns] = graph_->add_vertex(codec.pack(ak::EmbeddedVertex::mix(
 						slice_on_model[chain[i-1]], slice_on_model[chain[i]], m
-					);
+					)));
 				}
 			}
-			assert(ka.size() == stitches.size());
-			assert(vertices.size() == stitches.size());
 			if (!stitches.empty()) {
-				uint32_t prev = (is_loop ? vertices.back() : -1U);
+				uint32_t prev = (is_loop ? vertices[stitches.size()-1] : -1U);
 				for (uint32_t ns = 0; ns < stitches.size(); ++ns) {
 					uint32_t cur = vertices[ns];
 					if (ka[ns].first && prev != -1U) {
 						assert(cur != -1U);
 						//assert(prev != -1U); //<-- have to add to condition above because previous can be -1U in chains
-						assert(cur < graph_->vertices.size() && prev < graph_->vertices.size());
-						assert(graph_->vertices[cur].row_in == -1U);
-						graph_->vertices[cur].row_in = prev;
-						assert(graph_->vertices[prev].row_out == -1U);
-						graph_->vertices[prev].row_out = cur;
+						assert(cur < graph_->size() && prev < graph_->size());
+						assert(graph_->row_in[cur] == -1U);
+						graph_->row_in[cur] = prev;
+						assert(graph_->row_out[prev] == -1U);
+						graph_->row_out[prev] = cur;
 					}
 					prev = cur;
 				}
@@ -366,11 +477,11 @@ void ak::build_next_active_chains(
 
 		for (auto const &l : links) {
 			uint32_t fv = active_stitches[l.from_chain][l.from_stitch].vertex;
-			uint32_t tv = next_vertices[l.to_chain][l.to_stitch];
-			assert(fv < graph_->vertices.size());
-			assert(tv < graph_->vertices.size());
-			graph_->vertices[fv].add_col_out(tv);
-			graph_->vertices[tv].add_col_in(fv);
+			uint32_t tv = next_vertices[next_offsets[l.to_chain] + l.to_stitch];
+			assert(fv < graph_->size());
+			assert(tv < graph_->size());
+			graph_->add_col_out(fv, tv);
+			graph_->add_col_in(tv, fv);
 		}
 
 	}
@@ -413,18 +524,43 @@ void ak::build_next_active_chains(
 
 
 	//build a lookup structure for stitches:
-
-	std::map< std::pair< OnChainStitch, OnChainStitch >, OnChainStitch > next_vertex;
+	//steps (prev, cur) -> next, where cur is always a stitch; each stitch is cur in at most two steps:
+	auto stitch_index = [&](OnChainStitch const &ocs) -> uint32_t {
+		assert(ocs.stitch != -1U);
+		if (ocs.on == OnChainStitch::OnActive) return active_offsets[ocs.chain] + ocs.stitch;
+		else { assert(ocs.on == OnChainStitch::OnNext); return active_total + next_offsets[ocs.chain] + ocs.stitch; }
+	};
+	auto &steps = scratch.steps;
+	auto &steps_at = scratch.steps_at;
+	steps.reserve(next_total + 2 * active_total);
+	steps_at.assign(2 * (active_total + next_total), -1U);
+
+	auto find_step = [&](OnChainStitch const &prev, OnChainStitch const &cur) -> uint32_t {
+		if (cur.on == OnChainStitch::OnNone || cur.stitch == -1U) return -1U;
+		uint32_t i = stitch_index(cur);
+		for (uint32_t k = 0; k < 2; ++k) {
+			uint32_t s = steps_at[2*i+k];
+			if (s != -1U && steps[s].prev.same_key(prev)) return s;
+		}
+		return -1U;
+	};
+	auto add_step = [&](OnChainStitch const &prev, OnChainStitch const &cur, OnChainStitch const &next) {
+		assert(find_step(prev, cur) == -1U);
+		uint32_t i = stitch_index(cur);
+		uint32_t k = (steps_at[2*i] == -1U ? 0 : 1);
+		assert(steps_at[2*i+k] == -1U);
+		steps_at[2*i+k] = steps.size();
+		steps.emplace_back(Step{prev, cur, next});
+		LOG(Debug, Chains) << "Inserted [" << prev << ", " << cur << "] -> " << next;
+	};
 
 	//edges where middle vertex is on a next chain:
 	for (uint32_t nc = 0; nc < next_chains.size(); ++nc) {
 		auto const &chain = next_chains[nc];
 		bool is_loop = (chain[0] == chain.back());
-		auto const &ak = keep_adj[nc];
+		auto ak = keep_adj.begin() + next_offsets[nc];
 		auto const &stitches = next_stitches[nc];
 
-		assert(ak.size() == stitches.size());
-
 		for (uint32_t ns = 0; ns < stitches.size(); ++ns) {
 			if (stitches[ns].flag == ak::Stitch::FlagDiscard) continue;
 			OnChainStitch cur_ocs(OnChainStitch::OnNext, nc, ns);
@@ -443,11 +579,11 @@ void ak::build_next_active_chains(
 				}
 			} else {
 				//don't keep before segment, so prev involves walking down a link:
-				auto fa = next_active.find(ChainStitch(nc, ns));
-				assert(fa != next_active.end()); //there should always be a link to walk down, right?
+				auto fa = find_next_active(ChainStitch(nc, ns));
+				assert(!fa.empty()); //there should always be a link to walk down, right?
 				prev_ocs.on = OnChainStitch::OnActive;
-				prev_ocs.chain = fa->second[0].chain;
-				prev_ocs.stitch = fa->second[0].stitch;
+				prev_ocs.chain = fa[0].chain;
+				prev_ocs.stitch = fa[0].stitch;
 			}
 			OnChainStitch next_ocs;
 			if (ak[ns].second) {
@@ -464,20 +600,15 @@ void ak::build_next_active_chains(
 				}
 			} else {
 				//don't keep next segment, so next involves walking down a link:
-				auto fa = next_active.find(ChainStitch(nc, ns));
-				assert(fa != next_active.end()); //there should always be a link to walk down, right?
+				auto fa = find_next_active(ChainStitch(nc, ns));
+				assert(!fa.empty()); //there should always be a link to walk down, right?
 				next_ocs.on = OnChainStitch::OnActive;
-				next_ocs.chain = fa->second.back().chain;
-				next_ocs.stitch = fa->second.back().stitch;
+				next_ocs.chain = fa.back().chain;
+				next_ocs.stitch = fa.back().stitch;
 			}
 
 			if (prev_ocs.on != OnChainStitch::OnNone && next_ocs.on != OnChainStitch::OnNone) {
-				auto ret = next_vertex.insert(std::make_pair(
-					std::make_pair(prev_ocs, cur_ocs),
-					next_ocs
-				));
-				//std::cout << "Inserted [" << ret.first->first.first << ", " << ret.first->first.second << "] -> " << ret.first->second << std::endl; //DEBUG
-				assert(ret.second);
+				add_step(prev_ocs, cur_ocs, next_ocs);
 			}
 		}
 	}
@@ -486,7 +617,7 @@ void ak::build_next_active_chains(
 	//now edges from active chains:
 	for (uint32_t ac = 0; ac < active_chains.size(); ++ac) {
 		if (discard_active[ac]) {
-			std::cout << "Will discard active chain of " << active_stitches[ac].size() << " stitches because it had no outgoing links." << std::endl;
+			LOG(Info, Chains) << "Will discard active chain of " << active_stitches[ac].size() << " stitches because it had no outgoing links.";
 			continue;
 		}
 
@@ -514,37 +645,27 @@ void ak::build_next_active_chains(
 				next_ocs.type = OnChainStitch::TypeEnd;
 			}
 
-			auto fn = active_next.find(ChainStitch(ac, as));
-			if (fn == active_next.end()) {
+			auto fn = find_active_next(ChainStitch(ac, as));
+			if (fn.empty()) {
 				//no link, so edge is previous to next:
 				//      x    
 				// p -> c -> n
-				auto ret = next_vertex.insert(std::make_pair(
-					std::make_pair(prev_ocs, cur_ocs),
-					next_ocs
-				));
-				//std::cout << "Inserted [" << ret.first->first.first << ", " << ret.first->first.second << "] -> " << ret.first->second << std::endl; //DEBUG
-				assert(ret.second);
+				add_step(prev_ocs, cur_ocs, next_ocs);
 			} else {
 				//have a link. check for discarded segments:
 
 				//previous segment is discarded, so link prev up:
-				if (!keep_adj[fn->second[0].chain][fn->second[0].stitch].first) {
-					auto n = fn->second[0];
-					auto fa = next_active.find(n);
-					assert(fa != next_active.end());
-					if (fa->second[0] == ChainStitch(ac, as)) {
+				if (!keep_adj_at(fn[0]).first) {
+					auto n = fn[0];
+					auto fa = find_next_active(n);
+					assert(!fa.empty());
+					if (fa[0] == ChainStitch(ac, as)) {
 						//   xxx n0
 						//       | /
 						// p --- c
-						auto ret = next_vertex.insert(std::make_pair(
-							std::make_pair(prev_ocs, cur_ocs),
-								OnChainStitch(OnChainStitch::OnNext, n.chain, n.stitch)
-							));
-						//std::cout << "Inserted [" << ret.first->first.first << ", " << ret.first->first.second << "] -> " << ret.first->second << std::endl; //DEBUG
-						assert(ret.second);
+						add_step(prev_ocs, cur_ocs, OnChainStitch(OnChainStitch::OnNext, n.chain, n.stitch));
 					} else {
-						assert(fa->second.size() == 2 && fa->second.back() == ChainStitch(ac, as));
+						assert(fa.size() == 2 && fa.back() == ChainStitch(ac, as));
 						//don't link (this sort of case):
 						//   xxx n0
 						//     /  | 
@@ -553,22 +674,17 @@ void ak::build_next_active_chains(
 				}
 
 				//next segment is discarded, so link down to next:
-				if (!keep_adj[fn->second.back().chain][fn->second.back().stitch].second) {
-					auto n = fn->second.back();
-					auto fa = next_active.find(n);
-					assert(fa != next_active.end());
-					if (fa->second.back() == ChainStitch(ac, as)) {
+				if (!keep_adj_at(fn.back()).second) {
+					auto n = fn.back();
+					auto fa = find_next_active(n);
+					assert(!fa.empty());
+					if (fa.back() == ChainStitch(ac, as)) {
 						//   n0 xxx
 						// \ |
 						//   c --- n
-						auto ret = next_vertex.insert(std::make_pair(
-							std::make_pair(OnChainStitch(OnChainStitch::OnNext, n.chain, n.stitch), cur_ocs),
-								next_ocs
-							));
-						//std::cout << "Inserted [" << ret.first->first.first << ", " << ret.first->first.second << "] -> " << ret.first->second << std::endl; //DEBUG
-						assert(ret.second);
+						add_step(OnChainStitch(OnChainStitch::OnNext, n.chain, n.stitch), cur_ocs, next_ocs);
 					} else {
-						assert(fa->second.size() == 2 && fa->second[0] == ChainStitch(ac, as));
+						assert(fa.size() == 2 && fa[0] == ChainStitch(ac, as));
 						//don't link (this sort of case):
 						//    n0 xxx
 						//   / |
@@ -579,97 +695,114 @@ void ak::build_next_active_chains(
 		}
 	}
 
-
-#if 0
-	//DEBUG:
-	for (uint32_t c = 0; c < next_chains.size(); ++c) {
-		std::cout << "next[" << c << "] ";
-		for (auto f : next_flags[c]) {
-			if      (f == ak::FlagDiscard)  std::cout << '-';
-			else if (f == ak::FlagLinkNone) std::cout << '.';
-			else if (f == ak::FlagLinkOne)  std::cout << '1';
-			else if (f == ak::FlagLinkAny)  std::cout << '2';
-			else std::cout << '?';
+	//steps are walked in (prev, cur) order; prev may be a chain's begin/end, which sorts after that chain's stitches:
+	auto key_index = [&](OnChainStitch const &ocs) -> uint32_t {
+		if (ocs.on == OnChainStitch::OnActive) {
+			return active_offsets[ocs.chain] + ocs.chain + (ocs.stitch == -1U ? active_stitches[ocs.chain].size() : ocs.stitch);
+		} else { assert(ocs.on == OnChainStitch::OnNext);
+			return active_total + active_chains.size() + next_offsets[ocs.chain] + ocs.chain + (ocs.stitch == -1U ? next_stitches[ocs.chain].size() : ocs.stitch);
 		}
-		std::cout << std::endl;
-	}
-
-	//DEBUG:
-	for (uint32_t c = 0; c < active_chains.size(); ++c) {
-		std::cout << "active[" << c << "] ";
-		for (auto f : active_flags[c]) {
-			if      (f == ak::FlagDiscard)  std::cout << '-';
-			else if (f == ak::FlagLinkNone) std::cout << '.';
-			else if (f == ak::FlagLinkOne)  std::cout << '1';
-			else if (f == ak::FlagLinkAny)  std::cout << '2';
-			else std::cout << '?';
+	};
+	auto &step_order = scratch.step_order;
+	{ //(two counting sort passes: by cur, then stably by prev)
+		auto &temp = scratch.step_order_temp;
+		auto &counts = scratch.step_counts;
+		auto counting_sort = [&](std::vector< uint32_t > const &in, std::vector< uint32_t > *out, uint32_t keys, auto const &key) {
+			counts.assign(keys + 1, 0);
+			for (uint32_t s : in) {
+				counts[key(steps[s]) + 1] += 1;
+			}
+			for (uint32_t k = 0; k < keys; ++k) {
+				counts[k + 1] += counts[k];
+			}
+			out->resize(in.size());
+			for (uint32_t s : in) {
+				(*out)[counts[key(steps[s])]++] = s;
+			}
+		};
+		temp.resize(steps.size());
+		for (uint32_t s = 0; s < steps.size(); ++s) {
+			temp[s] = s;
 		}
-		std::cout << std::endl;
+		counting_sort(temp, &step_order, active_total + next_total, [&](Step const &step) {
+			return stitch_index(step.cur);
+		});
+		temp.swap(step_order);
+		counting_sort(temp, &step_order, active_total + active_chains.size() + next_total + next_chains.size(), [&](Step const &step) {
+			return key_index(step.prev);
+		});
 	}
 
-	//DEBUG:
-	for (auto const &cvv : active_next) {
-		std::cout << "active[" << cvv.first.chain << "][" << cvv.first.vertex << "] ->";
-		for (auto const &s : cvv.second) {
-			std::cout << " next[" << s.chain << "][" << s.vertex << "]";
+	if (LOG_ENABLED(Debug, Chains)) {
+		//DEBUG:
+		std::ostringstream dump;
+		for (uint32_t nc = 0; nc < next_chains.size(); ++nc) {
+			dump << "next[" << nc << "] ";
+			for (uint32_t ns = 0; ns < next_stitches[nc].size(); ++ns) {
+				auto const &ka = keep_adj_at(ChainStitch(nc, ns));
+				dump << (ka.first ? '-' : 'x') << (next_stitches[nc][ns].flag == ak::Stitch::FlagDiscard ? 'D' : 's') << (ka.second ? '-' : 'x');
+			}
+			dump << '\n';
 		}
-		std::cout << "\n";
-	}
-	std::cout.flush();
-
-	//DEBUG
-
-	auto check_ocs = [&](OnChainStitch const &ocs) {
-		assert(ocs.on == OnChainStitch::OnActive || ocs.on == OnChainStitch::OnNext);
-		auto const &chains = (ocs.on == OnChainStitch::OnActive ? active_chains : next_chains);
-		assert(ocs.chain < chains.size());
-		auto const &stitches = (ocs.on == OnChainStitch::OnActive ? active_stitches : next_stitches);
-		assert(stitches.size() == chains.size());
-		auto const &stitche = stitches[ocs.chain];
-		if (ocs.type == OnChainStitch::TypeStitch) {
-			assert(ocs.stitch < stitche.size());
-		} else {
-			assert(ocs.type == OnChainStitch::TypeBegin || ocs.type == OnChainStitch::TypeEnd);
-			assert(ocs.stitch == -1U);
+		for (uint32_t ac = 0; ac < active_chains.size(); ++ac) {
+			for (uint32_t as = 0; as < active_stitches[ac].size(); ++as) {
+				auto fn = find_active_next(ChainStitch(ac, as));
+				if (fn.empty()) continue;
+				dump << "active[" << ac << "][" << as << "] ->";
+				for (uint32_t i = 0; i < fn.size(); ++i) {
+					dump << " next[" << fn[i].chain << "][" << fn[i].stitch << "]";
+				}
+				dump << '\n';
+			}
 		}
-	};
-
-	for (auto const &pv : next_vertex) {
-		std::cout << "(" << pv.first.first << ", " << pv.first.second << ") -> " << pv.second << "\n";
-		check_ocs(pv.first.first);
-		check_ocs(pv.first.second);
-		check_ocs(pv.second);
+		for (uint32_t s : step_order) {
+			dump << "(" << steps[s].prev << ", " << steps[s].cur << ") -> " << steps[s].next << '\n';
+		}
+		LOG(Debug, Chains) << dump.str();
 	}
-	std::cout.flush();
-
-#endif
 
 	//Walk through created edges array, creating chains therefrom:
 
 	std::vector< std::vector< OnChainStitch > > loops;
-	std::map< std::pair< OnChainStitch, OnChainStitch >, std::vector< OnChainStitch > > partials;
+	//partial chains are found by their first two entries:
+	std::vector< std::vector< OnChainStitch > > partials;
+	std::vector< bool > partial_used;
+	auto &partials_at = scratch.partials_at;
+	partials_at.assign(2 * (active_total + next_total), -1U);
 
-	while (!next_vertex.empty()) {
+	auto &step_used = scratch.step_used;
+	step_used.assign(steps.size(), false);
+
+	for (uint32_t first : step_order) {
+		if (step_used[first]) continue;
 		std::vector< OnChainStitch > chain;
-		chain.emplace_back(next_vertex.begin()->first.first);
-		chain.emplace_back(next_vertex.begin()->first.second);
-		chain.emplace_back(next_vertex.begin()->second);
+		chain.emplace_back(steps[first].prev);
+		chain.emplace_back(steps[first].cur);
+		chain.emplace_back(steps[first].next);
 		//assert(chain[0] != chain[1] && chain[0] != chain[2] && chain[1] != chain[2]); //<-- not always true in two-stitch-loop cases (do we want two-stitch loops? Probably not.)
-		next_vertex.erase(next_vertex.begin());
+		step_used[first] = true;
 		while (true) {
-			auto f = next_vertex.find(std::make_pair(chain[chain.size()-2], chain[chain.size()-1]));
-			if (f == next_vertex.end()) break;
-			chain.emplace_back(f->second);
-			next_vertex.erase(f);
+			uint32_t f = find_step(chain[chain.size()-2], chain[chain.size()-1]);
+			if (f == -1U || step_used[f]) break;
+			chain.emplace_back(steps[f].next);
+			step_used[f] = true;
 		}
 
 		{ //check if a partial chain comes after this one; if so, append it:
-			auto f = partials.find(std::make_pair(chain[chain.size()-2], chain[chain.size()-1]));
-			if (f != partials.end()) {
-				chain.pop_back();
-				chain.pop_back();
-				chain.insert(chain.end(), f->second.begin(), f->second.end());
-				partials.erase(f);
+			OnChainStitch const &a = chain[chain.size()-2];
+			OnChainStitch const &b = chain[chain.size()-1];
+			if (b.on != OnChainStitch::OnNone && b.stitch != -1U) {
+				uint32_t i = stitch_index(b);
+				for (uint32_t k = 0; k < 2; ++k) {
+					uint32_t p = partials_at[2*i+k];
+					if (p == -1U || !partials[p][0].same_key(a)) continue;
+					chain.pop_back();
+					chain.pop_back();
+					chain.insert(chain.end(), partials[p].begin(), partials[p].end());
+					partials_at[2*i+k] = -1U;
+					partial_used[p] = true;
+					break;
+				}
 			}
 		}
 
@@ -681,45 +814,70 @@ void ak::build_next_active_chains(
 			loops.emplace_back(chain);
 		} else {
 			//partial loop -- save for later
-			auto ret = partials.insert(std::make_pair(std::make_pair(chain[0], chain[1]), chain));
-			assert(ret.second);
+			uint32_t i = stitch_index(chain[1]);
+			uint32_t k = (partials_at[2*i] == -1U ? 0 : 1);
+			assert(partials_at[2*i+k] == -1U);
+			assert(k == 0 || !partials[partials_at[2*i]][0].same_key(chain[0]));
+			partials_at[2*i+k] = partials.size();
+			partials.emplace_back(std::move(chain));
+			partial_used.emplace_back(false);
 		}
 	}
 
+	//remaining partials are output in (first, second) order:
+	std::vector< uint32_t > partial_order;
+	for (uint32_t p = 0; p < partials.size(); ++p) {
+		if (!partial_used[p]) partial_order.emplace_back(p);
+	}
+	std::sort(partial_order.begin(), partial_order.end(), [&](uint32_t a, uint32_t b) {
+		if (!partials[a][0].same_key(partials[b][0])) return partials[a][0] < partials[b][0];
+		return partials[a][1] < partials[b][1];
+	});
+
 
 
 
 
-	auto output = [&](std::vector< OnChainStitch > const &path) {
-		assert(path.size() >= 2);
+	//slice topology for embedded paths is built once and shared by all outputs:
+	ak::EmbeddedPathEngine path_engine(slice);
 
-		{ //don't pass onward any chains that touch a boundary:
-			uint32_t on_discard = 0;
-			uint32_t on_non_discard = 0;
-			for (auto const &ocs : path) {
-				if (ocs.on == OnChainStitch::OnNext && next_used_boundary[ocs.chain]) {
-					++on_discard;
-				} else {
-					++on_non_discard;
-				}
-			}
-			if (on_discard) {
-				assert(on_non_discard == 0); //should either be entirely discard or entirely not!
-				return;
+	//don't pass onward any chains that touch a boundary:
+	auto touches_boundary = [&](std::vector< OnChainStitch > const &path) {
+		uint32_t on_discard = 0;
+		uint32_t on_non_discard = 0;
+		for (auto const &ocs : path) {
+			if (ocs.on == OnChainStitch::OnNext && next_used_boundary[ocs.chain]) {
+				++on_discard;
+			} else {
+				++on_non_discard;
 			}
 		}
+		assert(on_discard == 0 || on_non_discard == 0); //should either be entirely discard or entirely not!
+		return on_discard != 0;
+	};
 
-		//build embedded vertices for all stitches:
-		std::vector< ak::EmbeddedVertex > path_evs;
-		std::vector< uint32_t > path_lefts; //also loop up i such that the stitch is in [ chain[i], chain[l+1] )
+	//build embedded vertices for all stitches:
+	auto embed_stitches = [&](std::vector< OnChainStitch > const &path,
+		std::vector< ak::EmbeddedVertex > *path_evs_,
+		std::vector< uint32_t > *path_lefts_ //also look up i such that the stitch is in [ chain[i], chain[l+1] )
+		) {
+		assert(path_evs_);
+		auto &path_evs = *path_evs_;
+		assert(path_lefts_);
+		auto &path_lefts = *path_lefts_;
+		path_evs.clear();
+		path_lefts.clear();
 		path_evs.reserve(path.size());
 		path_lefts.reserve(path.size());
 		for (auto const &ocs : path) {
 			std::vector< uint32_t > const &src_chain = (ocs.on == OnChainStitch::OnActive ? active_chains : next_chains)[ocs.chain];
-			std::vector< float > const &src_lengths = (ocs.on == OnChainStitch::OnActive ? active_lengths : next_lengths)[ocs.chain];
+			std::vector< uint32_t > const &src_length_offsets = (ocs.on == OnChainStitch::OnActive ? scratch.active_length_offsets : scratch.next_length_offsets);
+			std::vector< float > const &all_lengths = (ocs.on == OnChainStitch::OnActive ? scratch.active_lengths : scratch.next_lengths);
+			float const *src_lengths_begin = all_lengths.data() + src_length_offsets[ocs.chain];
+			float const *src_lengths_end = all_lengths.data() + src_length_offsets[ocs.chain + 1];
 			std::vector< ak::Stitch > const &src_stitches = (ocs.on == OnChainStitch::OnActive ? active_stitches : next_stitches)[ocs.chain];
 			assert(!src_chain.empty());
-			assert(src_lengths.size() == src_chain.size());
+			assert(uint32_t(src_lengths_end - src_lengths_begin) == src_chain.size());
 			//std::cout << (path_evs.size()-1) << " " << ocs << " "; //DEBUG
 			if (ocs.type == OnChainStitch::TypeBegin) {
 				assert(src_chain[0] != src_chain.back());
@@ -733,12 +891,12 @@ void ak::build_next_active_chains(
 				//std::cout << "End: " << src_chain.back() << std::endl; //DEBUG
 			} else { assert(ocs.type == OnChainStitch::TypeStitch);
 				assert(ocs.stitch < src_stitches.size());
-				float l = src_lengths.back() * src_stitches[ocs.stitch].t;
-				auto li = std::upper_bound(src_lengths.begin(), src_lengths.end(), l);
-				assert(li != src_lengths.end());
-				assert(li != src_lengths.begin());
+				float l = *(src_lengths_end-1) * src_stitches[ocs.stitch].t;
+				auto li = std::upper_bound(src_lengths_begin, src_lengths_end, l);
+				assert(li != src_lengths_end);
+				assert(li != src_lengths_begin);
 				float m = (l - *(li-1)) / (*li - *(li-1));
-				uint32_t i = li - src_lengths.begin();
+				uint32_t i = li - src_lengths_begin;
 				assert(i > 0);
 				path_evs.emplace_back(ak::EmbeddedVertex::on_edge(src_chain[i-1], src_chain[i], m));
 				path_lefts.emplace_back(i-1);
@@ -746,6 +904,42 @@ void ak::build_next_active_chains(
 			}
 		}
 
+	};
+
+	//outputs are loops, then partials (in order), skipping any that touch a boundary:
+	std::vector< std::vector< OnChainStitch > const * > outputs;
+	for (auto const &loop : loops) {
+		if (!touches_boundary(loop)) outputs.emplace_back(&loop);
+	}
+	for (auto p : partial_order) {
+		if (!touches_boundary(partials[p])) outputs.emplace_back(&partials[p]);
+	}
+
+	//embed stitches of all outputs, and find embedded paths for all active <-> next transitions in one batch:
+	std::vector< std::vector< ak::EmbeddedVertex > > outputs_evs(outputs.size());
+	std::vector< std::vector< uint32_t > > outputs_lefts(outputs.size());
+	std::vector< uint32_t > outputs_transitions(outputs.size()); //index of first transition of each output
+	std::vector< std::pair< ak::EmbeddedVertex, ak::EmbeddedVertex > > transitions;
+	for (uint32_t o = 0; o < outputs.size(); ++o) {
+		std::vector< OnChainStitch > const &path = *outputs[o];
+		embed_stitches(path, &outputs_evs[o], &outputs_lefts[o]);
+		outputs_transitions[o] = transitions.size();
+		for (uint32_t pi = 0; pi + 1 < path.size(); ++pi) {
+			if (path[pi].on != path[pi+1].on) {
+				transitions.emplace_back(outputs_evs[o][pi], outputs_evs[o][pi+1]);
+			}
+		}
+	}
+	std::vector< std::vector< ak::EmbeddedVertex > > transition_paths;
+	path_engine.paths(transitions, &transition_paths);
+
+	auto output = [&](uint32_t o) {
+		std::vector< OnChainStitch > const &path = *outputs[o];
+		assert(path.size() >= 2);
+		std::vector< ak::EmbeddedVertex > const &path_evs = outputs_evs[o];
+		std::vector< uint32_t > const &path_lefts = outputs_lefts[o];
+		uint32_t next_transition = outputs_transitions[o];
+
 		std::vector< ak::EmbeddedVertex > chain;
 		std::vector< ak::Stitch > stitches;
 		std::vector< uint32_t > remove_stitches; //indices of stitches to remove in a moment.
@@ -792,7 +986,8 @@ void ak::build_next_active_chains(
 				if (a.on == OnChainStitch::OnActive) {
 					a_vertex = active_stitches.at(a.chain).at(a.stitch).vertex;
 				} else {
-					a_vertex = next_vertices.at(a.chain).at(a.stitch);
+					assert(a.stitch < next_stitches.at(a.chain).size());
+					a_vertex = next_vertices[next_offsets[a.chain] + a.stitch];
 				}
 				if (pi == 0) stitches.emplace_back(length, a_flag, a_vertex);
 				else assert(!stitches.empty() && stitches.back().t == length && stitches.back().flag == a_flag && stitches.back().vertex == a_vertex);
@@ -821,9 +1016,10 @@ void ak::build_next_active_chains(
 				}
 			} else {
 				//std::cout << "Building embedded path." << std::endl; //DEBUG
-				//find an embedded path between a and b:
-				std::vector< ak::EmbeddedVertex > ab;
-				ak::embedded_path( parameters, slice, a_ev, b_ev, &ab);
+				//embedded path between a and b (found above):
+				assert(next_transition < transition_paths.size());
+				std::vector< ak::EmbeddedVertex > const &ab = transition_paths[next_transition];
+				++next_transition;
 				assert(ab[0] == a_ev);
 				assert(ab.back() == b_ev);
 				for (uint32_t i = 1; i + 1 < ab.size(); ++i) {
@@ -843,7 +1039,8 @@ void ak::build_next_active_chains(
 				if (b.on == OnChainStitch::OnActive) {
 					b_vertex = active_stitches.at(b.chain).at(b.stitch).vertex;
 				} else {
-					b_vertex = next_vertices.at(b.chain).at(b.stitch);
+					assert(b.stitch < next_stitches.at(b.chain).size());
+					b_vertex = next_vertices[next_offsets[b.chain] + b.stitch];
 				}
 
 				stitches.emplace_back(length, b_flag, b_vertex);
@@ -854,6 +1051,8 @@ void ak::build_next_active_chains(
 			}
 		}
 	
+		assert(next_transition == (o + 1 < outputs.size() ? outputs_transitions[o+1] : transition_paths.size()));
+
 		//should turn loops into loops:
 		assert((chain[0] == chain.back()) == (path[0] == path.back()));
 
@@ -883,7 +1082,7 @@ void ak::build_next_active_chains(
 				}
 			}
 			if (out != stitches.end()) {
-				std::cout << "Removed " << stitches.end() - out << " stitches under short-row ends." << std::endl;
+				LOG(Info, Chains) << "Removed " << stitches.end() - out << " stitches under short-row ends.";
 				stitches.erase(out, stitches.end());
 			}
 		}
@@ -894,6 +1093,7 @@ void ak::build_next_active_chains(
 		}
 
 		//convert chain from being embedded on slice to being embedded on model:
+		//(snapped, so that compact copies of active chains are exact)
 		for (auto &ev : chain) {
 			glm::uvec3 simplex = slice_on_model[ev.simplex.x].simplex;
 			if (ev.simplex.y != -1U) simplex = ak::EmbeddedVertex::common_simplex(simplex, slice_on_model[ev.simplex.y].simplex);
@@ -903,7 +1103,7 @@ void ak::build_next_active_chains(
 			if (ev.simplex.y != -1U) weights += ev.weights.y * slice_on_model[ev.simplex.y].weights_on(simplex);
 			if (ev.simplex.z != -1U) weights += ev.weights.z * slice_on_model[ev.simplex.z].weights_on(simplex);
 
-			ev = ak::EmbeddedVertex::canonicalize(simplex, weights);
+			ev = codec.snap(ak::EmbeddedVertex::canonicalize(simplex, weights));
 		}
 
 		next_active_chains.emplace_back(chain);
@@ -911,15 +1111,13 @@ void ak::build_next_active_chains(
 
 	};
 
-	std::cout << "Found " << loops.size() << " loops and " << partials.size() << " chains." << std::endl;
-	for (auto const &loop : loops) {
-		output(loop);
-	}
-	for (auto const &pp : partials) {
-		output(pp.second);
+	LOG(Info, Chains) << "Found " << loops.size() << " loops and " << partial_order.size() << " chains.";
+	for (uint32_t o = 0; o < outputs.size(); ++o) {
+		output(o);
 	}
 
 	//HACK: sometimes duplicate vertices after splatting back to model somehow:
+	// (and snapping can merge very close vertices)
 	uint32_t trimmed = 0;
 	for (auto &chain : next_active_chains) {
 		for (uint32_t i = 1; i < chain.size(); /* later */) {
@@ -933,7 +1131,7 @@ void ak::build_next_active_chains(
 	}
 
 	if (trimmed) {
-		std::cout << "Trimmed " << trimmed << " identical-after-moving-to-model vertices from next active chains." << std::endl;
+		LOG(Info, Chains) << "Trimmed " << trimmed << " identical-after-moving-to-model vertices from next active chains.";
 	}
 
 
@@ -950,7 +1148,7 @@ void ak::build_next_active_chains(
 		for (auto const &stitches : next_active_stitches) {
 			for (auto const &s : stitches) {
 				assert(s.vertex != -1U);
-				assert(s.vertex < graph_->vertices.size());
+				assert(s.vertex < graph_->size());
 			}
 		}
 	}
@@ -0,0 +1,187 @@
+#include "pipeline.hpp"
+
+#include <cstring>
+#include <cmath>
+#include <stdexcept>
+
+static_assert(sizeof(ak::CompactEmbeddedVertex) == 8, "CompactEmbeddedVertex should be eight bytes");
+
+namespace {
+uint32_t float_bits(float f) {
+	uint32_t ret;
+	std::memcpy(&ret, &f, sizeof(ret));
+	return ret;
+}
+float bits_float(uint32_t u) {
+	float ret;
+	std::memcpy(&ret, &u, sizeof(ret));
+	return ret;
+}
+}
+
+ak::EmbeddedVertexCodec::EmbeddedVertexCodec(ak::Model const &model) {
+	auto less2 = [](glm::uvec2 const &a, glm::uvec2 const &b) {
+		if (a.x != b.x) return a.x < b.x;
+		return a.y < b.y;
+	};
+	auto less3 = [](glm::uvec3 const &a, glm::uvec3 const &b) {
+		if (a.x != b.x) return a.x < b.x;
+		if (a.y != b.y) return a.y < b.y;
+		return a.z < b.z;
+	};
+
+	triangles.reserve(model.triangles.size());
+	for (auto const &tri : model.triangles) {
+		glm::uvec3 s = tri;
+		if (s.x > s.y) std::swap(s.x, s.y);
+		if (s.y > s.z) std::swap(s.y, s.z);
+		if (s.x > s.y) std::swap(s.x, s.y);
+		assert(s.x < s.y && s.y < s.z && s.z < model.vertices.size());
+		triangles.emplace_back(s);
+	}
+	std::sort(triangles.begin(), triangles.end(), less3);
+	triangles.erase(std::unique(triangles.begin(), triangles.end()), triangles.end());
+	if (triangles.size() > CompactEmbeddedVertex::IdMask || model.vertices.size() > CompactEmbeddedVertex::IdMask) {
+		throw std::runtime_error("Model is too large for compact embedded vertices.");
+	}
+
+	edges.reserve(triangles.size() * 3);
+	for (auto const &t : triangles) {
+		edges.emplace_back(t.x, t.y);
+		edges.emplace_back(t.y, t.z);
+		edges.emplace_back(t.x, t.z);
+	}
+	std::sort(edges.begin(), edges.end(), less2);
+	edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+	if (edges.size() > CompactEmbeddedVertex::IdMask) {
+		throw std::runtime_error("Model is too large for compact embedded vertices.");
+	}
+
+	edge_offsets.assign(model.vertices.size() + 1, 0);
+	for (auto const &e : edges) {
+		edge_offsets[e.x + 1] += 1;
+	}
+	for (uint32_t v = 0; v < model.vertices.size(); ++v) {
+		edge_offsets[v + 1] += edge_offsets[v];
+	}
+
+	//triangles are sorted, so triangles starting with each edge are contiguous and in edge order:
+	triangle_offsets.assign(edges.size() + 1, 0);
+	{
+		uint32_t e = 0;
+		for (auto const &t : triangles) {
+			while (edges[e] != glm::uvec2(t.x, t.y)) {
+				++e;
+				assert(e < edges.size());
+			}
+			triangle_offsets[e + 1] += 1;
+		}
+	}
+	for (uint32_t e = 0; e < edges.size(); ++e) {
+		triangle_offsets[e + 1] += triangle_offsets[e];
+	}
+}
+
+ak::CompactEmbeddedVertex ak::EmbeddedVertexCodec::pack(ak::EmbeddedVertex const &ev) const {
+	CompactEmbeddedVertex ret;
+
+	assert(ev.simplex.x != -1U);
+	assert(ev.simplex.x + 1 < edge_offsets.size());
+	if (ev.simplex.y == -1U) {
+		assert(ev.simplex.z == -1U);
+		ret.simplex = (CompactEmbeddedVertex::KindVertex << CompactEmbeddedVertex::KindShift) | ev.simplex.x;
+		ret.weights = float_bits(ev.weights.x);
+		return ret;
+	}
+
+	assert(ev.simplex.x < ev.simplex.y);
+	auto e_begin = edges.begin() + edge_offsets[ev.simplex.x];
+	auto e_end = edges.begin() + edge_offsets[ev.simplex.x + 1];
+	auto e = std::lower_bound(e_begin, e_end, ev.simplex.y, [](glm::uvec2 const &edge, uint32_t y) {
+		return edge.y < y;
+	});
+	assert(e != e_end && e->y == ev.simplex.y && "edge should be in model");
+	uint32_t edge = e - edges.begin();
+
+	if (ev.simplex.z == -1U) {
+		//NOTE: weights.x is reconstructed as 1.0f - weights.y (exact for on_edge() points)
+		ret.simplex = (CompactEmbeddedVertex::KindEdge << CompactEmbeddedVertex::KindShift) | edge;
+		ret.weights = float_bits(ev.weights.y);
+		return ret;
+	}
+
+	assert(ev.simplex.y < ev.simplex.z);
+	auto t_begin = triangles.begin() + triangle_offsets[edge];
+	auto t_end = triangles.begin() + triangle_offsets[edge + 1];
+	auto t = std::lower_bound(t_begin, t_end, ev.simplex.z, [](glm::uvec3 const &tri, uint32_t z) {
+		return tri.z < z;
+	});
+	assert(t != t_end && t->z == ev.simplex.z && "triangle should be in model");
+
+	float const sum = float(CompactEmbeddedVertex::CompactWeightSum);
+	int32_t y = int32_t(std::round(ev.weights.y * sum));
+	y = std::max(0, std::min(int32_t(sum), y));
+	int32_t z = int32_t(std::round(ev.weights.z * sum));
+	z = std::max(0, std::min(int32_t(sum) - y, z));
+
+	ret.simplex = (CompactEmbeddedVertex::KindTriangle << CompactEmbeddedVertex::KindShift) | uint32_t(t - triangles.begin());
+	ret.weights = (uint32_t(y) << 16) | uint32_t(z);
+	return ret;
+}
+
+ak::EmbeddedVertex ak::EmbeddedVertexCodec::unpack(ak::CompactEmbeddedVertex const &cev) const {
+	uint32_t kind = cev.simplex >> CompactEmbeddedVertex::KindShift;
+	uint32_t id = cev.simplex & CompactEmbeddedVertex::IdMask;
+	if (kind == CompactEmbeddedVertex::KindVertex) {
+		assert(id + 1 < edge_offsets.size());
+		return EmbeddedVertex(glm::uvec3(id, -1U, -1U), glm::vec3(bits_float(cev.weights), 0.0f, 0.0f));
+	} else if (kind == CompactEmbeddedVertex::KindEdge) {
+		assert(id < edges.size());
+		float y = bits_float(cev.weights);
+		return EmbeddedVertex(glm::uvec3(edges[id], -1U), glm::vec3(1.0f - y, y, 0.0f));
+	} else { assert(kind == CompactEmbeddedVertex::KindTriangle);
+		assert(id < triangles.size());
+		float const sum = float(CompactEmbeddedVertex::CompactWeightSum);
+		float y = (cev.weights >> 16) / sum;
+		float z = (cev.weights & 0xffff) / sum;
+		return EmbeddedVertex(triangles[id], glm::vec3(1.0f - y - z, y, z));
+	}
+}
+
+void ak::EmbeddedVertexCodec::pack(std::vector< ak::EmbeddedVertex > const &evs, std::vector< ak::CompactEmbeddedVertex > *out_) const {
+	assert(out_);
+	auto &out = *out_;
+	out.clear();
+	out.reserve(evs.size());
+	for (auto const &ev : evs) {
+		out.emplace_back(pack(ev));
+	}
+}
+
+void ak::EmbeddedVertexCodec::unpack(std::vector< ak::CompactEmbeddedVertex > const &cevs, std::vector< ak::EmbeddedVertex > *out_) const {
+	assert(out_);
+	auto &out = *out_;
+	out.clear();
+	out.reserve(cevs.size());
+	for (auto const &cev : cevs) {
+		out.emplace_back(unpack(cev));
+	}
+}
+
+void ak::EmbeddedVertexCodec::pack(std::vector< std::vector< ak::EmbeddedVertex > > const &chains, std::vector< std::vector< ak::CompactEmbeddedVertex > > *out_) const {
+	assert(out_);
+	auto &out = *out_;
+	out.resize(chains.size());
+	for (uint32_t c = 0; c < chains.size(); ++c) {
+		pack(chains[c], &out[c]);
+	}
+}
+
+void ak::EmbeddedVertexCodec::unpack(std::vector< std::vector< ak::CompactEmbeddedVertex > > const &chains, std::vector< std::vector< ak::EmbeddedVertex > > *out_) const {
+	assert(out_);
+	auto &out = *out_;
+	out.resize(chains.size());
+	for (uint32_t c = 0; c < chains.size(); ++c) {
+		unpack(chains[c], &out[c]);
+	}
+}
@@ -0,0 +1,192 @@
+#include "dataflow.hpp"
+
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+ak::Dataflow::Node ak::Dataflow::add_source(std::string const &name) {
+	std::lock_guard< std::mutex > lock(mutex);
+	nodes.emplace_back();
+	nodes.back().name = name;
+	nodes.back().invalid = false; //sources are always up to date
+	return nodes.size() - 1;
+}
+
+ak::Dataflow::Node ak::Dataflow::add_node(
+	std::string const &name,
+	std::vector< Node > const &inputs,
+	std::function< bool() > const &compute,
+	bool main_thread
+) {
+	assert(compute);
+	std::lock_guard< std::mutex > lock(mutex);
+	for (auto i : inputs) {
+		if (i >= nodes.size()) throw std::runtime_error("Dataflow node '" + name + "' has an input that doesn't exist yet.");
+	}
+	nodes.emplace_back();
+	NodeInfo &info = nodes.back();
+	info.name = name;
+	info.inputs = inputs;
+	info.compute = compute;
+	info.main_thread = main_thread;
+	info.seen.assign(inputs.size(), 0);
+	return nodes.size() - 1;
+}
+
+void ak::Dataflow::changed(Node node) {
+	std::lock_guard< std::mutex > lock(mutex);
+	assert(node < nodes.size());
+	nodes[node].version += 1;
+}
+
+void ak::Dataflow::invalidate(Node node) {
+	std::lock_guard< std::mutex > lock(mutex);
+	assert(node < nodes.size());
+	assert(nodes[node].compute && "only computed nodes can be invalidated");
+	nodes[node].invalid = true;
+}
+
+bool ak::Dataflow::own_stale_locked(Node node) const {
+	NodeInfo const &info = nodes[node];
+	if (!info.compute) return false;
+	if (info.invalid) return true;
+	for (uint32_t i = 0; i < info.inputs.size(); ++i) {
+		if (info.seen[i] != nodes[info.inputs[i]].version) return true;
+	}
+	return false;
+}
+
+bool ak::Dataflow::stale_locked(Node node, std::vector< int8_t > *memo_) const {
+	auto &memo = *memo_;
+	if (memo[node] < 0) {
+		bool stale = own_stale_locked(node);
+		for (auto i : nodes[node].inputs) {
+			if (stale) break;
+			stale = stale_locked(i, memo_);
+		}
+		memo[node] = (stale ? 1 : 0);
+	}
+	return memo[node] != 0;
+}
+
+bool ak::Dataflow::stale(Node node) const {
+	std::lock_guard< std::mutex > lock(mutex);
+	assert(node < nodes.size());
+	std::vector< int8_t > memo(nodes.size(), -1);
+	return stale_locked(node, &memo);
+}
+
+void ak::Dataflow::update(std::vector< Node > const &targets) {
+	std::unique_lock< std::mutex > lock(mutex);
+
+	//find everything the targets depend on (inputs always have lower indices than their users):
+	std::vector< bool > needed(nodes.size(), false);
+	for (auto t : targets) {
+		assert(t < nodes.size());
+		needed[t] = true;
+	}
+	for (uint32_t n = nodes.size() - 1; n < nodes.size(); --n) {
+		if (!needed[n]) continue;
+		for (auto i : nodes[n].inputs) needed[i] = true;
+	}
+
+	//count inputs still to be brought up to date; nodes become ready when they reach zero:
+	std::vector< uint32_t > waiting(nodes.size(), 0);
+	std::vector< std::vector< Node > > users(nodes.size());
+	std::deque< Node > ready;
+	for (uint32_t n = 0; n < nodes.size(); ++n) {
+		if (!needed[n]) continue;
+		for (auto i : nodes[n].inputs) {
+			waiting[n] += 1;
+			users[i].emplace_back(n);
+		}
+		if (waiting[n] == 0) ready.emplace_back(n);
+	}
+
+	std::condition_variable done_cv;
+	uint32_t running = 0;
+	std::exception_ptr error;
+	std::vector< std::thread > threads;
+
+	auto finished = [&](Node n) {
+		//(called with lock held)
+		for (auto u : users[n]) {
+			assert(waiting[u] > 0);
+			waiting[u] -= 1;
+			if (waiting[u] == 0) ready.emplace_back(u);
+		}
+	};
+
+	//run one node's compute function (called with lock held; releases it while computing):
+	auto run = [&](Node n, std::unique_lock< std::mutex > &held) {
+		NodeInfo &info = nodes[n];
+		std::vector< uint32_t > seen;
+		seen.reserve(info.inputs.size());
+		for (auto i : info.inputs) seen.emplace_back(nodes[i].version);
+		std::function< bool() > compute = info.compute;
+
+		held.unlock();
+		auto before = std::chrono::high_resolution_clock::now();
+		bool changed = false;
+		std::exception_ptr failed;
+		try {
+			changed = compute();
+		} catch (...) {
+			failed = std::current_exception();
+		}
+		auto after = std::chrono::high_resolution_clock::now();
+		held.lock();
+
+		NodeInfo &info2 = nodes[n]; //(nodes might have been added meanwhile)
+		info2.computes += 1;
+		info2.seconds += std::chrono::duration< double >(after - before).count();
+		if (failed) {
+			info2.invalid = true;
+			if (!error) error = failed;
+		} else {
+			info2.seen = seen;
+			info2.invalid = false;
+			if (changed) info2.version += 1;
+			finished(n);
+		}
+	};
+
+	while (true) {
+		if (!ready.empty() && !error) {
+			//start nodes that can go to other threads before running any here:
+			auto pick = ready.begin();
+			while (pick != ready.end() && nodes[*pick].main_thread) ++pick;
+			if (pick == ready.end()) pick = ready.begin();
+			Node n = *pick;
+			ready.erase(pick);
+			if (!own_stale_locked(n)) {
+				finished(n);
+			} else if (nodes[n].main_thread) {
+				run(n, lock);
+			} else {
+				running += 1;
+				threads.emplace_back([&, n]() {
+					std::unique_lock< std::mutex > held(mutex);
+					run(n, held);
+					running -= 1;
+					done_cv.notify_all();
+				});
+			}
+		} else if (running > 0) {
+			done_cv.wait(lock);
+		} else {
+			break;
+		}
+	}
+
+	lock.unlock();
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	if (error) std::rethrow_exception(error);
+}
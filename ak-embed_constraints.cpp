@@ -1,5 +1,6 @@
 #include "pipeline.hpp"
 #include "EmbeddedPlanarMap.hpp"
+#include "log.hpp"
 
 
 #include <glm/gtx/norm.hpp>
@@ -93,7 +94,7 @@ void ak::embed_constraints(
 			}
 			while (path.back() != goal) {
 				if (visited[path.back()].second == -1U) {
-					std::cerr << "ERROR: constraint chain moves between connected components." << std::endl;
+					LOG(Error, Embed) << "ERROR: constraint chain moves between connected components.";
 					break;
 				}
 				path.emplace_back(visited[path.back()].second);
@@ -110,7 +111,7 @@ void ak::embed_constraints(
 	const float MaxEdgeLength2 = MaxEdgeLength * MaxEdgeLength;
 	constexpr const float MinEdgeRatio2 = MinEdgeRatio * MinEdgeRatio;
 
-	std::cout << "Max edge length: " << MaxEdgeLength << " model units." << std::endl;
+	LOG(Info, Embed) << "Max edge length: " << MaxEdgeLength << " model units.";
 
 	std::vector< glm::vec3 > verts = model.vertices;
 	std::vector< glm::uvec3 > tris = model.triangles;
@@ -420,12 +421,13 @@ void ak::embed_constraints(
 					//PARANOIA:
 					float dis3 = glm::length(verts[root] - verts[ci]);
 					if (dis3 > dis + 1e-6) {
-						std::cerr << "dis3: " << dis3 << " vs flat dis " << dis << " seems bad!" << std::endl;
-						std::cerr << "  ra3: " << glm::length(verts[root] - verts[ai]) << " vs ra: " << glm::length(flat_root - flat_a) << std::endl;
-						std::cerr << "  rb3: " << glm::length(verts[root] - verts[bi]) << " vs rb: " << glm::length(flat_root - flat_b) << std::endl;
-						std::cerr << "  ab3: " << glm::length(verts[ai] - verts[bi]) << " vs ab: " << glm::length(flat_a - flat_b) << std::endl;
-						std::cerr << "  ac3: " << glm::length(verts[ai] - verts[ci]) << " vs ac: " << glm::length(flat_a - flat_c) << std::endl;
-						std::cerr << "  bc3: " << glm::length(verts[bi] - verts[ci]) << " vs bc: " << glm::length(flat_b - flat_c) << std::endl;
+						//(logged as an error so it is written before the assert below)
+						LOG(Error, Embed) << "dis3: " << dis3 << " vs flat dis " << dis << " seems bad!\n"
+							<< "  ra3: " << glm::length(verts[root] - verts[ai]) << " vs ra: " << glm::length(flat_root - flat_a) << "\n"
+							<< "  rb3: " << glm::length(verts[root] - verts[bi]) << " vs rb: " << glm::length(flat_root - flat_b) << "\n"
+							<< "  ab3: " << glm::length(verts[ai] - verts[bi]) << " vs ab: " << glm::length(flat_a - flat_b) << "\n"
+							<< "  ac3: " << glm::length(verts[ai] - verts[ci]) << " vs ac: " << glm::length(flat_a - flat_c) << "\n"
+							<< "  bc3: " << glm::length(verts[bi] - verts[ci]) << " vs bc: " << glm::length(flat_b - flat_c);
 						assert(dis3 < dis + 1e-6);
 					}
 
@@ -640,7 +642,7 @@ void ak::embed_constraints(
 	assert(embedded_chains.size() == constraints.size());
 
 	//embed chains using planar map:
-	EmbeddedPlanarMap< float, SameValue< float >, ReplaceValue< float > > epm;
+	EmbeddedPlanarMap< float, SameValue< float >, ReplaceValue< float > > epm(verts.size(), tris);
 	uint32_t total_chain_edges = 0;
 	for (uint32_t c = 0; c < constraints.size(); ++c) {
 		uint32_t first = 0;
@@ -655,21 +657,11 @@ void ak::embed_constraints(
 		}
 		//if (first != last) std::cout << "NOTE: have open chain." << std::endl;
 	}
-	uint32_t total_simplex_edges = 0;
-	for (const auto &edges : epm.simplex_edges) {
-		total_simplex_edges += edges.second.size();
-	}
 	/*//DEBUG:
-	std::cout << "EPM has " << epm.vertices.size() << " vertices." << std::endl;
-	std::cout << "EPM has " << epm.simplex_vertices.size() << " simplices with vertices." << std::endl;
-	std::cout << "EPM has " << epm.simplex_edges.size() << " simplices with edges (" << total_simplex_edges << " edges from " << total_chain_edges << " chain edges)." << std::endl;
-
-	for (const auto &se : epm.simplex_edges) {
-		assert(se.first.x <= se.first.y && se.first.y <= se.first.z);
-		if (se.first.z != -1U) {
-			std::cout << se.first.x << ", " << se.first.y << ", " << se.first.z << std::endl;
-		}
-	}*/
+	LOG(Info, Embed) << "EPM has " << epm.vertices.size() << " vertices.";
+	LOG(Info, Embed) << "EPM has " << epm.simplices_with_vertices() << " simplices with vertices.";
+	LOG(Info, Embed) << "EPM has " << epm.simplices_with_edges() << " simplices with edges (" << epm.edge_count() << " edges from " << total_chain_edges << " chain edges).";
+	*/
 
 	{ //Build a mesh that is split at the embedded edges:
 		std::vector< ak::EmbeddedVertex > split_evs;
@@ -687,8 +679,8 @@ void ak::embed_constraints(
 		//record constrained edges in terms of split_verts:
 		std::unordered_map< glm::uvec2, float > constrained_edges;
 		std::vector< float > split_values(split_verts.size(), std::numeric_limits< float >::quiet_NaN());
-		for (const auto &se : epm.simplex_edges) {
-			for (auto const &e : se.second) {
+		for (uint32_t slot = 0; slot < epm.slot_count(); ++slot) {
+			for (auto const &e : epm.edges_in(slot)) {
 				glm::uvec2 ab = glm::uvec2(epm_to_split[e.first], epm_to_split[e.second]);
 				if (ab.x > ab.y) std::swap(ab.x, ab.y);
 				constrained_edges.insert(std::make_pair(ab, e.value));
@@ -697,7 +689,7 @@ void ak::embed_constraints(
 				split_values[epm_to_split[e.second]] = e.value;
 			}
 		}
-		std::cout << constrained_edges.size() << " constrained edges." << std::endl;
+		LOG(Info, Embed) << constrained_edges.size() << " constrained edges.";
 
 		
 		std::vector< uint32_t > tri_component(split_tris.size(), -1U);
@@ -751,7 +743,7 @@ void ak::embed_constraints(
 				}
 				component_keep.emplace_back(values.size() > 1);
 			}
-			std::cout << "Have " << component_keep.size() << " connected components." << std::endl;
+			LOG(Info, Embed) << "Have " << component_keep.size() << " connected components.";
 		}
 
 
@@ -780,7 +772,7 @@ void ak::embed_constraints(
 			tri.z = add_vert(tri.z);
 		}
 
-		std::cout << "Went from " << tris.size() << " to (via split) " << split_tris.size() << " to (via discard) " << compressed_tris.size() << " triangles." << std::endl; //DEBUG
+		LOG(Info, Embed) << "Went from " << tris.size() << " to (via split) " << split_tris.size() << " to (via discard) " << compressed_tris.size() << " triangles."; //DEBUG
 
 		constrained_model.vertices = compressed_verts;
 		constrained_model.triangles = compressed_tris;
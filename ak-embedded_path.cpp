@@ -1,271 +1,205 @@
 #include "pipeline.hpp"
+#include "parallel.hpp"
 
-#include <unordered_map>
-#include <unordered_set>
 #include <algorithm>
 #include <iostream>
+#include <limits>
 #include <stdexcept>
 
-#include <glm/gtx/hash.hpp>
 #include <glm/gtx/norm.hpp>
 
-void embedded_path_simple(
-	ak::Parameters const &parameters,
-	ak::Model const &model,
-	ak::EmbeddedVertex const &source,
-	ak::EmbeddedVertex const &target,
-	std::vector< ak::EmbeddedVertex > *path_ //out: path; path[0] will be source and path.back() will be target
-) {
-	assert(source != target);
-
-	assert(path_);
-	auto &path = *path_;
-	path.clear();
+ak::EmbeddedPathEngine::EmbeddedPathEngine(ak::Model const &model_) : model(model_) {
 
+	uint32_t const V = model.vertices.size();
 
-	//idea: place distance storage along each edge and on each corner.
-	std::vector< ak::EmbeddedVertex > loc_ev;
-	std::vector< glm::vec3 > loc_pos;
-
-	//TODO: eventually, incrementally build locs starting from source / target verts
-
-	//add locs for each vertex in the mesh:
-	std::vector< uint32_t > vertex_locs;
-	vertex_locs.reserve(model.vertices.size());
-	for (uint32_t vi = 0; vi < model.vertices.size(); ++vi) {
-		vertex_locs.emplace_back(loc_ev.size());
-		loc_ev.emplace_back(ak::EmbeddedVertex::on_vertex(vi));
-		loc_pos.emplace_back(loc_ev.back().interpolate(model.vertices));
+	//edges of the model, (a,b) with a < b:
+	edges.reserve(model.triangles.size() * 3);
+	for (auto const &tri : model.triangles) {
+		edges.emplace_back(std::min(tri.x, tri.y), std::max(tri.x, tri.y));
+		edges.emplace_back(std::min(tri.y, tri.z), std::max(tri.y, tri.z));
+		edges.emplace_back(std::min(tri.z, tri.x), std::max(tri.z, tri.x));
 	}
+	auto edge_less = [](glm::uvec2 const &a, glm::uvec2 const &b) {
+		if (a.x != b.x) return a.x < b.x;
+		return a.y < b.y;
+	};
+	std::sort(edges.begin(), edges.end(), edge_less);
+	edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+	auto find_edge = [&](uint32_t a, uint32_t b) -> uint32_t {
+		glm::uvec2 e(std::min(a,b), std::max(a,b));
+		auto f = std::lower_bound(edges.begin(), edges.end(), e, edge_less);
+		assert(f != edges.end() && *f == e);
+		return f - edges.begin();
+	};
 
-	//make an edge-to-triangle look-up structure:
-	std::unordered_multimap< glm::uvec2, uint32_t > edge_triangles;
-	std::unordered_map< glm::uvec3, uint32_t > simplex_triangle;
-	std::unordered_set< glm::uvec2 > edges;
+	//triangle edges and edge/vertex triangles:
+	tri_edges.reserve(model.triangles.size());
+	edge_tri_offsets.assign(edges.size() + 1, 0);
+	vertex_tri_offsets.assign(V + 1, 0);
 	for (auto const &tri : model.triangles) {
-		uint32_t ti = &tri - &model.triangles[0];
-		auto do_edge = [&](uint32_t a, uint32_t b) {
-			if (a > b) std::swap(a,b);
-			edge_triangles.insert(std::make_pair(glm::uvec2(a,b), ti));
-			edges.insert(glm::uvec2(a,b));
-		};
-		do_edge(tri.x, tri.y);
-		do_edge(tri.y, tri.z);
-		do_edge(tri.z, tri.x);
-
-		glm::uvec3 simplex = tri;
-		if (simplex.x > simplex.y) std::swap(simplex.x, simplex.y);
-		if (simplex.y > simplex.z) std::swap(simplex.y, simplex.z);
-		if (simplex.x > simplex.y) std::swap(simplex.x, simplex.y);
-		auto ret = simplex_triangle.insert(std::make_pair(simplex, ti));
-		assert(ret.second);
+		tri_edges.emplace_back(find_edge(tri.x, tri.y), find_edge(tri.y, tri.z), find_edge(tri.z, tri.x));
+		edge_tri_offsets[tri_edges.back().x + 1] += 1;
+		edge_tri_offsets[tri_edges.back().y + 1] += 1;
+		edge_tri_offsets[tri_edges.back().z + 1] += 1;
+		vertex_tri_offsets[tri.x + 1] += 1;
+		vertex_tri_offsets[tri.y + 1] += 1;
+		vertex_tri_offsets[tri.z + 1] += 1;
 	}
-
-	//add (several?) locs along each edge:
-	std::unordered_map< glm::uvec2, std::pair< uint32_t, uint32_t > > edge_locs;
-	edge_locs.reserve(edges.size());
-	float const max_spacing = parameters.get_max_path_sample_spacing();
-	for (auto const &e : edges) {
-		uint32_t count = std::max(0, int32_t(std::floor(glm::length(model.vertices[e.y] - model.vertices[e.x]) / max_spacing)));
-		uint32_t begin = loc_ev.size();
-		uint32_t end = begin + count;
-		edge_locs.insert(std::make_pair(e, std::make_pair(begin, end)));
-		for (uint32_t i = 0; i < count; ++i) {
-			loc_ev.emplace_back(ak::EmbeddedVertex::on_edge(e.x, e.y, (i + 0.5f) / float(count)));
-			loc_pos.emplace_back(loc_ev.back().interpolate(model.vertices));
-		}
-		assert(loc_ev.size() == end);
+	for (uint32_t e = 0; e < edges.size(); ++e) {
+		edge_tri_offsets[e + 1] += edge_tri_offsets[e];
 	}
-
-	//build adjacency lists for each triangle:
-	std::vector< std::vector< uint32_t > > loc_tris(loc_ev.size());
-	std::vector< std::vector< uint32_t > > tri_adj(model.triangles.size());
-	for (auto const &tri : model.triangles) {
-		uint32_t ti = &tri - &model.triangles[0];
-		auto do_edge = [&](uint32_t a, uint32_t b) {
-			if (a > b) std::swap(b,a);
-			auto f = edge_locs.find(glm::uvec2(a,b));
-			assert(f != edge_locs.end());
-			for (uint32_t i = f->second.first; i < f->second.second; ++i) {
-				loc_tris[i].emplace_back(ti);
-				tri_adj[ti].emplace_back(i);
-			}
-		};
-
-		auto do_vertex = [&](uint32_t a) {
-			uint32_t i = vertex_locs[a];
-			loc_tris[i].emplace_back(ti);
-			tri_adj[ti].emplace_back(i);
-		};
-
-		do_edge(tri.x, tri.y);
-		do_edge(tri.y, tri.z);
-		do_edge(tri.z, tri.x);
-		do_vertex(tri.x);
-		do_vertex(tri.y);
-		do_vertex(tri.z);
+	for (uint32_t v = 0; v < V; ++v) {
+		vertex_tri_offsets[v + 1] += vertex_tri_offsets[v];
 	}
-
-
-	//add source and target to the locs lists:
-	auto add_embedded = [&](ak::EmbeddedVertex const &ev) {
-		assert(ev.simplex.x != -1U);
-		if (ev.simplex.y == -1U) {
-			//at a vertex
-			return vertex_locs[ev.simplex.x];
-		} else if (ev.simplex.z == -1U) {
-			//on an edge
-			uint32_t idx = loc_ev.size();
-			loc_ev.emplace_back(ev);
-			loc_pos.emplace_back(loc_ev.back().interpolate(model.vertices));
-
-			loc_tris.emplace_back();
-			auto r = edge_triangles.equal_range(glm::uvec2(ev.simplex));
-			assert(r.first != r.second);
-			for (auto ri = r.first; ri != r.second; ++ri) {
-				uint32_t ti = ri->second;
-				loc_tris.back().emplace_back(ti);
-				tri_adj[ti].emplace_back(idx);
-			}
-
-			return idx;
-		} else {
-			//on a triangle
-			uint32_t idx = loc_ev.size();
-			loc_ev.emplace_back(ev);
-			loc_pos.emplace_back(loc_ev.back().interpolate(model.vertices));
-
-			auto f = simplex_triangle.find(ev.simplex);
-			assert(f != simplex_triangle.end());
-			uint32_t ti = f->second;
-
-			loc_tris.emplace_back();
-			loc_tris.back().emplace_back(ti);
-			tri_adj[ti].emplace_back(idx);
-
-			return idx;
-		}
-	};
-
-	uint32_t source_idx = add_embedded(source);
-	uint32_t target_idx = add_embedded(target);
-
-	/*//DEBUG:
-	std::cout << "Source is loc " << source_idx << " with adj\n";
-	for (auto t : loc_tris[source_idx]) {
-		std::cout << " " << t << ":";
-		for (auto a : tri_adj[t]) {
-			std::cout << " " << a;
+	edge_tris.resize(edge_tri_offsets.back());
+	vertex_tris.resize(vertex_tri_offsets.back());
+	{
+		std::vector< uint32_t > edge_fill(edge_tri_offsets.begin(), edge_tri_offsets.end() - 1);
+		std::vector< uint32_t > vertex_fill(vertex_tri_offsets.begin(), vertex_tri_offsets.end() - 1);
+		for (auto const &tri : model.triangles) {
+			uint32_t ti = &tri - &model.triangles[0];
+			edge_tris[edge_fill[tri_edges[ti].x]++] = ti;
+			edge_tris[edge_fill[tri_edges[ti].y]++] = ti;
+			edge_tris[edge_fill[tri_edges[ti].z]++] = ti;
+			vertex_tris[vertex_fill[tri.x]++] = ti;
+			vertex_tris[vertex_fill[tri.y]++] = ti;
+			vertex_tris[vertex_fill[tri.z]++] = ti;
 		}
-		std::cout << "\n";
 	}
-	std::cout.flush();*/
-
-	//now do actual search:
-
-	std::vector< float > loc_dis(loc_pos.size(), std::numeric_limits< float >::infinity());
-	std::vector< uint32_t > loc_from(loc_pos.size(), -1U);
-
-	glm::vec3 target_pos = target.interpolate(model.vertices);
-
-	std::vector< std::pair< float, std::pair< uint32_t, float > > > todo;
-
-	auto queue = [&](uint32_t at, float distance, uint32_t from) {
-		assert(distance < loc_dis[at]);
-		loc_dis[at] = distance;
-		loc_from[at] = from;
-
-		float heuristic = glm::length(target_pos - loc_pos[at]);
-		todo.emplace_back(std::make_pair(-(heuristic + distance), std::make_pair(at, distance)));
-		std::push_heap(todo.begin(), todo.end());
-	};
-
-	queue(source_idx, 0.0f, -1U);
-	while (!todo.empty()) {
-		std::pop_heap(todo.begin(), todo.end());
-		uint32_t at = todo.back().second.first;
-		float distance = todo.back().second.second;
-		todo.pop_back();
+}
 
-		if (distance > loc_dis[at]) continue;
-		if (at == target_idx) break; //bail out early -- don't need distances to everything.
+void ak::EmbeddedPathEngine::path(
+	ak::EmbeddedVertex const &source,
+	ak::EmbeddedVertex const &target,
+	std::vector< ak::EmbeddedVertex > *path_
+) {
+	path(source, target, path_, &scratch);
+}
 
-		assert(distance == loc_dis[at]);
-		for (auto t : loc_tris[at]) {
-			for (auto n : tri_adj[t]) {
-				if (n == at) continue;
-				float d = distance + glm::length(loc_pos[n] - loc_pos[at]);
-				if (d < loc_dis[n]) queue(n, d, at);
-			}
+void ak::EmbeddedPathEngine::paths(
+	std::vector< std::pair< ak::EmbeddedVertex, ak::EmbeddedVertex > > const &queries,
+	std::vector< std::vector< ak::EmbeddedVertex > > *paths_
+) {
+	assert(paths_);
+	auto &paths = *paths_;
+	paths.assign(queries.size(), std::vector< ak::EmbeddedVertex >());
+
+	//queries are split into contiguous runs, each with its own scratch buffers:
+	uint32_t runs = std::max(1U, std::min< uint32_t >(ak::worker_count(), queries.size()));
+	if (runs == 1) {
+		for (uint32_t q = 0; q < queries.size(); ++q) {
+			path(queries[q].first, queries[q].second, &paths[q], &scratch);
 		}
+		return;
 	}
-
-	//read back path:
-	if (loc_from[target_idx] == -1U) {
-		throw std::runtime_error("embedded_path requested between disconnected vertices");
-	}
-
-	uint32_t at = target_idx;
-	do {
-		path.emplace_back(loc_ev[at]);
-		at = loc_from[at];
-	} while (at != -1U);
-	assert(path.size() >= 2);
-	std::reverse(path.begin(), path.end());
-
-	assert(path[0] == source);
-	assert(path.back() == target);
+	std::vector< Scratch > run_scratch(runs);
+	ak::parallel_for(runs, [&](uint32_t r) {
+		uint32_t begin = uint32_t(uint64_t(queries.size()) * r / runs);
+		uint32_t end = uint32_t(uint64_t(queries.size()) * (r + 1) / runs);
+		for (uint32_t q = begin; q < end; ++q) {
+			path(queries[q].first, queries[q].second, &paths[q], &run_scratch[r]);
+		}
+	});
 }
 
+namespace {
+//twice the signed area of triangle (a,b,c); positive if c is left of a->b:
+float cross2(glm::vec2 const &a, glm::vec2 const &b, glm::vec2 const &c) {
+	return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
+}
 
-void ak::embedded_path(
-	ak::Parameters const &parameters,
-	ak::Model const &model,
+void ak::EmbeddedPathEngine::path(
 	ak::EmbeddedVertex const &source,
 	ak::EmbeddedVertex const &target,
-	std::vector< ak::EmbeddedVertex > *path_ //out: path; path[0] will be source and path.back() will be target
-) {
+	std::vector< ak::EmbeddedVertex > *path_,
+	Scratch *scratch_
+) const {
+	assert(source != target);
 
 	assert(path_);
 	auto &path = *path_;
 	path.clear();
 
-	//first do a vertex-to-vertex distance computation to bound the computation:
-
-	std::vector< std::vector< uint32_t > > adj(model.vertices.size());
-
-	std::unordered_set< glm::uvec2 > edges;
-	for (auto const &tri : model.triangles) {
-		auto do_edge = [&](uint32_t a, uint32_t b) {
-			if (a > b) std::swap(a,b);
-			edges.insert(glm::uvec2(a,b));
-		};
-		do_edge(tri.x, tri.y);
-		do_edge(tri.y, tri.z);
-		do_edge(tri.z, tri.x);
+	assert(scratch_);
+	auto &scratch = *scratch_;
+
+	//(re-)size buffers and start a new query:
+	uint32_t const Target = edges.size() * SamplesPerEdge;
+	if (scratch.node_stamp.size() != Target + 1) {
+		scratch.node_stamp.assign(Target + 1, 0);
+		scratch.node_dis.resize(Target + 1);
+		scratch.node_from.resize(Target + 1);
+		scratch.node_tri.resize(Target + 1);
+		scratch.query = 0;
 	}
-
-	for (auto const &e : edges) {
-		adj[e.x].emplace_back(e.y);
-		adj[e.y].emplace_back(e.x);
+	scratch.query += 1;
+	if (scratch.query == 0) {
+		//stamps wrapped around; clear them:
+		std::fill(scratch.node_stamp.begin(), scratch.node_stamp.end(), 0);
+		scratch.query = 1;
 	}
+	uint32_t const query = scratch.query;
 
-	uint32_t target_idx = target.simplex.x;
-
-	std::vector< float > dis(model.vertices.size(), std::numeric_limits< float >::infinity());
+	glm::vec3 const src = source.interpolate(model.vertices);
+	glm::vec3 const tgt = target.interpolate(model.vertices);
 
-	std::vector< std::pair< float, std::pair< uint32_t, float > > > todo;
-
-	auto queue = [&](uint32_t at, float distance) {
-		assert(distance < dis[at]);
-		dis[at] = distance;
+	//does triangle ti contain embedded vertex ev?
+	auto touches = [&](ak::EmbeddedVertex const &ev, uint32_t ti) {
+		glm::uvec3 const &tri = model.triangles[ti];
+		for (uint32_t i = 0; i < 3; ++i) {
+			if (ev.simplex[i] == -1U) break;
+			if (tri.x != ev.simplex[i] && tri.y != ev.simplex[i] && tri.z != ev.simplex[i]) return false;
+		}
+		return true;
+	};
 
-		float heuristic = glm::length(model.vertices[target_idx] - model.vertices[at]);
-		todo.emplace_back(std::make_pair(-(heuristic + distance), std::make_pair(at, distance)));
+	//(1) find a corridor of triangles from source to target with A* over edge sample points:
+	auto node_point = [&](uint32_t n) {
+		if (n == Target) return tgt;
+		glm::uvec2 const &e = edges[n / SamplesPerEdge];
+		float t = ((n % SamplesPerEdge) + 0.5f) / float(SamplesPerEdge);
+		return glm::mix(model.vertices[e.x], model.vertices[e.y], t);
+	};
+	auto node_dis = [&](uint32_t n) {
+		return (scratch.node_stamp[n] == query ? scratch.node_dis[n] : std::numeric_limits< float >::infinity());
+	};
+	auto &todo = scratch.todo;
+	todo.clear();
+	auto queue = [&](uint32_t n, float distance, uint32_t from, uint32_t tri) {
+		if (!(distance < node_dis(n))) return;
+		scratch.node_stamp[n] = query;
+		scratch.node_dis[n] = distance;
+		scratch.node_from[n] = from;
+		scratch.node_tri[n] = tri;
+
+		float heuristic = glm::length(tgt - node_point(n));
+		todo.emplace_back(std::make_pair(-(heuristic + distance), std::make_pair(n, distance)));
 		std::push_heap(todo.begin(), todo.end());
 	};
+	//cross triangle ti from point 'at' (node 'from') to the sample points on its edges (and the target):
+	auto cross_triangle = [&](uint32_t ti, glm::vec3 const &at, float distance, uint32_t from) {
+		if (touches(target, ti)) {
+			queue(Target, distance + glm::length(tgt - at), from, ti);
+		}
+		glm::uvec3 const &te = tri_edges[ti];
+		for (uint32_t e : {te.x, te.y, te.z}) {
+			for (uint32_t s = 0; s < SamplesPerEdge; ++s) {
+				uint32_t n = e * SamplesPerEdge + s;
+				if (n == from) continue;
+				queue(n, distance + glm::length(node_point(n) - at), from, ti);
+			}
+		}
+	};
 
-	queue(source.simplex.x, glm::length(source.interpolate(model.vertices) - model.vertices[source.simplex.x]));
+	{
+		assert(source.simplex.x != -1U);
+		for (uint32_t i = vertex_tri_offsets[source.simplex.x]; i < vertex_tri_offsets[source.simplex.x + 1]; ++i) {
+			uint32_t ti = vertex_tris[i];
+			if (touches(source, ti)) cross_triangle(ti, src, 0.0f, -1U);
+		}
+	}
 
 	while (!todo.empty()) {
 		std::pop_heap(todo.begin(), todo.end());
@@ -273,113 +207,332 @@ void ak::embedded_path(
 		float distance = todo.back().second.second;
 		todo.pop_back();
 
-		if (distance > dis[at]) continue;
-		assert(distance == dis[at]);
+		if (distance > node_dis(at)) continue;
+		assert(distance == node_dis(at));
 
-		if (at == target_idx) break; //bail out early -- don't need distances to everything.
+		if (at == Target) break;
 
-		for (auto n : adj[at]) {
-			float d = distance + glm::length(model.vertices[n] - model.vertices[at]);
-			if (d < dis[n]) queue(n, d);
+		glm::vec3 const point = node_point(at);
+		uint32_t e = at / SamplesPerEdge;
+		for (uint32_t i = edge_tri_offsets[e]; i < edge_tri_offsets[e+1]; ++i) {
+			uint32_t ti = edge_tris[i];
+			if (ti == scratch.node_tri[at]) continue; //(no reason to go back)
+			cross_triangle(ti, point, distance, at);
 		}
 	}
 
-	//okay, so this is a conservative (long) estimate of path length:
-	float dis2 = dis[target_idx] + glm::length(target.interpolate(model.vertices) - model.vertices[target_idx]);
-	dis2 = dis2*dis2;
+	if (node_dis(Target) == std::numeric_limits< float >::infinity()) {
+		throw std::runtime_error("embedded_path requested between disconnected vertices");
+	}
 
-	//come up with a model containing only triangles that might be used in the path:
+	std::vector< uint32_t > corridor;
+	for (uint32_t n = Target; n != -1U; n = scratch.node_from[n]) {
+		corridor.emplace_back(scratch.node_tri[n]);
+	}
+	std::reverse(corridor.begin(), corridor.end());
 
-	Model trimmed;
-	trimmed.vertices.reserve(model.vertices.size());
-	trimmed.triangles.reserve(model.triangles.size());
+	//(2) unfold the corridor into the plane, recording the (left, right) ends of each portal (shared edge):
+	struct Portal {
+		glm::vec2 left, right;
+		uint32_t left_vertex, right_vertex; //(-1U for source / target)
+	};
+	std::vector< Portal > portals;
+	glm::vec2 src2, tgt2;
+	auto unfold = [&]() {
+		portals.clear();
+		portals.reserve(corridor.size() + 1);
+
+		//place the first triangle:
+		glm::uvec3 tri = model.triangles[corridor[0]];
+		glm::vec3 const &a = model.vertices[tri.x];
+		glm::vec3 const &b = model.vertices[tri.y];
+		glm::vec3 const &c = model.vertices[tri.z];
+		float ab = glm::length(b - a);
+		glm::vec2 pos[3];
+		pos[0] = glm::vec2(0.0f, 0.0f);
+		pos[1] = glm::vec2(ab, 0.0f);
+		{
+			float x = (ab > 0.0f ? glm::dot(c - a, b - a) / ab : 0.0f);
+			float y = std::sqrt(std::max(0.0f, glm::length2(c - a) - x * x));
+			pos[2] = glm::vec2(x, y);
+		}
+		auto place = [&](glm::uvec3 const &t, glm::vec2 const *p, ak::EmbeddedVertex const &ev) {
+			glm::uvec3 simplex = t;
+			glm::vec2 sp[3] = {p[0], p[1], p[2]};
+			//sort (simplex, positions) to match canonical ev:
+			if (simplex.x > simplex.y) { std::swap(simplex.x, simplex.y); std::swap(sp[0], sp[1]); }
+			if (simplex.y > simplex.z) { std::swap(simplex.y, simplex.z); std::swap(sp[1], sp[2]); }
+			if (simplex.x > simplex.y) { std::swap(simplex.x, simplex.y); std::swap(sp[0], sp[1]); }
+			glm::vec3 w = ev.weights_on(simplex);
+			return w.x * sp[0] + w.y * sp[1] + w.z * sp[2];
+		};
+		src2 = place(tri, pos, source);
+
+		//walk the corridor, unfolding each next triangle across the shared edge:
+		portals.emplace_back();
+		portals.back().left = portals.back().right = src2;
+		portals.back().left_vertex = portals.back().right_vertex = -1U;
+		for (uint32_t i = 0; i + 1 < corridor.size(); ++i) {
+			glm::uvec3 const &next = model.triangles[corridor[i+1]];
+			//find shared vertices and the other vertex of 'tri':
+			uint32_t other = -1U;
+			for (uint32_t j = 0; j < 3; ++j) {
+				if (tri[j] != next.x && tri[j] != next.y && tri[j] != next.z) other = j;
+			}
+			assert(other != -1U);
+			uint32_t ia = (other + 1) % 3;
+			uint32_t ib = (other + 2) % 3;
+			//(next's vertex not on the shared edge):
+			uint32_t nc = -1U;
+			for (uint32_t j = 0; j < 3; ++j) {
+				if (next[j] != tri[ia] && next[j] != tri[ib]) nc = j;
+			}
+			assert(nc != -1U);
+
+			glm::vec2 A = pos[ia], B = pos[ib];
+			glm::vec3 const &a3 = model.vertices[tri[ia]];
+			glm::vec3 const &b3 = model.vertices[tri[ib]];
+			glm::vec3 const &c3 = model.vertices[next[nc]];
+			float len = glm::length(B - A);
+			glm::vec2 C;
+			if (len > 0.0f) {
+				glm::vec2 along = (B - A) / len;
+				glm::vec2 perp(-along.y, along.x);
+				float x = glm::dot(c3 - a3, b3 - a3) / glm::length(b3 - a3);
+				float y = std::sqrt(std::max(0.0f, glm::length2(c3 - a3) - x * x));
+				//new triangle goes on the other side of the shared edge from the old one:
+				if (cross2(A, B, pos[other]) > 0.0f) y = -y;
+				C = A + x * along + y * perp;
+			} else {
+				C = A;
+			}
 
-	std::vector< uint32_t > to_trimmed(model.vertices.size(), -1U);
-	std::vector< uint32_t > from_trimmed;
-	from_trimmed.reserve(model.vertices.size());
-	auto vertex_to_trimmed = [&to_trimmed,&from_trimmed,&trimmed,&model](uint32_t v) {
-		if (to_trimmed[v] == -1U) {
-			to_trimmed[v] = trimmed.vertices.size();
-			from_trimmed.emplace_back(v);
-			trimmed.vertices.emplace_back(model.vertices[v]);
+			Portal portal;
+			if (cross2(A, B, C) > 0.0f) {
+				//facing from the old triangle into the new one, A is on the left:
+				portal.left = A; portal.left_vertex = tri[ia];
+				portal.right = B; portal.right_vertex = tri[ib];
+			} else {
+				portal.left = B; portal.left_vertex = tri[ib];
+				portal.right = A; portal.right_vertex = tri[ia];
+			}
+			portals.emplace_back(portal);
+
+			glm::vec2 new_pos[3];
+			for (uint32_t j = 0; j < 3; ++j) {
+				if (next[j] == tri[ia]) new_pos[j] = A;
+				else if (next[j] == tri[ib]) new_pos[j] = B;
+				else new_pos[j] = C;
+			}
+			tri = next;
+			pos[0] = new_pos[0]; pos[1] = new_pos[1]; pos[2] = new_pos[2];
 		}
-		return to_trimmed[v];
+		tgt2 = place(tri, pos, target);
+		portals.emplace_back();
+		portals.back().left = portals.back().right = tgt2;
+		portals.back().left_vertex = portals.back().right_vertex = -1U;
 	};
 
-	{ //keep triangles that are close enough to source and target that the path could possible pass through them:
-		glm::vec3 src = source.interpolate(model.vertices);
-		glm::vec3 tgt = target.interpolate(model.vertices);
-		for (auto const &tri : model.triangles) {
-			glm::vec3 min = glm::min(model.vertices[tri.x], glm::min(model.vertices[tri.y], model.vertices[tri.z]));
-			glm::vec3 max = glm::max(model.vertices[tri.x], glm::max(model.vertices[tri.y], model.vertices[tri.z]));
-
-			float len2_src = glm::length2(glm::max(min, glm::min(max, src)) - src);
-			float len2_tgt = glm::length2(glm::max(min, glm::min(max, tgt)) - tgt);
-			if (len2_src + len2_tgt < dis2) {
-				trimmed.triangles.emplace_back(glm::uvec3(
-					vertex_to_trimmed(tri.x), vertex_to_trimmed(tri.y), vertex_to_trimmed(tri.z)
-				));
+	//(3) string-pull through the portals (the "simple stupid funnel algorithm"):
+	struct Corner {
+		glm::vec2 at;
+		uint32_t vertex; //(-1U for source / target)
+		uint32_t portal; //portal on which the corner lies
+	};
+	std::vector< Corner > corners;
+	//returns path length:
+	auto pull = [&]() {
+		corners.clear();
+		glm::vec2 apex = portals[0].left;
+		glm::vec2 left = portals[0].left;
+		glm::vec2 right = portals[0].right;
+		uint32_t apex_index = 0, left_index = 0, right_index = 0;
+		corners.push_back(Corner{apex, -1U, 0});
+
+		for (uint32_t i = 1; i < portals.size(); ++i) {
+			glm::vec2 const &l = portals[i].left;
+			glm::vec2 const &r = portals[i].right;
+
+			//try to narrow the right side:
+			if (cross2(apex, right, r) >= 0.0f) {
+				if (apex == right || cross2(apex, left, r) < 0.0f) {
+					right = r;
+					right_index = i;
+				} else {
+					//right crossed over left; left is a corner:
+					corners.push_back(Corner{left, portals[left_index].left_vertex, left_index});
+					apex = left;
+					apex_index = left_index;
+					left = right = apex;
+					left_index = right_index = apex_index;
+					i = apex_index;
+					continue;
+				}
+			}
+
+			//try to narrow the left side:
+			if (cross2(apex, left, l) <= 0.0f) {
+				if (apex == left || cross2(apex, right, l) > 0.0f) {
+					left = l;
+					left_index = i;
+				} else {
+					//left crossed over right; right is a corner:
+					corners.push_back(Corner{right, portals[right_index].right_vertex, right_index});
+					apex = right;
+					apex_index = right_index;
+					left = right = apex;
+					left_index = right_index = apex_index;
+					i = apex_index;
+					continue;
+				}
 			}
 		}
-	}
+		corners.push_back(Corner{tgt2, -1U, uint32_t(portals.size() - 1)});
 
-	ak::EmbeddedVertex trimmed_source = source;
-		
-	trimmed_source.simplex.x = vertex_to_trimmed(trimmed_source.simplex.x);
-	if (trimmed_source.simplex.y != -1U) trimmed_source.simplex.y = vertex_to_trimmed(trimmed_source.simplex.y);
-	if (trimmed_source.simplex.z != -1U) trimmed_source.simplex.z = vertex_to_trimmed(trimmed_source.simplex.z);
-	trimmed_source = ak::EmbeddedVertex::canonicalize(trimmed_source.simplex, trimmed_source.weights);
-
-	ak::EmbeddedVertex trimmed_target = target;
-	trimmed_target.simplex.x = vertex_to_trimmed(trimmed_target.simplex.x);
-	if (trimmed_target.simplex.y != -1U) trimmed_target.simplex.y = vertex_to_trimmed(trimmed_target.simplex.y);
-	if (trimmed_target.simplex.z != -1U) trimmed_target.simplex.z = vertex_to_trimmed(trimmed_target.simplex.z);
-	trimmed_target = ak::EmbeddedVertex::canonicalize(trimmed_target.simplex, trimmed_target.weights);
-
-	assert(from_trimmed.size() == trimmed.vertices.size());
-
-	/*//DEBUG:
-	std::cout << "Trimmed has " << trimmed.vertices.size() << " verts and " << trimmed.triangles.size() << " tris." << std::endl;
-
-	std::cout << "source on: " << (int)source.simplex.x << ", " << (int)source.simplex.y << ", " << (int)source.simplex.z << std::endl;
-	std::cout << "trimmed_source on: " << (int)trimmed_source.simplex.x << ", " << (int)trimmed_source.simplex.y << ", " << (int)trimmed_source.simplex.z << std::endl;
-	std::cout << "target on: " << (int)target.simplex.x << ", " << (int)target.simplex.y << ", " << (int)target.simplex.z << std::endl;
-	std::cout << "trimmed_target on: " << (int)trimmed_target.simplex.x << ", " << (int)trimmed_target.simplex.y << ", " << (int)trimmed_target.simplex.z << std::endl;
-
-	//PARANOIA:
-	bool found_source = false;
-	bool found_target = false;
-	for (auto simplex : trimmed.triangles) {
-		if (simplex.x > simplex.y) std::swap(simplex.x, simplex.y);
-		if (simplex.y > simplex.z) std::swap(simplex.y, simplex.z);
-		if (simplex.x > simplex.y) std::swap(simplex.x, simplex.y);
-
-		if (simplex == trimmed_source.simplex) found_source = true;
-		if (simplex == trimmed_target.simplex) found_target = true;
-		simplex.z = -1U;
-		if (simplex == trimmed_source.simplex) found_source = true;
-		if (simplex == trimmed_target.simplex) found_target = true;
-		simplex.y = -1U;
-		if (simplex == trimmed_source.simplex) found_source = true;
-		if (simplex == trimmed_target.simplex) found_target = true;
+		float length = 0.0f;
+		for (uint32_t c = 0; c + 1 < corners.size(); ++c) {
+			length += glm::length(corners[c+1].at - corners[c].at);
+		}
+		return length;
+	};
+
+	unfold();
+	float length = pull();
+
+	//(3b) the corridor was picked with sampled distances, so the path may wrap around a vertex on the longer side;
+	// re-route the corridor around the other side of such vertices while that makes the path shorter:
+	for (uint32_t iter = 0; iter < 4 * corridor.size() + 10; ++iter) {
+		bool improved = false;
+		for (uint32_t c = 1; c + 1 < corners.size(); ++c) {
+			uint32_t v = corners[c].vertex;
+			if (v == -1U) continue; //(corner at source or target)
+			auto has_v = [&](uint32_t ti) {
+				glm::uvec3 const &tri = model.triangles[ti];
+				return tri.x == v || tri.y == v || tri.z == v;
+			};
+			//the run of corridor triangles around v:
+			uint32_t begin = corners[c].portal;
+			assert(begin > 0 && begin < corridor.size());
+			assert(has_v(corridor[begin-1]) && has_v(corridor[begin]));
+			begin -= 1;
+			while (begin > 0 && has_v(corridor[begin-1])) --begin;
+			uint32_t end = corners[c].portal + 1;
+			while (end < corridor.size() && has_v(corridor[end])) ++end;
+
+			//walk around v the other way, from corridor[begin] to corridor[end-1]:
+			std::vector< uint32_t > around;
+			around.emplace_back(corridor[begin]);
+			uint32_t through = -1U; //edge to stay away from
+			{
+				glm::uvec3 const &te = tri_edges[corridor[begin]];
+				for (uint32_t e : {te.x, te.y, te.z}) {
+					for (uint32_t i = edge_tri_offsets[e]; i < edge_tri_offsets[e+1]; ++i) {
+						if (edge_tris[i] == corridor[begin+1]) through = e;
+					}
+				}
+			}
+			assert(through != -1U);
+			bool ok = true;
+			while (ok) {
+				uint32_t at = around.back();
+				if (at == corridor[end-1] && around.size() > 1) break;
+				//leave through the other edge touching v:
+				uint32_t exit = -1U;
+				glm::uvec3 const &te = tri_edges[at];
+				for (uint32_t e : {te.x, te.y, te.z}) {
+					if (e != through && (edges[e].x == v || edges[e].y == v)) exit = e;
+				}
+				assert(exit != -1U);
+				if (edge_tri_offsets[exit+1] - edge_tri_offsets[exit] != 2) {
+					ok = false; //boundary (or non-manifold) edge, can't go this way
+					break;
+				}
+				uint32_t next = edge_tris[edge_tri_offsets[exit]];
+				if (next == at) next = edge_tris[edge_tri_offsets[exit] + 1];
+				around.emplace_back(next);
+				through = exit;
+				if (around.size() > vertex_tri_offsets[v+1] - vertex_tri_offsets[v] + 1) ok = false;
+			}
+			if (!ok) continue;
+
+			std::vector< uint32_t > old_corridor = corridor;
+			corridor.erase(corridor.begin() + begin, corridor.begin() + end);
+			corridor.insert(corridor.begin() + begin, around.begin(), around.end());
+
+			std::vector< Portal > old_portals = portals;
+			std::vector< Corner > old_corners = corners;
+			glm::vec2 old_src2 = src2, old_tgt2 = tgt2;
+			unfold();
+			float new_length = pull();
+			if (new_length < length * (1.0f - 1e-5f)) {
+				length = new_length;
+				improved = true;
+				break;
+			} else {
+				corridor = std::move(old_corridor);
+				portals = std::move(old_portals);
+				corners = std::move(old_corners);
+				src2 = old_src2;
+				tgt2 = old_tgt2;
+			}
+		}
+		if (!improved) break;
 	}
-	assert(found_source);
-	assert(found_target);
-	*/
-
-
-	embedded_path_simple(
-		parameters,
-		trimmed,
-		trimmed_source,
-		trimmed_target,
-		&path);
-
-	for (auto &v : path) {
-		v.simplex.x = from_trimmed[v.simplex.x];
-		if (v.simplex.y != -1U) v.simplex.y = from_trimmed[v.simplex.y];
-		if (v.simplex.z != -1U) v.simplex.z = from_trimmed[v.simplex.z];
-		v = ak::EmbeddedVertex::canonicalize(v.simplex, v.weights);
+
+	//(4) path is source, the crossing of each portal, then target:
+	auto append = [&path](ak::EmbeddedVertex const &ev) {
+		if (path.empty() || path.back() != ev) path.emplace_back(ev);
+	};
+	append(source);
+	{
+		uint32_t c = 0;
+		for (uint32_t i = 1; i + 1 < portals.size(); ++i) {
+			while (c + 1 < corners.size() && corners[c + 1].portal <= i) ++c;
+			Portal const &portal = portals[i];
+			if (corners[c].portal == i && corners[c].vertex != -1U) {
+				//path passes through a corner on this portal:
+				append(ak::EmbeddedVertex::on_vertex(corners[c].vertex));
+				continue;
+			}
+			assert(c + 1 < corners.size());
+			//portals touching the path's corners are crossed at the corner:
+			uint32_t snap = -1U;
+			for (uint32_t v : {corners[c].vertex, corners[c+1].vertex}) {
+				if (v != -1U && (v == portal.left_vertex || v == portal.right_vertex)) snap = v;
+			}
+			if (snap != -1U) {
+				append(ak::EmbeddedVertex::on_vertex(snap));
+				continue;
+			}
+			glm::vec2 const &p0 = corners[c].at;
+			glm::vec2 const &p1 = corners[c+1].at;
+			//where does segment p0-p1 cross the portal's line?
+			float den = cross2(glm::vec2(0.0f), portal.right - portal.left, p1 - p0);
+			float t = (den != 0.0f ? cross2(glm::vec2(0.0f), p0 - portal.left, p1 - p0) / den : 0.5f);
+			t = std::max(0.0f, std::min(1.0f, t));
+			if (t == 0.0f) {
+				append(ak::EmbeddedVertex::on_vertex(portal.left_vertex));
+			} else if (t == 1.0f) {
+				append(ak::EmbeddedVertex::on_vertex(portal.right_vertex));
+			} else {
+				append(ak::EmbeddedVertex::on_edge(portal.left_vertex, portal.right_vertex, t));
+			}
+		}
 	}
+	if (path.back() == target) path.pop_back(); //(can happen if target is at a vertex)
+	path.emplace_back(target);
+
+	assert(path.size() >= 2);
+	assert(path[0] == source);
+	assert(path.back() == target);
+}
 
+void ak::embedded_path(
+	ak::Model const &model,
+	ak::EmbeddedVertex const &source,
+	ak::EmbeddedVertex const &target,
+	std::vector< ak::EmbeddedVertex > *path //out: path; path[0] will be source and path.back() will be target
+) {
+	ak::EmbeddedPathEngine engine(model);
+	engine.path(source, target, path);
 }
@@ -1,8 +1,10 @@
 #include "pipeline.hpp"
+#include "parallel.hpp"
+#include "log.hpp"
 
 #include <unordered_map>
-#include <iostream>
 #include <deque>
+#include <algorithm>
 
 #include <glm/gtx/hash.hpp>
 
@@ -123,5 +125,207 @@ void ak::extract_level_chains(
 		}
 	}
 
-	std::cout << "extract_level_chains found " << found_loops << " loops and " << found_chains << " chains." << std::endl;
+	LOG(Info, Peel) << "extract_level_chains found " << found_loops << " loops and " << found_chains << " chains.";
+}
+
+void ak::extract_level_chains(
+	ak::Model const &model, //in: model on which to embed vertices
+	std::vector< float > const &values, //in: values at vertices
+	std::vector< float > const &levels, //in: levels at which to extract chains (sorted, increasing)
+	std::vector< std::vector< std::vector< ak::EmbeddedVertex > > > *chains_ //out: chains at each level
+) {
+	assert(chains_);
+	auto &chains = *chains_;
+	chains.clear();
+	chains.resize(levels.size());
+
+	//PARANOIA:
+	for (uint32_t l = 1; l < levels.size(); ++l) {
+		assert(levels[l-1] < levels[l]);
+	}
+	assert(values.size() == model.vertices.size());
+
+	std::vector< glm::uvec3 > const &tris = model.triangles;
+
+	//levels crossed going from value 'lo' up to value 'hi' are [first_above(lo), first_above(hi))
+	// (as above, level is treated as "level + epsilon"):
+	auto first_above = [&levels](float v) -> uint32_t {
+		return std::upper_bound(levels.begin(), levels.end(), v) - levels.begin();
+	};
+
+	//number edges, as CSR from lower vertex index:
+	std::vector< uint32_t > edge_offsets(model.vertices.size() + 1, 0);
+	std::vector< uint32_t > edge_others;
+	{
+		std::vector< glm::uvec2 > edges;
+		edges.reserve(tris.size() * 3);
+		for (auto const &tri : tris) {
+			edges.emplace_back(std::min(tri.x, tri.y), std::max(tri.x, tri.y));
+			edges.emplace_back(std::min(tri.y, tri.z), std::max(tri.y, tri.z));
+			edges.emplace_back(std::min(tri.z, tri.x), std::max(tri.z, tri.x));
+		}
+		std::sort(edges.begin(), edges.end(), [](glm::uvec2 const &a, glm::uvec2 const &b) {
+			if (a.x != b.x) return a.x < b.x;
+			return a.y < b.y;
+		});
+		edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+		edge_others.reserve(edges.size());
+		for (auto const &e : edges) {
+			edge_offsets[e.x + 1] += 1;
+			edge_others.emplace_back(e.y);
+		}
+		for (uint32_t v = 0; v < model.vertices.size(); ++v) {
+			edge_offsets[v + 1] += edge_offsets[v];
+		}
+	}
+	auto edge_id = [&](uint32_t a, uint32_t b) -> uint32_t {
+		if (a > b) std::swap(a,b);
+		auto begin = edge_others.begin() + edge_offsets[a];
+		auto end = edge_others.begin() + edge_offsets[a+1];
+		auto f = std::lower_bound(begin, end, b);
+		assert(f != end && *f == b);
+		return f - edge_others.begin();
+	};
+
+	//each edge gets one point per level it crosses; points are numbered by edge, then level:
+	std::vector< uint32_t > edge_first_level(edge_others.size());
+	std::vector< uint32_t > point_offsets(edge_others.size() + 1, 0);
+	for (uint32_t a = 0; a < model.vertices.size(); ++a) {
+		for (uint32_t e = edge_offsets[a]; e < edge_offsets[a+1]; ++e) {
+			uint32_t b = edge_others[e];
+			float lo = std::min(values[a], values[b]);
+			float hi = std::max(values[a], values[b]);
+			edge_first_level[e] = first_above(lo);
+			point_offsets[e + 1] = first_above(hi) - edge_first_level[e];
+		}
+	}
+	for (uint32_t e = 0; e < edge_others.size(); ++e) {
+		point_offsets[e + 1] += point_offsets[e];
+	}
+	uint32_t const point_count = point_offsets.back();
+
+	//point on edge (a,b) [values[a] < level <= values[b]] at level index l:
+	auto point = [&](uint32_t a, uint32_t b, uint32_t l) {
+		assert(values[a] < levels[l] && values[b] >= levels[l]);
+		uint32_t e = edge_id(a,b);
+		assert(l >= edge_first_level[e] && l - edge_first_level[e] < point_offsets[e+1] - point_offsets[e]);
+		return point_offsets[e] + (l - edge_first_level[e]);
+	};
+
+	//links between points (each point has at most one link out and one link in):
+	std::vector< uint32_t > next(point_count, -1U);
+	std::vector< uint32_t > prev(point_count, -1U);
+	auto link = [&next, &prev](uint32_t f, uint32_t t) {
+		assert(next[f] == -1U);
+		next[f] = t;
+		assert(prev[t] == -1U);
+		prev[t] = f;
+	};
+
+	//sweep triangles (in parallel blocks; every link slot is written by exactly one triangle):
+	uint32_t const blocks = std::max(1U, std::min(ak::worker_count(), uint32_t(tris.size() / 1024)));
+	ak::parallel_for(blocks, [&](uint32_t block) {
+		uint32_t begin = uint32_t(uint64_t(tris.size()) * block / blocks);
+		uint32_t end = uint32_t(uint64_t(tris.size()) * (block + 1) / blocks);
+		for (uint32_t ti = begin; ti < end; ++ti) {
+			uint32_t a = tris[ti].x;
+			uint32_t b = tris[ti].y;
+			uint32_t c = tris[ti].z;
+			//spin triangle until 'a' is the minimum distance value:
+			for (uint32_t i = 0; i < 3; ++i) {
+				if (values[a] <= values[b] && values[a] <= values[c]) break;
+				uint32_t t = a; a = b; b = c; c = t;
+			}
+			//crossed levels are those above a and at or below the max of b,c:
+			uint32_t l_begin = first_above(values[a]);
+			uint32_t l_mid = first_above(std::min(values[b], values[c]));
+			uint32_t l_end = first_above(std::max(values[b], values[c]));
+			//(see single-level version for orientation cases)
+			for (uint32_t l = l_begin; l < l_mid; ++l) {
+				//edge is from ca to ab
+				link(point(a,c,l), point(a,b,l));
+			}
+			for (uint32_t l = l_mid; l < l_end; ++l) {
+				if (values[b] >= levels[l]) {
+					//edge is from bc to ab
+					link(point(c,b,l), point(a,b,l));
+				} else {
+					//edge is from ca to bc
+					link(point(a,c,l), point(b,c,l));
+				}
+			}
+		}
+	});
+
+	//bucket points by level (keeping edge order within each level):
+	std::vector< uint32_t > level_offsets(levels.size() + 1, 0);
+	for (uint32_t e = 0; e < edge_others.size(); ++e) {
+		for (uint32_t l = edge_first_level[e]; l < edge_first_level[e] + (point_offsets[e+1] - point_offsets[e]); ++l) {
+			level_offsets[l + 1] += 1;
+		}
+	}
+	for (uint32_t l = 0; l < levels.size(); ++l) {
+		level_offsets[l + 1] += level_offsets[l];
+	}
+	std::vector< uint32_t > level_points(point_count);
+	std::vector< EmbeddedVertex > embedded_pts(point_count);
+	{
+		std::vector< uint32_t > fill(level_offsets.begin(), level_offsets.end() - 1);
+		for (uint32_t a = 0; a < model.vertices.size(); ++a) {
+			for (uint32_t e = edge_offsets[a]; e < edge_offsets[a+1]; ++e) {
+				uint32_t lo = a;
+				uint32_t hi = edge_others[e];
+				if (values[lo] > values[hi]) std::swap(lo, hi);
+				for (uint32_t p = point_offsets[e]; p < point_offsets[e+1]; ++p) {
+					uint32_t l = edge_first_level[e] + (p - point_offsets[e]);
+					level_points[fill[l]++] = p;
+					float mix = (levels[l] - values[lo]) / (values[hi] - values[lo]);
+					embedded_pts[p] = EmbeddedVertex::on_edge(lo, hi, mix);
+				}
+			}
+		}
+	}
+
+	//read back chains for each level in parallel:
+	std::vector< uint32_t > found_chains(levels.size(), 0);
+	std::vector< uint32_t > found_loops(levels.size(), 0);
+	std::vector< uint8_t > visited(point_count, 0);
+	ak::parallel_for(levels.size(), [&](uint32_t l) {
+		for (uint32_t i = level_offsets[l]; i < level_offsets[l+1]; ++i) {
+			uint32_t seed = level_points[i];
+			if (visited[seed]) continue;
+			//walk back to start of chain (or all the way around a loop):
+			uint32_t start = seed;
+			while (prev[start] != -1U && prev[start] != seed) {
+				start = prev[start];
+			}
+			bool loop = (prev[start] == seed);
+			if (loop) start = seed;
+
+			chains[l].emplace_back();
+			auto &chain = chains[l].back();
+			uint32_t p = start;
+			do {
+				assert(!visited[p]);
+				visited[p] = 1;
+				chain.emplace_back(embedded_pts[p]);
+				p = next[p];
+			} while (p != -1U && p != start);
+			if (loop) {
+				chain.emplace_back(embedded_pts[start]);
+				++found_loops[l];
+			} else {
+				++found_chains[l];
+			}
+			assert(chain.size() >= 2);
+		}
+	});
+
+	uint32_t total_loops = 0;
+	uint32_t total_chains = 0;
+	for (uint32_t l = 0; l < levels.size(); ++l) {
+		total_loops += found_loops[l];
+		total_chains += found_chains[l];
+	}
+	LOG(Info, Peel) << "extract_level_chains found " << total_loops << " loops and " << total_chains << " chains over " << levels.size() << " levels.";
 }
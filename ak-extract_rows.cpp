@@ -0,0 +1,327 @@
+#include "pipeline.hpp"
+#include "parallel.hpp"
+#include "log.hpp"
+
+#include <glm/gtx/norm.hpp>
+
+#include <algorithm>
+
+//Row extraction engine: instead of peeling one slice at a time, pull out every
+// row at once as an isoline of the time field.
+//Row times are spaced so that rows are (on average) one row height apart on the
+// surface: the spacing comes from the time field's gradient, integrated over time.
+//Rows are then linked with link_chains/build_next_active_chains, exactly as peeling
+// would link them, for as long as every row is a set of loops that links to the row
+// before; at the first row where that isn't true, the caller goes back to peeling
+// (which handles boundaries and ends properly) and tries again after each round,
+// so only the region around the inconsistent rows is peeled.
+
+namespace {
+
+//times at which the time field's isolines are 'row_height' apart (on average), starting at 'begin':
+void row_times(
+	ak::Model const &model,
+	std::vector< float > const &times,
+	float begin,
+	float row_height,
+	std::vector< float > *levels_
+) {
+	assert(levels_);
+	auto &levels = *levels_;
+	levels.clear();
+
+	float end = begin;
+	for (auto t : times) {
+		end = std::max(end, t);
+	}
+	if (!(end > begin)) return;
+
+	//surface distance per unit time is 1/|grad t|, averaged over isoline length;
+	// by the coarea formula, a triangle spanning [lo,hi] carries isolines of total
+	// length area*|grad t| over that range, so in each time bin:
+	//   distance / time = sum(area) / sum(area * |grad t|)
+	uint32_t const bins = std::max(16U, std::min(4096U, uint32_t(model.triangles.size() / 4)));
+	float const bin_width = (end - begin) / bins;
+	std::vector< double > area(bins, 0.0);
+	std::vector< double > area_gradient(bins, 0.0);
+	for (auto const &tri : model.triangles) {
+		glm::vec3 const &a = model.vertices[tri.x];
+		glm::vec3 const &b = model.vertices[tri.y];
+		glm::vec3 const &c = model.vertices[tri.z];
+		float ta = times[tri.x];
+		float tb = times[tri.y];
+		float tc = times[tri.z];
+		float lo = std::min(ta, std::min(tb, tc));
+		float hi = std::max(ta, std::max(tb, tc));
+		if (!(hi > lo) || hi <= begin) continue;
+
+		glm::vec3 e1 = b - a;
+		glm::vec3 e2 = c - a;
+		glm::vec3 n = glm::cross(e1, e2);
+		float len2 = glm::length2(n);
+		if (len2 == 0.0f) continue;
+		glm::vec3 gradient = ((tb - ta) * glm::cross(e2, n) + (tc - ta) * glm::cross(n, e1)) / len2;
+		double tri_area = 0.5 * std::sqrt(len2);
+		double tri_gradient = glm::length(gradient);
+
+		//spread over the bins the triangle spans (in proportion to overlap):
+		uint32_t first = uint32_t(std::max(0.0f, (lo - begin) / bin_width));
+		uint32_t last = std::min(bins - 1, uint32_t((hi - begin) / bin_width));
+		for (uint32_t i = first; i <= last; ++i) {
+			float bin_lo = begin + i * bin_width;
+			float overlap = std::min(hi, bin_lo + bin_width) - std::max(lo, bin_lo);
+			if (overlap <= 0.0f) continue;
+			double f = overlap / (hi - lo);
+			area[i] += f * tri_area;
+			area_gradient[i] += f * tri_area * tri_gradient;
+		}
+	}
+
+	//walk up the bins, placing a row every row_height of accumulated distance:
+	double distance = 0.0;
+	double next = row_height;
+	for (uint32_t i = 0; i < bins; ++i) {
+		if (area_gradient[i] == 0.0) continue; //no isolines here
+		double step = bin_width * area[i] / area_gradient[i];
+		while (distance + step >= next) {
+			float t = begin + (i + float((next - distance) / step)) * bin_width;
+			if (t >= end) return; //(an isoline at the very top is degenerate)
+			levels.emplace_back(t);
+			next += row_height;
+		}
+		distance += step;
+	}
+}
+
+} //namespace
+
+uint32_t ak::extract_rows(
+	ak::Parameters const &parameters,
+	ak::Model const &model,
+	std::vector< float > const &times,
+	std::vector< std::vector< ak::EmbeddedVertex > > *active_chains_,
+	std::vector< std::vector< ak::Stitch > > *active_stitches_,
+	ak::RowColGraph *graph_
+) {
+	assert(times.size() == model.vertices.size());
+
+	assert(active_chains_);
+	auto &active_chains = *active_chains_;
+
+	assert(active_stitches_);
+	auto &active_stitches = *active_stitches_;
+	assert(active_stitches.size() == active_chains.size());
+
+	assert(graph_);
+	auto &graph = *graph_;
+
+	if (active_chains.empty()) return 0;
+	for (auto const &chain : active_chains) {
+		if (chain[0] != chain.back()) {
+			LOG(Debug, Peel) << "Row extraction only handles loops; leaving active chains for peeling.";
+			return 0;
+		}
+	}
+
+	//rows start above the highest point of the active chains:
+	float lowest = std::numeric_limits< float >::infinity();
+	float begin = -std::numeric_limits< float >::infinity();
+	for (auto const &chain : active_chains) {
+		for (auto const &ev : chain) {
+			float t = ev.interpolate(times);
+			lowest = std::min(lowest, t);
+			begin = std::max(begin, t);
+		}
+	}
+
+	float const row_height = 2.0f * parameters.stitch_height_mm / parameters.model_units_mm;
+	std::vector< float > levels;
+	row_times(model, times, begin, row_height, &levels);
+	if (levels.empty()) return 0;
+
+	//the first row is a row height above the active chains' highest point, so if the chains aren't
+	// close to an isoline (e.g., they came from peeling around a split), parts of that row would be much taller:
+	if (begin - lowest > 0.5f * (levels[0] - begin)) {
+		LOG(Debug, Peel) << "Active chains span " << (begin - lowest) << " in time, too much to start rows " << (levels[0] - begin) << " apart; leaving them for peeling.";
+		return 0;
+	}
+
+	//check the first row before extracting all of them (the caller tries this after every round of peeling):
+	{
+		std::vector< std::vector< EmbeddedVertex > > first;
+		ak::extract_level_chains(model, times, levels[0], &first);
+		bool loops = !first.empty();
+		for (auto const &chain : first) {
+			if (chain.size() < 2 || chain[0] != chain.back()) loops = false;
+		}
+		if (!loops) {
+			LOG(Debug, Peel) << "First row above active chains isn't made of loops; leaving active chains for peeling.";
+			return 0;
+		}
+	}
+	LOG(Info, Peel) << "Time field above active chains holds " << levels.size() << " rows.";
+
+	//extract all row isolines in one sweep:
+	//(all rows are kept until used, so they are stored compactly -- level chain points come from on_edge, so this is exact)
+	EmbeddedVertexCodec codec(model);
+	std::vector< std::vector< std::vector< CompactEmbeddedVertex > > > level_chains;
+	{
+		std::vector< std::vector< std::vector< EmbeddedVertex > > > extracted;
+		ak::extract_level_chains(model, times, levels, &extracted);
+		level_chains.resize(extracted.size());
+		ak::parallel_for(extracted.size(), [&](uint32_t l) {
+			level_chains[l].resize(extracted[l].size());
+			for (uint32_t c = 0; c < extracted[l].size(); ++c) {
+				codec.pack(extracted[l][c], &level_chains[l][c]);
+			}
+			extracted[l].clear();
+			extracted[l].shrink_to_fit();
+		});
+	}
+
+	//Rows are linked in batches. The slice between each pair of rows only depends on the rows themselves,
+	// so a batch's rows are sampled and its slices trimmed in parallel. Linking has to go in order,
+	// since the stitches link_chains places on a row depend on the stitches of the row below; but it
+	// only touches the stitches, so is much cheaper than trimming.
+	//Between rows, stitches are kept on the (sampled) row chains, as placed by link_chains -- which
+	// are the same chains the next slice starts from -- rather than on build_next_active_chains's output
+	// (which starts at a stitch and includes the stitch points); only the first slice of a call starts
+	// from active_chains.
+	uint32_t const batch = std::max(4U, ak::worker_count());
+
+	struct Band {
+		ak::Model slice;
+		std::vector< ak::EmbeddedVertex > slice_on_model;
+		std::vector< std::vector< uint32_t > > slice_active_chains;
+		std::vector< std::vector< uint32_t > > slice_next_chains;
+		std::vector< float > slice_times;
+		bool consistent = false; //chains made it through trimming one-to-one
+	};
+
+	std::vector< std::vector< EmbeddedVertex > > lower_chains = active_chains; //chains at the bottom of the next slice
+	std::vector< std::vector< Stitch > > lower_stitches = active_stitches; //stitches on lower_chains
+
+	uint32_t extracted = 0;
+	bool stopped = false;
+	while (extracted < levels.size() && !stopped) {
+		uint32_t count = std::min(batch, uint32_t(levels.size()) - extracted);
+
+		//sample the next batch of rows in parallel:
+		std::vector< std::vector< std::vector< EmbeddedVertex > > > row_chains(count);
+		ak::parallel_for(count, [&](uint32_t i) {
+			auto const &chains = level_chains[extracted + i];
+			row_chains[i].reserve(chains.size());
+			std::vector< EmbeddedVertex > chain;
+			for (auto const &compact : chains) {
+				codec.unpack(compact, &chain);
+				row_chains[i].emplace_back();
+				ak::sample_chain(parameters.get_chain_sample_spacing(), model, chain, &row_chains[i].back());
+			}
+		});
+
+		//rows that touch the boundary need peel_slice's boundary handling, so the batch ends before the first such row:
+		for (uint32_t i = 0; i < count; ++i) {
+			bool loops = !row_chains[i].empty();
+			for (auto const &chain : row_chains[i]) {
+				if (chain.size() < 2 || chain[0] != chain.back()) loops = false;
+			}
+			if (!loops) {
+				count = i;
+				stopped = true;
+				break;
+			}
+		}
+
+		//trim the slices below each row in parallel:
+		std::vector< Band > bands(count);
+		ak::parallel_for(count, [&](uint32_t i) {
+			Band &band = bands[i];
+			auto const &below = (i == 0 ? lower_chains : row_chains[i-1]);
+			ak::trim_model(model, below, row_chains[i], &band.slice, &band.slice_on_model, &band.slice_active_chains, &band.slice_next_chains);
+			//trimming can combine vertices; remove repeats:
+			for (auto &chain : band.slice_active_chains) {
+				chain.erase(std::unique(chain.begin(), chain.end()), chain.end());
+			}
+			for (auto &chain : band.slice_next_chains) {
+				chain.erase(std::unique(chain.begin(), chain.end()), chain.end());
+			}
+			band.consistent = (band.slice_active_chains.size() == below.size()
+			                && band.slice_next_chains.size() == row_chains[i].size());
+			if (band.consistent) {
+				ak::interpolate_batch(band.slice_on_model, times, &band.slice_times);
+			}
+		});
+
+		//link rows in order:
+		for (uint32_t i = 0; i < count && !stopped; ++i) {
+			Band &band = bands[i];
+			if (!band.consistent) {
+				stopped = true;
+				break;
+			}
+
+			std::vector< bool > used_boundary(band.slice_next_chains.size(), false);
+			std::vector< std::vector< ak::Stitch > > next_stitches;
+			std::vector< ak::Link > links;
+			ak::link_chains(parameters, band.slice, band.slice_times, band.slice_active_chains, lower_stitches, band.slice_next_chains, used_boundary, &next_stitches, &links);
+
+			//every chain must link to the row before/after (otherwise a row started or ended; leave that to peeling):
+			std::vector< bool > active_linked(band.slice_active_chains.size(), false);
+			std::vector< bool > next_linked(band.slice_next_chains.size(), false);
+			for (auto const &l : links) {
+				active_linked[l.from_chain] = true;
+				next_linked[l.to_chain] = true;
+			}
+			if (std::find(active_linked.begin(), active_linked.end(), false) != active_linked.end()
+			 || std::find(next_linked.begin(), next_linked.end(), false) != next_linked.end()) {
+				stopped = true;
+				break;
+			}
+
+			uint32_t base = graph.size();
+			std::vector< std::vector< ak::EmbeddedVertex > > next_active_chains;
+			std::vector< std::vector< ak::Stitch > > next_active_stitches;
+			ak::build_next_active_chains(band.slice, band.slice_on_model, codec, band.slice_active_chains, lower_stitches, band.slice_next_chains, next_stitches, used_boundary, links, &next_active_chains, &next_active_stitches, &graph);
+			active_chains = std::move(next_active_chains);
+			active_stitches = std::move(next_active_stitches);
+			++extracted;
+
+			//move the stitches that survived onto the row's chain for the next slice:
+			//(build_next_active_chains adds a graph vertex for each non-discard next stitch, in chain order)
+			uint32_t kept = 0;
+			std::vector< ak::Stitch::Flag > flags(graph.size() - base, ak::Stitch::FlagDiscard);
+			for (auto const &stitches : active_stitches) {
+				for (auto const &s : stitches) {
+					assert(s.vertex != -1U && s.vertex < graph.size());
+					if (s.vertex >= base) flags[s.vertex - base] = s.flag;
+					++kept;
+				}
+			}
+			lower_chains = std::move(row_chains[i]);
+			lower_stitches.assign(next_stitches.size(), std::vector< ak::Stitch >());
+			uint32_t vertex = base;
+			for (uint32_t c = 0; c < next_stitches.size(); ++c) {
+				for (auto const &s : next_stitches[c]) {
+					if (s.flag == ak::Stitch::FlagDiscard) continue;
+					if (vertex < graph.size() && flags[vertex - base] != ak::Stitch::FlagDiscard) {
+						lower_stitches[c].emplace_back(s.t, flags[vertex - base], vertex);
+						--kept;
+					}
+					++vertex;
+				}
+			}
+			//if the new active chains aren't just the row's chains (e.g., they kept part of the row below), the next
+			// slice has to start from them, so the rest of the batch is trimmed again:
+			if (vertex != graph.size() || kept != 0) {
+				lower_chains = active_chains;
+				lower_stitches = active_stitches;
+				break;
+			}
+		}
+	}
+
+	LOG(Info, Peel) << "Extracted " << extracted << " of " << levels.size() << " rows from the time field"
+		<< (extracted < levels.size() ? " (the next row isn't linked loops; peeling from there)" : "") << ".";
+
+	return extracted;
+}
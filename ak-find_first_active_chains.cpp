@@ -1,4 +1,5 @@
 #include "pipeline.hpp"
+#include "log.hpp"
 
 #include <unordered_map>
 #include <iostream>
@@ -30,6 +31,9 @@ void ak::find_first_active_chains(
 	}
 	//end PARANOIA
 
+	//chains and graph positions are stored compactly, so chains are snapped to (and graph positions packed with) this:
+	EmbeddedVertexCodec codec(model);
+
 	//find boundary loops:
 
 	//build half-edge -> other vertex map:
@@ -91,7 +95,7 @@ void ak::find_first_active_chains(
 		//std::cout << "Considering chain with value range [" << chain_min << ", " << chain_max << "] and neighbor value range [" << adj_min << ", " << adj_max << "]." << std::endl;
 
 		if (chain_min != chain_max) {
-			std::cerr << "WARNING: discarding chain with non-constant value range [" << chain_min << ", " << chain_max << "]." << std::endl;
+			LOG(Warning, Peel) << "WARNING: discarding chain with non-constant value range [" << chain_min << ", " << chain_max << "].";
 			continue;
 		}
 		//the 1e-3 is to add some slop in case of somewhat noisy interpolation
@@ -99,7 +103,7 @@ void ak::find_first_active_chains(
 			if (adj_max < chain_min) {
 				//this is a maximum chain
 			} else { //this is a mixed min/max chain; weird
-				std::cerr << "WARNING: discarding chain with value range [" << chain_min << ", " << chain_max << "] because neighbors have value range [" << adj_min << ", " << adj_max << "]." << std::endl;
+				LOG(Warning, Peel) << "WARNING: discarding chain with value range [" << chain_min << ", " << chain_max << "] because neighbors have value range [" << adj_min << ", " << adj_max << "].";
 			}
 			continue;
 		}
@@ -115,6 +119,9 @@ void ak::find_first_active_chains(
 		//subdivide the chain to make sure there are enough samples for later per-sample computations:
 		std::vector< EmbeddedVertex > divided_chain;
 		sample_chain(parameters.get_chain_sample_spacing(), model, embedded_chain, &divided_chain);
+		for (auto &ev : divided_chain) {
+			ev = codec.snap(ev);
+		}
 
 		//further subdivide and place stitches:
 		float total_length = 0.0f;
@@ -137,7 +144,7 @@ void ak::find_first_active_chains(
 
 	assert(active_chains.size() == active_stitches.size());
 
-	std::cout << "Found " << active_chains.size() << " first active chains." << std::endl;
+	LOG(Info, Peel) << "Found " << active_chains.size() << " first active chains.";
 
 	if (graph_) {
 		for (uint32_t ci = 0; ci < active_chains.size(); ++ci) {
@@ -165,22 +172,20 @@ void ak::find_first_active_chains(
 				uint32_t i = li - lengths.begin();
 
 				assert(s.vertex == -1U);
-				s.vertex = graph_->vertices.size();
-				graph_->vertices.emplace_back();
-				graph_->vertices.back().at = ak::EmbeddedVertex::mix(
+				s.vertex = graph_->add_vertex(codec.pack(ak::EmbeddedVertex::mix(
 					chain[i-1], chain[i], m
-				);
+				)));
 			}
 
 			uint32_t prev = (chain[0] == chain.back() ? active_stitches[ci].back().vertex : -1U);
 			for (auto &s : active_stitches[ci]) {
 				if (prev != -1U) {
-					assert(prev < graph_->vertices.size());
-					assert(s.vertex < graph_->vertices.size());
-					assert(graph_->vertices[prev].row_out == -1U);
-					graph_->vertices[prev].row_out = s.vertex;
-					assert(graph_->vertices[s.vertex].row_in == -1U);
-					graph_->vertices[s.vertex].row_in = prev;
+					assert(prev < graph_->size());
+					assert(s.vertex < graph_->size());
+					assert(graph_->row_out[prev] == -1U);
+					graph_->row_out[prev] = s.vertex;
+					assert(graph_->row_in[s.vertex] == -1U);
+					graph_->row_in[s.vertex] = prev;
 				}
 				prev = s.vertex;
 			}
@@ -0,0 +1,165 @@
+#include "pipeline.hpp"
+
+//On gcc/clang x86 builds, an AVX2 kernel is compiled in and selected at run time:
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AK_INTERPOLATE_AVX2
+#include <immintrin.h>
+#endif
+
+//The kernels gather straight from the (array-of-structures) inputs:
+static_assert(sizeof(ak::EmbeddedVertex) == 6 * sizeof(uint32_t), "EmbeddedVertex is (simplex, weights) with no padding");
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "glm::vec3 is three packed floats");
+
+//NOTE: kernels use separate multiply and add (not FMA) so results are bit-identical to EmbeddedVertex::interpolate;
+// peeling makes discrete decisions based on these values.
+
+namespace {
+
+template< typename T >
+void interpolate_scalar(ak::EmbeddedVertex const *evs, uint32_t count, std::vector< T > const &values, T *out) {
+	for (uint32_t i = 0; i < count; ++i) {
+		out[i] = evs[i].interpolate(values);
+	}
+}
+
+#ifdef AK_INTERPOLATE_AVX2
+
+bool have_avx2() {
+	static bool const have = __builtin_cpu_supports("avx2");
+	return have;
+}
+
+//Gathers the simplex and weights of eight vertices into SoA registers.
+//has_y / has_z lanes are all-ones where simplex.y / simplex.z are not -1U.
+struct Lanes {
+	__m256i sx, sy, sz;
+	__m256 wx, wy, wz;
+	__m256 has_y, has_z;
+};
+
+__attribute__((target("avx2")))
+inline Lanes load_lanes(ak::EmbeddedVertex const *evs) {
+	__m256i const stride = _mm256_setr_epi32(0, 6, 12, 18, 24, 30, 36, 42);
+	__m256i const none = _mm256_set1_epi32(-1);
+	int const *ints = reinterpret_cast< int const * >(evs);
+	float const *floats = reinterpret_cast< float const * >(evs);
+	Lanes l;
+	l.sx = _mm256_i32gather_epi32(ints + 0, stride, 4);
+	l.sy = _mm256_i32gather_epi32(ints + 1, stride, 4);
+	l.sz = _mm256_i32gather_epi32(ints + 2, stride, 4);
+	l.wx = _mm256_i32gather_ps(floats + 3, stride, 4);
+	l.wy = _mm256_i32gather_ps(floats + 4, stride, 4);
+	l.wz = _mm256_i32gather_ps(floats + 5, stride, 4);
+	l.has_y = _mm256_castsi256_ps(_mm256_xor_si256(_mm256_cmpeq_epi32(l.sy, none), none));
+	l.has_z = _mm256_castsi256_ps(_mm256_xor_si256(_mm256_cmpeq_epi32(l.sz, none), none));
+	return l;
+}
+
+//ret = v[x] * w.x, then (if present) ret += v[y] * w.y, ret += v[z] * w.z -- same operation order as interpolate():
+__attribute__((target("avx2")))
+inline __m256 combine_lanes(float const *values, Lanes const &l, __m256i ix, __m256i iy, __m256i iz) {
+	__m256 const zero = _mm256_setzero_ps();
+	__m256 vx = _mm256_i32gather_ps(values, ix, 4);
+	__m256 vy = _mm256_mask_i32gather_ps(zero, values, iy, l.has_y, 4);
+	__m256 vz = _mm256_mask_i32gather_ps(zero, values, iz, l.has_z, 4);
+	__m256 ret = _mm256_mul_ps(vx, l.wx);
+	ret = _mm256_blendv_ps(ret, _mm256_add_ps(ret, _mm256_mul_ps(vy, l.wy)), l.has_y);
+	ret = _mm256_blendv_ps(ret, _mm256_add_ps(ret, _mm256_mul_ps(vz, l.wz)), l.has_z);
+	return ret;
+}
+
+__attribute__((target("avx2")))
+uint32_t interpolate_avx2(ak::EmbeddedVertex const *evs, uint32_t count, float const *values, float *out) {
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		Lanes l = load_lanes(evs + i);
+		_mm256_storeu_ps(out + i, combine_lanes(values, l, l.sx, l.sy, l.sz));
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+uint32_t interpolate_avx2(ak::EmbeddedVertex const *evs, uint32_t count, glm::vec3 const *values_, glm::vec3 *out) {
+	float const *values = reinterpret_cast< float const * >(values_);
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		Lanes l = load_lanes(evs + i);
+		//index of x component of each value:
+		__m256i ix = _mm256_add_epi32(l.sx, _mm256_add_epi32(l.sx, l.sx));
+		__m256i iy = _mm256_add_epi32(l.sy, _mm256_add_epi32(l.sy, l.sy));
+		__m256i iz = _mm256_add_epi32(l.sz, _mm256_add_epi32(l.sz, l.sz));
+		__m256i const one = _mm256_set1_epi32(1);
+		alignas(32) float px[8], py[8], pz[8];
+		_mm256_store_ps(px, combine_lanes(values, l, ix, iy, iz));
+		ix = _mm256_add_epi32(ix, one); iy = _mm256_add_epi32(iy, one); iz = _mm256_add_epi32(iz, one);
+		_mm256_store_ps(py, combine_lanes(values, l, ix, iy, iz));
+		ix = _mm256_add_epi32(ix, one); iy = _mm256_add_epi32(iy, one); iz = _mm256_add_epi32(iz, one);
+		_mm256_store_ps(pz, combine_lanes(values, l, ix, iy, iz));
+		for (uint32_t j = 0; j < 8; ++j) {
+			out[i + j] = glm::vec3(px[j], py[j], pz[j]);
+		}
+	}
+	return i;
+}
+
+#endif //AK_INTERPOLATE_AVX2
+
+template< typename T >
+void interpolate_batch(std::vector< ak::EmbeddedVertex > const &evs, std::vector< T > const &values, std::vector< T > *out_) {
+	assert(out_);
+	auto &out = *out_;
+	out.resize(evs.size());
+	if (evs.empty()) return;
+
+	//gathers use 32-bit signed offsets:
+	assert(values.size() * (sizeof(T) / sizeof(float)) < 0x80000000ULL);
+	//PARANOIA: all indices are in range (gathers don't check):
+	for (auto const &ev : evs) {
+		assert(ev.simplex.x < values.size());
+		assert(ev.simplex.y == -1U || ev.simplex.y < values.size());
+		assert(ev.simplex.z == -1U || ev.simplex.z < values.size());
+	}
+
+	uint32_t done = 0;
+#ifdef AK_INTERPOLATE_AVX2
+	if (have_avx2()) {
+		done = interpolate_avx2(evs.data(), evs.size(), values.data(), out.data());
+	}
+#endif
+	interpolate_scalar(evs.data() + done, evs.size() - done, values, out.data() + done);
+}
+
+} //namespace
+
+void ak::interpolate_batch(
+	std::vector< ak::EmbeddedVertex > const &evs,
+	std::vector< float > const &values,
+	std::vector< float > *out
+) {
+	::interpolate_batch(evs, values, out);
+}
+
+void ak::interpolate_batch(
+	std::vector< ak::EmbeddedVertex > const &evs,
+	std::vector< glm::vec3 > const &values,
+	std::vector< glm::vec3 > *out
+) {
+	::interpolate_batch(evs, values, out);
+}
+
+void ak::interpolated_vertices(
+	std::vector< ak::EmbeddedVertex > const &evs,
+	std::vector< uint32_t > *vertices_
+) {
+	assert(vertices_);
+	auto &vertices = *vertices_;
+	vertices.clear();
+	vertices.reserve(evs.size());
+	for (auto const &ev : evs) {
+		vertices.emplace_back(ev.simplex.x);
+		if (ev.simplex.y != -1U) vertices.emplace_back(ev.simplex.y);
+		if (ev.simplex.z != -1U) vertices.emplace_back(ev.simplex.z);
+	}
+	std::sort(vertices.begin(), vertices.end());
+	vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+}
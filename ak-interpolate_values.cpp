@@ -1,4 +1,5 @@
 #include "pipeline.hpp"
+#include "log.hpp"
 
 //#include <Eigen/SparseQR>
 #include <Eigen/SparseCholesky>
@@ -27,7 +28,7 @@ void ak::interpolate_values(
 		else dofs.emplace_back(total_dofs++);
 	}
 
-	std::cout << "Have " << total_dofs << " degrees of freedom and " << (constraints.size() - total_dofs) << " constraints." << std::endl;
+	LOG(Info, Interpolate) << "Have " << total_dofs << " degrees of freedom and " << (constraints.size() - total_dofs) << " constraints.";
 
 	if (total_dofs == constraints.size()) {
 		throw std::runtime_error("Cannot interpolate from no constraints.");
@@ -89,12 +90,12 @@ void ak::interpolate_values(
 	//Eigen::ConjugateGradient< Eigen::SparseMatrix< double > > solver;
 	solver.compute(A);
 	if (solver.info() != Eigen::Success) {
-		std::cerr << "Decomposition failed." << std::endl;
+		LOG(Error, Interpolate) << "ERROR: Decomposition failed.";
 		exit(1);
 	}
 	Eigen::VectorXd x = solver.solve(rhs);
 	if (solver.info() != Eigen::Success) {
-		std::cerr << "Solving failed." << std::endl;
+		LOG(Error, Interpolate) << "ERROR: Solving failed.";
 		exit(1);
 	}
 	//std::cout << solver.iterations() << " interations later..." << std::endl; //DEBUG
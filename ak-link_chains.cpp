@@ -1,22 +1,43 @@
 #include "pipeline.hpp"
+#include "parallel.hpp"
+#include "log.hpp"
 
 #include <glm/gtx/norm.hpp>
 #include <glm/gtx/hash.hpp>
 
 #include <iostream>
-#include <map>
-#include <set>
+#include <sstream>
+#include <cmath>
 #include <functional>
 #include <algorithm>
 #include <unordered_set>
 #include <unordered_map>
 
+//On gcc/clang x86 builds, an AVX2 kernel for link_dtw's inner loop is compiled in and selected at run time:
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AK_LINK_DTW_AVX2
+#include <immintrin.h>
+#endif
+
 //fill in any -1U segments in closest with nearby indices (or return false if closest is entirely -1U):
 bool fill_unassigned(std::vector< uint32_t > &closest, std::vector< float > const &weights, bool is_loop);
 
 //helper to re-label closest points so they have a possible flattening on the bed, given the supplied costs for relabelling:
 void flatten(std::vector< uint32_t > &closest, std::vector< float > const &costs, bool is_loop);
 
+//helper to link active to next stitches (as loops, starting from the rolled first stitches) by dynamic time warping;
+// returns false if no alignment in the band respects the FlagLinkOne flags:
+bool link_dtw(
+	std::vector< glm::vec3 > const &active_locations,
+	std::vector< bool > const &active_linkones,
+	std::vector< glm::vec3 > const &next_locations,
+	std::vector< bool > const &next_linkones,
+	float row_height, //in: ideal link length
+	uint32_t roll_active, uint32_t roll_new, //in: first active and next stitch (linked to each other)
+	std::vector< std::pair< uint32_t, uint32_t > > *links, //out: (active, next) index pairs, in chain order
+	float *cost //out: sum of (length - row_height)^2 over links
+);
+
 void ak::link_chains(
 	Parameters const &parameters,
 	Model const &slice, //in: slice on which the chains reside
@@ -203,7 +224,7 @@ void ak::link_chains(
 			}
 		}
 		if (marked) {
-			std::cout << "NOTE: marked " << marked << " next chains as all-accept because they touch boundaries." << std::endl;
+			LOG(Info, Link) << "NOTE: marked " << marked << " next chains as all-accept because they touch boundaries.";
 		}
 	}
 
@@ -221,14 +242,14 @@ void ak::link_chains(
 		}
 
 		if (only_discard) {
-			std::cout << "Marking everything accept because it was all marked discard." << std::endl;
+			LOG(Info, Link) << "Marking everything accept because it was all marked discard.";
 			for (auto &discard_after : next_discard_after) {
 				assert(discard_after.size() == 1);
 				assert(discard_after[0] == std::make_pair(0.0f, true));
 				discard_after[0].second = false;
 			}
 		} else {
-			std::cout << "Have a mix of discard and accept." << std::endl;
+			LOG(Info, Link) << "Have a mix of discard and accept.";
 		}
 	}
 
@@ -346,13 +367,19 @@ void ak::link_chains(
 
 	//HELPER: discard any matches which aren't mutual
 	auto discard_nonmutual = [&](){
-		std::vector< std::set< uint32_t > > active_refs; active_refs.reserve(active_closest.size());
+		//refs[ai * next_closest.size() + ni] has bit 1 set if active ai refers to next ni, bit 2 if next ni refers to active ai:
+		std::vector< uint8_t > refs(active_closest.size() * next_closest.size(), 0);
 		for (auto const &ac : active_closest) {
-			active_refs.emplace_back(ac.begin(), ac.end());
+			uint32_t ai = &ac - &active_closest[0];
+			for (auto c : ac) {
+				if (c != -1U) refs[ai * next_closest.size() + c] |= 1;
+			}
 		}
-		std::vector< std::set< uint32_t > > next_refs; next_refs.reserve(next_closest.size());
 		for (auto const &nc : next_closest) {
-			next_refs.emplace_back(nc.begin(), nc.end());
+			uint32_t ni = &nc - &next_closest[0];
+			for (auto c : nc) {
+				if (c != -1U) refs[c * next_closest.size() + ni] |= 2;
+			}
 		}
 
 		uint32_t discarded = 0;
@@ -360,7 +387,7 @@ void ak::link_chains(
 		for (auto &ac : active_closest) {
 			uint32_t ai = &ac - &active_closest[0];
 			for (auto &c : ac) {
-				if (c != -1U && !next_refs[c].count(ai)) {
+				if (c != -1U && !(refs[ai * next_closest.size() + c] & 2)) {
 					c = -1U;
 					++discarded;
 				}
@@ -370,14 +397,14 @@ void ak::link_chains(
 		for (auto &nc : next_closest) {
 			uint32_t ni = &nc - &next_closest[0];
 			for (auto &c : nc) {
-				if (c != -1U && !active_refs[c].count(ni)) {
+				if (c != -1U && !(refs[c * next_closest.size() + ni] & 1)) {
 					c = -1U;
 					++discarded;
 				}
 			}
 		}
 
-		if (discarded) std::cout << "Discarded " << discarded << " non-mutual segment matches." << std::endl;
+		if (discarded) LOG(Info, Link) << "Discarded " << discarded << " non-mutual segment matches.";
 
 		return discarded > 0;
 	};
@@ -418,7 +445,7 @@ void ak::link_chains(
 		}
 
 		if (discard_nonmutual()) {
-			std::cout << "NOTE: doing another pass through fill/flatten because additional non-mutual links were discarded." << std::endl;
+			LOG(Info, Link) << "NOTE: doing another pass through fill/flatten because additional non-mutual links were discarded.";
 		} else {
 			break;
 		}
@@ -451,7 +478,19 @@ void ak::link_chains(
 		std::vector< BeginEndStitches2 > next; //at most two (after post-processing)
 	};
 
-	std::map< std::pair< uint32_t, uint32_t >, Match > matches;
+	//matches between (active chain, next chain) pairs (either may be -1U for "nothing");
+	// looked up through a dense table indexed by chain pair, and sorted by pair once built:
+	typedef std::pair< std::pair< uint32_t, uint32_t >, Match > PairMatch;
+	std::vector< PairMatch > matches;
+	std::vector< uint32_t > match_slot((active_chains.size() + 1) * (next_chains.size() + 1), -1U);
+	auto get_match = [&](uint32_t ai, uint32_t ni) -> Match & {
+		uint32_t slot = (ai == -1U ? active_chains.size() : ai) * (next_chains.size() + 1) + (ni == -1U ? next_chains.size() : ni);
+		if (match_slot[slot] == -1U) {
+			match_slot[slot] = matches.size();
+			matches.emplace_back(std::make_pair(ai, ni), Match());
+		}
+		return matches[match_slot[slot]].second;
+	};
 
 	//build parametric segments into matches:
 	for (auto &closest : active_closest) {
@@ -464,9 +503,8 @@ void ak::link_chains(
 			while (end < closest.size() && closest[end] == closest[begin]) ++end;
 			assert(end < lengths.size());
 			//std::cout << "[" << begin << ", " << end << ") becomes "; //DEBUG
-			matches[std::make_pair(ai, closest[begin])].active.emplace_back(lengths[begin] / lengths.back(), lengths[end] / lengths.back(), closest[begin]);
-			auto m = matches[std::make_pair(ai, closest[begin])].active;
-			//std::cout << "[" << m.back().begin << ", " << m.back().end << ')'; //DEBUG
+			get_match(ai, closest[begin]).active.emplace_back(lengths[begin] / lengths.back(), lengths[end] / lengths.back(), closest[begin]);
+			//std::cout << "[" << get_match(ai, closest[begin]).active.back().begin << ", " << get_match(ai, closest[begin]).active.back().end << ')'; //DEBUG
 			//std::cout << " = [" << lengths[begin] << ", " << lengths[end] << ") / " << lengths.back() << std::endl; //DEBUG
 			begin = end;
 		}
@@ -483,11 +521,16 @@ void ak::link_chains(
 			uint32_t end = begin + 1;
 			while (end < closest.size() && closest[end] == closest[begin]) ++end;
 			assert(end < lengths.size());
-			matches[std::make_pair(closest[begin], ni)].next.emplace_back(lengths[begin] / lengths.back(), lengths[end] / lengths.back(), closest[begin]);
+			get_match(closest[begin], ni).next.emplace_back(lengths[begin] / lengths.back(), lengths[end] / lengths.back(), closest[begin]);
 			begin = end;
 		}
 	}
 
+	//process matches in pair order (-1U last); no matches are added after this, so pointers into them stay valid:
+	std::sort(matches.begin(), matches.end(), [](PairMatch const &a, PairMatch const &b) {
+		return a.first < b.first;
+	});
+
 	{ //do stitch assignments:
 		//sort ranges from matches back to actives:
 		std::vector< std::vector< BeginEndStitches * > > active_segments(active_chains.size());
@@ -561,7 +604,7 @@ void ak::link_chains(
 		}
 		assert(anm.second.active.size() <= 2); //<-- should be guaranteed by flatten
 	}
-	if (active_merges) std::cout << "Merged " << active_merges << " active segments." << std::endl;
+	if (active_merges) LOG(Info, Link) << "Merged " << active_merges << " active segments.";
 
 	uint32_t next_merges = 0;
 	for (auto &anm : matches) {
@@ -580,7 +623,7 @@ void ak::link_chains(
 		}
 		assert(anm.second.next.size() <= 2); //<-- should be guaranteed by flatten
 	}
-	if (next_merges) std::cout << "Merged " << next_merges << " next segments." << std::endl;
+	if (next_merges) LOG(Info, Link) << "Merged " << next_merges << " next segments.";
 
 
 	{ //balance stitch assignments for splits:
@@ -765,12 +808,11 @@ void ak::link_chains(
 			//end DEBUG
 
 			if (old_back != new_back || old_front != new_front) {
-				std::cout << "Balanced a merge:\n";
-				std::cout << "old: " << old_back << "\n";
-				std::cout << "     " << old_front << "\n";
-				std::cout << "new: " << new_back << "\n";
-				std::cout << "     " << new_front << "\n";
-				std::cout.flush();
+				LOG(Debug, Link) << "Balanced a merge:\n"
+					<< "old: " << old_back << "\n"
+					<< "     " << old_front << "\n"
+					<< "new: " << new_back << "\n"
+					<< "     " << new_front;
 			//} else {
 			//if (old_back == new_back && old_front == new_front) {
 				//std::cout << "NOTE: merge was already balanced." << std::endl;
@@ -789,26 +831,29 @@ void ak::link_chains(
 		if (anm.first.second != -1U) next_matches[anm.first.second] += 1;
 		if (anm.first.first == -1U || anm.first.second == -1U) ++empty_matches;
 	}
-	if (empty_matches) std::cout << "NOTE: have " << empty_matches << " segments that match with nothing." << std::endl;
+	if (empty_matches) LOG(Info, Link) << "NOTE: have " << empty_matches << " segments that match with nothing.";
 
 	{ //If there are any merges or splits, all participating next cycles are marked 'accept':
-		std::set< uint32_t > to_mark;
+		std::vector< bool > to_mark(next_chains.size(), false);
 		for (auto const &anm : matches) {
 			if (anm.first.first == -1U || anm.first.second == -1U) continue;
 			bool is_split_or_merge = (active_matches[anm.first.first] > 1 || next_matches[anm.first.second] > 1);
 			if (is_split_or_merge) {
-				to_mark.insert(anm.first.second);
+				to_mark[anm.first.second] = true;
 			}
 		}
+		uint32_t marked_cycles = 0;
 		uint32_t were_marked = 0;
-		for (auto ni : to_mark) {
+		for (uint32_t ni = 0; ni < next_chains.size(); ++ni) {
+			if (!to_mark[ni]) continue;
+			++marked_cycles;
 			for (auto const &td : next_discard_after[ni]) {
 				if (td.second) ++were_marked;
 			}
 			next_discard_after[ni].assign(1, std::make_pair(0.0f, false));
 		}
-		if (!to_mark.empty() && were_marked != 0) {
-			std::cerr << "Marked " << were_marked << " segments on " << to_mark.size() << " next cycles as 'accept' based on participating in a merge/split." << std::endl;
+		if (marked_cycles != 0 && were_marked != 0) {
+			LOG(Info, Link) << "Marked " << were_marked << " segments on " << marked_cycles << " next cycles as 'accept' based on participating in a merge/split.";
 		}
 	}
 
@@ -819,20 +864,25 @@ void ak::link_chains(
 	//allocate stitch counts based on segment lengths + source stitches:
 	//(and limit based on active stitch counts)
 	//then make next stitches
-	for (auto &anm : matches) {
+	//(matches are independent here, so are handled in parallel; results are appended in match order afterward)
+	std::vector< std::vector< ak::Stitch > > match_new_stitches(matches.size());
+	std::vector< std::ostringstream > match_logs(matches.size());
+	ak::parallel_for(matches.size(), [&](uint32_t mi) {
+		auto &anm = matches[mi];
 		Match &match = anm.second;
+		std::ostringstream &log = match_logs[mi];
 
 		if (match.active.empty()) {
-			std::cout << "Ignoring match with empty active chain." << std::endl;
-			continue;
+			log << "Ignoring match with empty active chain.\n";
+			return;
 		} else if (match.next.empty()) {
 			if (active_matches[anm.first.first] == 1) {
-				std::cout << "WARNING: active chain matches nothing at all; will not be linked and will thus be discarded." << std::endl;
+				log << "WARNING: active chain matches nothing at all; will not be linked and will thus be discarded.\n";
 			} else {
-				std::cout << "Ignoring match with empty next chain." << std::endl;
+				log << "Ignoring match with empty next chain.\n";
 			}
 
-			continue;
+			return;
 		}
 		assert(!match.active.empty());
 		assert(!match.next.empty());
@@ -878,7 +928,7 @@ void ak::link_chains(
 			}
 
 			if (next_ones > 2 * active_anys + active_ones) {
-				std::cerr << "ERROR: more discard/non-discard ends are required (" << next_ones << ") than are permitted by the current active flags (" << active_anys << "*2 + " << active_ones << "); code to fix this (by removing shortest same-discard segment) not yet implemented." << std::endl;
+				LOG(Error, Link) << "ERROR: more discard/non-discard ends are required (" << next_ones << ") than are permitted by the current active flags (" << active_anys << "*2 + " << active_ones << "); code to fix this (by removing shortest same-discard segment) not yet implemented.";
 				assert(next_ones <= 2 * active_anys + active_ones);
 			}
 		}
@@ -887,9 +937,9 @@ void ak::link_chains(
 		assert(anm.first.second < next_lengths.size());
 		std::vector< float > const &lengths = next_lengths[anm.first.second];
 		float total_length = 0.0f;
-		//std::cout << "Matching to"; //DEBUG
+		//log << "Matching to"; //DEBUG
 		for (auto const &be : match.next) {
-		//	std::cout << " [" << be.begin << ", " << be.end << ")"; std::cout.flush(); //DEBUG
+		//	log << " [" << be.begin << ", " << be.end << ")"; log.flush(); //DEBUG
 			if (be.begin <= be.end) {
 				total_length += be.end - be.begin;
 			} else {
@@ -897,7 +947,7 @@ void ak::link_chains(
 				total_length += (be.end + 1.0f) - be.begin;
 			}
 		}
-		//std::cout << std::endl; //DEBUG
+		//log << std::endl; //DEBUG
 		total_length *= lengths.back();
 
 		float stitch_width = parameters.stitch_width_mm / parameters.model_units_mm;
@@ -913,17 +963,17 @@ void ak::link_chains(
 
 			if (is_split_or_merge) {
 				assert(lower <= active_ones + active_anys && active_ones + active_anys <= upper);
-				std::cout << "NOTE: setting stitches from " << stitches << " to ";
+				log << "NOTE: setting stitches from " << stitches << " to ";
 				stitches = active_ones + active_anys;
-				std::cout << stitches << " to make split/merge 1-1." << std::endl;
+				log << stitches << " to make split/merge 1-1.\n";
 				//stitches = active_ones + active_anys;
 			}
 
 			if (stitches < lower || stitches > upper) {
-				std::cout << "NOTE: stitches (" << stitches << ") will be clamped to possible range [" << lower << ", " << upper << "], which might cause some shape distortion." << std::endl;
+				log << "NOTE: stitches (" << stitches << ") will be clamped to possible range [" << lower << ", " << upper << "], which might cause some shape distortion.\n";
 				stitches = std::max(lower, std::min(upper, stitches));
 			}
-			std::cout << "Will make " << stitches << " stitches, given active with " << active_ones << " ones, " << active_anys << " anys; next with " << next_ones << " ones." << std::endl; //DEBUG
+			log << "Will make " << stitches << " stitches, given active with " << active_ones << " ones, " << active_anys << " anys; next with " << next_ones << " ones.\n"; //DEBUG
 		}
 
 		std::vector< ak::Stitch > new_stitches;
@@ -1015,8 +1065,15 @@ void ak::link_chains(
 		}
 		assert(new_stitches.size() == stitches);
 
-		next_stitches[anm.first.second].insert(next_stitches[anm.first.second].end(), new_stitches.begin(), new_stitches.end());
-	} //end stitch allocation
+		match_new_stitches[mi] = std::move(new_stitches);
+	}); //end stitch allocation
+
+	for (uint32_t mi = 0; mi < matches.size(); ++mi) {
+		if (match_logs[mi].tellp() > 0) LOG(Info, Link) << match_logs[mi].str();
+		if (match_new_stitches[mi].empty()) continue;
+		auto &stitches = next_stitches[matches[mi].first.second];
+		stitches.insert(stitches.end(), match_new_stitches[mi].begin(), match_new_stitches[mi].end());
+	}
 
 	{ //balance new stitch allocations for merges:
 		//sort ranges from matches back to nexts:
@@ -1173,12 +1230,11 @@ void ak::link_chains(
 			//end DEBUG
 
 			if (old_back != new_back || old_front != new_front) {
-				std::cout << "Balanced a split:\n";
-				std::cout << "old: " << old_back << "\n";
-				std::cout << "     " << old_front << "\n";
-				std::cout << "new: " << new_back << "\n";
-				std::cout << "     " << new_front << "\n";
-				std::cout.flush();
+				LOG(Debug, Link) << "Balanced a split:\n"
+					<< "old: " << old_back << "\n"
+					<< "     " << old_front << "\n"
+					<< "new: " << new_back << "\n"
+					<< "     " << new_front;
 			//} else {
 			//if (old_back == new_back && old_front == new_front) {
 			//	std::cout << "NOTE: split was already balanced." << std::endl;
@@ -1259,35 +1315,39 @@ void ak::link_chains(
 			&all_next_stitch_linkones[ni] );
 	}
 
-	//PARANOIA:
-	std::vector< std::unordered_set< uint32_t > > all_next_claimed(next_chains.size());
-	std::vector< std::unordered_set< uint32_t > > all_active_claimed(active_chains.size());
+	//Links for each match are built independently (in parallel) and appended in match order afterward:
+	struct MatchLinks {
+		std::vector< uint32_t > active_stitch_indices; //(for PARANOIA checks)
+		std::vector< uint32_t > next_stitch_indices;
+		std::vector< Link > links;
+		std::ostringstream log;
+	};
+	std::vector< MatchLinks > match_links(matches.size());
 
-	for (auto const &anm : matches) {
+	ak::parallel_for(matches.size(), [&](uint32_t mi) {
+		auto const &anm = matches[mi];
 		Match const &match = anm.second;
+		std::ostringstream &log = match_links[mi].log;
 
-		std::vector< uint32_t > next_stitch_indices;
+		std::vector< uint32_t > &next_stitch_indices = match_links[mi].next_stitch_indices;
 		std::vector< glm::vec3 > next_stitch_locations;
 		std::vector< bool > next_stitch_linkones;
-		std::unordered_set< uint32_t > &next_claimed = all_next_claimed[anm.first.second];
 		auto do_range = [&](float begin, float end) {
-			//std::cout << "do_range [" << begin << ", " << end << "): "; //DEBUG
+			//log << "do_range [" << begin << ", " << end << "): "; //DEBUG
 			assert(begin <= end);
 			auto const &ns = next_stitches[anm.first.second];
 			uint32_t count = 0;
 			for (auto const &s : ns) {
 				if (begin <= s.t && s.t < end) {
 					uint32_t si = &s - &ns[0];
-					//std::cout << " " << si; std::cout.flush(); //DEBUG
+					//log << " " << si; log.flush(); //DEBUG
 					next_stitch_indices.emplace_back(si);
 					next_stitch_locations.emplace_back(all_next_stitch_locations[anm.first.second][si]);
 					next_stitch_linkones.emplace_back(all_next_stitch_linkones[anm.first.second][si]);
-					auto ret = next_claimed.insert(si); //PARANOIA
-					assert(ret.second);
 					++count;
 				}
 			}
-			//std::cout << std::endl; //DEBUG
+			//log << std::endl; //DEBUG
 			return count;
 		};
 		for (auto const &be : match.next) {
@@ -1318,17 +1378,14 @@ void ak::link_chains(
 		}
 
 
-		std::vector< uint32_t > active_stitch_indices;
+		std::vector< uint32_t > &active_stitch_indices = match_links[mi].active_stitch_indices;
 		std::vector< glm::vec3 > active_stitch_locations;
 		std::vector< bool > active_stitch_linkones;
-		std::unordered_set< uint32_t > &active_claimed = all_active_claimed[anm.first.first];
 		for (auto const &be : match.active) {
 			for (auto si : be.stitches) {
 				active_stitch_indices.emplace_back(si);
 				active_stitch_locations.emplace_back(all_active_stitch_locations[anm.first.first][si]);
 				active_stitch_linkones.emplace_back(all_active_stitch_linkones[anm.first.first][si]);
-				auto ret = active_claimed.insert(si); //PARANOIA
-				assert(ret.second);
 			}
 		}
 
@@ -1349,11 +1406,11 @@ void ak::link_chains(
 
 
 		if (match.active.empty()) {
-			std::cout << "Ignoring match with empty active chain." << std::endl;
-			continue;
+			log << "Ignoring match with empty active chain.\n";
+			return;
 		} else if (match.next.empty()) {
-			std::cout << "Ignoring match with empty next chain." << std::endl;
-			continue;
+			log << "Ignoring match with empty next chain.\n";
+			return;
 		}
 		assert(!match.active.empty());
 		assert(!match.next.empty());
@@ -1369,17 +1426,21 @@ void ak::link_chains(
 			for (auto o : active_stitch_linkones) {
 				if (o) ++active_ones;
 			}
-			std::cout << " About to connect " << active_stitch_locations.size() << " active stitches (" << active_ones << " linkones) to " << next_stitch_locations.size() << " new stitches (" << new_ones << " linkones)." << std::endl;
+			log << " About to connect " << active_stitch_locations.size() << " active stitches (" << active_ones << " linkones) to " << next_stitch_locations.size() << " new stitches (" << new_ones << " linkones).\n";
 		}
 
 		//actually build links:
 		{ //least-clever linking solution: FlagLinkOne's link 1-1, others link to keep arrays mostly in sync
 
-			std::vector< std::pair< uint32_t, uint32_t > > best_links;
-			float best_cost = std::numeric_limits< float >::infinity();
-
-			auto try_links_even = [&](uint32_t roll_active, uint32_t roll_new) {
-				std::vector< std::pair< uint32_t, uint32_t > > possible_links;
+			//The even-spacing links for any roll are the roll-zero links with the rolled side's indices shifted,
+			// so build that pattern once and only score rolls.
+			//(NOTE: with per-link cost (len - row_height)^2 the roll costs don't reduce to a correlation,
+			//  so this is still O(rolls * links) in the worst case; pruning makes it much cheaper in practice.)
+			std::vector< std::pair< uint32_t, uint32_t > > pattern;
+			auto make_even_links = [&](uint32_t roll_active, uint32_t roll_new, std::vector< std::pair< uint32_t, uint32_t > > *possible_links_) {
+				assert(possible_links_);
+				auto &possible_links = *possible_links_;
+				possible_links.clear();
 
 				if (active_stitch_locations.size() <= next_stitch_locations.size()) {
 					//evenly distribute increases among the non-linkone stitches:
@@ -1445,30 +1506,104 @@ void ak::link_chains(
 					assert(i == total);
 					assert(a == active_stitch_locations.size());
 				}
-				float const row_height = 2.0f * parameters.stitch_height_mm / parameters.model_units_mm;
-				float cost = 0.0f;
-				for (auto const &p : possible_links) {
-					float len = glm::length(next_stitch_locations[p.second] - active_stitch_locations[p.first]);
-					cost += (len - row_height) * (len - row_height);
+			};
+			bool const roll_active = (active_stitch_locations.size() >= next_stitch_locations.size());
+			uint32_t const rolls = (roll_active ? active_stitch_locations.size() : next_stitch_locations.size());
+
+			float const row_height = 2.0f * parameters.stitch_height_mm / parameters.model_units_mm;
+
+			//the roll that best lines up the first stitches (links always start by linking active 0 to next 0):
+			uint32_t nearest_roll = 0;
+			{
+				float nearest_dis = std::numeric_limits< float >::infinity();
+				for (uint32_t roll = 0; roll < rolls; ++roll) {
+					uint32_t ra = (roll_active ? roll : 0);
+					uint32_t rn = (roll_active ? 0 : roll);
+					float dis = glm::length2(next_stitch_locations[rn] - active_stitch_locations[ra]);
+					if (dis < nearest_dis) {
+						nearest_dis = dis;
+						nearest_roll = roll;
+					}
 				}
+			}
+
+			std::vector< std::pair< uint32_t, uint32_t > > best_links;
+			float best_cost = std::numeric_limits< float >::infinity();
 
-				if (cost < best_cost) {
-					best_cost = cost;
-					best_links = possible_links;
+			if (parameters.link_dtw) {
+				//DTW warps each alignment locally, so only a few rolls near the nearest one need to be tried
+				// (rather than every roll); if none fits the band and flags, fall back to even links:
+				std::vector< std::pair< uint32_t, uint32_t > > dtw_links;
+				uint32_t dtw_tried = 0;
+				for (int32_t delta : {0, -1, 1}) {
+					if (uint32_t(std::abs(delta)) * 2 >= rolls) continue; //(small loops: don't try the same roll twice)
+					uint32_t roll = (nearest_roll + rolls + delta) % rolls;
+					float dtw_cost;
+					++dtw_tried;
+					if (!link_dtw(
+						active_stitch_locations, active_stitch_linkones,
+						next_stitch_locations, next_stitch_linkones,
+						row_height,
+						(roll_active ? roll : 0), (roll_active ? 0 : roll),
+						&dtw_links, &dtw_cost)) continue;
+					if (dtw_cost < best_cost) {
+						best_cost = dtw_cost;
+						best_links = dtw_links;
+					}
 				}
-			};
+				if (!best_links.empty()) {
+					log << "  DTW linked with cost " << best_cost << " (tried " << dtw_tried << " rolls).\n";
+				} else {
+					log << "  DTW found no alignment in " << dtw_tried << " rolls; using even links.\n";
+				}
+			}
 
+			if (best_links.empty()) {
+				make_even_links(0, 0, &pattern);
+
+				//cost of the pattern rolled by 'roll'; returns infinity as soon as the cost is known to be more than 'limit':
+				// (terms are non-negative, so partial sums never decrease)
+				auto rolled_cost = [&](uint32_t roll, float limit) {
+					float cost = 0.0f;
+					for (auto const &p : pattern) {
+						uint32_t ra = p.first;
+						uint32_t rn = p.second;
+						if (roll_active) {
+							ra += roll;
+							if (ra >= active_stitch_locations.size()) ra -= active_stitch_locations.size();
+						} else {
+							rn += roll;
+							if (rn >= next_stitch_locations.size()) rn -= next_stitch_locations.size();
+						}
+						float len = glm::length(next_stitch_locations[rn] - active_stitch_locations[ra]);
+						cost += (len - row_height) * (len - row_height);
+						if (cost > limit) return std::numeric_limits< float >::infinity();
+					}
+					return cost;
+				};
 
-			if (active_stitch_locations.size() >= next_stitch_locations.size()) {
-				for (uint32_t roll_active = 0; roll_active < active_stitch_locations.size(); ++roll_active) {
-					try_links_even(roll_active,0);
+				//initial bound: the roll that best lines up the first link of the pattern:
+				float limit = std::numeric_limits< float >::infinity();
+				if (!pattern.empty()) {
+					assert(pattern[0] == std::make_pair(0U, 0U));
+					limit = rolled_cost(nearest_roll, limit);
 				}
-			} else {
-				for (uint32_t roll_new = 0; roll_new < next_stitch_locations.size(); ++roll_new) {
-					try_links_even(0,roll_new);
+
+				//rolls are scanned in order and only strict improvements are taken, so the first cheapest roll wins (as before):
+				uint32_t best_roll = -1U;
+				for (uint32_t roll = 0; roll < rolls; ++roll) {
+					float cost = rolled_cost(roll, limit);
+					if (cost < best_cost) {
+						best_cost = cost;
+						best_roll = roll;
+						limit = std::min(limit, best_cost);
+					}
 				}
-			}
 
+				if (best_roll != -1U) {
+					make_even_links((roll_active ? best_roll : 0), (roll_active ? 0 : best_roll), &best_links);
+				}
+			}
 
 			for (auto const &p : best_links) {
 				Link link;
@@ -1479,9 +1614,26 @@ void ak::link_chains(
 				link.to_chain = anm.first.second;
 				assert(p.second < next_stitch_indices.size());
 				link.to_stitch = next_stitch_indices[p.second];
-				links.emplace_back(link);
+				match_links[mi].links.emplace_back(link);
 			}
 		}
+	});
+
+	//PARANOIA: no stitch claimed by two matches
+	std::vector< std::unordered_set< uint32_t > > all_next_claimed(next_chains.size());
+	std::vector< std::unordered_set< uint32_t > > all_active_claimed(active_chains.size());
+
+	for (uint32_t mi = 0; mi < matches.size(); ++mi) {
+		if (match_links[mi].log.tellp() > 0) LOG(Info, Link) << match_links[mi].log.str();
+		for (auto si : match_links[mi].next_stitch_indices) {
+			auto ret = all_next_claimed[matches[mi].first.second].insert(si); //PARANOIA
+			assert(ret.second);
+		}
+		for (auto si : match_links[mi].active_stitch_indices) {
+			auto ret = all_active_claimed[matches[mi].first.first].insert(si); //PARANOIA
+			assert(ret.second);
+		}
+		links.insert(links.end(), match_links[mi].links.begin(), match_links[mi].links.end());
 	}
 
 	//PARANOIA: every stitch should have been claimed
@@ -1511,7 +1663,7 @@ void ak::link_chains(
 			++total;
 		}
 	}
-	std::cout << "Marked " << marked << " of " << total << " newly created stitches as 'discard'." << std::endl;
+	LOG(Info, Link) << "Marked " << marked << " of " << total << " newly created stitches as 'discard'.";
 
 
 }
@@ -1628,256 +1780,278 @@ void flatten(std::vector< uint32_t > &closest, std::vector< float > const &weigh
 	//if (symbols.size() == 2) return; //two symbols without alternation
 	//if (is_loop && symbols.size() == 3 && symbols[0] == symbols.back()) return; //two symbols without alternation (loop version)
 
-	//symbols -> bits
-	std::vector< std::pair< uint16_t, float > > bit_symbols;
-	uint32_t bits;
+	//symbols -> dense indices (in order of first appearance):
+	std::vector< std::pair< uint32_t, float > > index_symbols;
+	uint32_t symbol_count;
 	{
-		bit_symbols.reserve(symbols.size());
-		std::map< uint32_t, uint16_t > symbol_bit;
+		index_symbols.reserve(symbols.size());
+		std::unordered_map< uint32_t, uint32_t > symbol_index;
 		for (auto &sw : symbols) {
-			auto ret = symbol_bit.insert(std::make_pair(sw.first, uint16_t(1 << symbol_bit.size())));
-			assert(ret.first->second && "Only have enough bits for 16-symbol flattening");
-			bit_symbols.emplace_back(ret.first->second, sw.second);
+			auto ret = symbol_index.insert(std::make_pair(sw.first, uint32_t(symbol_index.size())));
+			index_symbols.emplace_back(ret.first->second, sw.second);
 		}
-		assert(bit_symbols.size() == symbols.size());
-		bits = symbol_bit.size();
+		assert(index_symbols.size() == symbols.size());
+		symbol_count = symbol_index.size();
 	}
-
+	uint32_t const n = index_symbols.size();
+	uint32_t const None = -1U;
+
+	//Search states are (used, current, min, max):
+	//  used -- set of symbols that have been kept (a bitset, so any number of symbols works)
+	//  current -- most recently kept symbol (or None)
+	//  min, max -- symbols that are strictly between min and max have been processed
+	//Each (used, current) pair is interned as a 'layer', so a state is (layer, min, max).
+	//NOTE: 'used' can't be dropped to get a dense, polynomial-size DP over (min, max, current):
+	// keeping every symbol to one run is the Longest Run Subsequence problem, which is NP-hard.
+	// A dense table per layer would need (reachable layers) x n x n entries, and reachable layers grow
+	// exponentially with the number of symbols; a cheapest-first search only visits states that can
+	// still beat the best finish, so states are hashed instead.
 	struct State {
-		uint16_t used = 0; //have seen all symbols with bits in used
-		uint8_t min = 0; //symbols that are strictly between min and max have been processed
-		uint8_t max = 0;
-		uint16_t current = 0; //most recently kept symbol
-		uint16_t padding = 0; //padding to make state 64 bits long
-
-		typedef uint64_t Packed;
-		Packed pack() const {
-			return *reinterpret_cast< Packed const * >(this);
-		}
-		static State unpack(Packed packed) {
-			return *reinterpret_cast< State const * >(&packed);
-		}
-
-		std::string to_string(uint32_t bits = 16) const {
-			std::string ret = "(" + std::to_string(min) + "," + std::to_string(max) + ")";
-			for (uint32_t i = bits-1; i < bits; --i) {
-				if (used & (1 << i)) {
-					if ((1 << i) == current) {
-						ret += "*";
-					} else {
-						ret += "x";
-					}
-				} else {
-					ret += ".";
-				}
-			}
-			return ret;
+		uint32_t layer;
+		uint32_t min;
+		uint32_t max;
+	};
+	uint32_t const words = (symbol_count + 63) / 64;
+	std::vector< uint64_t > layer_used; //'words' words per layer
+	std::vector< uint32_t > layer_current;
+	std::vector< uint32_t > layer_with; //symbol_count entries per layer: layer reached by keeping each symbol (or -1U if not yet known)
+	struct WordsHash {
+		size_t operator()(std::vector< uint64_t > const &key) const {
+			uint64_t h = 14695981039346656037ULL;
+			for (auto w : key) {
+				h = (h ^ w) * 1099511628211ULL;
+			}
+			return size_t(h);
 		}
 	};
-	static_assert(sizeof(State) == 8, "packed state");
+	std::unordered_map< std::vector< uint64_t >, uint32_t, WordsHash > layer_index;
+
+	std::vector< uint64_t > key; //scratch (used words + current)
+	auto get_layer = [&](uint32_t current) -> uint32_t {
+		key.resize(words + 1);
+		key[words] = current;
+		auto f = layer_index.find(key);
+		if (f != layer_index.end()) return f->second;
+		auto ret = layer_index.insert(std::make_pair(key, uint32_t(layer_current.size())));
+		if (ret.second) {
+			layer_used.insert(layer_used.end(), key.begin(), key.begin() + words);
+			layer_current.emplace_back(current);
+			layer_with.insert(layer_with.end(), symbol_count, -1U);
+		}
+		return ret.first->second;
+	};
+	auto is_used = [&](uint32_t layer, uint32_t symbol) {
+		return (layer_used[layer * words + symbol / 64] >> (symbol % 64)) & 1;
+	};
+	auto with_used = [&](uint32_t layer, uint32_t symbol) {
+		if (layer_with[layer * symbol_count + symbol] == -1U) {
+			key.assign(layer_used.begin() + layer * words, layer_used.begin() + (layer + 1) * words);
+			key[symbol / 64] |= (uint64_t(1) << (symbol % 64));
+			uint32_t next = get_layer(symbol);
+			layer_with[layer * symbol_count + symbol] = next;
+		}
+		return layer_with[layer * symbol_count + symbol];
+	};
 
+	//best cost and previous state for each visited state:
+	//(NOTE: per-layer dense [min][max] tables were tried; most layers are visited very sparsely, so they were slower)
+	std::unordered_map< uint64_t, std::pair< float, State > > visited;
+	auto state_key = [n](State const &state) {
+		return (uint64_t(state.layer) * n + state.min) * n + state.max;
+	};
 
 	struct {
-		State::Packed state;
+		State state;
 		float cost = std::numeric_limits< float >::infinity();
-		State::Packed from;
+		State from;
 	} finished;
-	std::unordered_map< State::Packed, std::pair< float, State::Packed > > visited;
-	std::vector< std::pair< float, State::Packed > > todo;
-	static std::greater< std::pair< float, State::Packed > > const TODOCompare;
 
-	auto queue_state = [&visited, &finished, &todo, bits](State const state, float const cost, State const from) {
-		assert(state.min != from.min || state.max != from.max); //must have done *something*
+	//Cheapest-first search. Ties are broken by (current, max, min, used), with 'used' compared as a binary number,
+	// which is the order the old 64-bit packed state (16-symbol limit) used:
+	//(entries are kept to 16 bytes -- heap operations dominate the search -- so (current + 1, max, min) are packed in 21-bit fields)
+	assert(n < (1U << 21) && symbol_count < (1U << 21) - 1);
+	struct Todo {
+		float cost;
+		uint32_t layer;
+		uint64_t order; //(current + 1) << 42 | max << 21 | min
+	};
+	std::vector< Todo > todo;
+	auto todo_greater = [&](Todo const &a, Todo const &b) {
+		if (a.cost != b.cost) return a.cost > b.cost;
+		if (a.order != b.order) return a.order > b.order;
+		for (uint32_t w = words - 1; w < words; --w) {
+			uint64_t ua = layer_used[a.layer * words + w];
+			uint64_t ub = layer_used[b.layer * words + w];
+			if (ua != ub) return ua > ub;
+		}
+		return false;
+	};
 
-		(void)bits;
-		//std::cout << state.to_string(bits) << " from " << from.to_string(bits) << " cost " << cost << std::endl; //DEBUG
+	auto queue_state = [&](State const state, float const cost, State const from) {
+		assert(state.min != from.min || state.max != from.max); //must have done *something*
 
 		if ((state.min != from.min && state.min == from.max)
 		 || (state.max != from.max && state.max == from.min)) {
 			//pointers crossed or met -> state is finished!
 			assert(state.min == state.max || (state.min == from.max && state.max == from.min));
 			if (cost < finished.cost) {
-				finished.state = state.pack();
+				finished.state = state;
 				finished.cost = cost;
-				finished.from = from.pack();
+				finished.from = from;
 			}
 			return;
 		}
 
 		//queue/indicate regular
-		auto ret = visited.insert(std::make_pair(state.pack(), std::make_pair(cost, from.pack())));
+		auto ret = visited.insert(std::make_pair(state_key(state), std::make_pair(cost, from)));
 		if (ret.second || ret.first->second.first > cost) {
-			ret.first->second = std::make_pair(cost, from.pack());
-			todo.emplace_back(std::make_pair(cost, state.pack()));
-			std::push_heap(todo.begin(), todo.end(), TODOCompare);
+			ret.first->second = std::make_pair(cost, from);
+			Todo t;
+			t.cost = cost;
+			t.layer = state.layer;
+			t.order = (uint64_t(layer_current[state.layer] + 1U) << 42) | (uint64_t(state.max) << 21) | state.min; //(None -> 0)
+			todo.emplace_back(t);
+			std::push_heap(todo.begin(), todo.end(), todo_greater);
 		}
-
 	};
 
-	auto expand_state = [&bit_symbols, &queue_state](State const state, float const cost) {
-		auto const used = state.used;
+	auto expand_state = [&](State const state, float const cost) {
+		uint32_t const current = layer_current[state.layer];
 		auto const min = state.min;
 		auto const max = state.max;
-		auto const current = state.current;
-		assert(state.padding == 0);
 
 		//*_next_symbol is the symbol that is advanced over when moving min/max,
 		// leading to some asymmetry in indexing:
 		// a(bc)d -> (abc)d <-- min_next_symbol is 'a' (at index of min_next)
 		// a(bc)d -> a(bcd) <-- max_next_symbol is 'd' (at index of max)
 
-		auto min_next = (min == 0 ? bit_symbols.size() - 1 : min - 1);
-		auto min_next_symbol = bit_symbols[min_next];
-		auto max_next = (max + 1U < bit_symbols.size() ? max + 1 : 0);
-		auto max_next_symbol = bit_symbols[max];
+		uint32_t min_next = (min == 0 ? n - 1 : min - 1);
+		auto min_next_symbol = index_symbols[min_next];
+		uint32_t max_next = (max + 1U < n ? max + 1 : 0);
+		auto max_next_symbol = index_symbols[max];
 
 		//actions:
 		//no reason not to keep if symbol is current:
 		if (min_next_symbol.first == current || max_next_symbol.first == current) {
-			assert(used & current);
+			assert(is_used(state.layer, current));
 			State next;
-			next.used = used;
+			next.layer = state.layer;
 			next.min = (min_next_symbol.first == current ? min_next : min);
 			next.max = (max_next_symbol.first == current ? max_next : max);
-			next.current = current;
 
-			float next_cost = cost;
-
-			queue_state(next, next_cost, state);
+			queue_state(next, cost, state);
 
 			return; //no other actions worth taking; this one was free!
 		}
 
 		//keep min (symbol must be unused):
-		if (!(used & min_next_symbol.first)) {
+		if (!is_used(state.layer, min_next_symbol.first)) {
 			State next;
-			next.used = used | min_next_symbol.first;
+			next.layer = with_used(state.layer, min_next_symbol.first);
 			next.min = min_next;
 			next.max = max;
-			next.current = min_next_symbol.first;
-
-			float next_cost = cost;
 
-			queue_state(next, next_cost, state);
+			queue_state(next, cost, state);
 		}
 
 		//keep max (symbol must be unused):
-		if (!(used & max_next_symbol.first)) {
+		if (!is_used(state.layer, max_next_symbol.first)) {
 			State next;
-			next.used = used | max_next_symbol.first;
+			next.layer = with_used(state.layer, max_next_symbol.first);
 			next.min = min;
 			next.max = max_next;
-			next.current = max_next_symbol.first;
 
-			float next_cost = cost;
-
-			queue_state(next, next_cost, state);
+			queue_state(next, cost, state);
 		}
 
 		//discard min:
 		{
 			State next;
-			next.used = used;
+			next.layer = state.layer;
 			next.min = min_next;
 			next.max = max;
-			next.current = current;
-
-			float next_cost = cost + min_next_symbol.second;
 
-			queue_state(next, next_cost, state);
+			queue_state(next, cost + min_next_symbol.second, state);
 		}
 
 		//discard max:
 		{
 			State next;
-			next.used = used;
+			next.layer = state.layer;
 			next.min = min;
 			next.max = max_next;
-			next.current = current;
 
-			float next_cost = cost + max_next_symbol.second;
-
-			queue_state(next, next_cost, state);
+			queue_state(next, cost + max_next_symbol.second, state);
 		}
 	};
 
 	//queue starting states:
-	for (uint32_t s = 0; s < bit_symbols.size(); ++s) {
-		State init;
-		init.used = 0;
-		init.min = s;
-		init.max = s;
-		init.current = 0;
-		expand_state(init, 0.0f);
-		if (!is_loop) break;
+	{
+		key.assign(words, 0);
+		uint32_t start_layer = get_layer(None);
+		for (uint32_t s = 0; s < n; ++s) {
+			State init;
+			init.layer = start_layer;
+			init.min = s;
+			init.max = s;
+			expand_state(init, 0.0f);
+			if (!is_loop) break;
+		}
 	}
 
 	while (!todo.empty()) {
-		std::pop_heap(todo.begin(), todo.end(), TODOCompare);
-		auto state = State::unpack(todo.back().second);
-		float cost = todo.back().first;
+		std::pop_heap(todo.begin(), todo.end(), todo_greater);
+		State state;
+		state.layer = todo.back().layer;
+		state.min = todo.back().order & 0x1fffff;
+		state.max = (todo.back().order >> 21) & 0x1fffff;
+		float cost = todo.back().cost;
 		todo.pop_back();
 		//if the cheapest thing is more expensive than the finish, we're done:
 		if (cost >= finished.cost) break;
 
 		{ //cost should either be stale or what is stored in 'visited':
-			auto f = visited.find(state.pack());
+			auto f = visited.find(state_key(state));
 			assert(f != visited.end());
 			if (cost > f->second.first) continue;
 			assert(cost == f->second.first);
 		}
+
 		expand_state(state, cost);
 	}
 	assert(finished.cost != std::numeric_limits< float >::infinity()); //found ~some~ path
 
 	//read back states:
-	std::vector< State::Packed > path;
+	std::vector< State > path;
 	path.emplace_back(finished.state);
 	path.emplace_back(finished.from);
 	while (true) {
-		auto f = visited.find(path.back());
+		auto f = visited.find(state_key(path.back()));
 		if (f == visited.end()) break;
 		path.emplace_back(f->second.second);
 	}
 	std::reverse(path.begin(), path.end());
-	//std::cout << "----" << std::endl; //DEBUG
 
-	std::vector< int8_t > keep(bit_symbols.size(), -1);
+	std::vector< int8_t > keep(n, -1);
 	for (uint32_t i = 1; i < path.size(); ++i) {
-		State state = State::unpack(path[i-1]);
-		State next = State::unpack(path[i]);
+		State state = path[i-1];
+		State next = path[i];
+		uint32_t next_current = layer_current[next.layer];
 
-		//std::cout << state.to_string(bits) << " -> " << next.to_string(bits) << ": "; std::cout.flush(); //DEBUG
 		if (state.min != next.min && state.max != next.max) {
 			//a(bc)d -> (abcd), keep 'a' (next.min), 'd' (state.max)
-			assert(bit_symbols[next.min].first == bit_symbols[state.max].first);
-			assert(next.current = bit_symbols[state.min].first);
-			//std::cout << "keep " << int32_t(next.min) << " (\"" << symbols[next.min].first << "\")" << ", " << int32_t(state.max) << " (\"" << symbols[state.max].first << "\")" << std::endl; //DEBUG
+			assert(index_symbols[next.min].first == index_symbols[state.max].first);
 			assert(keep[next.min] == -1);
 			assert(keep[state.max] == -1);
 			keep[next.min] = keep[state.max] = 1;
 		} else if (state.min != next.min) {
 			//a(bc)d -> (abc)d, keep/discard next.min
-			if (bit_symbols[next.min].first == next.current) {
-				//std::cout << "keep " << int32_t(next.min) << " (\"" << symbols[next.min].first << "\")" << std::endl; //DEBUG
-				assert(keep[next.min] == -1);
-				keep[next.min] = 1;
-			} else {
-				//std::cout << "discard " << int32_t(next.min) << " (\"" << symbols[next.min].first << "\")" << std::endl; //DEBUG
-				assert(keep[next.min] == -1);
-				keep[next.min] = 0;
-			}
+			assert(keep[next.min] == -1);
+			keep[next.min] = (index_symbols[next.min].first == next_current ? 1 : 0);
 		} else { assert(state.max != next.max);
 			//a(bc)d -> a(bcd), keep/discard state.max
-			if (bit_symbols[state.max].first == next.current) {
-				//std::cout << "keep " << int32_t(state.max) << " (\"" << symbols[state.max].first << "\")" << std::endl; //DEBUG
-				assert(keep[state.max] == -1);
-				keep[state.max] = 1;
-			} else {
-				//std::cout << "discard " << int32_t(state.max) << " (\"" << symbols[state.max].first << "\")" << std::endl; //DEBUG
-				assert(keep[state.max] == -1);
-				keep[state.max] = 0;
-			}
+			assert(keep[state.max] == -1);
+			keep[state.max] = (index_symbols[state.max].first == next_current ? 1 : 0);
 		}
 	}
 
@@ -1920,13 +2094,21 @@ void flatten(std::vector< uint32_t > &closest, std::vector< float > const &weigh
 	}
 
 	{ //do relabelling:
-		auto relabel_range = [&closest,&weights,&relabel](uint32_t first, uint32_t last) {
+		auto relabel_range = [&closest,&weights,&relabel,is_loop](uint32_t first, uint32_t last) {
 			uint32_t before = (first == 0 ? closest.back() : closest[first-1]);
 			uint32_t after  = (last + 1 == closest.size() ? closest[0] : closest[last+1]);
+			//chains don't wrap, so ranges at the ends take the label of their only neighbor:
+			// (the label across the ends can be the range's own, which would undo the relabelling)
+			if (!is_loop) {
+				assert(first <= last);
+				assert(first != 0 || last + 1 != closest.size());
+				if (first == 0) before = after;
+				if (last + 1 == closest.size()) after = before;
+			}
 			//std::cout << "Relabelling [" << first << ", " << last << "] using " << before << "/" << after << std::endl; //DEBUG
 
-			assert(!relabel[(first == 0 ? closest.size() : first) - 1]);
-			assert(!relabel[(last + 1 == closest.size() ? 0 : last) + 1]);
+			assert(!is_loop || !relabel[(first == 0 ? closest.size() : first) - 1]);
+			assert(!is_loop || !relabel[(last + 1 == closest.size() ? 0 : last + 1)]);
 			assert(relabel[first]);
 			assert(relabel[last]);
 
@@ -1937,7 +2119,7 @@ void flatten(std::vector< uint32_t > &closest, std::vector< float > const &weigh
 					assert(relabel[i]);
 					total += weights[i];
 					if (i == last) break;
-					++i;
+					i = (i + 1 < closest.size() ? i + 1 : 0); //(ranges may wrap around the end of a loop)
 				}
 			}
 			float sum = 0.0f;
@@ -1952,18 +2134,18 @@ void flatten(std::vector< uint32_t > &closest, std::vector< float > const &weigh
 					relabel[i] = false;
 					sum += weights[i];
 					if (i == last) break;
-					++i;
+					i = (i + 1 < closest.size() ? i + 1 : 0);
 				}
 			}
 		};
 		for (uint32_t seed = 0; seed < closest.size(); ++seed) {
 			if (!relabel[seed]) continue;
 			uint32_t first = seed;
-			while (relabel[first > 0 ? first - 1 : closest.size()-1]) {
+			while ((is_loop || first > 0) && relabel[first > 0 ? first - 1 : closest.size()-1]) {
 				first = (first > 0 ? first - 1 : closest.size()-1);
 			}
 			uint32_t last = seed;
-			while (relabel[last + 1 < closest.size() ? last + 1 : 0]) {
+			while ((is_loop || last + 1 < closest.size()) && relabel[last + 1 < closest.size() ? last + 1 : 0]) {
 				last = (last + 1 < closest.size() ? last + 1 : 0);
 			}
 			relabel_range(first, last);
@@ -1972,3 +2154,238 @@ void flatten(std::vector< uint32_t > &closest, std::vector< float > const &weigh
 
 }
 
+
+namespace {
+
+//One anti-diagonal of link_dtw's DP (see link_dtw for the layout):
+struct DTWDiagonal {
+	uint32_t count;
+	float row_height;
+	float const *px, *py, *pz, *pp; //active stitch locations and penalties
+	float const *qx, *qy, *qz, *qp; //(reversed) next stitch locations and penalties
+	float const *D1; //previous diagonal's D (D1[k] is a-1, D1[k+1] is a)
+	float const *D2, *I2, *R2; //D, I, R two diagonals back (at a-1)
+	float *D0, *I0, *R0; //out: this diagonal's D, I, R
+	uint8_t *F0; //out: state preceding the D step
+};
+
+void dtw_diagonal_scalar(DTWDiagonal const &g, uint32_t begin) {
+	for (uint32_t k = begin; k < g.count; ++k) {
+		float dx = g.qx[k] - g.px[k];
+		float dy = g.qy[k] - g.py[k];
+		float dz = g.qz[k] - g.pz[k];
+		float len = std::sqrt(dx*dx + dy*dy + dz*dz);
+		float c = (len - g.row_height) * (len - g.row_height);
+
+		float best = g.D2[k];
+		uint8_t from = 0;
+		if (g.I2[k] < best) { best = g.I2[k]; from = 1; }
+		if (g.R2[k] < best) { best = g.R2[k]; from = 2; }
+		g.D0[k] = c + best;
+		g.F0[k] = from;
+		g.I0[k] = c + g.D1[k+1] + g.pp[k];
+		g.R0[k] = c + g.D1[k] + g.qp[k];
+	}
+}
+
+#ifdef AK_LINK_DTW_AVX2
+
+bool have_avx2() {
+	static bool const have = __builtin_cpu_supports("avx2");
+	return have;
+}
+
+//Eight cells at a time; returns the number of cells done (the rest are left for dtw_diagonal_scalar).
+//NOTE: same operation order as the scalar loop (and no FMA), so costs -- and so the chosen links -- are bit-identical.
+__attribute__((target("avx2")))
+uint32_t dtw_diagonal_avx2(DTWDiagonal const &g) {
+	__m256 const row_height = _mm256_set1_ps(g.row_height);
+	uint32_t k = 0;
+	for (; k + 8 <= g.count; k += 8) {
+		__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(g.qx + k), _mm256_loadu_ps(g.px + k));
+		__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(g.qy + k), _mm256_loadu_ps(g.py + k));
+		__m256 dz = _mm256_sub_ps(_mm256_loadu_ps(g.qz + k), _mm256_loadu_ps(g.pz + k));
+		__m256 len2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+		__m256 err = _mm256_sub_ps(_mm256_sqrt_ps(len2), row_height);
+		__m256 c = _mm256_mul_ps(err, err);
+
+		__m256 best = _mm256_loadu_ps(g.D2 + k);
+		__m256 i2 = _mm256_loadu_ps(g.I2 + k);
+		__m256 from_i = _mm256_cmp_ps(i2, best, _CMP_LT_OQ);
+		best = _mm256_blendv_ps(best, i2, from_i);
+		__m256 r2 = _mm256_loadu_ps(g.R2 + k);
+		__m256 from_r = _mm256_cmp_ps(r2, best, _CMP_LT_OQ);
+		best = _mm256_blendv_ps(best, r2, from_r);
+		_mm256_storeu_ps(g.D0 + k, _mm256_add_ps(c, best));
+		uint32_t bits_i = _mm256_movemask_ps(from_i);
+		uint32_t bits_r = _mm256_movemask_ps(from_r);
+		for (uint32_t j = 0; j < 8; ++j) {
+			g.F0[k + j] = ((bits_r >> j) & 1 ? 2 : (bits_i >> j) & 1);
+		}
+
+		_mm256_storeu_ps(g.I0 + k, _mm256_add_ps(_mm256_add_ps(c, _mm256_loadu_ps(g.D1 + k + 1)), _mm256_loadu_ps(g.pp + k)));
+		_mm256_storeu_ps(g.R0 + k, _mm256_add_ps(_mm256_add_ps(c, _mm256_loadu_ps(g.D1 + k)), _mm256_loadu_ps(g.qp + k)));
+	}
+	return k;
+}
+
+#endif //AK_LINK_DTW_AVX2
+
+} //namespace
+
+bool link_dtw(
+	std::vector< glm::vec3 > const &active_locations,
+	std::vector< bool > const &active_linkones,
+	std::vector< glm::vec3 > const &next_locations,
+	std::vector< bool > const &next_linkones,
+	float row_height,
+	uint32_t roll_active, uint32_t roll_new,
+	std::vector< std::pair< uint32_t, uint32_t > > *links_,
+	float *cost_) {
+
+	assert(active_locations.size() == active_linkones.size());
+	assert(next_locations.size() == next_linkones.size());
+	assert(links_);
+	auto &links = *links_;
+	links.clear();
+	assert(cost_);
+	auto &cost = *cost_;
+	cost = std::numeric_limits< float >::infinity();
+
+	int32_t const A = active_locations.size();
+	int32_t const N = next_locations.size();
+	if (A == 0 || N == 0) return false;
+	float const Inf = std::numeric_limits< float >::infinity();
+
+	//Alignment is a monotone path of (a,n) links from (0,0) to (A-1,N-1) (indices relative to the rolls):
+	//  D: diagonal step (a-1,n-1) -> (a,n)
+	//  I: increase step (a,n-1) -> (a,n); 'a' links to two next stitches, so must not be FlagLinkOne
+	//  R: decrease step (a-1,n) -> (a,n); 'n' links from two active stitches, so must not be FlagLinkOne
+	//Only a D step may follow an I or R step (so no stitch gets three links and no two-link stitches are linked to each other).
+	//Cost is the same per-link cost as the even linker: (len - row_height)^2.
+
+	//rolled, structure-of-arrays copies of the inputs; 'penalty' is Inf where a stitch may only have one link:
+	std::vector< float > ax(A), ay(A), az(A), a_penalty(A);
+	for (int32_t a = 0; a < A; ++a) {
+		uint32_t ra = (a + roll_active) % A;
+		ax[a] = active_locations[ra].x;
+		ay[a] = active_locations[ra].y;
+		az[a] = active_locations[ra].z;
+		a_penalty[a] = (active_linkones[ra] ? Inf : 0.0f);
+	}
+	//next stitches are stored reversed, since 'n' decreases along an anti-diagonal:
+	std::vector< float > nx(N), ny(N), nz(N), n_penalty(N);
+	for (int32_t n = 0; n < N; ++n) {
+		uint32_t rn = (n + roll_new) % N;
+		nx[N-1-n] = next_locations[rn].x;
+		ny[N-1-n] = next_locations[rn].y;
+		nz[N-1-n] = next_locations[rn].z;
+		n_penalty[N-1-n] = (next_linkones[rn] ? Inf : 0.0f);
+	}
+
+	//Sakoe-Chiba band around the line from (0,0) to (A-1,N-1), whose slope is the stitch count ratio:
+	float const slope = (A > 1 ? float(N - 1) / float(A - 1) : 0.0f);
+	float const band = 2.0f + std::max(A, N) / 16;
+
+	//The DP runs over anti-diagonals d = a + n. On each one, the cells in the band are a contiguous range of 'a',
+	// and the predecessors of cell a are cells a and a-1 of diagonal d-1 and cell a-1 of diagonal d-2.
+	//Each diagonal is stored with an Inf guard cell on each side; since ranges move by at most one per diagonal,
+	// this makes the inner loop branch-free over contiguous arrays (see dtw_diagonal_avx2).
+	int32_t const diagonals = A + N - 1;
+	std::vector< int32_t > diag_begin(diagonals + 2), diag_end(diagonals + 2); //[begin,end) range of 'a', with guards
+	std::vector< uint32_t > diag_offset(diagonals + 3);
+	//two leading all-guard diagonals (d = -2, -1) so that diagonals 0 and 1 need no special cases:
+	diag_begin[0] = diag_begin[1] = -1;
+	diag_end[0] = diag_end[1] = 2;
+	diag_offset[0] = 0;
+	diag_offset[1] = 3;
+	diag_offset[2] = 6;
+	for (int32_t d = 0; d < diagonals; ++d) {
+		int32_t lo = std::max(0, d - (N - 1));
+		int32_t hi = std::min(A - 1, d);
+		//|(d - a) - a * slope| <= band:
+		lo = std::max(lo, int32_t(std::ceil((d - band) / (1.0f + slope))));
+		hi = std::min(hi, int32_t(std::floor((d + band) / (1.0f + slope))));
+		if (lo > hi) return false; //no cells in band (e.g., one stitch against many)
+		diag_begin[d+2] = lo - 1;
+		diag_end[d+2] = hi + 2;
+		diag_offset[d+3] = diag_offset[d+2] + (diag_end[d+2] - diag_begin[d+2]);
+	}
+	for (int32_t d = 0; d < diagonals; ++d) {
+		//PARANOIA: guard cells of neighboring diagonals cover all predecessor lookups:
+		assert(diag_begin[d+1] <= diag_begin[d+2] && diag_end[d+1] >= diag_end[d+2] - 1);
+		assert(diag_begin[d] <= diag_begin[d+2] && diag_end[d] >= diag_end[d+2] - 2);
+	}
+	assert(diag_begin[2] == -1 && diag_end[2] == 2); //d = 0 contains only (0,0)
+	assert(diag_begin[diagonals+1] + 1 == A - 1 && diag_end[diagonals+1] - 2 == A - 1); //last diagonal only (A-1,N-1)
+
+	std::vector< float > D(diag_offset.back(), Inf), I(diag_offset.back(), Inf), R(diag_offset.back(), Inf);
+	std::vector< uint8_t > from_D(diag_offset.back(), 0); //state (0: D, 1: I, 2: R) preceding a D step
+
+	//the path starts at (0,0) with no prior cost (via the guard cell that is its D predecessor):
+	D[diag_offset[0] + 0] = 0.0f;
+
+	for (int32_t d = 0; d < diagonals; ++d) {
+		//cells of this diagonal are a = lo + k (between the guards); predecessors are at a and a-1 on d-1 and at a-1 on d-2:
+		int32_t const lo = diag_begin[d+2] + 1;
+		uint32_t const count = diag_end[d+2] - lo - 1;
+		uint32_t const o0 = diag_offset[d+2] + 1;
+		DTWDiagonal g;
+		g.count = count;
+		g.row_height = row_height;
+		g.D0 = &D[o0]; g.I0 = &I[o0]; g.R0 = &R[o0];
+		g.F0 = &from_D[o0];
+		g.D1 = &D[diag_offset[d+1] + (lo - 1 - diag_begin[d+1])];
+		uint32_t const o2 = diag_offset[d] + (lo - 1 - diag_begin[d]);
+		g.D2 = &D[o2]; g.I2 = &I[o2]; g.R2 = &R[o2];
+		g.px = &ax[lo]; g.py = &ay[lo]; g.pz = &az[lo]; g.pp = &a_penalty[lo];
+		//(n = d - a, so reversed next index N-1-n is N-1-d+a)
+		int32_t const r0 = N - 1 - d + lo;
+		g.qx = &nx[r0]; g.qy = &ny[r0]; g.qz = &nz[r0]; g.qp = &n_penalty[r0];
+
+		uint32_t done = 0;
+#ifdef AK_LINK_DTW_AVX2
+		if (have_avx2()) {
+			done = dtw_diagonal_avx2(g);
+		}
+#endif
+		dtw_diagonal_scalar(g, done);
+	}
+
+	//read back path from the end cell:
+	auto cell = [&](int32_t a, int32_t n) {
+		int32_t d = a + n;
+		assert(d >= 0 && d < diagonals);
+		assert(a > diag_begin[d+2] && a + 1 < diag_end[d+2]);
+		return diag_offset[d+2] + (a - diag_begin[d+2]);
+	};
+	int32_t a = A - 1;
+	int32_t n = N - 1;
+	uint8_t state;
+	{
+		uint32_t c = cell(a, n);
+		cost = D[c];
+		state = 0;
+		if (I[c] < cost) { cost = I[c]; state = 1; }
+		if (R[c] < cost) { cost = R[c]; state = 2; }
+	}
+	if (!(cost < Inf)) return false;
+
+	while (true) {
+		links.emplace_back((a + roll_active) % A, (n + roll_new) % N);
+		if (a == 0 && n == 0) break;
+		if (state == 0) {
+			state = from_D[cell(a, n)];
+			--a; --n;
+		} else if (state == 1) {
+			state = 0;
+			--n;
+		} else { assert(state == 2);
+			state = 0;
+			--a;
+		}
+		assert(a >= 0 && n >= 0);
+	}
+	std::reverse(links.begin(), links.end());
+	return true;
+}
@@ -1,54 +1,11 @@
 #include "pipeline.hpp"
+#include "binary_io.hpp"
+#include "log.hpp"
 
 #include <glm/gtx/norm.hpp>
 
-#include <iostream>
 #include <fstream>
 
-template< typename S >
-void write_scalar(std::ostream &out, S const &s, std::string const &name) {
-	if (!out.write(reinterpret_cast< const char * >(&s), sizeof(S))) {
-		throw std::runtime_error("Failed to write scalar " + name);
-	}
-}
-
-
-template< typename S >
-void read_scalar(std::istream &in, S *_out, std::string const &name) {
-	assert(_out);
-	if (!in.read(reinterpret_cast< char * >(_out), sizeof(S))) {
-		throw std::runtime_error("Failed to read scalar " + name);
-	}
-}
-
-template< typename S >
-void write_vector(std::ostream &out, std::vector< S > const &vs, std::string const &name) {
-	uint32_t count = vs.size();
-	write_scalar(out, count, name + " count");
-	if (!out.write(reinterpret_cast< const char * >(vs.data()), sizeof(S) * vs.size())) {
-		throw std::runtime_error("Failed to write vector data for " + name);
-	}
-}
-
-
-template< typename S >
-void read_vector(std::istream &in, std::vector< S > *_out, std::string const &name) {
-	assert(_out);
-	auto &out = *_out;
-	uint32_t count;
-	read_scalar(in, &count, name + " count");
-	out.assign(count, S());
-	if (!in.read(reinterpret_cast< char * >(out.data()), sizeof(S) * out.size())) {
-		throw std::runtime_error("Failed to read vector data for " + name);
-	}
-}
-
-void read_eof(std::istream &in, std::string const &name) {
-	if (std::istream::traits_type::not_eof( in.get() )) {
-		throw std::runtime_error("Trailing data reading " + name);
-	}
-}
-
 struct StoredConstraint {
 	uint32_t verts_count;
 	float value;
@@ -110,7 +67,7 @@ void ak::load_constraints(
 	}
 
 	if (missing_verts) {
-		std::cerr << "WARNING: had " << missing_verts << " missing verts loading constraints from '" << filename << "'" << std::endl;
+		LOG(Warning, Load) << "WARNING: had " << missing_verts << " missing verts loading constraints from '" << filename << "'";
 	}
 }
 
@@ -0,0 +1,74 @@
+#include "pipeline.hpp"
+#include "log.hpp"
+
+
+void ak::peel(
+	ak::Parameters const &parameters,
+	ak::Model const &model,
+	std::vector< float > const &times,
+	bool use_row_field,
+	ak::RowColGraph *graph_
+) {
+	assert(graph_);
+	auto &graph = *graph_;
+	graph.clear();
+
+	EmbeddedVertexCodec codec(model);
+
+	std::vector< std::vector< EmbeddedVertex > > active_chains, next_active_chains;
+	std::vector< std::vector< Stitch > > active_stitches, next_active_stitches;
+
+	//read lower boundary:
+	find_first_active_chains(parameters, model, times, &active_chains, &active_stitches, &graph);
+	if (use_row_field) {
+		//pull out as many rows as possible directly, peel the rest:
+		extract_rows(parameters, model, times, &active_chains, &active_stitches, &graph);
+	}
+
+	uint32_t rounds = 0;
+	bool one_component = false; //do the active chains (known to) bound one component?
+	while (!active_chains.empty()) {
+		rounds += 1;
+		next_active_chains.clear();
+		next_active_stitches.clear();
+
+		//(finding components takes a trim of the whole model, so skip it when the last round didn't change chain topology)
+		std::vector< std::vector< uint32_t > > components;
+		if (!one_component) {
+			find_active_components(model, active_chains, &components);
+		}
+		if (components.size() > 1) {
+			peel_components(parameters, model, codec, times, active_chains, active_stitches, components, &next_active_chains, &next_active_stitches, &graph);
+			one_component = false;
+		} else {
+			Model slice;
+			std::vector< EmbeddedVertex > slice_on_model;
+			std::vector< std::vector< uint32_t > > slice_active_chains;
+			std::vector< std::vector< uint32_t > > slice_next_chains;
+			std::vector< bool > slice_next_used_boundary;
+			peel_slice(parameters, model, active_chains, &slice, &slice_on_model, &slice_active_chains, &slice_next_chains, &slice_next_used_boundary);
+
+			std::vector< float > slice_times;
+			interpolate_batch(slice_on_model, times, &slice_times);
+
+			std::vector< std::vector< Stitch > > next_stitches;
+			std::vector< Link > links;
+			link_chains(parameters, slice, slice_times, slice_active_chains, active_stitches, slice_next_chains, slice_next_used_boundary, &next_stitches, &links);
+
+			build_next_active_chains(slice, slice_on_model, codec, slice_active_chains, active_stitches, slice_next_chains, next_stitches, slice_next_used_boundary, links, &next_active_chains, &next_active_stitches, &graph);
+			one_component = links_pair_chains(slice_active_chains.size(), slice_next_chains.size(), links);
+		}
+
+		active_chains = std::move(next_active_chains);
+		active_stitches = std::move(next_active_stitches);
+
+		if (use_row_field && !active_chains.empty()) {
+			//once peeling is past whatever stopped row extraction, extract rows again:
+			if (extract_rows(parameters, model, times, &active_chains, &active_stitches, &graph)) {
+				one_component = false;
+			}
+		}
+	}
+
+	LOG(Info, Peel) << "Peeled " << rounds << " rounds (" << graph.size() << " graph vertices).";
+}
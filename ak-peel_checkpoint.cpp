@@ -0,0 +1,152 @@
+#include "pipeline.hpp"
+#include "binary_io.hpp"
+
+#include <fstream>
+
+namespace {
+
+//"akpc" + format version; bump the version whenever anything stored changes:
+constexpr uint32_t CheckpointMagic = 0x63706b61;
+constexpr uint32_t CheckpointVersion = 2; //(2: active chains and graph positions are CompactEmbeddedVertex)
+
+//Stitch with explicit layout (no padding bytes in the file):
+struct StoredStitch {
+	float t;
+	uint32_t vertex;
+	int32_t flag;
+};
+static_assert(sizeof(StoredStitch) == 12, "StoredStitch is packed");
+
+}
+
+uint64_t ak::hash_peel_inputs(
+	ak::Parameters const &parameters,
+	ak::Model const &model,
+	std::vector< float > const &times
+) {
+	ContentHash hasher;
+	hasher.add(parameters.stitch_width_mm);
+	hasher.add(parameters.stitch_height_mm);
+	hasher.add(parameters.model_units_mm);
+	hasher.add(parameters.link_dtw);
+	hasher.add(model.vertices);
+	hasher.add(model.triangles);
+	hasher.add(times);
+	return hasher.value;
+}
+
+void ak::save_peel_checkpoint(
+	ak::PeelCheckpoint const &checkpoint, //in: checkpoint to save
+	std::string const &filename //in: file name to save to
+) {
+	assert(checkpoint.active_chains.size() == checkpoint.active_stitches.size());
+
+	std::ofstream out(filename, std::ios::binary);
+	if (!out) throw std::runtime_error("Failed to open '" + filename + "' for writing.");
+
+	write_scalar(out, CheckpointMagic, "magic");
+	write_scalar(out, CheckpointVersion, "version");
+	write_scalar(out, checkpoint.peel_step, "peel step");
+	write_scalar(out, checkpoint.inputs_hash, "inputs hash");
+
+	write_scalar(out, uint32_t(checkpoint.active_chains.size()), "active chains count");
+	for (auto const &chain : checkpoint.active_chains) {
+		write_vector(out, chain, "active chain");
+	}
+	std::vector< StoredStitch > stored;
+	for (auto const &stitches : checkpoint.active_stitches) {
+		stored.clear();
+		stored.reserve(stitches.size());
+		for (auto const &s : stitches) {
+			stored.emplace_back();
+			stored.back().t = s.t;
+			stored.back().vertex = s.vertex;
+			stored.back().flag = int32_t(s.flag);
+		}
+		write_vector(out, stored, "active stitches");
+	}
+
+	write_graph(out, checkpoint.graph);
+}
+
+void ak::load_peel_checkpoint(
+	std::string const &filename, //in: file to load
+	ak::PeelCheckpoint *checkpoint_ //out: loaded checkpoint
+) {
+	assert(checkpoint_);
+	auto &checkpoint = *checkpoint_;
+	checkpoint = PeelCheckpoint();
+
+	std::ifstream in(filename, std::ios::binary);
+	if (!in) throw std::runtime_error("Failed to open '" + filename + "' for reading.");
+
+	uint32_t magic, version;
+	read_scalar(in, &magic, "magic");
+	if (magic != CheckpointMagic) throw std::runtime_error("'" + filename + "' is not a peel checkpoint.");
+	read_scalar(in, &version, "version");
+	if (version != CheckpointVersion) {
+		throw std::runtime_error("'" + filename + "' is a version " + std::to_string(version) + " peel checkpoint (expecting version " + std::to_string(CheckpointVersion) + ").");
+	}
+	read_scalar(in, &checkpoint.peel_step, "peel step");
+	read_scalar(in, &checkpoint.inputs_hash, "inputs hash");
+
+	uint32_t chains;
+	read_scalar(in, &chains, "active chains count");
+	checkpoint.active_chains.resize(chains);
+	for (auto &chain : checkpoint.active_chains) {
+		read_vector(in, &chain, "active chain");
+	}
+	checkpoint.active_stitches.resize(chains);
+	std::vector< StoredStitch > stored;
+	for (auto &stitches : checkpoint.active_stitches) {
+		read_vector(in, &stored, "active stitches");
+		stitches.reserve(stored.size());
+		for (auto const &s : stored) {
+			if (s.flag != Stitch::FlagDiscard && s.flag != Stitch::FlagLinkOne && s.flag != Stitch::FlagLinkAny) {
+				throw std::runtime_error("Stored stitch has invalid flag.");
+			}
+			stitches.emplace_back(s.t, Stitch::Flag(s.flag), s.vertex);
+		}
+	}
+
+	read_graph(in, &checkpoint.graph);
+	read_eof(in, "peel checkpoint " + filename);
+
+	uint32_t count = checkpoint.graph.at.size();
+	for (auto const &stitches : checkpoint.active_stitches) {
+		for (auto const &s : stitches) {
+			if (s.vertex != -1U && s.vertex >= count) throw std::runtime_error("Stored stitch refers to a vertex not in the graph.");
+		}
+	}
+}
+
+void ak::write_graph(std::ostream &out, ak::RowColGraph const &graph) {
+	write_vector(out, graph.at, "graph at");
+	write_vector(out, graph.row_in, "graph row_in");
+	write_vector(out, graph.row_out, "graph row_out");
+	write_vector(out, graph.col_in, "graph col_in");
+	write_vector(out, graph.col_out, "graph col_out");
+}
+
+void ak::read_graph(std::istream &in, ak::RowColGraph *graph_) {
+	assert(graph_);
+	auto &graph = *graph_;
+	read_vector(in, &graph.at, "graph at");
+	read_vector(in, &graph.row_in, "graph row_in");
+	read_vector(in, &graph.row_out, "graph row_out");
+	read_vector(in, &graph.col_in, "graph col_in");
+	read_vector(in, &graph.col_out, "graph col_out");
+
+	uint32_t count = graph.at.size();
+	if (graph.row_in.size() != count || graph.row_out.size() != count || graph.col_in.size() != count || graph.col_out.size() != count) {
+		throw std::runtime_error("Stored graph arrays have mismatched sizes.");
+	}
+	for (uint32_t v = 0; v < count; ++v) {
+		if (graph.row_in[v] != -1U && graph.row_in[v] >= count) throw std::runtime_error("Stored graph has out-of-range row link.");
+		if (graph.row_out[v] != -1U && graph.row_out[v] >= count) throw std::runtime_error("Stored graph has out-of-range row link.");
+		for (uint32_t i = 0; i < 2; ++i) {
+			if (graph.col_in[v][i] != -1U && graph.col_in[v][i] >= count) throw std::runtime_error("Stored graph has out-of-range column link.");
+			if (graph.col_out[v][i] != -1U && graph.col_out[v][i] >= count) throw std::runtime_error("Stored graph has out-of-range column link.");
+		}
+	}
+}
@@ -0,0 +1,260 @@
+#include "pipeline.hpp"
+#include "parallel.hpp"
+#include "log.hpp"
+
+#include <unordered_map>
+
+void ak::find_active_components(
+	ak::Model const &model,
+	std::vector< std::vector< ak::EmbeddedVertex > > const &active_chains,
+	std::vector< std::vector< uint32_t > > *components_
+) {
+	assert(components_);
+	auto &components = *components_;
+	components.clear();
+
+	if (active_chains.empty()) return;
+	if (active_chains.size() == 1) {
+		//one chain is always one component; no need to trim:
+		components.emplace_back(1, 0);
+		return;
+	}
+
+	//the not-yet-peeled part of the model is everything left of the active chains:
+	ak::Model remaining;
+	std::vector< ak::EmbeddedVertex > remaining_on_model;
+	std::vector< std::vector< uint32_t > > chains_on_remaining;
+	ak::trim_model(model, active_chains, std::vector< std::vector< ak::EmbeddedVertex > >(), &remaining, &remaining_on_model, &chains_on_remaining);
+	assert(chains_on_remaining.size() == active_chains.size());
+
+	//union-find over remaining's vertices:
+	std::vector< uint32_t > parent(remaining.vertices.size());
+	for (uint32_t v = 0; v < parent.size(); ++v) {
+		parent[v] = v;
+	}
+	auto find = [&parent](uint32_t v) {
+		while (parent[v] != v) {
+			parent[v] = parent[parent[v]];
+			v = parent[v];
+		}
+		return v;
+	};
+	auto merge = [&parent,&find](uint32_t a, uint32_t b) {
+		a = find(a);
+		b = find(b);
+		if (a == b) return;
+		//smaller index as root keeps things deterministic:
+		if (a < b) parent[b] = a;
+		else parent[a] = b;
+	};
+	for (auto const &tri : remaining.triangles) {
+		merge(tri.x, tri.y);
+		merge(tri.y, tri.z);
+	}
+
+	//chains are grouped by the component of their vertices:
+	std::unordered_map< uint32_t, uint32_t > root_to_component;
+	for (uint32_t c = 0; c < chains_on_remaining.size(); ++c) {
+		auto const &chain = chains_on_remaining[c];
+		assert(!chain.empty());
+		uint32_t root = find(chain[0]);
+		//PARANOIA: the whole chain should be in one component:
+		for (auto v : chain) {
+			assert(find(v) == root);
+		}
+		auto ret = root_to_component.insert(std::make_pair(root, components.size()));
+		if (ret.second) components.emplace_back();
+		components[ret.first->second].emplace_back(c);
+	}
+
+	if (components.size() > 1) {
+		LOG(Info, Peel) << "Active chains form " << components.size() << " independent components.";
+	}
+}
+
+bool ak::links_pair_chains(
+	uint32_t active_count,
+	uint32_t next_count,
+	std::vector< ak::Link > const &links
+) {
+	if (active_count != next_count) return false;
+	std::vector< uint32_t > next_of_active(active_count, -1U);
+	std::vector< uint32_t > active_of_next(next_count, -1U);
+	for (auto const &l : links) {
+		assert(l.from_chain < active_count && l.to_chain < next_count);
+		if (next_of_active[l.from_chain] == -1U) next_of_active[l.from_chain] = l.to_chain;
+		else if (next_of_active[l.from_chain] != l.to_chain) return false; //split
+		if (active_of_next[l.to_chain] == -1U) active_of_next[l.to_chain] = l.from_chain;
+		else if (active_of_next[l.to_chain] != l.from_chain) return false; //merge
+	}
+	//every chain must be linked (no ends or new starts):
+	for (auto n : next_of_active) {
+		if (n == -1U) return false;
+	}
+	return true;
+}
+
+void ak::peel_components(
+	ak::Parameters const &parameters,
+	ak::Model const &model,
+	ak::EmbeddedVertexCodec const &codec,
+	std::vector< float > const &times,
+	std::vector< std::vector< ak::EmbeddedVertex > > const &active_chains,
+	std::vector< std::vector< ak::Stitch > > const &active_stitches,
+	std::vector< std::vector< uint32_t > > const &components,
+	std::vector< std::vector< ak::EmbeddedVertex > > *next_active_chains_,
+	std::vector< std::vector< ak::Stitch > > *next_active_stitches_,
+	ak::RowColGraph *graph_,
+	std::vector< uint32_t > *times_used_
+) {
+	assert(active_stitches.size() == active_chains.size());
+	assert(times.size() == model.vertices.size());
+
+	assert(next_active_chains_);
+	auto &next_active_chains = *next_active_chains_;
+	next_active_chains.clear();
+
+	assert(next_active_stitches_);
+	auto &next_active_stitches = *next_active_stitches_;
+	next_active_stitches.clear();
+
+	//PARANOIA: every chain is in exactly one component:
+	{
+		std::vector< uint32_t > seen(active_chains.size(), 0);
+		for (auto const &component : components) {
+			assert(!component.empty());
+			for (auto c : component) {
+				assert(c < active_chains.size());
+				seen[c] += 1;
+			}
+		}
+		for (auto s : seen) {
+			assert(s == 1);
+		}
+	}
+
+	//Each component is peeled into its own fragment of the graph.
+	//The fragment starts with copies of the (existing) graph vertices its active stitches refer to;
+	// every other fragment vertex is new and will be appended to the graph when merging.
+	struct Fragment {
+		std::vector< std::vector< EmbeddedVertex > > next_active_chains;
+		std::vector< std::vector< Stitch > > next_active_stitches;
+		RowColGraph graph;
+		std::vector< uint32_t > local_to_graph; //graph index of each copied vertex
+		std::vector< uint32_t > times_used;
+	};
+	std::vector< Fragment > fragments(components.size());
+
+	ak::parallel_for(components.size(), [&](uint32_t f) {
+		auto const &component = components[f];
+		Fragment &fragment = fragments[f];
+
+		std::vector< std::vector< EmbeddedVertex > > chains;
+		std::vector< std::vector< Stitch > > stitches;
+		chains.reserve(component.size());
+		stitches.reserve(component.size());
+		for (auto c : component) {
+			chains.emplace_back(active_chains[c]);
+			stitches.emplace_back(active_stitches[c]);
+		}
+
+		if (graph_) {
+			std::unordered_map< uint32_t, uint32_t > graph_to_local;
+			for (auto &chain_stitches : stitches) {
+				for (auto &s : chain_stitches) {
+					assert(s.vertex < graph_->size());
+					auto ret = graph_to_local.insert(std::make_pair(s.vertex, fragment.local_to_graph.size()));
+					if (ret.second) {
+						fragment.local_to_graph.emplace_back(s.vertex);
+						fragment.graph.add_vertex(graph_->at[s.vertex]);
+					}
+					s.vertex = ret.first->second;
+				}
+			}
+		}
+
+		ak::Model slice;
+		std::vector< ak::EmbeddedVertex > slice_on_model;
+		std::vector< std::vector< uint32_t > > slice_active_chains;
+		std::vector< std::vector< uint32_t > > slice_next_chains;
+		std::vector< bool > slice_next_used_boundary;
+		ak::peel_slice(parameters, model, chains, &slice, &slice_on_model, &slice_active_chains, &slice_next_chains, &slice_next_used_boundary);
+
+		std::vector< float > slice_times;
+		ak::interpolate_batch(slice_on_model, times, &slice_times);
+		if (times_used_) ak::interpolated_vertices(slice_on_model, &fragment.times_used);
+
+		std::vector< std::vector< ak::Stitch > > next_stitches;
+		std::vector< ak::Link > links;
+		ak::link_chains(parameters, slice, slice_times, slice_active_chains, stitches, slice_next_chains, slice_next_used_boundary, &next_stitches, &links);
+
+		ak::build_next_active_chains(slice, slice_on_model, codec, slice_active_chains, stitches, slice_next_chains, next_stitches, slice_next_used_boundary, links, &fragment.next_active_chains, &fragment.next_active_stitches, (graph_ ? &fragment.graph : nullptr));
+	});
+
+	//merge fragments in component order:
+	for (auto &fragment : fragments) {
+		if (graph_) {
+			auto &graph = *graph_;
+			auto const &local = fragment.graph;
+			uint32_t copied = fragment.local_to_graph.size();
+			uint32_t base = graph.size();
+			auto to_graph = [&](uint32_t i) -> uint32_t {
+				if (i == -1U) return -1U;
+				assert(i < local.size());
+				if (i < copied) return fragment.local_to_graph[i];
+				else return base + (i - copied);
+			};
+
+			//copied vertices only gain column links (to new vertices):
+			for (uint32_t i = 0; i < copied; ++i) {
+				assert(local.row_in[i] == -1U && local.row_out[i] == -1U);
+				assert(local.col_in[i][0] == -1U && local.col_in[i][1] == -1U);
+				uint32_t v = fragment.local_to_graph[i];
+				for (uint32_t o = 0; o < 2; ++o) {
+					if (local.col_out[i][o] != -1U) graph.add_col_out(v, to_graph(local.col_out[i][o]));
+				}
+			}
+
+			for (uint32_t i = copied; i < local.size(); ++i) {
+				uint32_t v = graph.add_vertex(local.at[i]);
+				assert(v == to_graph(i));
+				graph.row_in[v] = to_graph(local.row_in[i]);
+				graph.row_out[v] = to_graph(local.row_out[i]);
+				for (uint32_t o = 0; o < 2; ++o) {
+					graph.col_in[v][o] = to_graph(local.col_in[i][o]);
+					graph.col_out[v][o] = to_graph(local.col_out[i][o]);
+				}
+			}
+
+			for (auto &chain_stitches : fragment.next_active_stitches) {
+				for (auto &s : chain_stitches) {
+					s.vertex = to_graph(s.vertex);
+				}
+			}
+		}
+
+		next_active_chains.insert(next_active_chains.end(), fragment.next_active_chains.begin(), fragment.next_active_chains.end());
+		next_active_stitches.insert(next_active_stitches.end(), fragment.next_active_stitches.begin(), fragment.next_active_stitches.end());
+	}
+
+	if (times_used_) {
+		auto &times_used = *times_used_;
+		times_used.clear();
+		for (auto const &fragment : fragments) {
+			times_used.insert(times_used.end(), fragment.times_used.begin(), fragment.times_used.end());
+		}
+		std::sort(times_used.begin(), times_used.end());
+		times_used.erase(std::unique(times_used.begin(), times_used.end()), times_used.end());
+	}
+
+	//PARANOIA:
+	assert(next_active_stitches.size() == next_active_chains.size());
+	if (graph_) {
+		for (auto const &stitches : next_active_stitches) {
+			for (auto const &s : stitches) {
+				assert(s.vertex != -1U);
+				assert(s.vertex < graph_->size());
+			}
+		}
+	}
+}
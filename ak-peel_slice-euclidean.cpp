@@ -1,9 +1,9 @@
 #include "pipeline.hpp"
+#include "log.hpp"
 
 #include <glm/gtx/norm.hpp>
 #include <glm/gtx/hash.hpp>
 
-#include <iostream>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -42,7 +42,7 @@ void ak::peel_slice(
 			if (chain[0] == chain.back()) ++loops;
 			else ++lines;
 		}
-		std::cout << "---- peel slice on [" << loops << " loops and " << lines << " lines] ----" << std::endl;
+		LOG(Info, Peel) << "---- peel slice on [" << loops << " loops and " << lines << " lines] ----";
 	}
 
 	Model clipped;
@@ -69,9 +69,11 @@ void ak::peel_slice(
 		}
 	};
 
+	std::vector< glm::vec3 > chain_pts;
 	for (auto const &chain : active_chains) {
-		for (uint32_t i = 0; i + 1 < chain.size(); ++i) {
-			do_seg(chain[i].interpolate(model.vertices), chain[i+1].interpolate(model.vertices));
+		ak::interpolate_batch(chain, model.vertices, &chain_pts);
+		for (uint32_t i = 0; i + 1 < chain_pts.size(); ++i) {
+			do_seg(chain_pts[i], chain_pts[i+1]);
 		}
 	}
 
@@ -257,7 +259,7 @@ void ak::peel_slice(
 			next_chains.emplace_back();
 			sample_chain(parameters.get_chain_sample_spacing(), model, chain, &next_chains.back());
 		}
-		std::cout << "  extracted " << loops << " loops and " << lines << " lines." << std::endl;
+		LOG(Info, Peel) << "  extracted " << loops << " loops and " << lines << " lines.";
 	}
 
 	//PARANOIA:
@@ -318,7 +320,7 @@ void ak::peel_slice(
 	}
 
 	if (trimmed) {
-		std::cout << "Trimmed " << trimmed << " too-close-for-epm vertices from slice chains." << std::endl;
+		LOG(Info, Peel) << "Trimmed " << trimmed << " too-close-for-epm vertices from slice chains.";
 	}
 }
 
@@ -15,11 +15,14 @@ void ak::sample_chain(
 	//auto &sampled_flags = *sampled_flags_;
 	//sampled_flags.clear();
 
+	std::vector< glm::vec3 > chain_pts;
+	ak::interpolate_batch(chain, model.vertices, &chain_pts);
+
 	for (uint32_t ci = 0; ci + 1 < chain.size(); ++ci) {
 		sampled_chain.emplace_back(chain[ci]);
 
-		glm::vec3 a = chain[ci].interpolate(model.vertices);
-		glm::vec3 b = chain[ci+1].interpolate(model.vertices);
+		glm::vec3 a = chain_pts[ci];
+		glm::vec3 b = chain_pts[ci+1];
 		glm::uvec3 common = EmbeddedVertex::common_simplex(chain[ci].simplex, chain[ci+1].simplex);
 		glm::vec3 wa = chain[ci].weights_on(common);
 		glm::vec3 wb = chain[ci+1].weights_on(common);
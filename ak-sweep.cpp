@@ -0,0 +1,87 @@
+#include "pipeline.hpp"
+#include "parallel.hpp"
+#include "log.hpp"
+
+#include <chrono>
+
+namespace {
+double seconds_since(std::chrono::high_resolution_clock::time_point const &before) {
+	return std::chrono::duration< double >(std::chrono::high_resolution_clock::now() - before).count();
+}
+}
+
+void ak::sweep(
+	ak::Model const &model,
+	std::vector< ak::Constraint > const &constraints,
+	bool use_row_field,
+	std::vector< ak::SweepVariant > *variants_,
+	std::function< void(uint32_t, std::vector< ak::TracedStitch > const &) > const &traced
+) {
+	assert(variants_);
+	auto &variants = *variants_;
+
+	//group variants by the only parameter embedding reads:
+	std::vector< uint32_t > groups; //first variant of each group
+	for (uint32_t v = 0; v < variants.size(); ++v) {
+		float length = variants[v].parameters.get_max_edge_length();
+		variants[v].shared_with = v;
+		for (auto g : groups) {
+			if (variants[g].parameters.get_max_edge_length() == length) {
+				variants[v].shared_with = g;
+				break;
+			}
+		}
+		if (variants[v].shared_with == v) groups.emplace_back(v);
+	}
+	LOG(Info, Batch) << "Sweeping " << variants.size() << " variants (" << groups.size() << " distinct embeddings).";
+
+	//shared prefix: embed + interpolate once per group:
+	struct Shared {
+		Model constrained_model;
+		std::vector< float > times;
+		double embed_seconds = 0.0;
+		double interpolate_seconds = 0.0;
+	};
+	std::vector< Shared > shared(groups.size());
+	ak::parallel_for(groups.size(), [&](uint32_t g) {
+		Shared &s = shared[g];
+		Parameters const &parameters = variants[groups[g]].parameters;
+
+		auto before = std::chrono::high_resolution_clock::now();
+		std::vector< float > constrained_values;
+		embed_constraints(parameters, model, constraints, &s.constrained_model, &constrained_values);
+		s.embed_seconds = seconds_since(before);
+
+		before = std::chrono::high_resolution_clock::now();
+		interpolate_values(s.constrained_model, constrained_values, &s.times);
+		s.interpolate_seconds = seconds_since(before);
+	});
+
+	std::vector< uint32_t > group_of(variants.size(), -1U);
+	for (uint32_t g = 0; g < groups.size(); ++g) {
+		for (uint32_t v = 0; v < variants.size(); ++v) {
+			if (variants[v].shared_with == groups[g]) group_of[v] = g;
+		}
+	}
+
+	//each variant's peeling + tracing:
+	ak::parallel_for(variants.size(), [&](uint32_t v) {
+		SweepVariant &variant = variants[v];
+		Shared const &s = shared[group_of[v]];
+		variant.embed_seconds = s.embed_seconds;
+		variant.interpolate_seconds = s.interpolate_seconds;
+
+		auto before = std::chrono::high_resolution_clock::now();
+		RowColGraph graph;
+		peel(variant.parameters, s.constrained_model, s.times, use_row_field, &graph);
+		variant.peel_seconds = seconds_since(before);
+
+		before = std::chrono::high_resolution_clock::now();
+		std::vector< TracedStitch > stitches;
+		trace_graph(variant.parameters, graph, &stitches, &s.constrained_model);
+		variant.trace_seconds = seconds_since(before);
+		variant.stitches = stitches.size();
+
+		traced(v, stitches);
+	});
+}
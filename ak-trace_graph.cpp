@@ -1,73 +1,210 @@
 #include "pipeline.hpp"
+#include "binary_io.hpp"
+#include "log.hpp"
 
 #include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include <deque>
+
+namespace {
+//Thrown inside GraphTracer when tracing would need to look at part of the graph that may still change;
+// the step that was in progress is rolled back and retried after the next update():
+struct Pause { };
+}
 
-void ak::trace_graph(
-	Parameters const &parameters,
-	ak::RowColGraph const &graph, //in: row-column graph
-	std::vector< ak::TracedStitch > *traced_, //out:traced list of stitches
-	ak::Model *DEBUG_model_ //in (optional): model
-) {
-	std::vector< ak::RowColGraph::Vertex > const &vertices = graph.vertices;
+constexpr ak::TracedStitch::Dir Forward = ak::TracedStitch::CCW;
+constexpr ak::TracedStitch::Dir Backward = ak::TracedStitch::CW;
 
-	assert(traced_);
-	auto &traced = *traced_;
-	traced.clear();
-
-	//PARANOIA:
-	for (auto const &v : vertices) {
-		uint32_t vi = &v - &vertices[0];
-		if (v.row_in != -1U) {
-			assert(v.row_in < vertices.size());
-			assert(vertices[v.row_in].row_out == vi);
-		}
-		if (v.row_out != -1U) {
-			assert(v.row_out < vertices.size());
-			assert(vertices[v.row_out].row_in == vi);
-		}
-		if (v.col_in[0] != -1U) {
-			assert(v.col_in[0] < vertices.size());
-			assert(v.col_in[0] != v.col_in[1]);
-			assert(vertices[v.col_in[0]].col_out[0] == vi || vertices[v.col_in[0]].col_out[1] == vi);
-		}
-		if (v.col_in[1] != -1U) {
-			assert(v.col_in[1] < vertices.size());
-			assert(v.col_in[1] != v.col_in[0]);
-			assert(vertices[v.col_in[1]].col_out[0] == vi || vertices[v.col_in[1]].col_out[1] == vi);
-		}
-		if (v.col_out[0] != -1U) {
-			assert(v.col_out[0] < vertices.size());
-			assert(v.col_out[0] != v.col_out[1]);
-			assert(vertices[v.col_out[0]].col_in[0] == vi || vertices[v.col_out[0]].col_in[1] == vi);
-		}
-		if (v.col_out[1] != -1U) {
-			assert(v.col_out[1] < vertices.size());
-			assert(v.col_out[1] != v.col_out[0]);
-			assert(vertices[v.col_out[1]].col_in[0] == vi || vertices[v.col_out[1]].col_in[1] == vi);
-		}
+struct ak::GraphTracer::Impl {
+	Impl(Parameters const &parameters_, Model const *model_, std::function< void(TracedStitch const &) > const &emit_)
+		: parameters(parameters_), model(model_), emit(emit_) {
+		if (model) codec.reset(new EmbeddedVertexCodec(*model));
 	}
-	//end PARANOIA
 
-	//--------------------
+	Parameters parameters;
+	Model const *model;
+	std::unique_ptr< EmbeddedVertexCodec > codec; //(for graph positions; only if model is set)
+	std::function< void(TracedStitch const &) > emit;
+
+	//graph being traced (only valid during update()/finish()):
+	RowColGraph const *graph = nullptr;
+	//vertices [0, known) have been assigned to rows:
+	uint32_t known = 0;
+	//vertices that may still gain column links:
+	std::vector< bool > in_frontier;
+	std::vector< uint32_t > frontier;
+	//once finishing, the whole graph is final:
+	bool finishing = false;
+	bool done = false;
 
 	struct VertexInfo {
 		uint32_t row = -1U;
 		uint32_t knits = 0;
 		uint32_t last_stitch = -1U;
+		uint32_t stitches = 0; //number of stitches made on this vertex
+		TracedStitch::Type last_type = TracedStitch::None;
 	};
+	std::vector< VertexInfo > info;
+
+	std::vector< uint32_t > row_pending; //column links into the row from vertices not yet knit twice
+	std::vector< uint32_t > row_unfinished; //vertices in the row not yet knit twice
+	std::vector< std::vector< uint32_t > > row_vertices; //vertices of each row, in index order
+	//ready rows (no pending stitches), keyed by their earliest vertex that isn't knit twice;
+	// keys only grow (knits only go up), so stale entries are fixed when they reach the top:
+	std::vector< uint32_t > row_cursor;
+	std::vector< std::pair< uint32_t, uint32_t > > ready; //min-heap of (vertex, row)
+	std::vector< bool > row_emittable; //stitches on the row can no longer change
+
+	//yarn being traced:
+	bool in_yarn = false;
+	uint32_t at = -1U;
+	TracedStitch::Dir dir = Forward;
+	uint32_t yarn = -1U;
+	uint32_t fresh_yarn_id = 0;
+
+	//stitches [emitted, emitted + held.size()) have been traced but not passed to 'emit':
+	struct Held {
+		TracedStitch ts;
+		uint32_t index; //index among stitches on the same vertex
+	};
+	uint32_t emitted = 0;
+	std::deque< Held > held;
 
-	std::vector< VertexInfo > info(vertices.size());
-	std::vector< uint32_t > row_pending;
+	uint32_t traced_count() const { return emitted + uint32_t(held.size()); }
+	TracedStitch &traced(uint32_t i) {
+		assert(i >= emitted && i - emitted < held.size());
+		return held[i - emitted].ts;
+	}
 
-	//divide vertices into rows:
-	for (uint32_t seed = 0; seed < vertices.size(); ++seed) {
+	//undo log for the step in progress:
+	struct Saved {
+		bool in_yarn;
+		uint32_t at;
+		TracedStitch::Dir dir;
+		uint32_t yarn;
+		uint32_t fresh_yarn_id;
+		uint32_t traced_count;
+	} saved;
+	std::vector< std::pair< uint32_t, VertexInfo > > undo_info;
+	std::vector< std::pair< uint32_t, uint32_t > > undo_pending;
+	std::vector< std::pair< uint32_t, uint32_t > > undo_unfinished;
+	std::vector< std::pair< uint32_t, TracedStitch > > undo_traced;
+	//messages from the step in progress (dropped if it is rolled back):
+	std::ostringstream step_log;
+
+	//--------------------
+
+	bool is_final(uint32_t v) const {
+		return finishing || (v < known && !in_frontier[v]);
+	}
+	glm::uvec2 const &col_out(uint32_t v) const {
+		assert(v < known);
+		if (!is_final(v)) throw Pause();
+		return graph->col_out[v];
+	}
+	glm::uvec2 const &col_in(uint32_t v) const {
+		assert(v < known);
+		return graph->col_in[v];
+	}
+	uint32_t row_in(uint32_t v) const {
+		assert(v < known);
+		return graph->row_in[v];
+	}
+	uint32_t row_out(uint32_t v) const {
+		assert(v < known);
+		return graph->row_out[v];
+	}
+
+	VertexInfo &edit_info(uint32_t v) {
+		undo_info.emplace_back(v, info[v]);
+		return info[v];
+	}
+	uint32_t &edit_pending(uint32_t row) {
+		undo_pending.emplace_back(row, row_pending[row]);
+		return row_pending[row];
+	}
+	uint32_t &edit_unfinished(uint32_t row) {
+		undo_unfinished.emplace_back(row, row_unfinished[row]);
+		return row_unfinished[row];
+	}
+	TracedStitch &edit_traced(uint32_t i) {
+		undo_traced.emplace_back(i, traced(i));
+		return traced(i);
+	}
+
+	void push_ready(uint32_t row) {
+		if (row_cursor[row] == row_vertices[row].size()) return;
+		ready.emplace_back(row_vertices[row][row_cursor[row]], row);
+		std::push_heap(ready.begin(), ready.end(), std::greater< std::pair< uint32_t, uint32_t > >());
+	}
+
+	void add_vertices();
+	void set_frontier(std::vector< std::vector< Stitch > > const &active);
+	void run();
+	void step();
+	void make_stitch(uint32_t next, TracedStitch::Type type);
+	bool rule1();
+	bool rule2();
+	bool rule3();
+	bool rule4();
+	bool rule5();
+	bool can_emit(uint32_t row);
+	void emit_ready();
+	void emit_front();
+
+	uint32_t get_next(uint32_t v) const {
+		return (dir == Forward ? row_out(v) : row_in(v));
+	}
+	uint32_t get_prev_child(uint32_t v) const {
+		return (dir == Forward ? col_out(v)[0] : col_out(v)[1]);
+	}
+	uint32_t get_next_child(uint32_t v) const {
+		return (dir == Forward ? col_out(v)[1] : col_out(v)[0]);
+	}
+	uint32_t get_prev_parent(uint32_t v) const {
+		return (dir == Forward ? col_in(v)[0] : col_in(v)[1]);
+	}
+	uint32_t get_next_parent(uint32_t v) const {
+		return (dir == Forward ? col_in(v)[1] : col_in(v)[0]);
+	}
+	bool is_covered(uint32_t v) const {
+		//'covered' == vertex v already has stitches on successors
+		for (uint32_t o = 0; o < 2; ++o) {
+			uint32_t n = col_out(v)[o];
+			if (n != -1U && info[n].knits != 0) return true;
+		}
+		return false;
+	}
+};
+
+//divide newly-added vertices into rows.
+//NOTE: row links and incoming column links are made along with a vertex (only outgoing column links get added later),
+// so a new vertex's row is complete and its row's pending count can be computed right away.
+void ak::GraphTracer::Impl::add_vertices() {
+	uint32_t const count = graph->size();
+	if (count < known) {
+		throw std::runtime_error("GraphTracer: graph lost vertices between updates.");
+	}
+	if (count == known) return;
+	uint32_t const first = known;
+	known = count;
+	info.resize(count);
+	in_frontier.resize(count, false);
+
+	std::vector< uint32_t > todo;
+	for (uint32_t seed = first; seed < count; ++seed) {
 		if (info[seed].row != -1U) continue;
 
 		//make a new course by making a new slot in the pending array:
 		uint32_t row = row_pending.size();
 		row_pending.emplace_back(0);
+		row_unfinished.emplace_back(0);
+		row_vertices.emplace_back();
+		row_cursor.emplace_back(0);
+		row_emittable.emplace_back(false);
 
-		std::vector< uint32_t > todo;
 		info[seed].row = row;
 		todo.emplace_back(seed);
 
@@ -75,9 +212,10 @@ void ak::trace_graph(
 			uint32_t at = todo.back();
 			todo.pop_back();
 			assert(info[at].row == row);
-			for (uint32_t n : {vertices[at].row_in, vertices[at].row_out}) {
+			for (uint32_t n : {row_in(at), row_out(at)}) {
 				if (n != -1U) {
 					if (info[n].row != row) {
+						assert(n >= first && "row links are only made between vertices added together");
 						assert(info[n].row == -1U);
 						info[n].row = row;
 						todo.emplace_back(n);
@@ -87,454 +225,676 @@ void ak::trace_graph(
 		}
 	}
 
-	std::cout << "Found " << row_pending.size() << " rows." << std::endl;
+	uint32_t const first_row = info[first].row;
+	for (uint32_t vi = first; vi < count; ++vi) {
+		uint32_t row = info[vi].row;
+		assert(row >= first_row);
+		row_vertices[row].emplace_back(vi);
+		row_unfinished[row] += 1;
+		//count how many stitches rows are waiting on:
+		for (uint32_t i = 0; i < 2; ++i) {
+			uint32_t p = col_in(vi)[i];
+			if (p != -1U) {
+				//(parents are final once knit twice, so they can't have gained this child since)
+				assert(info[p].knits < 2);
+				row_pending[row] += 1;
+			}
+		}
+	}
+	for (uint32_t r = first_row; r < row_pending.size(); ++r) {
+		if (row_pending[r] == 0) push_ready(r);
+	}
+}
 
-	//count how many stitches rows are waiting on:
-	for (auto const &v : vertices) {
-		for (auto n : v.col_out) {
-			if (n != -1U) {
-				row_pending[info[n].row] += 1;
+void ak::GraphTracer::Impl::set_frontier(std::vector< std::vector< Stitch > > const &active) {
+	for (uint32_t v : frontier) {
+		in_frontier[v] = false;
+	}
+	frontier.clear();
+	for (auto const &chain : active) {
+		for (auto const &s : chain) {
+			if (s.vertex == -1U || in_frontier[s.vertex]) continue;
+			assert(s.vertex < known);
+			//vertices stop gaining links once they leave the active chains; if one came back, earlier tracing may have been wrong:
+			if (info[s.vertex].knits == 2) {
+				throw std::runtime_error("GraphTracer: vertex regained column links after being traced.");
 			}
+			in_frontier[s.vertex] = true;
+			frontier.emplace_back(s.vertex);
 		}
 	}
+}
 
-	//------ actual tracing --------
+//trace until done or until tracing needs a part of the graph that may still change:
+void ak::GraphTracer::Impl::run() {
+	while (!done) {
+		saved.in_yarn = in_yarn;
+		saved.at = at;
+		saved.dir = dir;
+		saved.yarn = yarn;
+		saved.fresh_yarn_id = fresh_yarn_id;
+		saved.traced_count = traced_count();
+		undo_info.clear();
+		undo_pending.clear();
+		undo_unfinished.clear();
+		undo_traced.clear();
+		step_log.str("");
+
+		try {
+			step();
+		} catch (Pause &) {
+			assert(!finishing);
+			//roll back (in reverse order, since entries may repeat):
+			for (auto u = undo_traced.rbegin(); u != undo_traced.rend(); ++u) {
+				if (u->first < saved.traced_count) traced(u->first) = u->second;
+			}
+			while (traced_count() > saved.traced_count) held.pop_back();
+			for (auto u = undo_info.rbegin(); u != undo_info.rend(); ++u) info[u->first] = u->second;
+			for (auto u = undo_pending.rbegin(); u != undo_pending.rend(); ++u) row_pending[u->first] = u->second;
+			for (auto u = undo_unfinished.rbegin(); u != undo_unfinished.rend(); ++u) row_unfinished[u->first] = u->second;
+			in_yarn = saved.in_yarn;
+			at = saved.at;
+			dir = saved.dir;
+			yarn = saved.yarn;
+			fresh_yarn_id = saved.fresh_yarn_id;
+			break;
+		}
 
-	constexpr ak::TracedStitch::Dir Forward = ak::TracedStitch::CCW;
-	constexpr ak::TracedStitch::Dir Backward = ak::TracedStitch::CW;
+		if (step_log.tellp() > 0) LOG(Info, Trace) << step_log.str();
+	}
+}
 
-	uint32_t fresh_yarn_id = 0;
+//one step of tracing: start a yarn or run one rule on the current yarn:
+void ak::GraphTracer::Impl::step() {
+	if (!in_yarn) {
+		at = -1U;
+		dir = Forward;
+		yarn = fresh_yarn_id++;
+		if (!rule1()) {
+			//(rows still to come have later vertices, so may have the next place to start)
+			if (!finishing) throw Pause();
+			done = true;
+			return;
+		}
+		assert(at != -1U);
+		in_yarn = true;
+	} else {
+		//continue running rules until none fire:
+		if (rule2() || rule3() || rule4() || rule5()) return;
 
-	auto trace_yarn = [&]() -> bool {
-		uint32_t at = -1U;
-		ak::TracedStitch::Dir dir = Forward;
-
-		uint32_t prev_stitch = -1U;
-		uint32_t yarn = fresh_yarn_id++;
-	
-		//move to 'next' and make a stitch there:
-		auto make_stitch = [&](uint32_t next, ak::TracedStitch::Type type) {
-
-			//DEBUG:
-			//std::cout << "Make " << char(type) << " at " << next; std::cout.flush(); //DEBUG
-
-			at = next;
-
-			assert(type != ak::TracedStitch::Knit || row_pending[info[at].row] == 0); //tuck on next row sometimes
-			assert(type != ak::TracedStitch::Knit || info[at].knits < 2);
-
-			//some type lawyering:
-			ak::TracedStitch::Type fancy_type;
-			if (type == ak::TracedStitch::Knit) {
-				if (info[at].last_stitch == -1U) {
-					if (vertices[at].col_in[0] == -1U && vertices[at].col_in[1] == -1U) {
-						fancy_type = ak::TracedStitch::Start;
-					} else if (vertices[at].col_in[0] != -1U && vertices[at].col_in[1] != -1U) {
-						fancy_type = ak::TracedStitch::Decrease;
-					} else {
-						fancy_type = type;
-					}
-				} else {
-					assert(info[at].knits <= 1); //could be a miss/tuck before as well
-					if (vertices[at].col_out[0] == -1U && vertices[at].col_out[1] == -1U) {
-						fancy_type = ak::TracedStitch::End;
-					} else if (vertices[at].col_out[0] != -1U && vertices[at].col_out[1] != -1U) {
-						fancy_type = ak::TracedStitch::Increase;
-					} else {
-						fancy_type = type;
-					}
-				}
-			} else { //tuck/miss
-				assert(type == ak::TracedStitch::Tuck || type == ak::TracedStitch::Miss);
-				if (info[at].last_stitch == -1U) {
-					//make sure there was a previous stitch that was an increase:
-					assert(vertices[at].col_in[0] != -1U && vertices[at].col_in[1] == -1U);
-					assert(vertices[at].col_in[0] < vertices.size());
-					assert(vertices[vertices[at].col_in[0]].col_out[0] != -1U && vertices[vertices[at].col_in[0]].col_out[1] != -1U);
-					assert(vertices[at].col_in[0] < info.size());
-					assert(info[vertices[at].col_in[0]].last_stitch != -1U);
-				} else {
-					ak::TracedStitch::Type last_type = traced[info[at].last_stitch].type;
-					assert(last_type != ak::TracedStitch::Increase);
-				}
+		//rule6: when all the other rules stop working, end the yarn.
+		in_yarn = false;
+	}
+}
+
+//move to 'next' and make a stitch there:
+void ak::GraphTracer::Impl::make_stitch(uint32_t next, TracedStitch::Type type) {
+	at = next;
+
+	assert(type != TracedStitch::Knit || row_pending[info[at].row] == 0); //tuck on next row sometimes
+	assert(type != TracedStitch::Knit || info[at].knits < 2);
+
+	//some type lawyering:
+	TracedStitch::Type fancy_type;
+	if (type == TracedStitch::Knit) {
+		if (info[at].last_stitch == -1U) {
+			if (col_in(at)[0] == -1U && col_in(at)[1] == -1U) {
+				fancy_type = TracedStitch::Start;
+			} else if (col_in(at)[0] != -1U && col_in(at)[1] != -1U) {
+				fancy_type = TracedStitch::Decrease;
+			} else {
 				fancy_type = type;
 			}
-			std::cout << " (became " << char(fancy_type) << ")" << std::endl; //DEBUG
-
-			//build stitch:
-			TracedStitch ts;
-			ts.yarn = yarn;
-			if (info[at].last_stitch != -1U) {
-				ts.ins[0] = info[at].last_stitch;
+		} else {
+			assert(info[at].knits <= 1); //could be a miss/tuck before as well
+			if (col_out(at)[0] == -1U && col_out(at)[1] == -1U) {
+				fancy_type = TracedStitch::End;
+			} else if (col_out(at)[0] != -1U && col_out(at)[1] != -1U) {
+				fancy_type = TracedStitch::Increase;
 			} else {
-				if (vertices[at].col_in[0] != -1U) ts.ins[0] = info[vertices[at].col_in[0]].last_stitch;
-				if (vertices[at].col_in[1] != -1U) ts.ins[1] = info[vertices[at].col_in[1]].last_stitch;
-				if (dir == Backward && ts.ins[0] != -1U && ts.ins[1] != -1U) {
-					std::swap(ts.ins[0], ts.ins[1]);
-				}
+				fancy_type = type;
 			}
-			ts.type = fancy_type;
-			ts.dir = dir;
-			ts.vertex = at;
-
-
-			//update info:
-			if (type == ak::TracedStitch::Knit) {
-				info[at].knits += 1;
-				if (info[at].knits == 2) {
-					for (auto n : vertices[at].col_out) {
-						if (n != -1U) {
-							assert(row_pending[info[n].row] > 0);
-							row_pending[info[n].row] -= 1;
-						}
-					}
+		}
+	} else { //tuck/miss
+		assert(type == TracedStitch::Tuck || type == TracedStitch::Miss);
+		if (info[at].last_stitch == -1U) {
+			//make sure there was a previous stitch that was an increase:
+			assert(col_in(at)[0] != -1U && col_in(at)[1] == -1U);
+			assert(col_out(col_in(at)[0])[0] != -1U && col_out(col_in(at)[0])[1] != -1U);
+			assert(info[col_in(at)[0]].last_stitch != -1U);
+		} else {
+			assert(info[at].last_type != TracedStitch::Increase);
+		}
+		fancy_type = type;
+	}
+	if (LOG_ENABLED(Debug, Trace)) {
+		step_log << "Made " << char(fancy_type) << " at " << at << '\n';
+	}
+
+	//build stitch:
+	TracedStitch ts;
+	ts.yarn = yarn;
+	if (info[at].last_stitch != -1U) {
+		ts.ins[0] = info[at].last_stitch;
+	} else {
+		if (col_in(at)[0] != -1U) ts.ins[0] = info[col_in(at)[0]].last_stitch;
+		if (col_in(at)[1] != -1U) ts.ins[1] = info[col_in(at)[1]].last_stitch;
+		if (dir == Backward && ts.ins[0] != -1U && ts.ins[1] != -1U) {
+			std::swap(ts.ins[0], ts.ins[1]);
+		}
+	}
+	ts.type = fancy_type;
+	ts.dir = dir;
+	ts.vertex = at;
+
+	//update info:
+	VertexInfo &ai = edit_info(at);
+	if (type == TracedStitch::Knit) {
+		ai.knits += 1;
+		if (ai.knits == 2) {
+			edit_unfinished(ai.row) -= 1;
+			for (uint32_t o = 0; o < 2; ++o) {
+				uint32_t n = col_out(at)[o];
+				if (n != -1U) {
+					uint32_t &pending = edit_pending(info[n].row);
+					assert(pending > 0);
+					pending -= 1;
+					if (pending == 0) push_ready(info[n].row);
 				}
 			}
-			info[at].last_stitch = traced.size();
+		}
+	}
+	uint32_t ti = traced_count();
+	Held h;
+	h.index = ai.stitches;
+	ai.stitches += 1;
+	ai.last_stitch = ti;
+	ai.last_type = fancy_type;
+
+	//hook up 'out' pointers from the 'in' pointers:
+	for (uint32_t i = 0; i < 2; ++i) {
+		if (ts.ins[i] == -1U) continue;
+		TracedStitch &in = edit_traced(ts.ins[i]);
+		if (in.outs[0] == -1U) {
+			in.outs[0] = ti;
+		} else if (in.outs[1] == -1U) {
+			in.outs[1] = ti;
+		} else {
+			assert(in.outs[0] == -1U || in.outs[1] == -1U); //gotta have some room!
+		}
+	}
 
-			//store stitch:
-			prev_stitch = traced.size();
-			traced.emplace_back(ts);
-		};
+	//store stitch:
+	h.ts = ts;
+	held.emplace_back(h);
+}
+
+//Rule 1: start by knitting a ready but not knit-twice node:
+bool ak::GraphTracer::Impl::rule1() {
+	uint32_t found = -1U;
+	while (!ready.empty()) {
+		uint32_t row = ready[0].second;
+		std::vector< uint32_t > const &verts = row_vertices[row];
+		while (row_cursor[row] < verts.size() && info[verts[row_cursor[row]]].knits >= 2) {
+			row_cursor[row] += 1;
+		}
+		std::pop_heap(ready.begin(), ready.end(), std::greater< std::pair< uint32_t, uint32_t > >());
+		uint32_t key = ready.back().first;
+		ready.pop_back();
+		if (row_cursor[row] == verts.size()) continue; //row is done
+		if (row_pending[row] != 0) continue; //pushed by a step that was rolled back; will be pushed again when ready
+		if (verts[row_cursor[row]] != key) {
+			push_ready(row); //stale key
+			continue;
+		}
+		assert(info[key].knits < 2);
+		found = key;
+		push_ready(row); //(row may still have more to knit)
+		break;
+	}
+	if (found == -1U) return false;
 
-		auto knit = [&](uint32_t next) { make_stitch(next, ak::TracedStitch::Knit); };
-		auto tuck = [&](uint32_t next) { make_stitch(next, ak::TracedStitch::Tuck); };
-		auto miss = [&](uint32_t next) { make_stitch(next, ak::TracedStitch::Miss); };
+	//now shove 'found' to one end of a chain of ready stitches:
+	auto adv = [&](uint32_t *vi) {
+		uint32_t prev = row_in(*vi);
+		//NOTE: probably some special cases to consider here around the ends of short rows; will ignore them for now.
 
-		//Rule 1: start by knitting a ready but not knit-twice node:
-		{
+		//if previous stitch exists but is already knit on, consider moving to a child of that stitch:
+		while (prev != -1U && info[prev].knits >= 2) {
+			assert(row_pending[info[prev].row] == 0); //it's the same row, so... yeah.
 			uint32_t found = -1U;
-			for (uint32_t vi = 0; vi < info.size(); ++vi) {
-				if (row_pending[info[vi].row] == 0 && info[vi].knits < 2) {
-					found = vi;
-					break;
-				}
-			}
-			if (found == -1U) return false;
-			//now shove 'found' to one end of a chain of ready stitches:
-			auto adv = [&](uint32_t *vi) {
-				uint32_t prev = vertices[*vi].row_in;
-				//NOTE: probably some special cases to consider here around the ends of short rows; will ignore them for now.
-
-				//if previous stitch exists but is already knit on, consider moving to a child of that stitch:
-				while (prev != -1U && info[prev].knits >= 2) {
-					assert(row_pending[info[prev].row] == 0); //it's the same row, so... yeah.
-					uint32_t found = -1U;
-					for (uint32_t o : {1 , 0}) {
-						uint32_t child = vertices[prev].col_out[o];
-						if (child == -1U) continue;
-						if (row_pending[info[child].row] != 0) continue;
-						found = child;
-						break;
-					}
-					prev = found;
-				}
-				//no previous stitch (or previous stitch child) was found that could support knits:
-				if (prev == -1U) return false;
-				//previous stitch found that could be knit:
-				assert(row_pending[info[prev].row] == 0);
-				assert(info[prev].knits < 2);
-				*vi = prev;
-				return true;
-			};
-
-			uint32_t found2 = found;
-			while (true) {
-				if (!adv(&found) || found == found2) break;
-				if (!adv(&found) || found == found2) break;
-				bool ret = adv(&found2);
-				assert(ret);
-				if (found == found2) break;
+			for (uint32_t o : {1 , 0}) {
+				uint32_t child = col_out(prev)[o];
+				if (child == -1U) continue;
+				if (row_pending[info[child].row] != 0) continue;
+				found = child;
+				break;
 			}
-
-			//Swap direction based on row-wise neighbors:
-			if (vertices[found].row_out == -1U || info[vertices[found].row_out].knits == 2) dir = Backward;
-			else dir = Forward;
-			knit(found);
+			prev = found;
 		}
-		if (at == -1U) return false;
+		//no previous stitch (or previous stitch child) was found that could support knits:
+		if (prev == -1U) return false;
+		//previous stitch found that could be knit:
+		assert(row_pending[info[prev].row] == 0);
+		assert(info[prev].knits < 2);
+		*vi = prev;
+		return true;
+	};
 
-		auto get_next = [&](uint32_t v) {
-			assert(v < vertices.size());
-			return (dir == Forward ? vertices[v].row_out : vertices[v].row_in);
-		};
+	uint32_t found2 = found;
+	while (true) {
+		if (!adv(&found) || found == found2) break;
+		if (!adv(&found) || found == found2) break;
+		bool ret = adv(&found2);
+		assert(ret);
+		if (found == found2) break;
+	}
 
-		/* unused
-		auto get_prev = [&](uint32_t v) {
-			assert(v < vertices.size());
-			return (dir == Forward ? vertices[v].row_in : vertices[v].row_out);
-		};
-		*/
+	//Swap direction based on row-wise neighbors:
+	if (row_out(found) == -1U || info[row_out(found)].knits == 2) dir = Backward;
+	else dir = Forward;
+	make_stitch(found, TracedStitch::Knit);
+	return true;
+}
 
-		auto get_prev_child = [&](uint32_t v) {
-			assert(v < vertices.size());
-			return (dir == Forward ? vertices[v].col_out[0] : vertices[v].col_out[1]);
-		};
+//Rule 2: move to next row if next row is ready
+bool ak::GraphTracer::Impl::rule2() {
+	uint32_t up = -1U;
+	for (uint32_t n : {get_next_child(at), get_prev_child(at)}) {
+		if (n != -1U && row_pending[info[n].row] == 0) {
+			up = n;
+			break;
+		}
+	}
+	if (up == -1U) return false;
+	//'at' is below 'up' which is ready
 
-		auto get_next_child = [&](uint32_t v) {
-			assert(v < vertices.size());
-			return (dir == Forward ? vertices[v].col_out[1] : vertices[v].col_out[0]);
-		};
+	{ //if 'up' has a next neighbor, just knit over to it:
+		uint32_t up_next = get_next(up);
+		if (up_next != -1U) {
+			make_stitch(up_next, TracedStitch::Knit);
+			return true;
+		}
+	}
 
-		auto get_prev_parent = [&](uint32_t v) {
-			assert(v < vertices.size());
-			return (dir == Forward ? vertices[v].col_in[0] : vertices[v].col_in[1]);
-		};
+	//otherwise, need to (maybe) tuck, then turn:
+	uint32_t next = get_next(at);
 
-		auto get_next_parent = [&](uint32_t v) {
-			assert(v < vertices.size());
-			return (dir == Forward ? vertices[v].col_in[1] : vertices[v].col_in[0]);
-		};
+	if (next != -1U && is_covered(next)) {
+		next = -1U;
+		step_log << "NOTE: not tucking because neighbor is covered.\n";
+	}
 
+	if (next != -1U && info[next].knits == 2 && col_out(next)[0] != -1U && col_out(next)[1] != -1U) {
+		next = get_prev_child(next);
+		step_log << "NOTE: tucking on child of next because of increase.\n";
+	}
 
-		auto is_covered = [&](uint32_t v) {
-			//'covered' == vertex v already has stitches on successors
-			assert(v < vertices.size());
-			for (auto n : vertices[v].col_out) {
-				if (n != -1U && info[n].knits != 0) return true;
-			}
-			return false;
-		};
+	if (next != -1U && info[next].last_type == TracedStitch::End) {
+		step_log << "NOTE: not tucking on next because it is an end.\n";
+		next = -1U;
+	}
 
+	if (next != -1U) {
+		step_log << "  TUCKING[2] at " << next << " which has " << info[next].knits << " knits.\n";
+	}
 
-		//Rule 2: move to next row if next row is ready
-		auto rule2 = [&]() -> bool {
-			uint32_t up = -1U;
-			for (uint32_t n : {get_next_child(at), get_prev_child(at)}) {
-				if (n != -1U && row_pending[info[n].row] == 0) {
-					up = n;
-					break;
-				}
-			}
-			if (up == -1U) return false;
-			//'at' is below 'up' which is ready
-
-			{ //if 'up' has a next neighbor, just knit over to it:
-				uint32_t up_next = get_next(up);
-				if (up_next != -1U) {
-					knit(up_next);
-					return true;
-				}
-			}
+	//tuck 'next', turn, knit 'up':
+	if (next != -1U) make_stitch(next, TracedStitch::Tuck);
+	dir = (dir == Forward ? Backward : Forward);
+	if (next != -1U) make_stitch(next, TracedStitch::Miss);
+	make_stitch(up, TracedStitch::Knit);
+	return true;
+}
 
-			//otherwise, need to (maybe) tuck, then turn:
-			uint32_t next = get_next(at);
+//Rule 3: continue along row if no column edge to ready next stitch:
+bool ak::GraphTracer::Impl::rule3() {
+	//is there a next stitch in this row that needs knitting?
+	uint32_t next = get_next(at);
+	if (next == -1U || info[next].knits >= 2) return false;
 
-			if (next != -1U && is_covered(next)) {
-				next = -1U;
-				std::cout << "NOTE: not tucking because neighbor is covered." << std::endl;
-			}
+	//yep, so knit it:
+	make_stitch(next, TracedStitch::Knit);
+	return true;
+}
 
-			if (next != -1U && info[next].knits == 2 && vertices[next].col_out[0] != -1U && vertices[next].col_out[1] != -1U) {
-				next = get_prev_child(next);
-				std::cout << "NOTE: tucking on child of next because of increase." << std::endl;
-			}
+//Rule 4: tuck and turn at the end of short rows:
+bool ak::GraphTracer::Impl::rule4() {
+	//must be at a stitch knit only once:
+	if (info[at].knits == 2) return false;
+	assert(info[at].knits == 1);
+
+	//must be no next stitch in this row:
+	uint32_t next = get_next(at);
+	if (next != -1U) return false;
+
+	//find parent stitch:
+	uint32_t down = -1U;
+	for (uint32_t n : {get_next_parent(at), get_prev_parent(at)}) {
+		if (n != -1U) {
+			down = n;
+			break;
+		}
+	}
+	if (down == -1U) return false;
+	assert(info[down].knits == 2); //can't be here if parent wasn't knit twice
 
-			if (next != -1U && info[next].last_stitch != -1U && traced[info[next].last_stitch].type == ak::TracedStitch::End) {
-				std::cout << "NOTE: not tucking on next because it is an end." << std::endl;
-				next = -1U;
-			}
+	//if down has a next neighbor, tuck before turning:
+	uint32_t down_next = get_next(down);
 
+	if (down_next != -1U && is_covered(down_next)) {
+		step_log << "NOTE: not tucking in rule4 because down_next is covered.\n";
+		down_next = -1U;
+	}
 
-			if (next != -1U) {
-				std::cout << "  TUCKING[2] at " << next << " which has " << info[next].knits << " knits." << std::endl;
-			}
+	if (down_next != -1U && info[down_next].knits == 2 && col_out(down_next)[0] != -1U && col_out(down_next)[1] != -1U) {
+		down_next = get_prev_child(down_next);
+		step_log << "NOTE: tucking on child of down_next because of increase.\n";
+	}
+	if (down_next != -1U && info[down_next].last_type == TracedStitch::End) {
+		step_log << "NOTE: not tucking on down_next because it is an end.\n";
+		down_next = -1U;
+	}
 
-			//tuck 'next', turn, knit 'up':
-			if (next != -1U) tuck(next);
-			dir = (dir == Forward ? Backward : Forward);
-			if (next != -1U) miss(next);
-			knit(up);
-			return true;
-		};
+	if (down_next != -1U) {
+		step_log << "  TUCKING[4] at " << down_next << " which has " << info[down_next].knits << " knits and outs " << int32_t(col_out(down_next)[0]) << " and " << int32_t(col_out(down_next)[1]) << '\n';
+	}
 
-		//Rule 3: continue along row if no column edge to ready next stitch:
-		auto rule3 = [&]() -> bool {
-			//is there a next stitch in this row that needs knitting?
-			uint32_t next = get_next(at);
-			if (next == -1U || info[next].knits >= 2) return false;
+	uint32_t here = at; //because tuck / miss will change 'at'
+	if (down_next != -1U) make_stitch(down_next, TracedStitch::Tuck);
+	dir = (dir == Forward ? Backward : Forward);
+	if (down_next != -1U) make_stitch(down_next, TracedStitch::Miss);
+	make_stitch(here, TracedStitch::Knit);
+	return true;
+}
 
-			//yep, so knit it:
-			knit(next);
-			return true;
-		};
+//Rule 5: walk off the end of short rows:
+bool ak::GraphTracer::Impl::rule5() {
+	//must be at a stitch knit twice:
+	if (info[at].knits != 2) return false;
+
+	//find next-most parent stitch with a next neighbor:
+	uint32_t par = at;
+	uint32_t par_next = -1U;
+	while (par_next == -1U) {
+		bool found = false;
+		for (uint32_t n : {get_next_parent(par), get_prev_parent(par)}) {
+			if (n != -1U) {
+				par = n;
+				found = true;
+				break;
+			}
+		}
+		if (!found) return false; //ran out of parents
+		par_next = get_next(par);
+	}
+	assert(par_next != -1U);
 
-		//Rule 4: tuck and turn at the end of short rows:
-		auto rule4 = [&]() -> bool {
-			//must be at a stitch knit only once:
-			if (info[at].knits == 2) return false;
-			assert(info[at].knits == 1);
+	if (info[par_next].knits == 2) return false;
+	make_stitch(par_next, TracedStitch::Knit);
 
-			//must be no next stitch in this row:
-			uint32_t next = get_next(at);
-			if (next != -1U) return false;
+	return true;
+}
 
-			//find parent stitch:
-			uint32_t down = -1U;
-			for (uint32_t n : {get_next_parent(at), get_prev_parent(at)}) {
-				if (n != -1U) {
-					down = n;
-					break;
-				}
+//Stitches on a row can no longer change once no more knits can happen on the row, on its parent and child rows,
+// or on the child rows of its parent rows (tucks and misses only land there, right before a knit), and the current
+// yarn isn't sitting on one of those rows. At that point the row's vertices (and their children) all have their stitches,
+// so 'out' pointers and positions are final as well:
+bool ak::GraphTracer::Impl::can_emit(uint32_t row) {
+	if (row_emittable[row]) return true;
+	if (row_unfinished[row] != 0) return false;
+
+	//(knit-twice vertices are final, so their column links can be read)
+	std::vector< uint32_t > near;
+	std::vector< uint32_t > parent_rows;
+	near.emplace_back(row);
+	for (uint32_t v : row_vertices[row]) {
+		for (uint32_t i = 0; i < 2; ++i) {
+			if (col_in(v)[i] != -1U) parent_rows.emplace_back(info[col_in(v)[i]].row);
+			if (col_out(v)[i] != -1U) near.emplace_back(info[col_out(v)[i]].row);
+		}
+	}
+	std::sort(parent_rows.begin(), parent_rows.end());
+	parent_rows.erase(std::unique(parent_rows.begin(), parent_rows.end()), parent_rows.end());
+	for (uint32_t p : parent_rows) {
+		if (row_unfinished[p] != 0) return false;
+		near.emplace_back(p);
+		for (uint32_t v : row_vertices[p]) {
+			for (uint32_t i = 0; i < 2; ++i) {
+				if (col_out(v)[i] != -1U) near.emplace_back(info[col_out(v)[i]].row);
 			}
-			if (down == -1U) return false;
-			assert(info[down].knits == 2); //can't be here if parent wasn't knit twice
+		}
+	}
+	for (uint32_t n : near) {
+		if (row_unfinished[n] != 0) return false;
+		if (in_yarn && info[at].row == n) return false;
+	}
 
-			//if down has a next neighbor, tuck before turning:
-			uint32_t down_next = get_next(down);
+	row_emittable[row] = true;
+	return true;
+}
 
-			if (down_next != -1U && is_covered(down_next)) {
-				std::cout << "NOTE: not tucking in rule4 because down_next is covered." << std::endl;
-				down_next = -1U;
-			}
+//pass along the oldest held stitch:
+void ak::GraphTracer::Impl::emit_front() {
+	assert(!held.empty());
+	Held &h = held.front();
+	TracedStitch &ts = h.ts;
+	uint32_t const vi = ts.vertex;
+	glm::uvec2 const &vi_out = graph->col_out[vi];
+
+	//sort outs using the handy 'vertex' field:
+	if (ts.outs[0] != -1U && ts.outs[1] != -1U) {
+		if (vi_out[0] == traced(ts.outs[1]).vertex
+		 && vi_out[1] == traced(ts.outs[0]).vertex) {
+			std::swap(ts.outs[0], ts.outs[1]);
+		}
+		assert( vi_out[0] == traced(ts.outs[0]).vertex
+		     && vi_out[1] == traced(ts.outs[1]).vertex );
 
-			if (down_next != -1U && info[down_next].knits == 2 && vertices[down_next].col_out[0] != -1U && vertices[down_next].col_out[1] != -1U) {
-				down_next = get_prev_child(down_next);
-				std::cout << "NOTE: tucking on child of down_next because of increase." << std::endl;
+		if (ts.dir == Backward) {
+			std::swap(ts.outs[0], ts.outs[1]);
+		}
+	}
+
+	//set stitch 'at' using model vertex positions:
+	if (model) {
+		auto position = [this](uint32_t v) {
+			return codec->unpack(graph->at[v]).interpolate(model->vertices);
+		};
+		glm::vec3 v_at = position(vi);
+
+		glm::vec3 acc = glm::vec3(0.0f);
+		uint32_t sum = 0;
+		for (uint32_t i = 0; i < 2; ++i) {
+			if (graph->col_in[vi][i] != -1U) {
+				acc += glm::normalize(v_at - position(graph->col_in[vi][i]));
+				sum += 1;
 			}
-			if (down_next != -1U && info[down_next].last_stitch != -1U && traced[info[down_next].last_stitch].type == ak::TracedStitch::End) {
-				std::cout << "NOTE: not tucking on down_next because it is an end." << std::endl;
-				down_next = -1U;
+		}
+		for (uint32_t i = 0; i < 2; ++i) {
+			if (vi_out[i] != -1U) {
+				acc += glm::normalize(position(vi_out[i]) - v_at);
+				sum += 1;
 			}
+		}
+		if (sum == 0) acc = glm::vec3(0.0f, 0.0f, 1.0f);
+		else acc = acc / float(sum);
 
-			if (down_next != -1U) {
-				std::cout << "  TUCKING[4] at " << down_next << " which has " << info[down_next].knits << " knits and outs " << int32_t(vertices[down_next].col_out[0]) << " and " << int32_t(vertices[down_next].col_out[1]) << std::endl;
-			}
+		float amt = float(h.index + 0.5f) / float(info[vi].stitches);
+		amt =  parameters.stitch_height_mm * (0.5 +  (2.0f * (amt - 0.5f)));
+		ts.at = v_at + amt * acc;
+	}
 
+	emit(ts);
+	held.pop_front();
+	emitted += 1;
+}
 
-		
-			uint32_t here = at; //because tuck() / miss() will change 'at'
-			if (down_next != -1U) tuck(down_next);
-			dir = (dir == Forward ? Backward : Forward);
-			if (down_next != -1U) miss(down_next);
-			knit(here);
-			return true;
-		};
+void ak::GraphTracer::Impl::emit_ready() {
+	while (!held.empty() && can_emit(info[held.front().ts.vertex].row)) {
+		emit_front();
+	}
+}
 
-		//Rule 5: walk off the end of short rows:
-		auto rule5 = [&]() -> bool {
-			//must be at a stitch knit twice:
-			if (info[at].knits != 2) return false;
-
-			//find next-most parent stitch with a next neighbor:
-			uint32_t par = at;
-			uint32_t par_next = -1U;
-			while (par_next == -1U) {
-				bool found = false;
-				for (uint32_t n : {get_next_parent(par), get_prev_parent(par)}) {
-					if (n != -1U) {
-						par = n;
-						found = true;
-						break;
-					}
-				}
-				if (!found) return false; //ran out of parents
-				par_next = get_next(par);
-			}
-			assert(par_next != -1U);
+//--------------------
 
-			if (info[par_next].knits == 2) return false;
-			knit(par_next);
+ak::GraphTracer::GraphTracer(Parameters const &parameters, Model const *model, std::function< void(TracedStitch const &) > const &emit)
+	: impl(new Impl(parameters, model, emit)) {
+}
 
-			return true;
-		};
+ak::GraphTracer::~GraphTracer() {
+}
 
-		//continue running rules until none fire:
-		while (
-			   rule2()
-			|| rule3()
-			|| rule4()
-			|| rule5()
-		) { /* spin */ }
+void ak::GraphTracer::update(RowColGraph const &graph, std::vector< std::vector< Stitch > > const &active) {
+	assert(impl);
+	if (impl->finishing) {
+		throw std::runtime_error("GraphTracer: update() after finish().");
+	}
+	impl->graph = &graph;
+	impl->add_vertices();
+	impl->set_frontier(active);
+	impl->run();
+	impl->emit_ready();
+	impl->graph = nullptr;
+
+	LOG(Info, Trace) << "Traced " << impl->traced_count() << " stitches on " << impl->row_pending.size() << " rows; " << impl->emitted << " emitted, " << impl->held.size() << " held.";
+}
 
-		//rule6: when all the other rules stop working, end the yarn.
+void ak::GraphTracer::finish(RowColGraph const &graph) {
+	assert(impl);
+	impl->graph = &graph;
+	impl->add_vertices();
+	impl->finishing = true;
+	impl->run();
+	assert(impl->done);
+	while (!impl->held.empty()) {
+		impl->emit_front();
+	}
+	impl->graph = nullptr;
+}
 
-		return true;
-	};
+uint32_t ak::GraphTracer::rows() const {
+	assert(impl);
+	return impl->row_pending.size();
+}
 
+uint32_t ak::GraphTracer::emitted() const {
+	assert(impl);
+	return impl->emitted;
+}
 
-	//trace yarns until no more yarns:
-	while (trace_yarn()) { /*spin */ }
+//--------------------
 
-	//fix up the 'out' pointers from the 'in' pointers:
-	auto add_out = [&traced](uint32_t ti, uint32_t b) {
-		assert(ti < traced.size());
-		if (traced[ti].outs[0] == -1U) {
-			traced[ti].outs[0] = b;
-		} else if (traced[ti].outs[1] == -1U) {
-			traced[ti].outs[1] = b;
-		} else {
-			assert(traced[ti].outs[0] == -1U || traced[ti].outs[1] == -1U); //gotta have some room!
+void ak::trace_graph(
+	Parameters const &parameters,
+	ak::RowColGraph const &graph, //in: row-column graph
+	std::vector< ak::TracedStitch > *traced_, //out:traced list of stitches
+	ak::Model const *DEBUG_model_ //in (optional): model
+) {
+	//graph arrays:
+	uint32_t const count = graph.size();
+	std::vector< uint32_t > const &row_in = graph.row_in;
+	std::vector< uint32_t > const &row_out = graph.row_out;
+	std::vector< glm::uvec2 > const &col_in = graph.col_in;
+	std::vector< glm::uvec2 > const &col_out = graph.col_out;
+
+	assert(traced_);
+	auto &traced = *traced_;
+	traced.clear();
+
+	LOG(Info, Trace) << "Tracing graph of " << count << " vertices (" << graph.footprint() / (1024.0 * 1024.0) << " MB).";
+
+	//PARANOIA:
+	for (uint32_t vi = 0; vi < count; ++vi) {
+		if (row_in[vi] != -1U) {
+			assert(row_in[vi] < count);
+			assert(row_out[row_in[vi]] == vi);
 		}
-	};
-	for (auto const &ts : traced) {
-		uint32_t ti = &ts - &traced[0];
-		if (ts.ins[0] != -1U) add_out(ts.ins[0], ti);
-		if (ts.ins[1] != -1U) add_out(ts.ins[1], ti);
-	}
-	
-	//sort outs using the handy 'vertex' field:
-	for (auto &ts : traced) {
-		if (ts.outs[0] != -1U && ts.outs[1] != -1U) {
-			if (vertices[ts.vertex].col_out[0] == traced[ts.outs[1]].vertex
-			 && vertices[ts.vertex].col_out[1] == traced[ts.outs[0]].vertex) {
-				std::swap(ts.outs[0], ts.outs[1]);
+		if (row_out[vi] != -1U) {
+			assert(row_out[vi] < count);
+			assert(row_in[row_out[vi]] == vi);
+		}
+		for (uint32_t i = 0; i < 2; ++i) {
+			if (col_in[vi][i] != -1U) {
+				assert(col_in[vi][i] < count);
+				assert(col_in[vi][i] != col_in[vi][1-i]);
+				assert(col_out[col_in[vi][i]][0] == vi || col_out[col_in[vi][i]][1] == vi);
 			}
-			assert( vertices[ts.vertex].col_out[0] == traced[ts.outs[0]].vertex
-			     && vertices[ts.vertex].col_out[1] == traced[ts.outs[1]].vertex );
-
-			if (ts.dir == Backward) {
-				std::swap(ts.outs[0], ts.outs[1]);
+			if (col_out[vi][i] != -1U) {
+				assert(col_out[vi][i] < count);
+				assert(col_out[vi][i] != col_out[vi][1-i]);
+				assert(col_in[col_out[vi][i]][0] == vi || col_in[col_out[vi][i]][1] == vi);
 			}
 		}
 	}
+	//end PARANOIA
 
+	//the whole graph is final, so the incremental tracer runs straight through:
+	GraphTracer tracer(parameters, DEBUG_model_, [&traced](TracedStitch const &ts) {
+		traced.emplace_back(ts);
+	});
+	tracer.finish(graph);
 
-	//set stitch 'at' using model vertex positions:
-	if (DEBUG_model_) {
-		std::vector< glm::vec3 > at; at.reserve(vertices.size());
-		for (auto const &v : vertices) {
-			at.emplace_back(v.at.interpolate(DEBUG_model_->vertices));
-		}
-		assert(at.size() == vertices.size());
-		std::vector< glm::vec3 > up; up.reserve(vertices.size());
-		for (auto const &v : vertices) {
-			glm::vec3 const &v_at = at[&v - &vertices[0]];
-
-			glm::vec3 acc = glm::vec3(0.0f);
-			uint32_t sum = 0;
-			for (uint32_t i = 0; i < 2; ++i) {
-				if (v.col_in[i] != -1U) {
-					acc += glm::normalize(v_at - at[v.col_in[i]]);
-					sum += 1;
-				}
-			}
-			for (uint32_t i = 0; i < 2; ++i) {
-				if (v.col_out[i] != -1U) {
-					acc += glm::normalize(at[v.col_out[i]] - v_at);
-					sum += 1;
-				}
-			}
-			if (sum == 0) acc = glm::vec3(0.0f, 0.0f, 1.0f);
-			else acc = acc / float(sum);
+	LOG(Info, Trace) << "Found " << tracer.rows() << " rows.";
+	assert(tracer.emitted() == traced.size());
+}
 
-			up.emplace_back(acc);
-		}
-		assert(up.size() == vertices.size());
+namespace {
+//TracedStitch with explicit layout (no padding bytes in the file):
+struct StoredTracedStitch {
+	uint32_t yarn;
+	uint32_t ins[2];
+	uint32_t outs[2];
+	uint32_t vertex;
+	glm::vec3 at;
+	char type;
+	char dir;
+	char pad[2];
+};
+static_assert(sizeof(StoredTracedStitch) == 40, "StoredTracedStitch is packed");
+}
 
-		std::vector< uint32_t > count(vertices.size(), 0);
-		std::vector< uint32_t > index; index.reserve(traced.size());
-		for (auto const &ts : traced) {
-			index.emplace_back(count[ts.vertex]);
-			count[ts.vertex] += 1;
-		}
-		assert(index.size() == traced.size());
+void ak::write_traced(std::ostream &out, std::vector< ak::TracedStitch > const &traced) {
+	std::vector< StoredTracedStitch > stored;
+	stored.reserve(traced.size());
+	for (auto const &ts : traced) {
+		stored.emplace_back();
+		StoredTracedStitch &s = stored.back();
+		s.yarn = ts.yarn;
+		s.ins[0] = ts.ins[0]; s.ins[1] = ts.ins[1];
+		s.outs[0] = ts.outs[0]; s.outs[1] = ts.outs[1];
+		s.vertex = ts.vertex;
+		s.at = ts.at;
+		s.type = ts.type;
+		s.dir = ts.dir;
+		s.pad[0] = s.pad[1] = 0;
+	}
+	write_vector(out, stored, "traced stitches");
+}
 
-		for (auto &ts : traced) {
-			uint32_t i = index[&ts - &traced[0]];
-			float amt = float(i + 0.5f) / float(count[ts.vertex]);
-			amt =  parameters.stitch_height_mm * (0.5 +  (2.0f * (amt - 0.5f)));
-			ts.at = at[ts.vertex] + amt * up[ts.vertex];
+void ak::read_traced(std::istream &in, std::vector< ak::TracedStitch > *traced_) {
+	assert(traced_);
+	auto &traced = *traced_;
+	std::vector< StoredTracedStitch > stored;
+	read_vector(in, &stored, "traced stitches");
+	traced.clear();
+	traced.reserve(stored.size());
+	for (auto const &s : stored) {
+		if (s.dir != TracedStitch::CW && s.dir != TracedStitch::AC) throw std::runtime_error("Stored traced stitch has invalid direction.");
+		traced.emplace_back();
+		TracedStitch &ts = traced.back();
+		ts.yarn = s.yarn;
+		ts.ins[0] = s.ins[0]; ts.ins[1] = s.ins[1];
+		ts.outs[0] = s.outs[0]; ts.outs[1] = s.outs[1];
+		ts.vertex = s.vertex;
+		ts.at = s.at;
+		ts.type = TracedStitch::Type(s.type);
+		ts.dir = TracedStitch::Dir(s.dir);
+	}
+	for (auto const &ts : traced) {
+		for (uint32_t i = 0; i < 2; ++i) {
+			if (ts.ins[i] != -1U && ts.ins[i] >= traced.size()) throw std::runtime_error("Stored traced stitch has out-of-range link.");
+			if (ts.outs[i] != -1U && ts.outs[i] >= traced.size()) throw std::runtime_error("Stored traced stitch has out-of-range link.");
 		}
 	}
 }
@@ -1,15 +1,20 @@
 #include "pipeline.hpp"
 
 #include "EmbeddedPlanarMap.hpp"
+#include "parallel.hpp"
+#include "log.hpp"
 
 #include <glm/gtx/hash.hpp>
 
 #include <iostream>
 
-inline std::ostream &operator<<(std::ostream &out, ak::EmbeddedVertex const &ev) {
+//(in namespace ak so LOG statements find it)
+namespace ak {
+inline std::ostream &operator<<(std::ostream &out, EmbeddedVertex const &ev) {
 	out << "(" << ev.weights.x << ", " << ev.weights.y << ", " << ev.weights.z << ")@[" << int32_t(ev.simplex.x) << ", " << int32_t(ev.simplex.y) << ", " << int32_t(ev.simplex.z) << "]";
 	return out;
 }
+}
 
 //EPM value that can track edge splits:
 struct Edge {
@@ -24,32 +29,43 @@ struct Edge {
 	} type;
 	Edge(Type type_, uint32_t a_, uint32_t b_) : a(a_), b(b_), type(type_) { }
 };
-std::vector< Edge > edges;
+//Edge log for the trim_model() call running on this thread.
+//(thread-local so that concurrent trim_model calls -- and EPM worker groups -- each get their own)
+//Entries logged by an EPM worker group are tagged with GroupTag until the group is merged.
+thread_local std::vector< Edge > *edge_log = nullptr;
+thread_local uint32_t edge_tag = 0;
+const uint32_t GroupTag = 0x80000000;
+
+inline uint32_t log_edge(Edge::Type type, uint32_t a, uint32_t b) {
+	assert(edge_log);
+	edge_log->emplace_back(type, a, b);
+	assert(edge_log->size() - 1 < GroupTag);
+	return edge_tag | uint32_t(edge_log->size() - 1);
+}
 
 struct Value {
 	int32_t sum;
 	uint32_t edge;
 	struct Reverse { static inline void reverse(Value *v) {
 		v->sum = - v->sum;
-		edges.emplace_back(Edge::Reverse, v->edge, v->edge);
-		v->edge = edges.size() - 1;
+		v->edge = log_edge(Edge::Reverse, v->edge, v->edge);
 	} };
 	struct Combine { static inline void combine(Value *v, Value const &b) {
 		v->sum += b.sum;
-		edges.emplace_back(Edge::Combine, v->edge, b.edge);
-		v->edge = edges.size() - 1;
+		v->edge = log_edge(Edge::Combine, v->edge, b.edge);
 	} };
 	struct Split { static inline void split(Value const &v, Value *first, Value *second) {
 		first->sum = v.sum;
 		second->sum = v.sum;
 
-		edges.emplace_back(Edge::SplitFirst, v.edge, v.edge);
-		first->edge = edges.size() - 1;
-		edges.emplace_back(Edge::SplitSecond, v.edge, v.edge);
-		second->edge = edges.size() - 1;
+		first->edge = log_edge(Edge::SplitFirst, v.edge, v.edge);
+		second->edge = log_edge(Edge::SplitSecond, v.edge, v.edge);
 	} };
 };
 
+//above this many chain edges (and with more than one worker), chains are inserted with EPM's parallel add_edges():
+const uint32_t BulkInsertEdges = 1024;
+
 void ak::trim_model(
 	ak::Model const &model, //in: model
 	std::vector< std::vector< ak::EmbeddedVertex > > const &left_of,
@@ -112,10 +128,20 @@ void ak::trim_model(
 
 	//embed chains using planar map:
 
-	edges.clear(); //global list used for edge tracking in epm; awkward but should work.
-	EmbeddedPlanarMap< Value, Value::Reverse, Value::Combine, Value::Split > epm;
+	std::vector< Edge > edges;
+	edge_log = &edges;
+	edge_tag = 0;
+	EmbeddedPlanarMap< Value, Value::Reverse, Value::Combine, Value::Split > epm(model.vertices.size(), model.triangles);
 	std::unordered_set< glm::uvec2 > empty_edges; //when it's the same vertex after rounding
 	uint32_t total_chain_edges = 0;
+	for (auto const &chain : left_of) total_chain_edges += chain.size() - 1;
+	for (auto const &chain : right_of) total_chain_edges += chain.size() - 1;
+
+	//for large inputs, chain edges are collected and inserted in bulk:
+	bool const bulk = (total_chain_edges >= BulkInsertEdges && ak::worker_count() > 1);
+	std::vector< EmbeddedEdge< Value > > bulk_edges;
+	if (bulk) bulk_edges.reserve(total_chain_edges);
+
 	uint32_t fresh_id = 0;
 	for (auto const &chain : left_of) {
 		uint32_t prev = epm.add_vertex(chain[0]);
@@ -124,17 +150,16 @@ void ak::trim_model(
 			uint32_t cur = epm.add_vertex(chain[i]);
 			uint32_t cur_id = fresh_id++;
 			if (prev == cur) {
-				std::cout << "NOTE: vertex " << chain[i-1] << " and " << chain[i] << " (in a left_of chain) round to the same value." << std::endl; //DEBUG
+				LOG(Debug, Peel) << "NOTE: vertex " << chain[i-1] << " and " << chain[i] << " (in a left_of chain) round to the same value.";
 				empty_edges.insert(glm::uvec2(prev_id, cur_id));
 			}
 			Value value;
 			value.sum = 1;
-			edges.emplace_back(Edge::Initial, prev_id, cur_id);
-			value.edge = edges.size() - 1;
-			epm.add_edge(prev, cur, value);
+			value.edge = log_edge(Edge::Initial, prev_id, cur_id);
+			if (bulk) bulk_edges.emplace_back(prev, cur, value);
+			else epm.add_edge(prev, cur, value);
 			prev = cur;
 			prev_id = cur_id;
-			++total_chain_edges;
 		}
 	}
 
@@ -145,27 +170,59 @@ void ak::trim_model(
 			uint32_t cur = epm.add_vertex(chain[i]);
 			uint32_t cur_id = fresh_id++;
 			if (prev == cur) {
-				std::cout << "NOTE: vertex " << chain[i-1] << " and " << chain[i] << " (in a right_of chain) round to the same value." << std::endl; //DEBUG
+				LOG(Debug, Peel) << "NOTE: vertex " << chain[i-1] << " and " << chain[i] << " (in a right_of chain) round to the same value.";
 				empty_edges.insert(glm::uvec2(prev_id, cur_id));
 			}
 			Value value;
 			value.sum = (1 << 8);
-			edges.emplace_back(Edge::Initial, cur_id, prev_id);
-			value.edge = edges.size() - 1;
-			epm.add_edge(cur, prev, value);
+			value.edge = log_edge(Edge::Initial, cur_id, prev_id);
+			if (bulk) bulk_edges.emplace_back(cur, prev, value);
+			else epm.add_edge(cur, prev, value);
 			prev = cur;
 			prev_id = cur_id;
-			++total_chain_edges;
 		}
 	}
 
-	uint32_t total_simplex_edges = 0;
-	for (const auto &edges : epm.simplex_edges) {
-		total_simplex_edges += edges.second.size();
+	if (bulk) {
+		//each worker group logs to its own list; lists are appended to 'edges' as groups are merged:
+		std::vector< std::vector< Edge > > group_logs(16);
+		std::vector< uint32_t > group_offsets(group_logs.size(), -1U);
+		auto enter_group = [&](uint32_t g) {
+			if (g == -1U) {
+				edge_log = &edges;
+				edge_tag = 0;
+			} else {
+				assert(g < group_logs.size());
+				edge_log = &group_logs[g];
+				edge_tag = GroupTag;
+			}
+		};
+		auto merge_value = [&](uint32_t g, Value *value) {
+			assert(g < group_logs.size());
+			uint32_t &offset = group_offsets[g];
+			auto translate = [&offset](uint32_t id) {
+				if (id & GroupTag) return offset + (id & ~GroupTag);
+				else return id;
+			};
+			if (offset == -1U) {
+				offset = edges.size();
+				edges.reserve(edges.size() + group_logs[g].size());
+				for (auto const &e : group_logs[g]) {
+					assert(e.type != Edge::Initial);
+					edges.emplace_back(e.type, translate(e.a), translate(e.b));
+				}
+				group_logs[g].clear();
+			}
+			value->edge = translate(value->edge);
+		};
+		epm.add_edges(bulk_edges, enter_group, merge_value, group_logs.size());
+		assert(edge_log == &edges && edge_tag == 0);
 	}
-	std::cout << "EPM has " << epm.vertices.size() << " vertices." << std::endl;
-	std::cout << "EPM has " << epm.simplex_vertices.size() << " simplices with vertices." << std::endl;
-	std::cout << "EPM has " << epm.simplex_edges.size() << " simplices with edges (" << total_simplex_edges << " edges from " << total_chain_edges << " chain edges)." << std::endl;
+	edge_log = nullptr;
+
+	LOG(Info, Peel) << "EPM has " << epm.vertices.size() << " vertices.";
+	LOG(Info, Peel) << "EPM has " << epm.simplices_with_vertices() << " simplices with vertices.";
+	LOG(Info, Peel) << "EPM has " << epm.simplices_with_edges() << " simplices with edges (" << epm.edge_count() << " edges from " << total_chain_edges << " chain edges).";
 
 
 	//clean up any small loops that may exist in chains:
@@ -228,8 +285,8 @@ void ak::trim_model(
 
 		//now iterate actual epm edges and check where they end up mapping.
 		std::unordered_map< glm::uvec2, std::vector< SubEdge > > edge_subedges; //<-- indexed by 'vertex_id' values, contains epm.vertices indices
-		for (auto const &se : epm.simplex_edges) {
-			for (auto const &ee : se.second) {
+		for (uint32_t slot = 0; slot < epm.slot_count(); ++slot) {
+			for (auto const &ee : epm.edges_in(slot)) {
 				assert(ee.value.edge < sources.size());
 				assert(!sources[ee.value.edge].empty());
 				//copy subedge(s) corresponding to this edge to their source edges:
@@ -329,10 +386,8 @@ void ak::trim_model(
 				auto &a = epm.vertices[epm_chain[i]];
 				auto &b = epm.vertices[epm_chain[i+1]];
 				glm::uvec3 common = IntegerEmbeddedVertex::common_simplex(a.simplex, b.simplex);
-				auto f = epm.simplex_edges.find(common);
-				assert(f != epm.simplex_edges.end());
 				bool found = false;
-				for (auto &e : f->second) {
+				for (auto &e : epm.edges_in(epm.simplex_slot(common))) {
 					if (e.first == epm_chain[i] && e.second == epm_chain[i+1]) {
 						e.value.sum -= value;
 						found = true;
@@ -404,7 +459,7 @@ void ak::trim_model(
 		} //while (again)
 		
 		if (verts_removed) {
-			std::cout << "Removed " << verts_removed << " vertices (that's " << length_removed << " units; " << length_removed / initial_length * 100.0 << "% of the initial length of " << initial_length << " units)." << std::endl;
+			LOG(Info, Peel) << "Removed " << verts_removed << " vertices (that's " << length_removed << " units; " << length_removed / initial_length * 100.0 << "% of the initial length of " << initial_length << " units).";
 		}
 
 	};
@@ -427,83 +482,156 @@ void ak::trim_model(
 	epm.split_triangles(model.vertices, model.triangles, &split_verts, &split_tris, &epm_to_split);
 
 
-	//transfer edge values to split mesh:
-	std::unordered_map< glm::uvec2, int32_t > edge_values;
-	for (auto const &se : epm.simplex_edges) {
-		for (auto const &ee : se.second) {
+	//half-edges of the split mesh are numbered 3 * triangle + corner (corner k goes from tri[k] to tri[(k+1)%3]):
+	auto half_from = [&split_tris](uint32_t h) { return split_tris[h / 3][h % 3]; };
+	auto half_to = [&split_tris](uint32_t h) { return split_tris[h / 3][(h % 3 + 1) % 3]; };
+
+	//half-edges leaving each vertex, as CSR:
+	std::vector< uint32_t > out_offsets(split_verts.size() + 1, 0);
+	std::vector< uint32_t > out_halves(split_tris.size() * 3);
+	for (uint32_t h = 0; h < out_halves.size(); ++h) {
+		out_offsets[half_from(h) + 1] += 1;
+	}
+	for (uint32_t v = 0; v < split_verts.size(); ++v) {
+		out_offsets[v + 1] += out_offsets[v];
+	}
+	{
+		std::vector< uint32_t > fill(out_offsets.begin(), out_offsets.end() - 1);
+		for (uint32_t h = 0; h < out_halves.size(); ++h) {
+			out_halves[fill[half_from(h)]++] = h;
+		}
+	}
+	auto find_half = [&](uint32_t a, uint32_t b) -> uint32_t {
+		for (uint32_t i = out_offsets[a]; i < out_offsets[a+1]; ++i) {
+			if (half_to(out_halves[i]) == b) return out_halves[i];
+		}
+		return -1U;
+	};
+
+	//neighboring half-edge (or -1U on boundary); filled in per-block below:
+	std::vector< uint32_t > opposite(split_tris.size() * 3, -1U);
+
+	//transfer edge values to split mesh;
+	// crossing[h] is the change in value when stepping out of h's triangle over h:
+	std::vector< int32_t > crossing(split_tris.size() * 3, 0);
+	for (uint32_t slot = 0; slot < epm.slot_count(); ++slot) {
+		for (auto const &ee : epm.edges_in(slot)) {
 			uint32_t a = epm_to_split[ee.first];
 			uint32_t b = epm_to_split[ee.second];
 			int32_t value = ee.value.sum;
-			auto ret = edge_values.insert(std::make_pair(glm::uvec2(a,b), value));
-			assert(ret.second);
-
-			ret = edge_values.insert(std::make_pair(glm::uvec2(b,a), -value));
-			assert(ret.second);
+			uint32_t ab = find_half(a, b);
+			uint32_t ba = find_half(b, a);
+			assert(ab != -1U || ba != -1U);
+			if (ab != -1U) crossing[ab] = -value;
+			if (ba != -1U) crossing[ba] = value;
 		}
 	}
-	
-	//tag triangles with values:
-	std::unordered_map< glm::uvec2, uint32_t > edge_to_tri;
-	edge_to_tri.reserve(split_tris.size() * 3);
-	for (auto const &tri : split_tris) {
-		uint32_t ti = &tri - &split_tris[0];
-		auto ret = edge_to_tri.insert(std::make_pair(glm::uvec2(tri.x, tri.y), ti)); assert(ret.second);
-		ret = edge_to_tri.insert(std::make_pair(glm::uvec2(tri.y, tri.z), ti)); assert(ret.second);
-		ret = edge_to_tri.insert(std::make_pair(glm::uvec2(tri.z, tri.x), ti)); assert(ret.second);
-	}
-
-	constexpr int32_t const Unvisited = std::numeric_limits< int32_t >::max();
-	std::vector< int32_t > values(split_tris.size(), Unvisited);
 
-	std::vector< bool > keep(split_tris.size(), false);
+	//Label components with a union-find that also tracks value offsets,
+	// so that value[t] == value[parent[t]] + offset[t].
+	//The root of each component is its smallest triangle, which gets the starting value.
+	//NOTE: since roots are smallest indices, parent[t] <= t always holds.
+	std::vector< uint32_t > parent(split_tris.size());
+	std::vector< int32_t > offset(split_tris.size(), 0);
+	for (uint32_t ti = 0; ti < split_tris.size(); ++ti) {
+		parent[ti] = ti;
+	}
+	auto find = [&parent, &offset](uint32_t t, int32_t *t_offset) {
+		//first pass: find root and offset to root:
+		uint32_t root = t;
+		int32_t total = 0;
+		while (parent[root] != root) {
+			total += offset[root];
+			root = parent[root];
+		}
+		//second pass: compress path:
+		int32_t remain = total;
+		while (parent[t] != t) {
+			uint32_t next = parent[t];
+			int32_t step = offset[t];
+			parent[t] = root;
+			offset[t] = remain;
+			remain -= step;
+			t = next;
+		}
+		*t_offset = total;
+		return root;
+	};
+	auto unite = [&](uint32_t h) {
+		uint32_t t = h / 3;
+		uint32_t n = opposite[h] / 3;
+		int32_t ot, on;
+		uint32_t rt = find(t, &ot);
+		uint32_t rn = find(n, &on);
+		//want: value[n] == value[t] + crossing[h]
+		if (rt == rn) {
+			assert(on == ot + crossing[h]);
+		} else if (rt < rn) {
+			parent[rn] = rt;
+			offset[rn] = ot + crossing[h] - on;
+		} else {
+			parent[rt] = rn;
+			offset[rt] = on - ot - crossing[h];
+		}
+	};
 
-	for (uint32_t seed = 0; seed < split_tris.size(); ++seed) {
-		if (values[seed] != Unvisited) continue;
-
-		std::vector< uint32_t > component;
-		component.reserve(split_tris.size());
-
-		values[seed] = (128 << 8) | (128);
-		component.emplace_back(seed);
-
-		for (uint32_t ci = 0; ci < component.size(); ++ci) {
-			uint32_t ti = component[ci];
-			uint32_t value = values[ti];
-			assert(value != Unvisited);
-			glm::uvec3 tri = split_tris[ti];
-			auto over = [&](uint32_t a, uint32_t b) {
-				auto f = edge_to_tri.find(glm::uvec2(b,a));
-				if (f == edge_to_tri.end()) return;
-				int32_t nv = value;
-				auto f2 = edge_values.find(glm::uvec2(b,a));
-				if (f2 != edge_values.end()) nv += f2->second;
-
-				if (values[f->second] == Unvisited) {
-					values[f->second] = nv;
-					component.emplace_back(f->second);
+	{ //union in parallel over blocks of triangles, then join across blocks:
+		uint32_t blocks = std::max(1U, std::min(ak::worker_count(), uint32_t(split_tris.size() / 1024)));
+		std::vector< std::vector< uint32_t > > block_crossings(blocks);
+		auto block_begin = [&](uint32_t b) { return uint32_t(uint64_t(split_tris.size()) * b / blocks); };
+		ak::parallel_for(blocks, [&](uint32_t b) {
+			uint32_t begin = block_begin(b);
+			uint32_t end = block_begin(b+1);
+			for (uint32_t h = 3 * begin; h < 3 * end; ++h) {
+				opposite[h] = find_half(half_to(h), half_from(h));
+				//PARANOIA: mesh is consistently oriented and manifold:
+				assert(find_half(half_from(h), half_to(h)) == h);
+			}
+			for (uint32_t h = 3 * begin; h < 3 * end; ++h) {
+				if (opposite[h] == -1U) continue;
+				uint32_t n = opposite[h] / 3;
+				if (n >= begin && n < end) {
+					//(within-block unions only ever touch the block's own triangles)
+					unite(h);
 				} else {
-					assert(values[f->second] == nv);
+					block_crossings[b].emplace_back(h);
 				}
-			};
-			over(tri.x, tri.y);
-			over(tri.y, tri.z);
-			over(tri.z, tri.x);
+			}
+		});
+		for (auto const &hs : block_crossings) {
+			for (auto h : hs) {
+				unite(h);
+			}
 		}
+	}
 
-		int32_t max_right = 128;
-		int32_t max_left = 128;
-		for (auto ti : component) {
-			int32_t right = values[ti] >> 8;
-			int32_t left = values[ti] & 0xff;
-			max_right = std::max(max_right, right);
-			max_left = std::max(max_left, left);
+	//resolve values (parents come first, so one forward pass suffices):
+	std::vector< int32_t > values(split_tris.size());
+	for (uint32_t ti = 0; ti < split_tris.size(); ++ti) {
+		if (parent[ti] == ti) {
+			values[ti] = (128 << 8) | (128);
+		} else {
+			assert(parent[ti] < ti);
+			values[ti] = values[parent[ti]] + offset[ti];
+			parent[ti] = parent[parent[ti]];
 		}
+	}
 
-		int32_t keep_value = (max_right << 8) | max_left;
-		for (auto ti : component) {
-			if (values[ti] == keep_value) {
-				keep[ti] = true;
-			}
+	//reduce max left/right level per component:
+	std::vector< int32_t > max_right(split_tris.size(), 128);
+	std::vector< int32_t > max_left(split_tris.size(), 128);
+	for (uint32_t ti = 0; ti < split_tris.size(); ++ti) {
+		uint32_t root = parent[ti];
+		max_right[root] = std::max(max_right[root], values[ti] >> 8);
+		max_left[root] = std::max(max_left[root], values[ti] & 0xff);
+	}
+
+	std::vector< bool > keep(split_tris.size(), false);
+	for (uint32_t ti = 0; ti < split_tris.size(); ++ti) {
+		uint32_t root = parent[ti];
+		int32_t keep_value = (max_right[root] << 8) | max_left[root];
+		if (values[ti] == keep_value) {
+			keep[ti] = true;
 		}
 	}
 
@@ -525,12 +653,9 @@ void ak::trim_model(
 			use_vertex(tri.z)
 		);
 	}
-	clipped.vertices.reserve(clipped_vertices.size());
-	for (auto const &v : clipped_vertices) {
-		clipped.vertices.emplace_back(v.interpolate(model.vertices));
-	}
+	ak::interpolate_batch(clipped_vertices, model.vertices, &clipped.vertices);
 
-	std::cout << "Trimmed model from " << model.triangles.size() << " triangles on " << model.vertices.size() << " vertices to " << clipped.triangles.size() << " triangles on " << clipped.vertices.size() << " vertices." << std::endl;
+	LOG(Info, Peel) << "Trimmed model from " << model.triangles.size() << " triangles on " << model.vertices.size() << " vertices to " << clipped.triangles.size() << " triangles on " << clipped.vertices.size() << " vertices.";
 
 	//transform vertex indices for left_of and right_of vertices -> clipped model:
 	auto transform_chain = [&](std::vector< uint32_t > const &epm_chain) {
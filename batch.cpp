@@ -0,0 +1,387 @@
+#include "pipeline.hpp"
+#include "parallel.hpp"
+#include "Stitch.hpp"
+#include "TaggedArguments.hpp"
+#include "log.hpp"
+#include "shell_quote.hpp"
+
+#include <glm/gtx/norm.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <unistd.h>
+
+//Batch runner: runs many (obj, constraints, parameters) jobs through the pipeline on a pool of worker threads,
+// admitting jobs only while their estimated memory fits in a global budget, and streaming
+// per-job results and timings to a summary file.
+
+namespace {
+
+//Rough per-job memory model (deliberately on the high side):
+// - per model vertex: the model, its constrained copy, and interpolation's sparse factorization;
+// - per stitch: graph vertex, traced stitch, and peeling's transient slices/chains around the active rows;
+// - scheduling (a separate 'schedule' process, run once the pipeline's memory is freed) per stitch.
+constexpr uint64_t BaseBytes = 16ULL << 20;
+constexpr uint64_t BytesPerVertex = 2048;
+constexpr uint64_t BytesPerStitch = 512;
+constexpr uint64_t ScheduleBytesPerStitch = 1024;
+
+struct Job {
+	std::string line; //(from manifest, for reporting)
+	std::string obj_file;
+	std::string constraints_file;
+	std::string traced_file;
+	std::string js_file;
+	bool row_field = false;
+	ak::Parameters parameters;
+
+	//estimates:
+	uint32_t vertices = 0;
+	uint32_t triangles = 0;
+	uint64_t estimated_stitches = 0;
+	uint64_t estimated_bytes = BaseBytes;
+};
+
+struct JobResult {
+	bool ok = false;
+	std::string error;
+	uint32_t stitches = 0;
+	double load_seconds = 0.0;
+	double embed_seconds = 0.0;
+	double interpolate_seconds = 0.0;
+	double peel_seconds = 0.0;
+	double trace_seconds = 0.0;
+	double schedule_seconds = 0.0;
+	double total_seconds = 0.0;
+	uint64_t process_rss_bytes = 0; //(whole process -- including any jobs running alongside -- when the job finished)
+};
+
+double seconds_since(std::chrono::high_resolution_clock::time_point const &before) {
+	return std::chrono::duration< double >(std::chrono::high_resolution_clock::now() - before).count();
+}
+
+//current resident set size of this process (0 if unknown):
+uint64_t current_rss_bytes() {
+	std::ifstream statm("/proc/self/statm");
+	uint64_t size = 0, resident = 0;
+	if (!(statm >> size >> resident)) return 0;
+	long page_size = sysconf(_SC_PAGESIZE);
+	return resident * uint64_t(page_size > 0 ? page_size : 4096);
+}
+
+void estimate_job(Job *job_) {
+	assert(job_);
+	auto &job = *job_;
+	ak::Model model;
+	ak::load_obj(job.obj_file, &model);
+	if (model.triangles.empty()) throw std::runtime_error("'" + job.obj_file + "' has no triangles.");
+	job.vertices = model.vertices.size();
+	job.triangles = model.triangles.size();
+
+	double area = 0.0;
+	for (auto const &tri : model.triangles) {
+		glm::vec3 const &a = model.vertices[tri.x];
+		glm::vec3 const &b = model.vertices[tri.y];
+		glm::vec3 const &c = model.vertices[tri.z];
+		area += 0.5 * glm::length(glm::cross(b - a, c - a));
+	}
+	double units_mm = job.parameters.model_units_mm;
+	double stitch_area = double(job.parameters.stitch_width_mm) * double(job.parameters.stitch_height_mm);
+	job.estimated_stitches = uint64_t(area * units_mm * units_mm / std::max(stitch_area, 1e-6));
+
+	uint64_t pipeline = BaseBytes + BytesPerVertex * job.vertices + BytesPerStitch * job.estimated_stitches;
+	uint64_t schedule = (job.js_file != "" ? BaseBytes + ScheduleBytesPerStitch * job.estimated_stitches : 0);
+	job.estimated_bytes = std::max(pipeline, schedule);
+}
+
+JobResult run_job(Job const &job, std::string const &schedule_program) {
+	JobResult result;
+	auto start = std::chrono::high_resolution_clock::now();
+	try {
+		auto before = std::chrono::high_resolution_clock::now();
+		ak::Model model;
+		ak::load_obj(job.obj_file, &model);
+		std::vector< ak::Constraint > constraints;
+		if (job.constraints_file != "") {
+			ak::load_constraints(model, job.constraints_file, &constraints);
+		}
+		result.load_seconds = seconds_since(before);
+
+		{ //pipeline (scoped so its memory is freed before scheduling):
+			before = std::chrono::high_resolution_clock::now();
+			ak::Model constrained_model;
+			std::vector< float > constrained_values;
+			ak::embed_constraints(job.parameters, model, constraints, &constrained_model, &constrained_values);
+			result.embed_seconds = seconds_since(before);
+
+			before = std::chrono::high_resolution_clock::now();
+			std::vector< float > times;
+			ak::interpolate_values(constrained_model, constrained_values, &times);
+			result.interpolate_seconds = seconds_since(before);
+
+			before = std::chrono::high_resolution_clock::now();
+			ak::RowColGraph graph;
+			ak::peel(job.parameters, constrained_model, times, job.row_field, &graph);
+			result.peel_seconds = seconds_since(before);
+
+			before = std::chrono::high_resolution_clock::now();
+			std::vector< ak::TracedStitch > traced;
+			ak::trace_graph(job.parameters, graph, &traced, &constrained_model);
+			result.stitches = traced.size();
+			graph = ak::RowColGraph(); //(free the graph before writing)
+
+			if (job.traced_file != "") {
+				StitchWriter writer(job.traced_file);
+				if (!writer.file) throw std::runtime_error("failed to open '" + job.traced_file + "'");
+				for (auto const &ts : traced) {
+					writer.write(ts);
+				}
+			}
+			result.trace_seconds = seconds_since(before);
+		}
+
+		if (job.js_file != "") {
+			before = std::chrono::high_resolution_clock::now();
+			std::string command = shell_quote(schedule_program) + " " + shell_quote("st:" + job.traced_file) + " " + shell_quote("js:" + job.js_file) + " > " + shell_quote(job.js_file + ".log") + " 2>&1";
+			int status = std::system(command.c_str());
+			result.schedule_seconds = seconds_since(before);
+			if (status != 0) throw std::runtime_error("scheduling failed (see '" + job.js_file + ".log')");
+		}
+
+		result.ok = true;
+	} catch (std::exception &e) {
+		result.error = e.what();
+	}
+	result.total_seconds = seconds_since(start);
+	result.process_rss_bytes = current_rss_bytes();
+	return result;
+}
+
+}
+
+int main(int argc, char **argv) {
+	std::string manifest_file = "";
+	std::string summary_file = "";
+	std::string schedule_program = "";
+	uint32_t workers = ak::worker_count();
+	uint32_t memory_mb = 0;
+	uint32_t log_level = 0;
+	std::string log_modules = "batch=1";
+	std::string log_file = "";
+	{ //parse arguments:
+		TaggedArguments args;
+		args.emplace_back("manifest", &manifest_file, "job list (required); one job per line as obj:, constraints:, obj-scale:, stitch-width:, stitch-height:, link-dtw:, row-field:, save-traced:, js: arguments ('#' starts a comment)");
+		args.emplace_back("summary", &summary_file, "file to stream per-job results and timings to (tab-separated)");
+		args.emplace_back("jobs", &workers, "number of jobs to run at once");
+		args.emplace_back("memory-mb", &memory_mb, "memory budget for all running jobs (MB); 0 for no limit");
+		args.emplace_back("schedule", &schedule_program, "scheduling program to run for jobs with js: (default: 'schedule' next to this program)");
+		args.emplace_back("log-level", &log_level, "console output from each job's pipeline: 0 = quiet, 1 = summaries, 2 = debug dumps");
+		args.emplace_back("log-modules", &log_modules, "per-module log levels overriding 'log-level:' (the default keeps the runner's own progress)");
+		args.emplace_back("log-file", &log_file, "write log output to this file instead of the console");
+		bool usage = !args.parse(argc, argv);
+		if (!usage && manifest_file == "") {
+			std::cerr << "ERROR: 'manifest:' argument is required." << std::endl;
+			usage = true;
+		}
+		if (!usage && workers == 0) {
+			std::cerr << "ERROR: 'jobs:' should be at least one." << std::endl;
+			usage = true;
+		}
+		Log::set_level(log_level);
+		if (!usage && !Log::set_filters(log_modules)) {
+			std::cerr << "ERROR: failed to parse 'log-modules:' list '" << log_modules << "'." << std::endl;
+			usage = true;
+		}
+		if (!usage && !Log::set_file(log_file)) {
+			std::cerr << "ERROR: failed to open log file '" << log_file << "'." << std::endl;
+			return 1;
+		}
+		if (usage) {
+			std::cerr << "Usage:\n\t./batch [tag:value] [...]\n" << args.help_string() << std::endl;
+			return 1;
+		}
+	}
+	if (schedule_program == "") {
+		std::string self = argv[0];
+		auto slash = self.rfind('/');
+		schedule_program = (slash == std::string::npos ? std::string("./") : self.substr(0, slash + 1)) + "schedule";
+	}
+
+	//------------------------------
+
+	std::vector< Job > jobs;
+	{ //read manifest:
+		std::ifstream manifest(manifest_file);
+		if (!manifest) {
+			std::cerr << "ERROR: failed to open manifest '" << manifest_file << "'." << std::endl;
+			return 1;
+		}
+		std::string line;
+		uint32_t line_number = 0;
+		while (std::getline(manifest, line)) {
+			line_number += 1;
+			std::istringstream str(line);
+			std::vector< std::string > words{"job"}; //(TaggedArguments skips the first word)
+			std::string word;
+			while (str >> word) {
+				if (word[0] == '#') break;
+				words.emplace_back(word);
+			}
+			if (words.size() == 1) continue;
+
+			jobs.emplace_back();
+			Job &job = jobs.back();
+			job.line = line;
+			int32_t row_field = 0;
+			TaggedArguments args;
+			args.emplace_back("obj", &job.obj_file, "input obj file (required)");
+			args.emplace_back("constraints", &job.constraints_file, "file to load time constraints from");
+			args.emplace_back("obj-scale", &job.parameters.model_units_mm, "length of one unit in obj file (mm)");
+			args.emplace_back("stitch-width", &job.parameters.stitch_width_mm, "stitch width (mm)");
+			args.emplace_back("stitch-height", &job.parameters.stitch_height_mm, "stitch height (mm)");
+			args.emplace_back("link-dtw", &job.parameters.link_dtw, "if non-zero, link rows by dynamic time warping (falling back to evenly-spaced shaping)");
+			args.emplace_back("row-field", &row_field, "if non-zero, extract rows directly as isolines of the time field before peeling");
+			args.emplace_back("save-traced", &job.traced_file, "save traced stitches to this file");
+			args.emplace_back("js", &job.js_file, "schedule traced stitches to this knitting file (requires save-traced:)");
+			bool ok = args.parse(words);
+			if (ok && job.obj_file == "") {
+				std::cerr << "ERROR: job has no 'obj:'." << std::endl;
+				ok = false;
+			}
+			if (ok && job.js_file != "" && job.traced_file == "") {
+				std::cerr << "ERROR: job has 'js:' but no 'save-traced:'." << std::endl;
+				ok = false;
+			}
+			if (!ok) {
+				std::cerr << "ERROR: bad job on line " << line_number << " of '" << manifest_file << "'.\n" << args.help_string() << std::endl;
+				return 1;
+			}
+			job.row_field = (row_field != 0);
+		}
+	}
+
+	//estimate memory use for each job (loading each model once to measure it):
+	std::vector< std::string > estimate_errors(jobs.size());
+	ak::parallel_for(jobs.size(), [&](uint32_t j) {
+		try {
+			estimate_job(&jobs[j]);
+		} catch (std::exception &e) {
+			estimate_errors[j] = e.what();
+		}
+	}, workers);
+
+	uint64_t budget = uint64_t(memory_mb) << 20;
+	LOG(Info, Batch) << "Running " << jobs.size() << " jobs, " << workers << " at a time"
+		<< (budget != 0 ? ", within " + std::to_string(memory_mb) + "MB" : std::string()) << ".";
+
+	std::ofstream summary;
+	if (summary_file != "") {
+		summary.open(summary_file);
+		if (!summary) {
+			LOG(Error, Batch) << "ERROR: failed to open summary file '" << summary_file << "'.";
+			return 1;
+		}
+		summary << "job\tobj\tstatus\tvertices\tstitches\testimated_stitches\testimated_mb\tprocess_rss_mb\tload_s\tembed_s\tinterpolate_s\tpeel_s\ttrace_s\tschedule_s\ttotal_s\terror\n";
+		summary.flush();
+	}
+
+	//------------------------------
+	//run jobs:
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::vector< bool > started(jobs.size(), false);
+	uint32_t remaining = 0;
+	for (uint32_t j = 0; j < jobs.size(); ++j) {
+		if (estimate_errors[j] == "") remaining += 1;
+		else started[j] = true; //(reported below without running)
+	}
+	uint64_t reserved = 0; //estimated bytes of running jobs
+	uint32_t running = 0;
+	uint32_t failed = 0;
+
+	auto report = [&](uint32_t j, JobResult const &result) {
+		//(called with mutex held)
+		Job const &job = jobs[j];
+		if (!result.ok) failed += 1;
+		LOG(Info, Batch) << "Job " << j << " (" << job.obj_file << ") " << (result.ok ? "finished" : "FAILED") << " in " << result.total_seconds << "s"
+			<< (result.ok ? "" : ": " + result.error);
+		if (summary.is_open()) {
+			summary << j << '\t' << job.obj_file << '\t' << (result.ok ? "ok" : "failed")
+				<< '\t' << job.vertices << '\t' << result.stitches << '\t' << job.estimated_stitches
+				<< '\t' << (job.estimated_bytes >> 20) << '\t' << (result.process_rss_bytes >> 20)
+				<< '\t' << result.load_seconds << '\t' << result.embed_seconds << '\t' << result.interpolate_seconds
+				<< '\t' << result.peel_seconds << '\t' << result.trace_seconds << '\t' << result.schedule_seconds
+				<< '\t' << result.total_seconds << '\t' << result.error << '\n';
+			summary.flush(); //(so results survive if a later job takes the process down)
+		}
+	};
+
+	for (uint32_t j = 0; j < jobs.size(); ++j) {
+		if (estimate_errors[j] != "") {
+			JobResult result;
+			result.error = estimate_errors[j];
+			report(j, result);
+		}
+	}
+
+	auto worker = [&]() {
+		//jobs already run one per core, so work inside each job runs serially:
+		if (workers > 1) ak::in_parallel_for() = true;
+
+		std::unique_lock< std::mutex > lock(mutex);
+		while (true) {
+			//first job (in manifest order) that fits in the budget; if nothing is running, the first job regardless:
+			uint32_t pick = -1U;
+			for (uint32_t j = 0; j < jobs.size(); ++j) {
+				if (started[j]) continue;
+				if (budget == 0 || running == 0 || reserved + jobs[j].estimated_bytes <= budget) {
+					pick = j;
+					break;
+				}
+			}
+			if (pick == -1U) {
+				if (remaining == 0) break;
+				cv.wait(lock);
+				continue;
+			}
+
+			started[pick] = true;
+			remaining -= 1;
+			reserved += jobs[pick].estimated_bytes;
+			running += 1;
+			if (budget != 0 && jobs[pick].estimated_bytes > budget) {
+				LOG(Warning, Batch) << "WARNING: job " << pick << " is estimated at " << (jobs[pick].estimated_bytes >> 20) << "MB, over the whole budget; running it alone.";
+			}
+
+			lock.unlock();
+			JobResult result = run_job(jobs[pick], schedule_program);
+			lock.lock();
+
+			reserved -= jobs[pick].estimated_bytes;
+			running -= 1;
+			report(pick, result);
+			cv.notify_all();
+		}
+	};
+
+	auto before = std::chrono::high_resolution_clock::now();
+	std::vector< std::thread > threads;
+	for (uint32_t t = 0; t < workers; ++t) {
+		threads.emplace_back(worker);
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	LOG(Info, Batch) << "Ran " << jobs.size() << " jobs (" << failed << " failed) in " << seconds_since(before) << "s.";
+
+	return (failed == 0 ? 0 : 1);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+//Helpers for reading/writing simple binary files (raw scalars and counted vectors of plain-old-data),
+// and for hashing the same sort of data.
+//NOTE: all throw std::runtime_error on failure
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cassert>
+#include <cstdint>
+
+template< typename S >
+inline void write_scalar(std::ostream &out, S const &s, std::string const &name) {
+	if (!out.write(reinterpret_cast< const char * >(&s), sizeof(S))) {
+		throw std::runtime_error("Failed to write scalar " + name);
+	}
+}
+
+
+template< typename S >
+inline void read_scalar(std::istream &in, S *_out, std::string const &name) {
+	assert(_out);
+	if (!in.read(reinterpret_cast< char * >(_out), sizeof(S))) {
+		throw std::runtime_error("Failed to read scalar " + name);
+	}
+}
+
+template< typename S >
+inline void write_vector(std::ostream &out, std::vector< S > const &vs, std::string const &name) {
+	uint32_t count = vs.size();
+	write_scalar(out, count, name + " count");
+	if (!out.write(reinterpret_cast< const char * >(vs.data()), sizeof(S) * vs.size())) {
+		throw std::runtime_error("Failed to write vector data for " + name);
+	}
+}
+
+
+template< typename S >
+inline void read_vector(std::istream &in, std::vector< S > *_out, std::string const &name) {
+	assert(_out);
+	auto &out = *_out;
+	uint32_t count;
+	read_scalar(in, &count, name + " count");
+	out.assign(count, S());
+	if (!in.read(reinterpret_cast< char * >(out.data()), sizeof(S) * out.size())) {
+		throw std::runtime_error("Failed to read vector data for " + name);
+	}
+}
+
+inline void read_eof(std::istream &in, std::string const &name) {
+	if (std::istream::traits_type::not_eof( in.get() )) {
+		throw std::runtime_error("Trailing data reading " + name);
+	}
+}
+
+//vectors of vectors (count, then each vector):
+template< typename S >
+inline void write_vectors(std::ostream &out, std::vector< std::vector< S > > const &vss, std::string const &name) {
+	uint32_t count = vss.size();
+	write_scalar(out, count, name + " count");
+	for (auto const &vs : vss) {
+		write_vector(out, vs, name);
+	}
+}
+
+template< typename S >
+inline void read_vectors(std::istream &in, std::vector< std::vector< S > > *_out, std::string const &name) {
+	assert(_out);
+	auto &out = *_out;
+	uint32_t count;
+	read_scalar(in, &count, name + " count");
+	out.assign(count, std::vector< S >());
+	for (auto &vs : out) {
+		read_vector(in, &vs, name);
+	}
+}
+
+//64-bit FNV-1a hash of raw bytes, for content-addressed keys (not cryptographic):
+struct ContentHash {
+	uint64_t value = 0xcbf29ce484222325ULL;
+	void add(void const *data, size_t size) {
+		unsigned char const *bytes = reinterpret_cast< unsigned char const * >(data);
+		for (size_t i = 0; i < size; ++i) {
+			value ^= bytes[i];
+			value *= 0x100000001b3ULL;
+		}
+	}
+	void add(std::string const &s) {
+		add(uint64_t(s.size()));
+		add(s.data(), s.size());
+	}
+	template< typename T >
+	void add(T const &t) { add(&t, sizeof(T)); }
+	template< typename T >
+	void add(std::vector< T > const &ts) {
+		add(uint64_t(ts.size()));
+		add(ts.data(), ts.size() * sizeof(T));
+	}
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+//Wire format shared by the resident pipeline daemon ('pipeline_daemon') and its client ('pipeline_client').
+//
+//One request per connection on a Unix-domain socket. Every message is a frame: a uint32 byte count
+// (native byte order -- both ends are on the same machine) followed by that many bytes.
+//
+//Request: one frame holding a command line, e.g.
+//    load obj:/path/to/model.obj
+//    run model:<16 hex digits> constraints:/path/to/model.cons stitch-width:3.66 schedule:1
+//    stats
+//    quit
+//Response: one frame starting with "ok" or "error", followed by whatever the command returns;
+// 'run' then streams the traced stitches (.st) and the scheduled knitting program (.js) as
+// runs of frames, each run ended by an empty frame.
+
+#include <cerrno>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#include <unistd.h>
+
+namespace daemon_protocol {
+
+//largest frame sent when streaming files:
+constexpr uint32_t ChunkSize = 1 << 16;
+
+inline bool write_all(int fd, void const *data_, size_t size) {
+	char const *data = reinterpret_cast< char const * >(data_);
+	while (size > 0) {
+		ssize_t ret = ::write(fd, data, size);
+		if (ret < 0 && errno == EINTR) continue;
+		if (ret <= 0) return false;
+		data += ret;
+		size -= ret;
+	}
+	return true;
+}
+
+inline bool read_all(int fd, void *data_, size_t size) {
+	char *data = reinterpret_cast< char * >(data_);
+	while (size > 0) {
+		ssize_t ret = ::read(fd, data, size);
+		if (ret < 0 && errno == EINTR) continue;
+		if (ret <= 0) return false;
+		data += ret;
+		size -= ret;
+	}
+	return true;
+}
+
+inline bool send_frame(int fd, std::string const &data) {
+	uint32_t size = data.size();
+	return write_all(fd, &size, sizeof(size)) && write_all(fd, data.data(), data.size());
+}
+
+//NOTE: 'limit' guards against garbage sizes from a confused peer.
+inline bool recv_frame(int fd, std::string *data_, uint32_t limit = 1 << 26) {
+	auto &data = *data_;
+	uint32_t size;
+	if (!read_all(fd, &size, sizeof(size))) return false;
+	if (size > limit) return false;
+	data.resize(size);
+	return read_all(fd, &data[0], size);
+}
+
+//send a file's contents as a run of frames ended by an empty frame (a missing file sends an empty run):
+inline bool send_file(int fd, std::string const &filename) {
+	std::ifstream in(filename, std::ios::binary);
+	std::string chunk(ChunkSize, '\0');
+	while (in) {
+		in.read(&chunk[0], chunk.size());
+		std::streamsize got = in.gcount();
+		if (got <= 0) break;
+		if (!send_frame(fd, chunk.substr(0, got))) return false;
+	}
+	return send_frame(fd, "");
+}
+
+//receive a run of frames into a file (or discard them, if 'out' isn't open):
+inline bool recv_file(int fd, std::ofstream &out, uint64_t *total = nullptr) {
+	std::string chunk;
+	if (total) *total = 0;
+	while (true) {
+		if (!recv_frame(fd, &chunk)) return false;
+		if (chunk.empty()) return true;
+		if (out.is_open()) out.write(chunk.data(), chunk.size());
+		if (total) *total += chunk.size();
+	}
+}
+
+} //namespace daemon_protocol
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Small dataflow graph for driving pipeline stages.
+// Each node computes some outputs (held elsewhere, e.g. in Interface) from the outputs of its input nodes.
+// Nodes remember the versions of their inputs they last computed from, so update() recomputes a node
+// only if one of its inputs has changed since -- and a node whose recompute left its outputs unchanged
+// doesn't make its dependents recompute.
+// Nodes that don't depend on each other run concurrently (except those that must run on the calling thread).
+
+namespace ak {
+
+struct Dataflow {
+	typedef uint32_t Node;
+
+	//add a source: data modified from outside the graph (call changed() after modifying it):
+	Node add_source(std::string const &name);
+
+	//add a computed node; inputs must already exist (so nodes are always added in a valid evaluation order).
+	//'compute' returns true if the node's outputs changed (false lets dependents skip recomputing).
+	//NOTE: concurrently-running nodes must not write anything the other reads or writes;
+	//  list an input for every node whose outputs this one reads *or* modifies.
+	Node add_node(
+		std::string const &name,
+		std::vector< Node > const &inputs,
+		std::function< bool() > const &compute,
+		bool main_thread = false //if set, always run on the thread calling update() (e.g., for GL uploads)
+	);
+
+	//the outputs of a node were changed from outside (e.g. the user edited constraints):
+	//NOTE: may be called from inside a compute function
+	void changed(Node node);
+	//force a node to recompute at its next update (e.g. it reads state not expressed as an input):
+	void invalidate(Node node);
+
+	//would update(node) have to recompute anything?
+	bool stale(Node node) const;
+
+	//bring nodes (and everything they depend on) up to date:
+	//NOTE: compute functions must not call update() themselves.
+	//NOTE: if a compute function throws, nodes already running are allowed to finish, the failed node stays
+	//  stale (so it will be retried), and the first exception is re-thrown.
+	void update(std::vector< Node > const &targets);
+	void update(Node target) { update(std::vector< Node >{target}); }
+
+	struct NodeInfo {
+		std::string name;
+		std::vector< Node > inputs;
+		std::function< bool() > compute; //(empty for sources)
+		bool main_thread = false;
+		uint32_t version = 1; //incremented whenever outputs change
+		std::vector< uint32_t > seen; //versions of inputs when last computed
+		bool invalid = true; //never computed, failed, or invalidated
+		//for instrumentation:
+		uint32_t computes = 0;
+		double seconds = 0.0;
+	};
+	std::vector< NodeInfo > nodes;
+
+	//(guards 'nodes' bookkeeping while update() is running computes on other threads)
+	mutable std::mutex mutex;
+
+private:
+	bool stale_locked(Node node, std::vector< int8_t > *memo) const;
+	bool own_stale_locked(Node node) const;
+};
+
+} //namespace ak
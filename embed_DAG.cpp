@@ -1,9 +1,10 @@
 #include "embed_DAG.hpp"
+#include "log.hpp"
 
 #include <set>
 #include <map>
 #include <algorithm>
-#include <iostream>
+#include <sstream>
 #include <unordered_set>
 #include <unordered_map>
 #include <functional>
@@ -19,7 +20,7 @@ bool embed_DAG(
 
 	for (auto const &node : nodes) {
 		if (node.options.empty()) {
-			std::cerr << "WARNING: embed_DAG will fail because a node has no options." << std::endl;
+			LOG(Warning, Schedule) << "WARNING: embed_DAG will fail because a node has no options.";
 			return false;
 		}
 	}
@@ -320,10 +321,13 @@ bool embed_DAG(
 			//assert(res.second);
 			if ((++step) % 10000 == 0) {
 				//DEBUG:
-				std::cout << /*expanded.size() << "/" <<*/ visited.size() << "/" << to_expand.size() << "   ";
-				std::cout << "[" << state.step << "]";
-				for (auto s : state.selected) std::cout << ' ' << (s == -1U ? std::string(".") : std::to_string(s));
-				std::cout << std::endl;
+				if (LOG_ENABLED(Info, Schedule)) {
+					std::ostringstream progress;
+					progress << /*expanded.size() << "/" <<*/ visited.size() << "/" << to_expand.size() << "   ";
+					progress << "[" << state.step << "]";
+					for (auto s : state.selected) progress << ' ' << (s == -1U ? std::string(".") : std::to_string(s));
+					LOG(Info, Schedule) << progress.str();
+				}
 			}
 
 			if (state.step < select_order.size()) {
@@ -1,10 +1,16 @@
 
 #include "Interface.hpp"
 #include "TaggedArguments.hpp"
+#include "Stitch.hpp"
+#include "binary_io.hpp"
+#include "log.hpp"
 
 #include <kit/kit.hpp>
 #include <kit/Load.hpp>
 
+#include <fstream>
+#include <sstream>
+
 kit::Config kit_config() {
 	kit::Config config;
 	config.size = glm::uvec2(1000, 800);
@@ -20,9 +26,18 @@ std::shared_ptr< kit::Mode > kit_mode() {
 	std::string save_constraints_file = "";
 	std::string constraints_file = "";
 	std::string save_traced_file = "";
+	std::string checkpoint_prefix = "";
+	int32_t checkpoint_every = 1;
+	std::string resume_file = "";
+	std::string cache_dir = "";
+	std::string sweep_file = "";
 	int32_t peel_test = 0;
 	int32_t peel_step = 0;
 	int32_t test_constraints = 0;
+	int32_t row_field = 0;
+	uint32_t log_level = 1;
+	std::string log_modules = "";
+	std::string log_file = "";
 	ak::Parameters parameters;
 	{
 		TaggedArguments args;
@@ -35,8 +50,18 @@ std::shared_ptr< kit::Mode > kit_mode() {
 		args.emplace_back("save-traced", &save_traced_file, "save traced stitches to this file");
 		args.emplace_back("stitch-width", &parameters.stitch_width_mm, "stitch width (mm)");
 		args.emplace_back("stitch-height", &parameters.stitch_height_mm, "stitch height (mm)");
+		args.emplace_back("link-dtw", &parameters.link_dtw, "if non-zero, link rows by dynamic time warping (falling back to evenly-spaced shaping)");
+		args.emplace_back("log-level", &log_level, "console output: 0 = quiet, 1 = summaries, 2 = debug dumps");
+		args.emplace_back("log-modules", &log_modules, "per-module log levels overriding 'log-level:', e.g. 'link=2,peel=0'");
+		args.emplace_back("log-file", &log_file, "write log output to this file instead of the console");
 		args.emplace_back("peel-test", &peel_test, "run N rounds of peeling then quit (-1 to run until done)");
 		args.emplace_back("peel-step", &peel_step, "run N rounds of peeling then show interface (-1 to run until done)");
+		args.emplace_back("row-field", &row_field, "if non-zero, extract rows directly as isolines of the time field before peeling");
+		args.emplace_back("checkpoint", &checkpoint_prefix, "save peeling checkpoints to files named <checkpoint>.<step>");
+		args.emplace_back("checkpoint-every", &checkpoint_every, "save a peeling checkpoint every N rounds of peeling");
+		args.emplace_back("resume", &resume_file, "resume peeling from this checkpoint file (peel-test/peel-step then count from its step)");
+		args.emplace_back("sweep", &sweep_file, "run the whole pipeline for each variant listed in this file (one per line: stitch-width:, stitch-height:, link-dtw:, save-traced: overriding the arguments here; save-traced: defaults to <save-traced>.<variant>), sharing work between variants where possible, then quit");
+		args.emplace_back("cache", &cache_dir, "directory (must exist) in which to cache stage outputs; stages whose inputs match a cached entry are skipped");
 		bool usage = !args.parse(kit::args);
 		if (!usage && obj_file == "") {
 			std::cerr << "ERROR: 'obj:' argument is required." << std::endl;
@@ -46,6 +71,19 @@ std::shared_ptr< kit::Mode > kit_mode() {
 			std::cerr << "ERROR: Please specify only one of 'peel-test:' and 'peel-step:'" << std::endl;
 			usage = true;
 		}
+		if (!usage && checkpoint_every < 1) {
+			std::cerr << "ERROR: 'checkpoint-every:' should be at least one." << std::endl;
+			usage = true;
+		}
+		Log::set_level(log_level);
+		if (!usage && !Log::set_filters(log_modules)) {
+			std::cerr << "ERROR: failed to parse 'log-modules:' list '" << log_modules << "'." << std::endl;
+			usage = true;
+		}
+		if (!usage && !Log::set_file(log_file)) {
+			std::cerr << "ERROR: failed to open log file '" << log_file << "'." << std::endl;
+			return nullptr;
+		}
 		if (usage) {
 			std::cerr << "Usage:\n\t./interface [tag:value] [...]\n" << args.help_string() << std::endl;
 			return nullptr;
@@ -56,7 +94,7 @@ std::shared_ptr< kit::Mode > kit_mode() {
 	ak::load_obj(obj_file, &model);
 
 	if (model.triangles.empty()) {
-		std::cerr << "ERROR: model is empty." << std::endl;
+		LOG(Error, Interface) << "ERROR: model is empty.";
 		return nullptr;
 	}
 
@@ -67,13 +105,83 @@ std::shared_ptr< kit::Mode > kit_mode() {
 		try {
 			ak::load_constraints(model, constraints_file, &constraints);
 		} catch (std::exception const &e) {
-			std::cerr << "WARNING: failed to load from '" << constraints_file << "' (" << e.what() << ")>" << std::endl;
+			LOG(Warning, Interface) << "WARNING: failed to load from '" << constraints_file << "' (" << e.what() << ")>";
 		}
 	}
 
+	if (sweep_file != "") {
+		std::vector< ak::SweepVariant > variants;
+		std::vector< std::string > traced_files;
+		std::ifstream sweep(sweep_file);
+		if (!sweep) {
+			LOG(Error, Interface) << "ERROR: failed to open sweep file '" << sweep_file << "'.";
+			return nullptr;
+		}
+		std::string line;
+		while (std::getline(sweep, line)) {
+			std::istringstream str(line);
+			std::vector< std::string > words{"sweep"}; //(TaggedArguments skips the first word)
+			std::string word;
+			while (str >> word) {
+				if (word[0] == '#') break;
+				words.emplace_back(word);
+			}
+			if (words.size() == 1) continue;
+
+			variants.emplace_back();
+			variants.back().parameters = parameters;
+			traced_files.emplace_back("");
+			TaggedArguments args;
+			args.emplace_back("stitch-width", &variants.back().parameters.stitch_width_mm, "stitch width (mm)");
+			args.emplace_back("stitch-height", &variants.back().parameters.stitch_height_mm, "stitch height (mm)");
+			args.emplace_back("link-dtw", &variants.back().parameters.link_dtw, "link rows by dynamic time warping");
+			args.emplace_back("save-traced", &traced_files.back(), "save traced stitches to this file");
+			if (!args.parse(words)) {
+				std::cerr << "ERROR: failed to parse sweep variant '" << line << "'.\n" << args.help_string() << std::endl;
+				return nullptr;
+			}
+			//variants are traced in parallel, so each needs its own output file:
+			if (traced_files.back() == "" && save_traced_file != "") {
+				traced_files.back() = save_traced_file + "." + std::to_string(variants.size() - 1);
+			}
+			for (uint32_t v = 0; v + 1 < traced_files.size(); ++v) {
+				if (traced_files.back() != "" && traced_files[v] == traced_files.back()) {
+					LOG(Error, Interface) << "ERROR: sweep variants " << v << " and " << (traced_files.size() - 1) << " both save traced stitches to '" << traced_files.back() << "'.";
+					return nullptr;
+				}
+			}
+		}
+
+		ak::sweep(model, constraints, (row_field != 0), &variants, [&traced_files](uint32_t v, std::vector< ak::TracedStitch > const &traced) {
+			if (traced_files[v] == "") return;
+			StitchWriter writer(traced_files[v]);
+			for (auto const &ts : traced) {
+				writer.write(ts);
+			}
+		});
+
+		LOG(Info, Interface) << "Sweep results:";
+		for (uint32_t v = 0; v < variants.size(); ++v) {
+			auto const &variant = variants[v];
+			std::ostringstream result;
+			result << "  [" << v << "] " << variant.parameters.stitch_width_mm << "mm x " << variant.parameters.stitch_height_mm << "mm: "
+				<< variant.stitches << " stitches";
+			if (traced_files[v] != "") result << " -> '" << traced_files[v] << "'";
+			result << "; embed " << variant.embed_seconds << "s + interpolate " << variant.interpolate_seconds << "s";
+			if (variant.shared_with != v) result << " (shared with [" << variant.shared_with << "])";
+			result << ", peel " << variant.peel_seconds << "s, trace " << variant.trace_seconds << "s.";
+			LOG(Info, Interface) << result.str();
+		}
+		return nullptr;
+	}
+
 	std::shared_ptr< Interface > interface = std::make_shared< Interface >();
 
 	interface->parameters = parameters;
+	interface->use_row_field = (row_field != 0);
+	interface->checkpoint_prefix = checkpoint_prefix;
+	interface->checkpoint_every = uint32_t(checkpoint_every);
+	interface->stage_cache.directory = cache_dir;
 
 	if (save_constraints_file != "") {
 		interface->save_constraints_file = save_constraints_file;
@@ -88,18 +196,76 @@ std::shared_ptr< kit::Mode > kit_mode() {
 		interface->DEBUG_test_linking(test_constraints < 0);
 	}
 
+	if (resume_file != "") {
+		try {
+			interface->resume_peeling(resume_file);
+		} catch (std::exception const &e) {
+			LOG(Error, Interface) << "ERROR: failed to resume peeling (" << e.what() << ")";
+			return nullptr;
+		}
+	}
+
 	if (peel_test != 0 || peel_step != 0) {
 		uint32_t target = (peel_test != 0 ? uint32_t(peel_test) : uint32_t(peel_step));
-		interface->clear_peeling();
-		while (interface->peel_step <= target) {
+		if (resume_file == "") interface->clear_peeling();
+
+		//headless peeling is a function of parameters, model, times, and round count, so its graph can be cached:
+		//(peel-step is not cached since the interface shows peeling's intermediate state)
+		uint64_t peel_key = 0;
+		bool peel_cached = false;
+		if (peel_test != 0 && interface->stage_cache.enabled()) {
+			interface->dataflow.update(interface->times_node);
+			ContentHash key;
+			key.add(ak::hash_peel_inputs(interface->parameters, interface->constrained_model, interface->times));
+			key.add(interface->use_row_field);
+			key.add(target);
+			peel_key = key.value;
+			ak::RowColGraph graph;
+			peel_cached = interface->stage_cache.load("peel", peel_key, [&graph](std::istream &in) {
+				ak::read_graph(in, &graph);
+			});
+			if (peel_cached) {
+				interface->clear_peeling();
+				interface->rowcol_graph = std::move(graph);
+			}
+		}
+
+		//when only saving the result, trace rows as soon as they are finished and stream stitches to the file:
+		//(not when caching, since the trace cache needs the whole trace)
+		std::unique_ptr< StitchWriter > traced_writer;
+		std::unique_ptr< ak::GraphTracer > tracer;
+		if (peel_test != 0 && save_traced_file != "" && !interface->stage_cache.enabled()) {
+			LOG(Info, Interface) << "Streaming traced stitches to '" << save_traced_file << "'.";
+			traced_writer.reset(new StitchWriter(save_traced_file));
+			tracer.reset(new ak::GraphTracer(parameters, &interface->constrained_model, [&traced_writer](ak::TracedStitch const &ts) {
+				traced_writer->write(ts);
+			}));
+		}
+
+		while (!peel_cached && interface->peel_step <= target) {
 			if (!interface->step_peeling()) {
-				std::cout << "--- NOTE: peeling finished ---" << std::endl;
+				LOG(Info, Interface) << "--- NOTE: peeling finished ---";
 				break;
 			}
+			//graph just grew; the next active stitches are the only vertices that can still gain links:
+			if (tracer && interface->peel_action == Interface::PeelRepeat) {
+				tracer->update(interface->rowcol_graph, interface->next_active_stitches);
+			}
 		}
-		if (save_traced_file != "") {
+		if (peel_test != 0 && !peel_cached && interface->stage_cache.enabled()) {
+			interface->stage_cache.save("peel", peel_key, [&interface](std::ostream &out) {
+				ak::write_graph(out, interface->rowcol_graph);
+			});
+		}
+		if (tracer) {
+			tracer->finish(interface->rowcol_graph);
+			LOG(Info, Interface) << "Streamed " << tracer->emitted() << " stitches.";
+		} else if (save_traced_file != "") {
 			interface->save_traced_file = save_traced_file;
-			interface->update_traced();
+			interface->dataflow.update(interface->traced_node);
+		}
+		if (interface->stage_cache.enabled()) {
+			LOG(Info, Interface) << "Stage cache: " << interface->stage_cache.hits << " hits, " << interface->stage_cache.misses << " misses.";
 		}
 		if (peel_test != 0) return nullptr;
 	}
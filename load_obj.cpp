@@ -1,6 +1,6 @@
 #include "pipeline.hpp"
+#include "log.hpp"
 
-#include <iostream>
 #include <fstream>
 #include <sstream>
 #include <unordered_set>
@@ -18,6 +18,7 @@ void ak::load_obj(
 	model.triangles.clear();
 
 	std::ifstream in(file);
+	if (!in) throw std::runtime_error("Failed to open '" + file + "'.");
 
 	uint32_t tri_faces = 0;
 
@@ -87,13 +88,13 @@ void ak::load_obj(
 		} else if (tokens[0] == "g") {
 			//"group" -- ignored
 		} else {
-			std::cerr << "WARNING: unknown obj command '" << tokens[0] << "'" << std::endl;
+			LOG(Warning, Load) << "WARNING: unknown obj command '" << tokens[0] << "'";
 		}
 	}
 
-	std::cout << "Read " << model.vertices.size() << " vertices and " << model.triangles.size() << " triangles from '" << file << "'." << std::endl;
+	LOG(Info, Load) << "Read " << model.vertices.size() << " vertices and " << model.triangles.size() << " triangles from '" << file << "'.";
 	if (tri_faces) {
-		std::cerr << "WARNING: had to triangulate " << tri_faces << " faces." << std::endl;
+		LOG(Warning, Load) << "WARNING: had to triangulate " << tri_faces << " faces.";
 	}
 
 	//validate + properly index triangles:
@@ -121,7 +122,7 @@ void ak::load_obj(
 		}
 	}
 	if (topologically_degenerate || numerically_degenerate) {
-		std::cerr << "WARNING: have " << topologically_degenerate << " topologically degenerate and " << numerically_degenerate << " numerically degenerate triangles. This is likely to mess things up!" << std::endl;
+		LOG(Warning, Load) << "WARNING: have " << topologically_degenerate << " topologically degenerate and " << numerically_degenerate << " numerically degenerate triangles. This is likely to mess things up!";
 	}
 
 	//PARANOIA: manifold + oriented
@@ -133,7 +134,7 @@ void ak::load_obj(
 		if (!oriented_edges.insert(glm::uvec2(tri.z, tri.x)).second) ++nonmanifold;
 	}
 	if (nonmanifold) {
-		std::cerr << "WARNING: have " << nonmanifold << " oriented edges that appear more than once; this means the mesh is probably not an orientable manifold, which is likely to mess things up!" << std::endl;
+		LOG(Warning, Load) << "WARNING: have " << nonmanifold << " oriented edges that appear more than once; this means the mesh is probably not an orientable manifold, which is likely to mess things up!";
 	}
 
 }
@@ -0,0 +1,227 @@
+#include "log.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+std::atomic< int32_t > Log::thresholds[Log::ModuleCount];
+
+namespace {
+
+char const *ModuleNames[Log::ModuleCount] = {
+	"load",
+	"embed",
+	"interpolate",
+	"peel",
+	"chains",
+	"link",
+	"trace",
+	"cache",
+	"schedule",
+	"transfers",
+	"interface",
+	"batch",
+	"daemon",
+};
+
+char const *level_name(Log::Level level) {
+	if (level == Log::Error) return "error";
+	else if (level == Log::Warning) return "warning";
+	else if (level == Log::Info) return "info";
+	else return "debug";
+}
+
+//queued lines are written once this much is waiting (or after a short delay, whichever is first):
+constexpr size_t WriteBytes = 1 << 16;
+constexpr auto WriteDelay = std::chrono::milliseconds(100);
+
+struct Writer {
+	std::mutex mutex;
+	std::condition_variable wake; //writer thread waits for work here
+	std::condition_variable written; //flush() waits for the writer here
+	std::string queued;
+	bool writing = false;
+	bool quit = false;
+	bool tags = false;
+	std::ofstream file; //sink, if open; otherwise stdout (and stderr for errors)
+	std::string file_name; //(so the abort handler can reopen the sink)
+	std::thread thread;
+	struct sigaction old_abort;
+
+	Writer() {
+		thread = std::thread([this](){ run(); });
+		//failed asserts abort; write what's queued first, so the lines leading up to the failure aren't lost:
+		struct sigaction action;
+		std::memset(&action, 0, sizeof(action));
+		action.sa_handler = on_abort;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGABRT, &action, &old_abort);
+	}
+	~Writer() {
+		sigaction(SIGABRT, &old_abort, nullptr);
+		{
+			std::lock_guard< std::mutex > lock(mutex);
+			quit = true;
+		}
+		wake.notify_all();
+		thread.join();
+	}
+
+	static void on_abort(int signal);
+
+	std::ostream &sink() {
+		if (file.is_open()) return file;
+		else return std::cout;
+	}
+
+	void run() {
+		std::unique_lock< std::mutex > lock(mutex);
+		while (true) {
+			wake.wait_for(lock, WriteDelay, [this](){ return quit || queued.size() >= WriteBytes; });
+			if (queued.empty()) {
+				if (quit) break;
+				continue;
+			}
+			std::string batch;
+			batch.swap(queued);
+			writing = true;
+			lock.unlock();
+			sink() << batch;
+			sink().flush(); //(once per batch, not per line)
+			lock.lock();
+			writing = false;
+			written.notify_all();
+		}
+	}
+
+	//write everything queued right now (called with lock held):
+	void drain(std::unique_lock< std::mutex > &lock) {
+		written.wait(lock, [this](){ return !writing; });
+		if (!queued.empty()) {
+			sink() << queued;
+			queued.clear();
+		}
+		sink().flush();
+	}
+};
+
+Writer &writer() {
+	static Writer w;
+	return w;
+}
+
+//SIGABRT handler: writes queued lines with plain write() calls, then hands the signal on.
+//(best effort -- it skips the queue if some thread is in the middle of changing it)
+void Writer::on_abort(int signal) {
+	Writer &w = writer();
+	if (w.mutex.try_lock()) {
+		int fd = 1;
+		if (w.file.is_open()) fd = open(w.file_name.c_str(), O_WRONLY | O_APPEND);
+		if (fd >= 0) {
+			char const *data = w.queued.data();
+			size_t size = w.queued.size();
+			while (size > 0) {
+				ssize_t count = ::write(fd, data, size);
+				if (count <= 0) break;
+				data += count;
+				size -= count;
+			}
+			if (fd != 1) close(fd);
+		}
+		w.queued.clear();
+		w.mutex.unlock();
+	}
+	sigaction(SIGABRT, &w.old_abort, nullptr);
+	raise(signal);
+}
+
+}
+
+void Log::write(Level level, Module module, std::string &&text) {
+	if (text.empty() || text.back() != '\n') text += '\n';
+	Writer &w = writer();
+	std::unique_lock< std::mutex > lock(w.mutex);
+	if (w.tags) {
+		text = std::string("[") + module_name(module) + ':' + level_name(level) + "] " + text;
+	}
+	if (level == Error) {
+		//errors skip the queue (but keep their place after earlier lines):
+		w.drain(lock);
+		if (w.file.is_open()) {
+			w.file << text;
+			w.file.flush();
+		} else {
+			std::cerr << text;
+			std::cerr.flush();
+		}
+		return;
+	}
+	w.queued += text;
+	if (w.queued.size() >= WriteBytes) w.wake.notify_one();
+}
+
+void Log::flush() {
+	Writer &w = writer();
+	std::unique_lock< std::mutex > lock(w.mutex);
+	w.drain(lock);
+}
+
+void Log::set_level(int32_t level) {
+	for (auto &t : thresholds) {
+		t.store(level - int32_t(Info), std::memory_order_relaxed);
+	}
+}
+
+bool Log::set_filters(std::string const &filters) {
+	std::vector< std::pair< uint32_t, int32_t > > parsed;
+	std::istringstream str(filters);
+	std::string filter;
+	while (std::getline(str, filter, ',')) {
+		if (filter.empty()) continue;
+		auto equals = filter.find('=');
+		if (equals == std::string::npos) return false;
+		std::string name = filter.substr(0, equals);
+		uint32_t module = 0;
+		while (module < ModuleCount && name != ModuleNames[module]) ++module;
+		if (module == ModuleCount) return false;
+		std::istringstream level_str(filter.substr(equals + 1));
+		int32_t level;
+		if (!(level_str >> level)) return false;
+		parsed.emplace_back(module, level);
+	}
+	for (auto const &p : parsed) {
+		thresholds[p.first].store(p.second - int32_t(Info), std::memory_order_relaxed);
+	}
+	return true;
+}
+
+bool Log::set_file(std::string const &filename) {
+	Writer &w = writer();
+	std::unique_lock< std::mutex > lock(w.mutex);
+	w.drain(lock);
+	if (w.file.is_open()) w.file.close();
+	w.file_name = filename;
+	if (filename == "") return true;
+	w.file.open(filename);
+	return w.file.is_open();
+}
+
+void Log::set_tags(bool tags) {
+	Writer &w = writer();
+	std::lock_guard< std::mutex > lock(w.mutex);
+	w.tags = tags;
+}
+
+char const *Log::module_name(Module module) {
+	if (module < ModuleCount) return ModuleNames[module];
+	else return "?";
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+//Leveled, buffered logging for the pipeline and scheduler:
+//    LOG(Info, Peel) << "Peeled " << rounds << " rounds.";
+//Each statement logs one line (no std::endl; a trailing '\n' isn't doubled). Lines are queued in
+// memory and written by a background thread, so logging never waits on (or flushes) the console.
+//Errors are written immediately, after anything queued before them. On SIGABRT (e.g., a failed
+// assert) queued lines are written before the process dies.
+//
+//A statement whose level is off -- at compile time via LOG_MAX_LEVEL, or at run time for its
+// module -- doesn't evaluate its arguments. Guard multi-statement dumps with LOG_ENABLED(level, module).
+
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+//messages above this level are compiled out (e.g. -DLOG_MAX_LEVEL=1 drops debug dumps):
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL 2
+#endif
+
+namespace Log {
+
+//levels line up with the tools' 'log-level:' argument (0 = quiet, 1 = summaries, 2 = debug dumps);
+// a message is shown if its level is at most its module's threshold:
+enum Level : int32_t {
+	Error = -1,
+	Warning = 0,
+	Info = 1,
+	Debug = 2,
+};
+
+enum Module : uint32_t {
+	Load, //obj, constraints, and stitch files
+	Embed, //embed_constraints
+	Interpolate, //interpolate_values
+	Peel, //peeling loop, slicing, trimming, row extraction
+	Chains, //build_next_active_chains
+	Link, //link_chains
+	Trace, //trace_graph
+	Cache, //stage cache and checkpoints
+	Schedule, //schedule (needle assignment and instruction output)
+	Transfers, //plan_transfers
+	Interface,
+	Batch, //batch runner and sweeps
+	Daemon, //resident pipeline daemon
+	ModuleCount
+};
+
+//per-module thresholds, stored relative to Info (so zero-initialization means 'Info'):
+extern std::atomic< int32_t > thresholds[ModuleCount];
+
+inline bool enabled(Level level, Module module) {
+	return int32_t(level) <= LOG_MAX_LEVEL
+		&& int32_t(level) <= int32_t(Info) + thresholds[module].load(std::memory_order_relaxed);
+}
+
+//set every module's threshold (e.g. from 'log-level:'):
+void set_level(int32_t level);
+//set some modules' thresholds from a list like "link=2,schedule=0"; returns false (changing nothing) on a bad list:
+bool set_filters(std::string const &filters);
+//send output to a file instead of stdout/stderr ("" for the console); returns false if the file can't be opened:
+bool set_file(std::string const &filename);
+//prefix each line with "[module:level] ":
+void set_tags(bool tags);
+//block until everything logged so far has been written:
+void flush();
+
+//queue a finished line (used by Line):
+void write(Level level, Module module, std::string &&text);
+
+char const *module_name(Module module);
+
+//collects one line; queued when destroyed at the end of the LOG statement:
+struct Line {
+	Line(Level level_, Module module_) : level(level_), module(module_) { }
+	~Line() { write(level, module, stream.str()); }
+	Line(Line const &) = delete;
+	Line &operator=(Line const &) = delete;
+
+	template< typename T >
+	Line &operator<<(T const &t) {
+		stream << t;
+		return *this;
+	}
+	//manipulators like std::hex (deliberately not std::endl -- lines end themselves):
+	Line &operator<<(std::ios_base &(*manipulator)(std::ios_base &)) {
+		stream << manipulator;
+		return *this;
+	}
+
+	Level level;
+	Module module;
+	std::ostringstream stream;
+};
+
+//lets LOG's conditional have void on both sides ('&' binds looser than '<<'):
+struct Voidify {
+	void operator&(Line const &) { }
+};
+
+} //namespace Log
+
+//(the conditional keeps disabled statements from evaluating their arguments; being one expression, it is safe inside unbraced if/else)
+#define LOG( LEVEL, MODULE ) \
+	!Log::enabled(Log::LEVEL, Log::MODULE) ? (void)0 : Log::Voidify() & Log::Line(Log::LEVEL, Log::MODULE)
+
+#define LOG_ENABLED( LEVEL, MODULE ) Log::enabled(Log::LEVEL, Log::MODULE)
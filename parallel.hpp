@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// Small helper for running independent pieces of work on a handful of threads.
+
+namespace ak {
+
+//number of worker threads to use by default (at least one):
+inline uint32_t worker_count() {
+	uint32_t count = std::thread::hardware_concurrency();
+	return (count == 0 ? 1 : count);
+}
+
+//true on threads that are running parallel_for work (so nested calls don't oversubscribe):
+inline bool &in_parallel_for() {
+	static thread_local bool inside = false;
+	return inside;
+}
+
+//call fn(0) ... fn(count-1), possibly in parallel and in any order.
+//each fn(i) should only write to its own outputs; results should be merged (in index order) by the caller.
+//NOTE: if any calls throw, the exception from the lowest index is re-thrown after all work is done.
+//NOTE: calls made from inside another parallel_for run serially.
+inline void parallel_for(uint32_t count, std::function< void(uint32_t) > const &fn, uint32_t workers = worker_count()) {
+	workers = std::max(1U, std::min(workers, count));
+	if (in_parallel_for()) workers = 1;
+	if (workers <= 1) {
+		for (uint32_t i = 0; i < count; ++i) {
+			fn(i);
+		}
+		return;
+	}
+
+	std::atomic< uint32_t > next(0);
+	std::vector< std::exception_ptr > errors(count);
+	auto work = [&]() {
+		bool was_inside = in_parallel_for();
+		in_parallel_for() = true;
+		while (true) {
+			uint32_t i = next.fetch_add(1);
+			if (i >= count) break;
+			try {
+				fn(i);
+			} catch (...) {
+				errors[i] = std::current_exception();
+			}
+		}
+		in_parallel_for() = was_inside;
+	};
+
+	std::vector< std::thread > threads;
+	threads.reserve(workers - 1);
+	for (uint32_t t = 0; t + 1 < workers; ++t) {
+		threads.emplace_back(work);
+	}
+	work();
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	for (auto const &e : errors) {
+		if (e) std::rethrow_exception(e);
+	}
+}
+
+} //namespace ak
@@ -5,6 +5,11 @@
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <functional>
+#include <memory>
+#include <iosfwd>
+#include <stdexcept>
+#include <cassert>
 
 // The autoknit pipeline in data formats and transformation functions.
 
@@ -40,6 +45,10 @@ struct Parameters {
 	//model unit size in millimeters:
 	float model_units_mm = 1.0f;
 
+	//if non-zero, link_chains aligns stitches with dynamic time warping near the best-lined-up roll (instead of scanning every roll of evenly-spaced shaping);
+	// falls back to evenly-spaced shaping when no alignment respects the link-one flags:
+	uint32_t link_dtw = 0;
+
 	//maximum edge length for embed_constraints:
 	float get_max_edge_length() const {
 		return 0.5f * std::min(stitch_width_mm, 2.0f * stitch_height_mm) / model_units_mm;
@@ -49,11 +58,6 @@ struct Parameters {
 	float get_chain_sample_spacing() const {
 		return 0.25f * stitch_width_mm / model_units_mm;
 	}
-
-	//edge sample spacing for embedded_path:
-	float get_max_path_sample_spacing() const {
-		return 0.02f * std::min(stitch_width_mm, 2.0f * stitch_height_mm) / model_units_mm;
-	}
 };
 
 //Load list of constraints from a file
@@ -177,6 +181,76 @@ struct EmbeddedVertex {
 	}
 };
 
+//helper: EmbeddedVertex::interpolate over a whole array (uses SIMD where available; results are identical):
+void interpolate_batch(
+	std::vector< EmbeddedVertex > const &evs, //in: embedded vertices
+	std::vector< float > const &values, //in: values at model vertices
+	std::vector< float > *out //out: interpolated value for each of evs
+);
+void interpolate_batch(
+	std::vector< EmbeddedVertex > const &evs, //in: embedded vertices
+	std::vector< glm::vec3 > const &values, //in: values (e.g., positions) at model vertices
+	std::vector< glm::vec3 > *out //out: interpolated value for each of evs
+);
+
+//helper: model vertices whose values interpolating at evs reads (sorted, no duplicates):
+void interpolated_vertices(
+	std::vector< EmbeddedVertex > const &evs, //in: embedded vertices
+	std::vector< uint32_t > *vertices //out: vertices used by their simplices
+);
+
+//Compact (8-byte) storage for an EmbeddedVertex on a particular model, for holding many
+// embedded points at once (RowColGraph positions, saved active chains, and extract_rows's
+// rows waiting to be linked; chains being worked on and slices keep full EmbeddedVertex values).
+// 'simplex' is a vertex, edge, or triangle id on the model, with the kind in the top two bits;
+// 'weights' holds the bits of weights.x (vertex) or weights.y (edge) as a float, or two 16-bit quantized weights (triangle).
+//Round-trip error:
+// - vertices are exact;
+// - edge points keep weights.y exactly and get weights.x = 1 - weights.y, so points made by
+//   EmbeddedVertex::on_edge are exact, and otherwise weights.x is off by at most |x + y - 1| + 2^-25
+//   (e.g., EmbeddedVertex::mix output, whose weights can sum to one only up to rounding);
+// - triangle weights.y/z are rounded to multiples of 1/CompactWeightSum and weights.x = 1 - y - z,
+//   so each weight is off by at most 1/CompactWeightSum (plus |x + y + z - 1| for weights.x).
+struct CompactEmbeddedVertex {
+	uint32_t simplex;
+	uint32_t weights;
+	bool operator==(CompactEmbeddedVertex const &o) const {
+		return simplex == o.simplex && weights == o.weights;
+	}
+	bool operator!=(CompactEmbeddedVertex const &o) const {
+		return !(*this == o);
+	}
+	enum : uint32_t {
+		KindShift = 30,
+		KindVertex = 0, KindEdge = 1, KindTriangle = 2,
+		IdMask = (1U << KindShift) - 1U,
+	};
+	static constexpr uint32_t const CompactWeightSum = (1U << 15);
+};
+
+//Converts between EmbeddedVertex and CompactEmbeddedVertex (tables of edge and triangle ids are built once per model):
+struct EmbeddedVertexCodec {
+	EmbeddedVertexCodec() : EmbeddedVertexCodec(Model()) { } //(codec for an empty model)
+	EmbeddedVertexCodec(Model const &model);
+
+	CompactEmbeddedVertex pack(EmbeddedVertex const &ev) const;
+	EmbeddedVertex unpack(CompactEmbeddedVertex const &cev) const;
+	//the point ev packs to; packing is exact for snapped points, and snapping them again doesn't change them:
+	EmbeddedVertex snap(EmbeddedVertex const &ev) const { return unpack(pack(ev)); }
+
+	void pack(std::vector< EmbeddedVertex > const &evs, std::vector< CompactEmbeddedVertex > *out) const;
+	void unpack(std::vector< CompactEmbeddedVertex > const &cevs, std::vector< EmbeddedVertex > *out) const;
+	//(and lists of chains:)
+	void pack(std::vector< std::vector< EmbeddedVertex > > const &chains, std::vector< std::vector< CompactEmbeddedVertex > > *out) const;
+	void unpack(std::vector< std::vector< CompactEmbeddedVertex > > const &chains, std::vector< std::vector< EmbeddedVertex > > *out) const;
+
+	//ids are indices into these (sorted) lists; CSR offsets give the range starting with a given vertex / edge:
+	std::vector< glm::uvec2 > edges; //(a,b), a < b
+	std::vector< uint32_t > edge_offsets; //edges starting with vertex a are [edge_offsets[a], edge_offsets[a+1])
+	std::vector< glm::uvec3 > triangles; //(a,b,c), a < b < c
+	std::vector< uint32_t > triangle_offsets; //triangles starting with edge e are [triangle_offsets[e], triangle_offsets[e+1])
+};
+
 //helper: extract embedded level sets given values at vertices:
 //NOTE: chain orientation is along +x (if values increase along +y)
 void extract_level_chains(
@@ -185,6 +259,13 @@ void extract_level_chains(
 	float const level, //in: level at which to extract chains
 	std::vector< std::vector< EmbeddedVertex > > *chains //chains of edges at given level
 );
+//multi-level version: one sweep over the mesh for all levels; chains[i] are the chains at levels[i]:
+void extract_level_chains(
+	Model const &model, //in: model on which to embed vertices
+	std::vector< float > const &values, //in: values at vertices
+	std::vector< float > const &levels, //in: levels at which to extract chains (sorted, increasing)
+	std::vector< std::vector< std::vector< EmbeddedVertex > > > *chains //out: chains at each level
+);
 //NOTE: chains represented as [a,b,c,d,a] if a loop, [a,b,c,d] if a chain. Always represented in CCW order.
 
 //an active chain is a list of embedded vertices on the mesh. If it is a loop, the first and last vertex are the same.
@@ -203,27 +284,80 @@ struct Stitch {
 };
 
 
+//Row-column graph of stitches; vertex data is stored as parallel arrays (one entry per vertex in each)
+// so passes that only need links or only need positions touch only those arrays:
 struct RowColGraph {
-	struct Vertex {
-		EmbeddedVertex at;
-		uint32_t row_in = -1U;
-		uint32_t row_out = -1U;
-		uint32_t col_in[2] = {-1U, -1U};
-		uint32_t col_out[2] = {-1U, -1U};
-		void add_col_in(uint32_t i) {
-			if (col_in[0] == -1U) col_in[0] = i;
-			else if (col_in[1] == -1U) col_in[1] = i;
-			else assert(col_in[0] == -1U || col_in[1] == -1U); //no room!
+	std::vector< CompactEmbeddedVertex > at; //position of each vertex (on model, packed with the model's EmbeddedVertexCodec)
+	std::vector< uint32_t > row_in, row_out; //previous/next vertex in row (-1U if none)
+	std::vector< glm::uvec2 > col_in, col_out; //vertices below/above (-1U if none; [0] is filled first)
+
+	uint32_t size() const { return at.size(); }
+	bool empty() const { return at.empty(); }
+
+	//add a vertex with no links, returning its index:
+	uint32_t add_vertex(CompactEmbeddedVertex const &at_) {
+		if (at.size() == at.capacity()) {
+			//grow by half (rather than doubling) since graphs for large jobs get big:
+			reserve(std::max< size_t >(1024, at.capacity() + at.capacity() / 2));
 		}
-		void add_col_out(uint32_t i) {
-			if (col_out[0] == -1U) col_out[0] = i;
-			else if (col_out[1] == -1U) col_out[1] = i;
-			else assert(col_out[0] == -1U || col_out[1] == -1U); //no room!
+		at.emplace_back(at_);
+		row_in.emplace_back(-1U);
+		row_out.emplace_back(-1U);
+		col_in.emplace_back(-1U);
+		col_out.emplace_back(-1U);
+		return at.size() - 1;
+	}
+	//NOTE: throws if the vertex already has two column links in that direction:
+	void add_col_in(uint32_t v, uint32_t i) {
+		assert(v < col_in.size());
+		if (col_in[v][0] == -1U) col_in[v][0] = i;
+		else if (col_in[v][1] == -1U) col_in[v][1] = i;
+		else throw std::runtime_error("RowColGraph vertex has more than two column-in links.");
+	}
+	void add_col_out(uint32_t v, uint32_t i) {
+		assert(v < col_out.size());
+		if (col_out[v][0] == -1U) col_out[v][0] = i;
+		else if (col_out[v][1] == -1U) col_out[v][1] = i;
+		else throw std::runtime_error("RowColGraph vertex has more than two column-out links.");
+	}
+
+	void reserve(size_t count) {
+		at.reserve(count);
+		row_in.reserve(count);
+		row_out.reserve(count);
+		col_in.reserve(count);
+		col_out.reserve(count);
+	}
+	//remove vertices [count, size()) and the column links older vertices have to them:
+	//NOTE: vertices only gain links to newer vertices, so this exactly undoes everything added since the graph had 'count' vertices
+	void truncate(uint32_t count) {
+		assert(count <= size());
+		at.resize(count);
+		row_in.resize(count);
+		row_out.resize(count);
+		col_in.resize(count);
+		col_out.resize(count);
+		for (auto &o : col_out) {
+			if (o[1] != -1U && o[1] >= count) o[1] = -1U;
+			if (o[0] != -1U && o[0] >= count) {
+				assert(o[1] == -1U); //([0] is filled first)
+				o[0] = -1U;
+			}
 		}
-	};
-	std::vector< Vertex > vertices;
+	}
+	//remove all vertices (keeps allocated memory):
 	void clear() {
-		vertices.clear();
+		at.clear();
+		row_in.clear();
+		row_out.clear();
+		col_in.clear();
+		col_out.clear();
+	}
+	//bytes of memory allocated for the graph:
+	size_t footprint() const {
+		return at.capacity() * sizeof(CompactEmbeddedVertex)
+		     + (row_in.capacity() + row_out.capacity()) * sizeof(uint32_t)
+		     + (col_in.capacity() + col_out.capacity()) * sizeof(glm::uvec2);
 	}
 };
 
@@ -254,6 +388,7 @@ void trim_model(
 );
 
 //The first active chains are along boundaries that are at minimums:
+//NOTE: chains are snapped to EmbeddedVertexCodec(model), so they can be stored compactly without changing them
 void find_first_active_chains(
 	Parameters const &parameters,
 	Model const &model, //in: model
@@ -308,21 +443,69 @@ void link_chains(
 // find a shortest path between two embedded vertices
 //  note: will throw runtime_error if no path exists
 void embedded_path(
-	Parameters const &parameters,
 	Model const &model,
 	EmbeddedVertex const &source,
 	EmbeddedVertex const &target,
 	std::vector< EmbeddedVertex > *path //out: path; path[0] will be source and path.back() will be target
 );
 
+//helper: answers many embedded_path queries on one model
+// (topology is built once; search buffers are reused between queries)
+//Paths are found in two steps: A* over a few sample points on each edge picks a corridor of triangles,
+// then the corridor is unfolded into the plane and straightened with the funnel algorithm.
+//So paths are exact shortest paths within their corridor and contain only the points where they
+// cross corridor edges (or pass through vertices).
+struct EmbeddedPathEngine {
+	EmbeddedPathEngine(Model const &model);
+
+	//find a shortest path between two embedded vertices (same as embedded_path):
+	//  note: will throw runtime_error if no path exists
+	void path(
+		EmbeddedVertex const &source,
+		EmbeddedVertex const &target,
+		std::vector< EmbeddedVertex > *path //out: path; path[0] will be source and path.back() will be target
+	);
+
+	//find paths for a batch of (source, target) queries, in parallel:
+	//  note: will throw runtime_error if any path does not exist
+	void paths(
+		std::vector< std::pair< EmbeddedVertex, EmbeddedVertex > > const &queries,
+		std::vector< std::vector< EmbeddedVertex > > *paths //out: paths[i] is the path for queries[i]
+	);
+
+	Model const &model;
+
+	//topology (CSR lists):
+	std::vector< uint32_t > vertex_tri_offsets, vertex_tris; //triangles touching vertex v are vertex_tris[vertex_tri_offsets[v] ... vertex_tri_offsets[v+1])
+	std::vector< glm::uvec2 > edges; //(a,b), a < b, sorted
+	std::vector< uint32_t > edge_tri_offsets, edge_tris; //triangles touching each edge
+	std::vector< glm::uvec3 > tri_edges; //edges of each triangle
+
+	//corridor search runs over SamplesPerEdge points on each edge (node e * SamplesPerEdge + s), plus the target:
+	static constexpr uint32_t SamplesPerEdge = 3;
+
+	//per-query buffers; entries are valid only where their stamp matches the current query:
+	struct Scratch {
+		uint32_t query = 0;
+		std::vector< uint32_t > node_stamp;
+		std::vector< float > node_dis;
+		std::vector< uint32_t > node_from; //previous node (-1U if reached from the source)
+		std::vector< uint32_t > node_tri; //triangle crossed to reach the node
+		std::vector< std::pair< float, std::pair< uint32_t, float > > > todo;
+	};
+	Scratch scratch; //used by path()
+
+	void path(EmbeddedVertex const &source, EmbeddedVertex const &target, std::vector< EmbeddedVertex > *path, Scratch *scratch) const;
+};
+
 //maybe:
 //void reposition_course -- somehow update next course's position based on linking result.
 
 
 void build_next_active_chains(
-	Parameters const &parameters,
 	Model const &slice,
 	std::vector< EmbeddedVertex > const &slice_on_model, //in: vertices of slice (on model)
+	EmbeddedVertexCodec const &codec, //in: codec for the model (next active chains are snapped to it; graph positions are packed with it)
 	std::vector< std::vector< uint32_t > > const &active_chains,  //in: current active chains (on slice)
 	std::vector< std::vector< Stitch > > const &active_stitches, //in: current active stitches
 	std::vector< std::vector< uint32_t > > const &next_chains, //in: next chains (on slice)
@@ -334,6 +517,99 @@ void build_next_active_chains(
 	RowColGraph *graph = nullptr //in/out: graph to update [optional]
 );
 
+//helper: group active chains by the connected component of the not-yet-peeled model they bound:
+// (chains in different components never link to each other, so can be peeled independently)
+void find_active_components(
+	Model const &model, //in: model
+	std::vector< std::vector< EmbeddedVertex > > const &active_chains, //in: current active chains
+	std::vector< std::vector< uint32_t > > *components //out: indices of active chains in each component (sorted; components ordered by first index)
+);
+
+//helper: do links pair active and next chains one-to-one (no splits, merges, ends, or starts)?
+// if so, and the active chains bounded one component, the next active chains do as well
+// (so peeling can skip find_active_components on the next round):
+bool links_pair_chains(
+	uint32_t active_count, //in: number of (slice) active chains
+	uint32_t next_count, //in: number of (slice) next chains
+	std::vector< Link > const &links //in: links (as from link_chains)
+);
+
+//peel (slice, link, build) every component of the active chains on its own worker:
+// next active chains/stitches are concatenated in component order and graph vertices
+// created by each component are appended in component order, so output does not depend on scheduling.
+void peel_components(
+	Parameters const &parameters,
+	Model const &model, //in: model
+	EmbeddedVertexCodec const &codec, //in: codec for model
+	std::vector< float > const &times, //in: time field (times @ vertices)
+	std::vector< std::vector< EmbeddedVertex > > const &active_chains, //in: current active chains
+	std::vector< std::vector< Stitch > > const &active_stitches, //in: current active stitches
+	std::vector< std::vector< uint32_t > > const &components, //in: components (as from find_active_components)
+	std::vector< std::vector< EmbeddedVertex > > *next_active_chains, //out: next active chains (on model)
+	std::vector< std::vector< Stitch > > *next_active_stitches, //out: next active stitches
+	RowColGraph *graph = nullptr, //in/out: graph to update [optional]
+	std::vector< uint32_t > *times_used = nullptr //out: model vertices whose times were read (sorted, no duplicates) [optional]
+);
+
+//alternative to peeling simple regions: extract all rows above the active chains at once as isolines
+// of the time field, spaced (by the field's average gradient) to be a row height apart.
+//Rows are extracted, sampled, and sliced in parallel, and linked in order with link_chains and
+// build_next_active_chains (so splits and merges are handled as in peeling), for as long
+// as every row is made of loops linked to the row before; returns the number of rows added to the graph.
+//active chains/stitches are left at the last extracted row, so peeling can continue from there.
+//Returns 0 (quickly) if the active chains aren't loops close to an isoline, or the row above them isn't loops,
+// so peel and Interface::step_peeling try it again after every round of peeling.
+uint32_t extract_rows(
+	Parameters const &parameters,
+	Model const &model, //in: model
+	std::vector< float > const &times, //in: time field (times @ vertices)
+	std::vector< std::vector< EmbeddedVertex > > *active_chains, //in/out: first active chains -> last extracted row
+	std::vector< std::vector< Stitch > > *active_stitches, //in/out: first active stitches -> last extracted row's stitches
+	RowColGraph *graph //in/out: graph to update
+);
+
+//peel the whole model (the same sequence of rounds Interface::step_peeling runs, without keeping the intermediate state):
+void peel(
+	Parameters const &parameters,
+	Model const &model, //in: model
+	std::vector< float > const &times, //in: time field (times @ vertices)
+	bool use_row_field, //in: if set, start with extract_rows
+	RowColGraph *graph //out: finished graph
+);
+
+//Snapshot of peeling between rounds: the active chains about to be peeled and the graph built so far.
+//Restoring one and continuing produces exactly the same results as never having stopped.
+struct PeelCheckpoint {
+	uint32_t peel_step = 0; //(Interface's step counter)
+	uint64_t inputs_hash = 0; //hash_peel_inputs() of the parameters/model/times being peeled
+	std::vector< std::vector< CompactEmbeddedVertex > > active_chains; //(packed with the model's codec; exact, since active chains are snapped to it)
+	std::vector< std::vector< Stitch > > active_stitches;
+	RowColGraph graph;
+};
+
+//helper: hash of everything peeling results depend on (the parameters that affect peeling, model, and times):
+uint64_t hash_peel_inputs(
+	Parameters const &parameters,
+	Model const &model,
+	std::vector< float > const &times
+);
+
+//Save/load a checkpoint in a versioned binary format:
+//NOTE: throw on error (including version mismatch)
+void save_peel_checkpoint(
+	PeelCheckpoint const &checkpoint, //in: checkpoint to save
+	std::string const &filename //in: file name to save to
+);
+void load_peel_checkpoint(
+	std::string const &filename, //in: file to load
+	PeelCheckpoint *checkpoint //out: loaded checkpoint
+);
+
+//helpers: binary (de)serialization of peeling's graph, as used by checkpoints and the stage cache:
+//NOTE: read_graph throws on malformed data
+void write_graph(std::ostream &out, RowColGraph const &graph);
+void read_graph(std::istream &in, RowColGraph *graph);
+
 
 struct TracedStitch {
 	uint32_t yarn = -1U; //yarn ID (why is this on a yarn_in? I guess the schedule.cpp code will tell me someday.
@@ -367,7 +643,62 @@ void trace_graph(
 	Parameters const &parameters, // stitch-params
 	RowColGraph const &graph, //in: row-column graph
 	std::vector< TracedStitch > *traced, //out:traced list of stitches
-	Model *DEBUG_model = nullptr //in (optional): model; stitches' .at will be set using its vertices
+	Model const *DEBUG_model = nullptr //in (optional): model; stitches' .at will be set using its vertices
+);
+
+//Incremental version of trace_graph, for tracing while peeling is still running.
+//Call update() after each peeling step; it traces as far as the finished part of the graph allows and
+// passes stitches to 'emit' once their rows can no longer change. Stitches are emitted in trace order with
+// the same contents as trace_graph, so (since ins/outs are indices in that order) they can be streamed to a file.
+//Only stitches waiting on unfinished rows are held, so memory use follows the active frontier, not the whole trace.
+struct GraphTracer {
+	GraphTracer(
+		Parameters const &parameters,
+		Model const *model, //in (optional): model; stitches' .at will be set using its vertices
+		std::function< void(TracedStitch const &) > const &emit //out: called with each stitch, in order
+	);
+	~GraphTracer();
+
+	void update(
+		RowColGraph const &graph, //in: row-column graph so far (vertices are only ever added)
+		std::vector< std::vector< Stitch > > const &active_stitches //in: stitches whose vertices may still gain column links
+	);
+	//trace and emit everything that remains (graph is complete):
+	void finish(RowColGraph const &graph);
+
+	uint32_t rows() const; //rows found so far
+	uint32_t emitted() const; //stitches emitted so far
+
+	struct Impl;
+	std::unique_ptr< Impl > impl;
+};
+
+//helpers: binary (de)serialization of traced stitches, as used by the stage cache:
+//NOTE: read_traced throws on malformed data
+void write_traced(std::ostream &out, std::vector< TracedStitch > const &traced);
+void read_traced(std::istream &in, std::vector< TracedStitch > *traced);
+
+//Parameter sweep: run the whole pipeline (embed, interpolate, peel, trace) for several parameter variants of one model.
+//Work is shared where results can't differ: variants with equal get_max_edge_length() share one embedding
+// (embed_constraints reads nothing else) and so also share interpolated times (which depend only on the embedding).
+//Each variant's peeling and tracing then run concurrently.
+struct SweepVariant {
+	Parameters parameters; //in
+	//out: timings (shared stages are reported in every variant that used them, with shared_with set):
+	uint32_t shared_with = -1U; //index of the variant whose embedding/times this one reused (its own index if computed for it)
+	double embed_seconds = 0.0;
+	double interpolate_seconds = 0.0;
+	double peel_seconds = 0.0;
+	double trace_seconds = 0.0;
+	uint32_t stitches = 0; //traced stitch count
+};
+void sweep(
+	Model const &model, //in: model
+	std::vector< Constraint > const &constraints, //in: time constraints
+	bool use_row_field, //in: passed to peel
+	std::vector< SweepVariant > *variants, //in/out: variants to run (timings filled in)
+	std::function< void(uint32_t, std::vector< TracedStitch > const &) > const &traced //out: called with each variant's index and stitches as it finishes
+	//NOTE: 'traced' may be called from several threads at once, in any order
 );
 
 void schedule_stitches(
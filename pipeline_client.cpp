@@ -0,0 +1,93 @@
+#include "daemon_protocol.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+//Minimal client for pipeline_daemon: sends one command and saves anything streamed back.
+//Usage:
+//    ./pipeline_client socket:<path> <command> [tag:value] [...] [save-traced:<file>] [js:<file>]
+//'save-traced:' and 'js:' name local files for 'run' results ('js:' also asks the daemon to schedule);
+// everything else is passed to the daemon (relative obj:/constraints: paths are made absolute first).
+
+int main(int argc, char **argv) {
+	std::string socket_path = "";
+	std::string traced_file = "";
+	std::string js_file = "";
+	std::vector< std::string > words;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		auto colon = arg.find(':');
+		std::string tag = (colon == std::string::npos ? "" : arg.substr(0, colon));
+		std::string value = (colon == std::string::npos ? "" : arg.substr(colon + 1));
+		if (tag == "socket") {
+			socket_path = value;
+		} else if (tag == "save-traced") {
+			traced_file = value;
+		} else if (tag == "js") {
+			js_file = value;
+		} else {
+			if ((tag == "obj" || tag == "constraints") && value != "" && value[0] != '/') {
+				//(the daemon may have a different working directory)
+				std::vector< char > cwd(4096);
+				if (getcwd(cwd.data(), cwd.size())) arg = tag + ":" + cwd.data() + "/" + value;
+			}
+			words.emplace_back(arg);
+		}
+	}
+	if (socket_path == "" || words.empty()) {
+		std::cerr << "Usage:\n\t./pipeline_client socket:<path> <load|run|stats|quit> [tag:value] [...] [save-traced:<file>] [js:<file>]" << std::endl;
+		return 1;
+	}
+	if (js_file != "") words.emplace_back("schedule:1");
+
+	std::string request;
+	for (auto const &word : words) {
+		if (!request.empty()) request += ' ';
+		request += word;
+	}
+
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (socket_path.size() >= sizeof(address.sun_path)) {
+		std::cerr << "ERROR: socket path '" << socket_path << "' is too long." << std::endl;
+		return 1;
+	}
+	std::strcpy(address.sun_path, socket_path.c_str());
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, reinterpret_cast< sockaddr * >(&address), sizeof(address)) != 0) {
+		std::cerr << "ERROR: failed to connect to '" << socket_path << "'." << std::endl;
+		return 1;
+	}
+
+	std::string reply;
+	if (!daemon_protocol::send_frame(fd, request) || !daemon_protocol::recv_frame(fd, &reply)) {
+		std::cerr << "ERROR: daemon closed the connection." << std::endl;
+		close(fd);
+		return 1;
+	}
+	std::cout << reply << std::endl;
+	bool ok = (reply.compare(0, 2, "ok") == 0);
+
+	if (ok && words[0] == "run") {
+		std::ofstream traced, js;
+		if (traced_file != "") traced.open(traced_file, std::ios::binary);
+		if (js_file != "") js.open(js_file, std::ios::binary);
+		uint64_t traced_bytes = 0, js_bytes = 0;
+		if (!daemon_protocol::recv_file(fd, traced, &traced_bytes) || !daemon_protocol::recv_file(fd, js, &js_bytes)) {
+			std::cerr << "ERROR: daemon closed the connection while sending results." << std::endl;
+			ok = false;
+		} else {
+			std::cout << "Received " << traced_bytes << " bytes of traced stitches and " << js_bytes << " bytes of knitting program." << std::endl;
+		}
+	}
+
+	close(fd);
+	return (ok ? 0 : 1);
+}
@@ -0,0 +1,397 @@
+#include "pipeline.hpp"
+#include "Stitch.hpp"
+#include "TaggedArguments.hpp"
+#include "binary_io.hpp"
+#include "daemon_protocol.hpp"
+#include "log.hpp"
+#include "shell_quote.hpp"
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <sstream>
+#include <unordered_map>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+//Resident pipeline daemon: keeps loaded models, their constraint embeddings, and interpolated times
+// in memory (keyed by content hash) so that repeated requests against the same model skip loading,
+// embedding, and interpolation. See daemon_protocol.hpp for the request format.
+
+namespace {
+
+//A resident pipeline result: a loaded model (values empty), an embedding (constrained model + values),
+// or interpolated times (model empty).
+struct Resident {
+	ak::Model model;
+	std::vector< float > values;
+	uint64_t bytes() const {
+		return sizeof(Resident)
+			+ model.vertices.capacity() * sizeof(glm::vec3)
+			+ model.triangles.capacity() * sizeof(glm::uvec3)
+			+ values.capacity() * sizeof(float);
+	}
+};
+
+//Least-recently-used set of resident results, held under a memory cap.
+//Entries are shared so that evicting one doesn't disturb a request still using it.
+struct ResidentCache {
+	uint64_t capacity = 0; //bytes
+	uint64_t used = 0; //bytes
+	uint32_t hits = 0;
+	uint32_t misses = 0;
+	uint32_t evictions = 0;
+
+	struct Entry {
+		std::shared_ptr< Resident const > value;
+		uint64_t bytes = 0;
+		std::list< uint64_t >::iterator position;
+	};
+	std::list< uint64_t > order; //most recently used first
+	std::unordered_map< uint64_t, Entry > entries;
+
+	std::shared_ptr< Resident const > get(uint64_t key) {
+		auto f = entries.find(key);
+		if (f == entries.end()) {
+			misses += 1;
+			return nullptr;
+		}
+		hits += 1;
+		order.splice(order.begin(), order, f->second.position);
+		return f->second.value;
+	}
+
+	//NOTE: an entry larger than the whole cap evicts everything else but is still kept.
+	void put(uint64_t key, std::shared_ptr< Resident const > const &value) {
+		assert(value);
+		auto f = entries.find(key);
+		if (f != entries.end()) {
+			used -= f->second.bytes;
+			order.erase(f->second.position);
+			entries.erase(f);
+		}
+		uint64_t bytes = value->bytes();
+		while (!order.empty() && used + bytes > capacity) {
+			auto e = entries.find(order.back());
+			assert(e != entries.end());
+			used -= e->second.bytes;
+			entries.erase(e);
+			order.pop_back();
+			evictions += 1;
+		}
+		order.emplace_front(key);
+		Entry &entry = entries[key];
+		entry.value = value;
+		entry.bytes = bytes;
+		entry.position = order.begin();
+		used += bytes;
+	}
+};
+
+//cache keys for each kind of resident result:
+uint64_t model_key(uint64_t model_hash) {
+	ContentHash key;
+	key.add(std::string("model"));
+	key.add(model_hash);
+	return key.value;
+}
+
+std::string hex(uint64_t value) {
+	char buffer[17];
+	std::snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)value);
+	return buffer;
+}
+
+struct Daemon {
+	ResidentCache cache;
+	std::string schedule_program;
+	std::string work_directory;
+	uint32_t requests = 0;
+
+	//handle one request from a connected client; returns false if the daemon should stop:
+	bool serve(int fd);
+
+	std::string load(std::vector< std::string > const &words);
+	std::string run(int fd, std::vector< std::string > const &words);
+	std::string stats() const;
+};
+
+bool Daemon::serve(int fd) {
+	std::string request;
+	if (!daemon_protocol::recv_frame(fd, &request, 1 << 16)) {
+		LOG(Warning, Daemon) << "WARNING: failed to read request.";
+		return true;
+	}
+	std::vector< std::string > words;
+	{
+		std::istringstream str(request);
+		std::string word;
+		while (str >> word) words.emplace_back(word);
+	}
+	if (words.empty()) {
+		daemon_protocol::send_frame(fd, "error empty request");
+		return true;
+	}
+
+	requests += 1;
+	auto before = std::chrono::high_resolution_clock::now();
+	std::string const &command = words[0];
+	std::string reply;
+	bool keep_running = true;
+	try {
+		if (command == "load") {
+			reply = load(words);
+		} else if (command == "run") {
+			reply = run(fd, words);
+		} else if (command == "stats") {
+			reply = stats();
+		} else if (command == "quit") {
+			reply = "ok";
+			keep_running = false;
+		} else {
+			throw std::runtime_error("unknown command '" + command + "'");
+		}
+	} catch (std::exception &e) {
+		reply = std::string("error ") + e.what();
+	}
+	//(run() sends its own reply, since file data follows it)
+	if (reply != "") daemon_protocol::send_frame(fd, reply);
+
+	auto after = std::chrono::high_resolution_clock::now();
+	LOG(Info, Daemon) << "Served '" << command << "' in " << std::chrono::duration< double >(after - before).count() << "s; "
+		<< cache.entries.size() << " resident (" << (cache.used >> 20) << "MB).";
+	return keep_running;
+}
+
+std::string Daemon::load(std::vector< std::string > const &words) {
+	std::string obj_file = "";
+	TaggedArguments args;
+	args.emplace_back("obj", &obj_file, "obj file to make resident");
+	if (!args.parse(words) || obj_file == "") throw std::runtime_error("usage: load obj:<file>");
+
+	auto resident = std::make_shared< Resident >();
+	ak::load_obj(obj_file, &resident->model);
+	if (resident->model.triangles.empty()) throw std::runtime_error("'" + obj_file + "' has no triangles");
+
+	ContentHash hash;
+	hash.add(resident->model.vertices);
+	hash.add(resident->model.triangles);
+	uint64_t key = model_key(hash.value);
+	if (!cache.get(key)) cache.put(key, resident);
+
+	return "ok model:" + hex(hash.value)
+		+ " vertices:" + std::to_string(resident->model.vertices.size())
+		+ " triangles:" + std::to_string(resident->model.triangles.size());
+}
+
+std::string Daemon::run(int fd, std::vector< std::string > const &words) {
+	std::string model_hash_string = "";
+	std::string constraints_file = "";
+	ak::Parameters parameters;
+	int32_t row_field = 0;
+	uint32_t schedule = 0;
+	TaggedArguments args;
+	args.emplace_back("model", &model_hash_string, "hash of a resident model (from 'load')");
+	args.emplace_back("constraints", &constraints_file, "file to load time constraints from");
+	args.emplace_back("obj-scale", &parameters.model_units_mm, "length of one unit in obj file (mm)");
+	args.emplace_back("stitch-width", &parameters.stitch_width_mm, "stitch width (mm)");
+	args.emplace_back("stitch-height", &parameters.stitch_height_mm, "stitch height (mm)");
+	args.emplace_back("link-dtw", &parameters.link_dtw, "if non-zero, link rows by dynamic time warping (falling back to evenly-spaced shaping)");
+	args.emplace_back("row-field", &row_field, "if non-zero, extract rows directly as isolines of the time field before peeling");
+	args.emplace_back("schedule", &schedule, "if non-zero, also schedule the traced stitches into a knitting program");
+	if (!args.parse(words) || model_hash_string == "") {
+		throw std::runtime_error("usage: run model:<hash> [constraints:<file>] [obj-scale:, stitch-width:, stitch-height:, link-dtw:, row-field:, schedule:]");
+	}
+	uint64_t model_hash;
+	try {
+		model_hash = std::stoull(model_hash_string, nullptr, 16);
+	} catch (std::exception &e) {
+		throw std::runtime_error("model hash '" + model_hash_string + "' isn't hexadecimal");
+	}
+
+	auto model = cache.get(model_key(model_hash));
+	if (!model) throw std::runtime_error("model " + model_hash_string + " isn't resident; 'load' it first");
+
+	std::vector< ak::Constraint > constraints;
+	if (constraints_file != "") {
+		ak::load_constraints(model->model, constraints_file, &constraints);
+	}
+
+	//embedding depends only on the model, the constraints, and the maximum edge length:
+	ContentHash embed_key;
+	embed_key.add(std::string("embed"));
+	embed_key.add(model_hash);
+	embed_key.add(uint64_t(constraints.size()));
+	for (auto const &c : constraints) {
+		embed_key.add(c.chain);
+		embed_key.add(c.value);
+		embed_key.add(c.radius);
+	}
+	embed_key.add(parameters.get_max_edge_length());
+
+	auto embedded = cache.get(embed_key.value);
+	bool embed_hit = (embedded != nullptr);
+	if (!embedded) {
+		auto resident = std::make_shared< Resident >();
+		ak::embed_constraints(parameters, model->model, constraints, &resident->model, &resident->values);
+		cache.put(embed_key.value, resident);
+		embedded = resident;
+	}
+
+	//times depend only on the embedding:
+	ContentHash times_key;
+	times_key.add(std::string("times"));
+	times_key.add(embed_key.value);
+
+	auto times = cache.get(times_key.value);
+	bool times_hit = (times != nullptr);
+	if (!times) {
+		auto resident = std::make_shared< Resident >();
+		ak::interpolate_values(embedded->model, embedded->values, &resident->values);
+		cache.put(times_key.value, resident);
+		times = resident;
+	}
+
+	ak::RowColGraph graph;
+	ak::peel(parameters, embedded->model, times->values, row_field != 0, &graph);
+	std::vector< ak::TracedStitch > traced;
+	ak::trace_graph(parameters, graph, &traced, &embedded->model);
+
+	//write outputs to scratch files, then stream them back:
+	std::string prefix = work_directory + "/pipeline_daemon-" + std::to_string(getpid()) + "-" + std::to_string(requests);
+	std::string st_file = prefix + ".st";
+	std::string js_file = prefix + ".js";
+	struct RemoveFiles {
+		std::vector< std::string > files;
+		~RemoveFiles() { for (auto const &f : files) std::remove(f.c_str()); }
+	} remove_files;
+	remove_files.files = {st_file, js_file, js_file + ".log"};
+
+	{
+		StitchWriter writer(st_file);
+		if (!writer.file) throw std::runtime_error("failed to open '" + st_file + "'");
+		for (auto const &ts : traced) {
+			writer.write(ts);
+		}
+	}
+	if (schedule) {
+		std::string command = shell_quote(schedule_program) + " " + shell_quote("st:" + st_file) + " " + shell_quote("js:" + js_file) + " > " + shell_quote(js_file + ".log") + " 2>&1";
+		if (std::system(command.c_str()) != 0) throw std::runtime_error("scheduling failed");
+	}
+
+	std::string reply = "ok stitches:" + std::to_string(traced.size())
+		+ " embed:" + (embed_hit ? "resident" : "computed")
+		+ " times:" + (times_hit ? "resident" : "computed");
+	if (!daemon_protocol::send_frame(fd, reply)
+	 || !daemon_protocol::send_file(fd, st_file)
+	 || !daemon_protocol::send_file(fd, schedule ? js_file : std::string())) {
+		LOG(Warning, Daemon) << "WARNING: client went away before results were sent.";
+	}
+	return "";
+}
+
+std::string Daemon::stats() const {
+	return "ok resident:" + std::to_string(cache.entries.size())
+		+ " resident-mb:" + std::to_string(cache.used >> 20)
+		+ " capacity-mb:" + std::to_string(cache.capacity >> 20)
+		+ " hits:" + std::to_string(cache.hits)
+		+ " misses:" + std::to_string(cache.misses)
+		+ " evictions:" + std::to_string(cache.evictions)
+		+ " requests:" + std::to_string(requests);
+}
+
+}
+
+int main(int argc, char **argv) {
+	Daemon daemon;
+	std::string socket_path = "";
+	uint32_t memory_mb = 1024;
+	uint32_t log_level = 0;
+	std::string log_modules = "daemon=1";
+	std::string log_file = "";
+	{ //parse arguments:
+		TaggedArguments args;
+		args.emplace_back("socket", &socket_path, "Unix-domain socket to listen on (required)");
+		args.emplace_back("memory-mb", &memory_mb, "memory cap for resident models, embeddings, and times (MB)");
+		args.emplace_back("schedule", &daemon.schedule_program, "scheduling program to run for 'run ... schedule:1' (default: 'schedule' next to this program)");
+		args.emplace_back("work", &daemon.work_directory, "directory for scratch files (default: /tmp)");
+		args.emplace_back("log-level", &log_level, "console output from the pipeline: 0 = quiet, 1 = summaries, 2 = debug dumps");
+		args.emplace_back("log-modules", &log_modules, "per-module log levels overriding 'log-level:' (the default keeps the daemon's own request log)");
+		args.emplace_back("log-file", &log_file, "write log output to this file instead of the console");
+		bool usage = !args.parse(argc, argv);
+		if (!usage && socket_path == "") {
+			std::cerr << "ERROR: 'socket:' argument is required." << std::endl;
+			usage = true;
+		}
+		Log::set_level(log_level);
+		if (!usage && !Log::set_filters(log_modules)) {
+			std::cerr << "ERROR: failed to parse 'log-modules:' list '" << log_modules << "'." << std::endl;
+			usage = true;
+		}
+		if (!usage && !Log::set_file(log_file)) {
+			std::cerr << "ERROR: failed to open log file '" << log_file << "'." << std::endl;
+			return 1;
+		}
+		if (usage) {
+			std::cerr << "Usage:\n\t./pipeline_daemon [tag:value] [...]\n" << args.help_string() << std::endl;
+			return 1;
+		}
+	}
+	daemon.cache.capacity = uint64_t(memory_mb) << 20;
+	if (daemon.work_directory == "") daemon.work_directory = "/tmp";
+	if (daemon.schedule_program == "") {
+		std::string self = argv[0];
+		auto slash = self.rfind('/');
+		daemon.schedule_program = (slash == std::string::npos ? std::string("./") : self.substr(0, slash + 1)) + "schedule";
+	}
+
+	//(a client hanging up mid-reply should fail the write, not kill the daemon)
+	std::signal(SIGPIPE, SIG_IGN);
+
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (socket_path.size() >= sizeof(address.sun_path)) {
+		LOG(Error, Daemon) << "ERROR: socket path '" << socket_path << "' is too long.";
+		return 1;
+	}
+	std::strcpy(address.sun_path, socket_path.c_str());
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0) {
+		LOG(Error, Daemon) << "ERROR: failed to create socket.";
+		return 1;
+	}
+	unlink(socket_path.c_str()); //(left over from an earlier daemon)
+	if (bind(listener, reinterpret_cast< sockaddr * >(&address), sizeof(address)) != 0 || listen(listener, 8) != 0) {
+		LOG(Error, Daemon) << "ERROR: failed to listen on '" << socket_path << "'.";
+		close(listener);
+		return 1;
+	}
+	LOG(Info, Daemon) << "Listening on '" << socket_path << "' with " << memory_mb << "MB for resident data.";
+
+	//requests are served one at a time (each already uses all cores inside peeling):
+	while (true) {
+		int fd = accept(listener, nullptr, nullptr);
+		if (fd < 0) {
+			if (errno == EINTR) continue;
+			LOG(Error, Daemon) << "ERROR: accept failed.";
+			break;
+		}
+		bool keep_running = daemon.serve(fd);
+		close(fd);
+		if (!keep_running) break;
+	}
+
+	close(listener);
+	unlink(socket_path.c_str());
+	LOG(Info, Daemon) << "Stopped after " << daemon.requests << " requests.";
+	return 0;
+}
@@ -500,7 +500,6 @@ void best_expand(
 		best = f->second.source;
 		is_first = false;
 	}
-	std::cout.flush(); //DEBUG
 
 	std::reverse(ops.begin(), ops.end());
 
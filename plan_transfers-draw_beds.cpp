@@ -1,6 +1,6 @@
 #include "plan_transfers-helpers.hpp"
+#include "log.hpp"
 
-#include <iostream>
 #include <sstream>
 
 void draw_beds(
@@ -114,8 +114,7 @@ void draw_beds(
 		bottom_str << bottom_labels[n - min_needle];
 	}
 
-	std::cout << needle_str.str() << '\n';
-	std::cout << top_str.str() << '\n';
-	std::cout << bottom_str.str() << '\n';
-	std::cout.flush();
+	LOG(Info, Transfers) << needle_str.str() << '\n'
+		<< top_str.str() << '\n'
+		<< bottom_str.str();
 }
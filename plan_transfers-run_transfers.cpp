@@ -1,4 +1,5 @@
 #include "plan_transfers-helpers.hpp"
+#include "log.hpp"
 
 //!!NOTE: transfers don't know if they are rolling or not. This might be an issue!
 
@@ -261,7 +262,7 @@ void run_transfers(
 	}
 
 	if (!good) {
-		std::cout << "!!!!! bad slacks after run_transfers !!!!!\n";
+		LOG(Error, Transfers) << "!!!!! bad slacks after run_transfers !!!!!";
 		draw_beds(to_top_bed, to_top, to_bottom_bed, to_bottom);
 		exit(1);
 	}
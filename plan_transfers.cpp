@@ -1,5 +1,6 @@
 #include "plan_transfers.hpp"
 #include "plan_transfers-helpers.hpp"
+#include "log.hpp"
 
 #include <cassert>
 #include <algorithm>
@@ -389,7 +390,7 @@ bool plan_transfers(
 			}
 		}
 		if (!(best_penalty < starting_penalty)) {
-			std::cout << "ERROR: penalty DID NOT DECREASE; you may be in for an infinite planning loop [...I think this happens because the code doesn't force zero-racking configurations after expand...]" << std::endl;
+			LOG(Error, Transfers) << "ERROR: penalty DID NOT DECREASE; you may be in for an infinite planning loop [...I think this happens because the code doesn't force zero-racking configurations after expand...]";
 			//assert(best_penalty < starting_penalty);
 		}
 
@@ -6,6 +6,9 @@
 #include "plan_transfers.hpp"
 
 #include "TaggedArguments.hpp"
+#include "StageCache.hpp"
+#include "binary_io.hpp"
+#include "log.hpp"
 
 #include <deque>
 #include <map>
@@ -74,15 +77,32 @@ struct CycleIndex {
 int main(int argc, char **argv) {
 	std::string in_st = "";
 	std::string out_js = "";
+	StageCache cache;
+	uint32_t log_level = 1;
+	std::string log_modules = "";
+	std::string log_file = "";
 	{ //parse arguments:
 		TaggedArguments args;
 		args.emplace_back("st", &in_st, "input stitches file (required)");
 		args.emplace_back("js", &out_js, "output knitting file");
+		args.emplace_back("cache", &cache.directory, "directory (must exist) in which to cache schedules; stitches matching a cached entry are not re-scheduled");
+		args.emplace_back("log-level", &log_level, "console output: 0 = quiet, 1 = summaries, 2 = debug dumps (including each instruction)");
+		args.emplace_back("log-modules", &log_modules, "per-module log levels overriding 'log-level:', e.g. 'schedule=2,transfers=0'");
+		args.emplace_back("log-file", &log_file, "write log output to this file instead of the console");
 		bool usage = !args.parse(argc, argv);
 		if (!usage && in_st == "") {
 			std::cerr << "ERROR: 'st:' argument is required." << std::endl;
 			usage = true;
 		}
+		Log::set_level(log_level);
+		if (!usage && !Log::set_filters(log_modules)) {
+			std::cerr << "ERROR: failed to parse 'log-modules:' list '" << log_modules << "'." << std::endl;
+			usage = true;
+		}
+		if (!usage && !Log::set_file(log_file)) {
+			std::cerr << "ERROR: failed to open log file '" << log_file << "'." << std::endl;
+			return 1;
+		}
 		if (usage) {
 			std::cerr << "Usage:\n\t./schedule [tag:value] [...]\n" << args.help_string() << std::endl;
 			return 1;
@@ -93,10 +113,55 @@ int main(int argc, char **argv) {
 
 	std::vector< Stitch > stitches;
 	if (!load_stitches(in_st, &stitches)) {
-		std::cerr << "ERROR: failed to load stitches from '" << in_st << "'." << std::endl;
+		LOG(Error, Schedule) << "ERROR: failed to load stitches from '" << in_st << "'.";
 		return 1;
 	}
-	std::cout << "Read " << stitches.size() << " stitches from '" << in_st << "'." << std::endl;
+	LOG(Info, Schedule) << "Read " << stitches.size() << " stitches from '" << in_st << "'.";
+
+	auto write_instructions = [&out_js](std::vector< std::string > const &instructions) {
+		if (out_js == "") return;
+		std::ofstream js(out_js, std::ios::binary);
+		for (auto const &instr : instructions) {
+			js << instr << '\n';
+		}
+		js.close();
+		LOG(Info, Schedule) << "Wrote '" << out_js << "'.";
+	};
+
+	//the schedule depends only on stitch types, directions, and connections (not on the debug positions):
+	//NOTE: the key includes ScheduleVersion; bump it whenever scheduling changes so old entries are not reused
+	constexpr uint32_t ScheduleVersion = 1;
+	uint64_t schedule_key = 0;
+	{
+		ContentHash key;
+		key.add(ScheduleVersion);
+		key.add(uint64_t(stitches.size()));
+		for (auto const &s : stitches) {
+			key.add(s.yarn);
+			key.add(s.type);
+			key.add(s.direction);
+			key.add(s.in);
+			key.add(s.out);
+		}
+		schedule_key = key.value;
+	}
+	{
+		std::vector< std::string > instructions;
+		bool cached = cache.load("schedule", schedule_key, [&instructions](std::istream &in) {
+			uint32_t count;
+			read_scalar(in, &count, "instruction count");
+			instructions.assign(count, std::string());
+			std::vector< char > chars;
+			for (auto &instr : instructions) {
+				read_vector(in, &chars, "instruction");
+				instr.assign(chars.begin(), chars.end());
+			}
+		});
+		if (cached) {
+			write_instructions(instructions);
+			return 0;
+		}
+	}
 
 	//------------------------------
 
@@ -147,7 +212,7 @@ int main(int argc, char **argv) {
 		std::vector< ScheduleOption > options;
 	};
 
-	#define REPORT_ERROR( X ) do { std::cerr << (X) << std::endl; exit(1); } while(0)
+	#define REPORT_ERROR( X ) do { LOG(Error, Schedule) << (X); exit(1); } while(0)
 
 	std::vector< Storage > storages;
 	std::vector< Step > steps;
@@ -297,7 +362,7 @@ int main(int argc, char **argv) {
 
 				//flip and re-jigger yarn storages:
 				auto link_ccw = [&outs](Loop const &a, Loop const &b) {
-					std::cout << "Linking " << a.to_string() << " -> " << b.to_string() << std::endl; //DEBUG
+					LOG(Debug, Schedule) << "Linking " << a.to_string() << " -> " << b.to_string();
 					std::list< Storage >::iterator sa = outs.end();
 					uint32_t la = -1U;
 					std::list< Storage >::iterator sb = outs.end();
@@ -460,16 +525,17 @@ int main(int argc, char **argv) {
 					ret += "]";
 					return ret;
 				};
-				std::cout << "step[" << (&step - &steps[0]) << "]:\n";
-				std::cout << "  in:";
-				for (auto i : step.in) std::cout << ' ' << storage_to_string(i);
-				std::cout << '\n';
-				std::cout << " int:";
-				for (auto const &l : step.inter) std::cout << ' ' << l.to_string();
-				std::cout << '\n';
-				std::cout << " out:";
-				for (auto o : step.out) std::cout << ' ' << storage_to_string(o);
-				std::cout << std::endl;
+				std::ostringstream dump;
+				dump << "step[" << (&step - &steps[0]) << "]:\n";
+				dump << "  in:";
+				for (auto i : step.in) dump << ' ' << storage_to_string(i);
+				dump << '\n';
+				dump << " int:";
+				for (auto const &l : step.inter) dump << ' ' << l.to_string();
+				dump << '\n';
+				dump << " out:";
+				for (auto o : step.out) dump << ' ' << storage_to_string(o);
+				LOG(Debug, Schedule) << dump.str();
 			}
 
 			if (step.in.size() > 0 && step.out.size() > 0) {
@@ -523,7 +589,7 @@ int main(int argc, char **argv) {
 							inter_to_out[f->second.index] = t->second.index;
 						}
 					} else {
-						std::cout << "What is '" << stitch.type << "'?" << std::endl; //DEBUG
+						LOG(Error, Schedule) << "What is '" << stitch.type << "'?";
 						assert(0 && "Unsupported stitch type.");
 					}
 				}
@@ -646,25 +712,25 @@ int main(int argc, char **argv) {
 
 
 	//Figure out possible shapes for storages near *interesting* steps:
-	std::cout << "Figuring out shapes for interesting steps:" << std::endl; //DEBUG
+	LOG(Info, Schedule) << "Figuring out shapes for interesting steps.";
 	for (auto &step : steps) {
 		//interesting steps have more than one out/in:
 		if (step.in.size() <= 1 && step.out.size() <= 1) continue;
 
-		std::cout << "\nsteps[" << (&step - &steps[0]) << "]:\n"; //DEBUG
-
-		{ //DEBUG
+		if (LOG_ENABLED(Debug, Schedule)) { //DEBUG
+			std::ostringstream dump;
+			dump << "\nsteps[" << (&step - &steps[0]) << "]:\n";
 			for (StorageIdx s : step.in) {
-				std::cout << "  uses storages[" << s << "]:";
-				for (auto const &l : storages[s]) std::cout << " " << l.to_string();
-				std::cout << "\n";
+				dump << "  uses storages[" << s << "]:";
+				for (auto const &l : storages[s]) dump << " " << l.to_string();
+				dump << "\n";
 			}
 			for (StorageIdx s : step.out) {
-				std::cout << "  makes storages[" << s << "]:";
-				for (auto const &l : storages[s]) std::cout << " " << l.to_string();
-				std::cout << "\n";
+				dump << "  makes storages[" << s << "]:";
+				for (auto const &l : storages[s]) dump << " " << l.to_string();
+				dump << "\n";
 			}
-			std::cout.flush();
+			LOG(Debug, Schedule) << dump.str();
 		}
 
 		//Construction model:
@@ -1023,16 +1089,15 @@ int main(int argc, char **argv) {
 
 		enumerate_orders();
 
-		std::cout << "In total, step had " << step.options.size() << " scheduling options." << std::endl;
+		LOG(Debug, Schedule) << "In total, step had " << step.options.size() << " scheduling options.";
 
 	} //interesting steps
-	std::cout << "(done)" << std::endl;
 
 
 	//Figure out possible shapes for storages near *boring* steps:
-	std::cout << "Figuring out shapes for boring steps:" << std::endl; //DEBUG
+	LOG(Info, Schedule) << "Figuring out shapes for boring steps.";
 	for (auto &step : steps) {
-		std::cout <<"step = " << &step - &steps[0] << std::endl;
+		LOG(Debug, Schedule) << "step = " << &step - &steps[0];
 		if (!(step.in.size() <= 1 && step.out.size() <= 1)) continue; //skip exciting steps
 		uint32_t inter_roll = 0; //such that: storages[step.in[0]][i] == step.inter[i + inter_roll]
 		//used to fix up inter_shape relative to in_shape so the stitches are in the same places.
@@ -1135,7 +1200,7 @@ int main(int argc, char **argv) {
 			}
 
 		}
-		std::cout << "steps[" << (&step - &steps[0]) << "] had " << step.options.size() << " scheduling options." << std::endl;
+		LOG(Debug, Schedule) << "steps[" << (&step - &steps[0]) << "] had " << step.options.size() << " scheduling options.";
 	}
 
 	//---------------------
@@ -1160,9 +1225,8 @@ int main(int argc, char **argv) {
 		step_in_edges.reserve(steps.size());
 		step_out_edges.reserve(steps.size());
 
-		std::cout << "Building DAG "; std::cout.flush();
+		LOG(Info, Schedule) << "Building DAG.";
 		for (auto const &step : steps) {
-			std::cout << "."; std::cout.flush();
 			step_in_edges.emplace_back();
 			step_out_edges.emplace_back();
 			if (step.in.size() == 1 && step.out.size() == 1) {
@@ -1313,17 +1377,16 @@ int main(int argc, char **argv) {
 				assert(node.options.size() == step.options.size());
 			}
 		} //for(steps)
-		std::cout << " done." << std::endl;
 
 		assert(node_steps.size() == nodes.size());
 
-		std::cout << "Have " << edges.size() << " edges and " << nodes.size() << " nodes." << std::endl;
+		LOG(Info, Schedule) << "Have " << edges.size() << " edges and " << nodes.size() << " nodes.";
 
 		std::vector< uint32_t > node_options;
 		std::vector< int32_t > node_positions, edge_positions;
 
 		if (!embed_DAG(nodes, edges, &node_options, &node_positions, &edge_positions)) {
-			std::cerr << "ERROR: failed to find an upward-planar embedding." << std::endl;
+			LOG(Error, Schedule) << "ERROR: failed to find an upward-planar embedding.";
 			return 1;
 		}
 
@@ -1335,13 +1398,12 @@ int main(int argc, char **argv) {
 		assert(node_options.size() == nodes.size());
 		for (uint32_t n = 0; n < nodes.size(); ++n) {
 			assert(node_steps[n] < steps.size());
-			std::cout << "Step " << node_steps[n] << " gets option " << node_options[n] << " of " << nodes[n].options.size() << " for cost " << nodes[n].options[node_options[n]].cost << std::endl;
+			LOG(Debug, Schedule) << "Step " << node_steps[n] << " gets option " << node_options[n] << " of " << nodes[n].options.size() << " for cost " << nodes[n].options[node_options[n]].cost;
 			assert(node_options[n] < steps[node_steps[n]].options.size());
 			assert(nodes[n].options.size() == steps[node_steps[n]].options.size());
 			step_options[node_steps[n]] = node_options[n];
 		}
 		for (auto const &e : edges) {
-			std::cout << "Edge " << (&e - &edges[0]) << " from " << e.from << " to " << e.to << " ends up with cost "; std::cout.flush();
 			uint32_t from_shape = -1U;
 			auto const &from_option = nodes[e.from].options[node_options[e.from]];
 			for (uint32_t out = 0; out < from_option.out_order.size(); ++out) {
@@ -1363,7 +1425,7 @@ int main(int argc, char **argv) {
 
 			assert(from_shape < e.from_shapes);
 			assert(to_shape < e.to_shapes);
-			std::cout << e.costs[from_shape * e.to_shapes + to_shape] << std::endl;
+			LOG(Debug, Schedule) << "Edge " << (&e - &edges[0]) << " from " << e.from << " to " << e.to << " ends up with cost " << e.costs[from_shape * e.to_shapes + to_shape];
 
 		}
 
@@ -1473,23 +1535,24 @@ int main(int argc, char **argv) {
 		//record shapes:
 		uint32_t pre_xfers = 0;
 		for (uint32_t si = 0; si < steps.size(); ++si) {
-			std::cout << "Step " << si << " option " << step_options[si] << " says "; //DEBUG
+			std::ostringstream says; //DEBUG
+			if (LOG_ENABLED(Debug, Schedule)) says << "Step " << si << " option " << step_options[si] << " says ";
 			assert(step_options[si] < steps[si].options.size());
 			auto const &option = steps[si].options[step_options[si]];
 			for (uint32_t in = 0; in < steps[si].in.size(); ++in) {
-				std::cout << " i" << steps[si].in[in] << "=" << option.in_shapes[in]; std::cout.flush(); //DEBUG
+				if (LOG_ENABLED(Debug, Schedule)) says << " i" << steps[si].in[in] << "=" << option.in_shapes[in];
 				assert(storage_shapes[steps[si].in[in]] != -1U);
 				if (storage_shapes[steps[si].in[in]] != option.in_shapes[in]) {
 					++pre_xfers;
-					std::cout << "*"; std::cout.flush(); //DEBUG
+					if (LOG_ENABLED(Debug, Schedule)) says << "*";
 				}
 			}
 			for (uint32_t out = 0; out < steps[si].out.size(); ++out) {
-				std::cout << " o" << steps[si].out[out] << "=" << option.out_shapes[out]; //DEBUG
+				if (LOG_ENABLED(Debug, Schedule)) says << " o" << steps[si].out[out] << "=" << option.out_shapes[out];
 				assert(storage_shapes[steps[si].out[out]] == -1U);
 				storage_shapes[steps[si].out[out]] = option.out_shapes[out];
 			}
-			std::cout << std::endl; //DEBUG
+			LOG(Debug, Schedule) << says.str();
 			//PARANOIA: check order vs storage positions:
 			for (uint32_t i = 1; i < option.in_order.size(); ++i) {
 				assert(option.in_order[i-1] < steps[si].in.size());
@@ -1509,7 +1572,7 @@ int main(int argc, char **argv) {
 			}
 		}
 		if (pre_xfers > 0) {
-			std::cout << "NOTE: will need to reshape " << pre_xfers << " inputs before steps." << std::endl;
+			LOG(Info, Schedule) << "NOTE: will need to reshape " << pre_xfers << " inputs before steps.";
 		}
 
 		//TODO: PARANOIA: check that step option orders match recorded storage positions.
@@ -1551,30 +1614,31 @@ int main(int argc, char **argv) {
 
 		//DEBUG: dump selections:
 		for (auto const &step : steps) {
+			if (!LOG_ENABLED(Debug, Schedule)) break;
+			std::ostringstream dump;
 			uint32_t si = &step - &steps[0];
-			std::cout << "Step " << si << " gets option " << step_options[si] << " of " << steps[si].options.size() << "\n";
+			dump << "Step " << si << " gets option " << step_options[si] << " of " << steps[si].options.size() << "\n";
 			auto const &option = steps[si].options[step_options[si]];
-			std::cout << "  takes";
+			dump << "  takes";
 			for (auto i : option.in_order) {
 				uint32_t in = step.in[i];
 				uint32_t mark = 0;
 				for (uint32_t s = 1; s < storages[in].size(); ++s) {
 					if (storages[in][mark] < storages[in][s]) mark = s;
 				}
-				std::cout << " s" << in << " in shape " << storage_shapes[in] << " " << summarize(Shape::unpack(storage_shapes[in]), storages[in].size(), mark) << " in lane " << storage_positions[in] << ",";
+				dump << " s" << in << " in shape " << storage_shapes[in] << " " << summarize(Shape::unpack(storage_shapes[in]), storages[in].size(), mark) << " in lane " << storage_positions[in] << ",";
 			}
-			std::cout << "\n";
-			std::cout << "  makes";
+			dump << "\n";
+			dump << "  makes";
 			for (auto o : option.out_order) {
 				uint32_t out = step.out[o];
 				uint32_t mark = 0;
 				for (uint32_t s = 1; s < storages[out].size(); ++s) {
 					if (storages[out][mark] < storages[out][s]) mark = s;
 				}
-				std::cout << " s" << out << " in shape " << storage_shapes[out] << " " << summarize(Shape::unpack(storage_shapes[out]), storages[out].size(), mark) << " in lane " << storage_positions[out] << ",";
+				dump << " s" << out << " in shape " << storage_shapes[out] << " " << summarize(Shape::unpack(storage_shapes[out]), storages[out].size(), mark) << " in lane " << storage_positions[out] << ",";
 			}
-			std::cout << "\n";
-			std::cout.flush();
+			LOG(Debug, Schedule) << dump.str();
 		}
 	}
 
@@ -1657,7 +1721,7 @@ int main(int argc, char **argv) {
 			}
 		}
 
-		{ //DEBUG: show where the steps sit on actual needles
+		if (LOG_ENABLED(Debug, Schedule)) { //DEBUG: show where the steps sit on actual needles
 			int32_t min_needle = std::numeric_limits< int32_t >::max();
 			int32_t max_needle = std::numeric_limits< int32_t >::min();
 			for (uint32_t si = 0; si < steps.size(); ++si) {
@@ -1668,7 +1732,8 @@ int main(int argc, char **argv) {
 			for (uint32_t si = 0; si < steps.size(); ++si) {
 				std::string num = std::to_string(si);
 				while (num.size() < 4) num = ' ' + num;
-				std::cout << "after " << num << ": ";
+				std::ostringstream dump;
+				dump << "after " << num << ": ";
 
 				std::vector< bool > on_back(max_needle - min_needle + 1, false);
 				std::vector< bool > on_front(max_needle - min_needle + 1, false);
@@ -1711,17 +1776,17 @@ int main(int argc, char **argv) {
 
 				for (auto d : dots) {
 					uint16_t c = 0x2800 | d;
-					std::cout << char(0xe0 | ((c >> 12) & 0x1f));
-					std::cout << char(0x80 | ((c >> 6) & 0x3f));
-					std::cout << char(0x80 | ((c) & 0x3f));
+					dump << char(0xe0 | ((c >> 12) & 0x1f));
+					dump << char(0x80 | ((c >> 6) & 0x3f));
+					dump << char(0x80 | ((c) & 0x3f));
 				}
 
-				std::cout << " |";
+				dump << " |";
 				for (auto l : lefts[si]) {
-					std::cout << " " << l;
+					dump << " " << l;
 				}
 
-				std::cout << std::endl;
+				LOG(Debug, Schedule) << dump.str();
 			}
 		}
 
@@ -1732,7 +1797,7 @@ int main(int argc, char **argv) {
 	std::vector< std::string > instructions;
 	auto add_instr = [&instructions](std::string const &instr) {
 		instructions.emplace_back(instr);
-		std::cout << instr << std::endl; //DEBUG
+		LOG(Debug, Schedule) << instr;
 	};
 	add_instr("const autoknit = require('autoknit');");
 	add_instr("let h = new autoknit.Helpers;");
@@ -2284,7 +2349,7 @@ int main(int argc, char **argv) {
 			}
 		};
 
-		std::cout << "Step[" << stepi << "]:" << std::endl; //DEBUG
+		LOG(Debug, Schedule) << "Step[" << stepi << "]:";
 		add_instr("//steps[" + std::to_string(stepi) + "]:");
 		auto const &step = steps[stepi];
 		assert(step_options[stepi] < step.options.size());
@@ -2322,16 +2387,18 @@ int main(int argc, char **argv) {
 				}
 			}
 		}
-		//DEBUG:
-		std::cout << "  layout: ";
-		for (auto si : left_of_step) std::cout << si << ' ';
-		std::cout << '[';
-		for (auto i : option.in_order) std::cout << (i == option.in_order[0] ? "" : " ") << step.in[i];
-		std::cout << " -> ";
-		for (auto o : option.out_order) std::cout << (o == option.out_order[0] ? "" : " ") << step.out[o];
-		std::cout << ']';
-		for (auto si : right_of_step) std::cout << ' ' << si;
-		std::cout << std::endl;
+		if (LOG_ENABLED(Debug, Schedule)) { //DEBUG
+			std::ostringstream layout;
+			layout << "  layout: ";
+			for (auto si : left_of_step) layout << si << ' ';
+			layout << '[';
+			for (auto i : option.in_order) layout << (i == option.in_order[0] ? "" : " ") << step.in[i];
+			layout << " -> ";
+			for (auto o : option.out_order) layout << (o == option.out_order[0] ? "" : " ") << step.out[o];
+			layout << ']';
+			for (auto si : right_of_step) layout << ' ' << si;
+			LOG(Debug, Schedule) << layout.str();
+		}
 
 
 		//Compute the location of each loop in the step inputs:
@@ -2390,7 +2457,7 @@ int main(int argc, char **argv) {
 				auto f = storage_layouts.find(&storages[step.in[i]]);
 				assert(f != storage_layouts.end());
 				if (f->second.second.pack() != option.in_shapes[i]) {
-					std::cout << "  NOTE: late reshape for storage " << step.in[i] << std::endl; //DEBUG
+					LOG(Debug, Schedule) << "  NOTE: late reshape for storage " << step.in[i];
 					f->second.second = Shape::unpack(option.in_shapes[i]); //<-- in some few cases, option's selected layout will be different from storage layout.
 				}
 			}
@@ -2402,13 +2469,13 @@ int main(int argc, char **argv) {
 				f->second.second.append_to_beds(storages[step.in[i]], INVALID_LOOP, &step_front, &step_back);
 			}
 
-			{ //DEBUG:
+			if (LOG_ENABLED(Debug, Schedule)) { //DEBUG:
 				std::string front_string, back_string;
 				typeset_beds< Loop >(step_front, step_back, [](Loop const &l){
 					return l.to_string();
 				}, " ", &front_string, &back_string);
-				std::cout << "  in: " << back_string << std::endl;
-				std::cout << "      " << front_string << std::endl;
+				LOG(Debug, Schedule) << "  in: " << back_string << "\n"
+					<< "      " << front_string;
 			}
 
 
@@ -2455,13 +2522,13 @@ int main(int argc, char **argv) {
 				}
 			}
 
-			{ //DEBUG:
+			if (LOG_ENABLED(Debug, Schedule)) { //DEBUG:
 				std::string front_string, back_string;
 				typeset_beds< Loop >(inter_front, inter_back, [](Loop const &l){
 					return l.to_string();
 				}, " ", &front_string, &back_string);
-				std::cout << " int: " << back_string << std::endl;
-				std::cout << "      " << front_string << std::endl;
+				LOG(Debug, Schedule) << " int: " << back_string << "\n"
+					<< "      " << front_string;
 			}
 
 			assert(inter_back == step_back);
@@ -3051,15 +3118,15 @@ int main(int argc, char **argv) {
 	}
 	add_instr("h.write();");
 
-	//write instructions to output file:
-	if (out_js != "") {
-		std::ofstream js(out_js, std::ios::binary);
+	cache.save("schedule", schedule_key, [&instructions](std::ostream &out) {
+		write_scalar(out, uint32_t(instructions.size()), "instruction count");
 		for (auto const &instr : instructions) {
-			js << instr << '\n';
+			write_vector(out, std::vector< char >(instr.begin(), instr.end()), "instruction");
 		}
-		js.close();
-		std::cout << "Wrote '" << out_js << "'." << std::endl;
-	}
+	});
+
+	//write instructions to output file:
+	write_instructions(instructions);
 
 	return 0;
 }
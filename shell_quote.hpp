@@ -0,0 +1,16 @@
+#pragma once
+
+//Quoting for command lines run through std::system (i.e., /bin/sh).
+
+#include <string>
+
+//quote a string as one /bin/sh word (single-quoted, with any single quotes written as '\''):
+inline std::string shell_quote(std::string const &str) {
+	std::string ret = "'";
+	for (char c : str) {
+		if (c == '\'') ret += "'\\''";
+		else ret += c;
+	}
+	ret += "'";
+	return ret;
+}
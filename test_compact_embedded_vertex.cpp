@@ -0,0 +1,80 @@
+#include "pipeline.hpp"
+
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <random>
+
+int main() {
+	//a small fan of triangles around vertex 0:
+	ak::Model model;
+	model.vertices.emplace_back(0.0f, 0.0f, 0.0f);
+	for (uint32_t i = 0; i < 6; ++i) {
+		float a = 2.0f * float(M_PI) * i / 6.0f;
+		model.vertices.emplace_back(std::cos(a), std::sin(a), 0.1f * i);
+	}
+	for (uint32_t i = 0; i < 6; ++i) {
+		model.triangles.emplace_back(0, 1 + i, 1 + (i + 1) % 6);
+	}
+
+	ak::EmbeddedVertexCodec codec(model);
+
+	uint32_t failed = 0;
+	auto check = [&](char const *what, ak::EmbeddedVertex const &ev, float weight_bound) {
+		ak::EmbeddedVertex rt = codec.unpack(codec.pack(ev));
+		float err = 0.0f;
+		for (uint32_t i = 0; i < 3; ++i) {
+			err = std::max(err, std::abs(rt.weights[i] - ev.weights[i]));
+		}
+		if (rt.simplex != ev.simplex || !(err <= weight_bound)) {
+			std::cerr << "FAILED: " << what << " point round-tripped with weight error " << err << " (bound " << weight_bound << ")." << std::endl;
+			++failed;
+		}
+		//round-tripped (snapped) points are exact, which is what lets peeling store snapped chains compactly:
+		if (codec.snap(rt) != rt || codec.pack(rt) != codec.pack(ev)) {
+			std::cerr << "FAILED: " << what << " point changed when snapped again." << std::endl;
+			++failed;
+		}
+	};
+
+	std::mt19937 mt(0xfeedf00d);
+	std::uniform_real_distribution< float > unit(0.0f, 1.0f);
+
+	//on-vertex points are exact:
+	for (uint32_t v = 0; v < model.vertices.size(); ++v) {
+		check("on-vertex", ak::EmbeddedVertex::on_vertex(v), 0.0f);
+	}
+
+	for (uint32_t iter = 0; iter < 1000; ++iter) {
+		auto const &tri = model.triangles[mt() % model.triangles.size()];
+
+		//on-edge points made with on_edge are exact:
+		check("on-edge", ak::EmbeddedVertex::on_edge(tri.y, tri.z, unit(mt)), 0.0f);
+
+		//on-edge points made with mix are within |x + y - 1| + 2^-25:
+		{
+			ak::EmbeddedVertex a = ak::EmbeddedVertex::on_edge(tri.y, tri.z, unit(mt));
+			ak::EmbeddedVertex b = ak::EmbeddedVertex::on_edge(tri.y, tri.z, unit(mt));
+			ak::EmbeddedVertex m = ak::EmbeddedVertex::mix(a, b, unit(mt));
+			//(sum error computed in double, since computing it in float would round it away)
+			float sum_err = float(std::abs(double(m.weights.x) + double(m.weights.y) - 1.0));
+			check("mixed on-edge", m, sum_err + std::ldexp(1.0f, -25));
+		}
+
+		//in-triangle points are within 1/CompactWeightSum (plus |x + y + z - 1|):
+		{
+			float y = unit(mt);
+			float z = unit(mt) * (1.0f - y);
+			ak::EmbeddedVertex ev = ak::EmbeddedVertex::canonicalize(tri, glm::vec3(1.0f - y - z, y, z));
+			float sum_err = float(std::abs(double(ev.weights.x) + double(ev.weights.y) + double(ev.weights.z) - 1.0));
+			check("in-triangle", ev, 1.0f / ak::CompactEmbeddedVertex::CompactWeightSum + sum_err);
+		}
+	}
+
+	if (failed) {
+		std::cerr << failed << " round trips failed." << std::endl;
+		return 1;
+	}
+	std::cout << "All round trips within bounds, and snapped points are exact." << std::endl;
+	return 0;
+}
@@ -0,0 +1,130 @@
+#include "dataflow.hpp"
+
+#include <iostream>
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+
+int main() {
+	//  a -> double -> sum <- triple <- b ; sign <- a
+	ak::Dataflow flow;
+	int a = 1, b = 2;
+	int doubled = 0, tripled = 0, sum = 0, sign = 0;
+	auto a_node = flow.add_source("a");
+	auto b_node = flow.add_source("b");
+	auto double_node = flow.add_node("double", {a_node}, [&]() {
+		doubled = 2 * a;
+		return true;
+	});
+	auto triple_node = flow.add_node("triple", {b_node}, [&]() {
+		tripled = 3 * b;
+		return true;
+	});
+	auto sum_node = flow.add_node("sum", {double_node, triple_node}, [&]() {
+		sum = doubled + tripled;
+		return true;
+	});
+	auto sign_node = flow.add_node("sign", {a_node}, [&]() {
+		int old = sign;
+		sign = (a < 0 ? -1 : 1);
+		return sign != old; //dependents only care if the sign flips
+	});
+	int sign_users = 0;
+	auto sign_user_node = flow.add_node("sign user", {sign_node}, [&]() {
+		sign_users += 1;
+		return true;
+	}, true);
+
+	auto check_computes = [&](ak::Dataflow::Node n, uint32_t expected) {
+		if (flow.nodes[n].computes != expected) {
+			std::cerr << "Expected '" << flow.nodes[n].name << "' to have computed " << expected << " times, but it computed " << flow.nodes[n].computes << "." << std::endl;
+			assert(0 && "unexpected compute count");
+			exit(1);
+		}
+	};
+
+	//first update computes everything needed (and only that):
+	flow.update(sum_node);
+	assert(sum == 8);
+	check_computes(double_node, 1);
+	check_computes(triple_node, 1);
+	check_computes(sign_node, 0);
+	assert(!flow.stale(sum_node));
+	assert(flow.stale(sign_user_node));
+
+	//nothing changed, so nothing recomputes:
+	flow.update({sum_node, sign_user_node});
+	check_computes(sum_node, 1);
+	check_computes(sign_user_node, 1);
+
+	//only the branch downstream of 'b' recomputes:
+	b = 5;
+	flow.changed(b_node);
+	assert(flow.stale(sum_node));
+	assert(!flow.stale(sign_user_node));
+	flow.update({sum_node, sign_user_node});
+	assert(sum == 17);
+	check_computes(double_node, 1);
+	check_computes(triple_node, 2);
+	check_computes(sum_node, 2);
+	check_computes(sign_node, 1);
+
+	//a node whose outputs didn't change doesn't make its users recompute:
+	a = 4;
+	flow.changed(a_node);
+	flow.update({sum_node, sign_user_node});
+	assert(sum == 23);
+	check_computes(sign_node, 2);
+	check_computes(sign_user_node, 1);
+
+	a = -4;
+	flow.changed(a_node);
+	flow.update({sign_user_node});
+	check_computes(sign_user_node, 2);
+	assert(flow.stale(sum_node));
+
+	//failed nodes stay stale and are retried:
+	bool fail = true;
+	auto fragile_node = flow.add_node("fragile", {a_node}, [&]() {
+		if (fail) throw std::runtime_error("failed on purpose");
+		return true;
+	});
+	try {
+		flow.update(fragile_node);
+		assert(0 && "update should have thrown");
+	} catch (std::runtime_error &e) {
+	}
+	assert(flow.stale(fragile_node));
+	fail = false;
+	flow.update(fragile_node);
+	assert(!flow.stale(fragile_node));
+
+	//independent nodes run at the same time:
+	{
+		ak::Dataflow par;
+		auto src = par.add_source("src");
+		std::atomic< uint32_t > inside(0);
+		std::atomic< uint32_t > most(0);
+		auto slow = [&]() {
+			uint32_t now = inside.fetch_add(1) + 1;
+			uint32_t prev = most.load();
+			while (now > prev && !most.compare_exchange_weak(prev, now)) { }
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			inside.fetch_sub(1);
+			return true;
+		};
+		std::vector< ak::Dataflow::Node > branches;
+		for (uint32_t i = 0; i < 4; ++i) {
+			branches.emplace_back(par.add_node("slow " + std::to_string(i), {src}, slow, (i == 0)));
+		}
+		par.update(branches);
+		std::cout << "Ran up to " << most.load() << " of " << branches.size() << " independent nodes at once." << std::endl;
+		assert(most.load() > 1);
+	}
+
+	std::cout << "Dataflow tests passed." << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,164 @@
+#include "pipeline.hpp"
+
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <queue>
+#include <vector>
+
+//flat grid of (size+1)^2 vertices in the z = 0 plane, with every quad split along the same diagonal:
+ak::Model make_grid(uint32_t size) {
+	ak::Model model;
+	for (uint32_t y = 0; y <= size; ++y) {
+		for (uint32_t x = 0; x <= size; ++x) {
+			model.vertices.emplace_back(float(x), float(y), 0.0f);
+		}
+	}
+	for (uint32_t y = 0; y < size; ++y) {
+		for (uint32_t x = 0; x < size; ++x) {
+			uint32_t a = y * (size + 1) + x;
+			uint32_t b = a + 1;
+			uint32_t c = a + (size + 1);
+			uint32_t d = c + 1;
+			model.triangles.emplace_back(a, b, d);
+			model.triangles.emplace_back(a, d, c);
+		}
+	}
+	return model;
+}
+
+//shortest path length along mesh edges (Dijkstra):
+float edge_path_length(ak::Model const &model, uint32_t source, uint32_t target) {
+	std::vector< std::vector< uint32_t > > adj(model.vertices.size());
+	for (auto const &tri : model.triangles) {
+		adj[tri.x].emplace_back(tri.y); adj[tri.y].emplace_back(tri.x);
+		adj[tri.y].emplace_back(tri.z); adj[tri.z].emplace_back(tri.y);
+		adj[tri.z].emplace_back(tri.x); adj[tri.x].emplace_back(tri.z);
+	}
+	std::vector< float > dis(model.vertices.size(), std::numeric_limits< float >::infinity());
+	std::priority_queue< std::pair< float, uint32_t >, std::vector< std::pair< float, uint32_t > >, std::greater< std::pair< float, uint32_t > > > todo;
+	dis[source] = 0.0f;
+	todo.emplace(0.0f, source);
+	while (!todo.empty()) {
+		auto at = todo.top();
+		todo.pop();
+		if (at.first > dis[at.second]) continue;
+		for (uint32_t n : adj[at.second]) {
+			float d = at.first + glm::length(model.vertices[n] - model.vertices[at.second]);
+			if (d < dis[n]) {
+				dis[n] = d;
+				todo.emplace(d, n);
+			}
+		}
+	}
+	return dis[target];
+}
+
+//is there a triangle that contains both simplices?
+bool share_triangle(ak::Model const &model, glm::uvec3 const &a, glm::uvec3 const &b) {
+	for (auto const &tri : model.triangles) {
+		auto in_tri = [&tri](glm::uvec3 const &s) {
+			for (uint32_t i = 0; i < 3; ++i) {
+				if (s[i] == -1U) continue;
+				if (s[i] != tri.x && s[i] != tri.y && s[i] != tri.z) return false;
+			}
+			return true;
+		};
+		if (in_tri(a) && in_tri(b)) return true;
+	}
+	return false;
+}
+
+//check a path is valid; returns its length:
+float check_path(ak::Model const &model, ak::EmbeddedVertex const &source, ak::EmbeddedVertex const &target, std::vector< ak::EmbeddedVertex > const &path) {
+	if (path.size() < 2 || path[0] != source || path.back() != target) {
+		std::cerr << "FAILED: path doesn't run from source to target." << std::endl;
+		exit(1);
+	}
+	float length = 0.0f;
+	for (uint32_t i = 1; i < path.size(); ++i) {
+		if (path[i-1] == path[i]) {
+			std::cerr << "FAILED: path repeats point " << i << "." << std::endl;
+			exit(1);
+		}
+		if (!share_triangle(model, path[i-1].simplex, path[i].simplex)) {
+			std::cerr << "FAILED: path points " << (i-1) << " and " << i << " don't share a triangle." << std::endl;
+			exit(1);
+		}
+		length += glm::length(path[i].interpolate(model.vertices) - path[i-1].interpolate(model.vertices));
+	}
+	return length;
+}
+
+int main() {
+	uint32_t const Size = 6;
+	ak::Model model = make_grid(Size);
+
+	//vertex-to-vertex paths on a flat grid should be straight lines, which (off the grid diagonals) are shorter than any edge path:
+	std::vector< std::pair< glm::uvec2, glm::uvec2 > > ends{
+		{ glm::uvec2(0,0), glm::uvec2(5,2) },
+		{ glm::uvec2(1,5), glm::uvec2(6,0) },
+		{ glm::uvec2(0,3), glm::uvec2(6,4) },
+	};
+	std::vector< std::pair< ak::EmbeddedVertex, ak::EmbeddedVertex > > queries;
+	for (auto const &e : ends) {
+		uint32_t s = e.first.y * (Size + 1) + e.first.x;
+		uint32_t t = e.second.y * (Size + 1) + e.second.x;
+		ak::EmbeddedVertex source = ak::EmbeddedVertex::on_vertex(s);
+		ak::EmbeddedVertex target = ak::EmbeddedVertex::on_vertex(t);
+		queries.emplace_back(source, target);
+
+		std::vector< ak::EmbeddedVertex > path;
+		ak::embedded_path(model, source, target, &path);
+		float length = check_path(model, source, target, path);
+		float straight = glm::length(model.vertices[t] - model.vertices[s]);
+		float edges = edge_path_length(model, s, t);
+		std::cout << "  " << s << " -> " << t << ": path " << length << " (straight " << straight << ", edges " << edges << ")" << std::endl;
+		if (!(length < edges - 1e-3f)) {
+			std::cerr << "FAILED: path isn't shorter than the edge path." << std::endl;
+			return 1;
+		}
+		if (!(std::abs(length - straight) < 1e-3f)) {
+			std::cerr << "FAILED: path across a flat grid isn't straight." << std::endl;
+			return 1;
+		}
+	}
+
+	//paths from points on edges and inside triangles are also valid and straight:
+	{
+		ak::EmbeddedVertex source = ak::EmbeddedVertex::on_edge(1, 8, 0.3f);
+		ak::EmbeddedVertex target = ak::EmbeddedVertex::canonicalize(model.triangles[41], glm::vec3(0.2f, 0.3f, 0.5f));
+		queries.emplace_back(source, target);
+
+		std::vector< ak::EmbeddedVertex > path;
+		ak::embedded_path(model, source, target, &path);
+		float length = check_path(model, source, target, path);
+		float straight = glm::length(target.interpolate(model.vertices) - source.interpolate(model.vertices));
+		std::cout << "  edge -> triangle: path " << length << " (straight " << straight << ")" << std::endl;
+		if (!(std::abs(length - straight) < 1e-3f)) {
+			std::cerr << "FAILED: path across a flat grid isn't straight." << std::endl;
+			return 1;
+		}
+	}
+
+	//batched queries give the same paths as single queries:
+	{
+		ak::EmbeddedPathEngine engine(model);
+		std::vector< std::vector< ak::EmbeddedVertex > > paths;
+		engine.paths(queries, &paths);
+		assert(paths.size() == queries.size());
+		for (uint32_t q = 0; q < queries.size(); ++q) {
+			std::vector< ak::EmbeddedVertex > path;
+			ak::embedded_path(model, queries[q].first, queries[q].second, &path);
+			if (paths[q] != path) {
+				std::cerr << "FAILED: batched query " << q << " differs from single query." << std::endl;
+				return 1;
+			}
+		}
+	}
+
+	std::cout << "All embedded paths valid and shorter than edge paths." << std::endl;
+	return 0;
+}
@@ -0,0 +1,166 @@
+#include "pipeline.hpp"
+#include "log.hpp"
+
+#include <glm/glm.hpp>
+
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
+
+//open tube along +z with 'around' vertices per ring and 'up' rings of quads:
+ak::Model make_tube(float radius, float height, uint32_t around, uint32_t up) {
+	ak::Model model;
+	for (uint32_t j = 0; j <= up; ++j) {
+		for (uint32_t i = 0; i < around; ++i) {
+			float a = 2.0f * float(M_PI) * i / around;
+			model.vertices.emplace_back(radius * std::cos(a), radius * std::sin(a), height * j / up);
+		}
+	}
+	for (uint32_t j = 0; j < up; ++j) {
+		for (uint32_t i = 0; i < around; ++i) {
+			uint32_t a = j * around + i;
+			uint32_t b = j * around + (i + 1) % around;
+			model.triangles.emplace_back(a, b, b + around);
+			model.triangles.emplace_back(a, b + around, a + around);
+		}
+	}
+	return model;
+}
+
+int main() {
+	Log::set_level(0);
+
+	ak::Parameters parameters;
+	parameters.stitch_width_mm = 3.0f;
+	parameters.stitch_height_mm = 1.0f;
+
+	//(height chosen so no row lands on a ring of vertices or on the top boundary)
+	ak::Model model = make_tube(5.0f, 21.1f, 24, 17);
+	std::vector< float > times;
+	for (auto const &v : model.vertices) {
+		times.emplace_back(v.z);
+	}
+
+	ak::RowColGraph peeled, extracted;
+	ak::peel(parameters, model, times, false, &peeled);
+	ak::peel(parameters, model, times, true, &extracted);
+
+	//on a straight tube with times = height, time isolines are exactly the peeling distance isolines,
+	// so extracting rows should build the same rows as peeling, with the same links between them.
+	//(rows are loops, and where each loop starts can differ, so rows are compared up to rotation)
+	std::cout << "Peeled " << peeled.size() << " vertices, extracted " << extracted.size() << " vertices." << std::endl;
+	if (peeled.size() == 0 || peeled.size() != extracted.size()) {
+		std::cerr << "Graph sizes differ." << std::endl;
+		return 1;
+	}
+
+	struct Row {
+		float z = 0.0f;
+		std::vector< uint32_t > links; //(col_in count) * 3 + (col_out count) for each stitch, in row order
+	};
+	ak::EmbeddedVertexCodec codec(model);
+	auto get_rows = [&model,&codec](ak::RowColGraph const &graph) {
+		auto links = [](glm::uvec2 const &col) {
+			return uint32_t(col[0] != -1U) + uint32_t(col[1] != -1U);
+		};
+		std::vector< Row > rows;
+		std::vector< bool > visited(graph.size(), false);
+		for (uint32_t begin = 0; begin < graph.size(); ++begin) {
+			if (visited[begin]) continue;
+			rows.emplace_back();
+			uint32_t v = begin;
+			do {
+				assert(v != -1U && !visited[v]);
+				visited[v] = true;
+				rows.back().z += codec.unpack(graph.at[v]).interpolate(model.vertices).z;
+				rows.back().links.emplace_back(links(graph.col_in[v]) * 3 + links(graph.col_out[v]));
+				v = graph.row_out[v];
+			} while (v != begin);
+			rows.back().z /= rows.back().links.size();
+		}
+		return rows;
+	};
+	std::vector< Row > peeled_rows = get_rows(peeled);
+	std::vector< Row > extracted_rows = get_rows(extracted);
+	std::cout << "Peeled " << peeled_rows.size() << " rows, extracted " << extracted_rows.size() << " rows." << std::endl;
+	if (peeled_rows.size() != extracted_rows.size()) {
+		std::cerr << "Row counts differ." << std::endl;
+		return 1;
+	}
+
+	for (uint32_t r = 0; r < peeled_rows.size(); ++r) {
+		Row const &a = peeled_rows[r];
+		Row const &b = extracted_rows[r];
+		if (!(std::abs(a.z - b.z) < 1e-3f)) {
+			std::cerr << "Row " << r << " is at height " << a.z << " when peeled but " << b.z << " when extracted." << std::endl;
+			return 1;
+		}
+		bool same = false;
+		if (a.links.size() == b.links.size()) {
+			for (uint32_t rot = 0; rot < b.links.size() && !same; ++rot) {
+				same = std::equal(a.links.begin(), a.links.end() - rot, b.links.begin() + rot)
+				    && std::equal(a.links.end() - rot, a.links.end(), b.links.begin());
+			}
+		}
+		if (!same) {
+			std::cerr << "Row " << r << " has different stitches or links when extracted." << std::endl;
+			return 1;
+		}
+	}
+
+	std::cout << "Extracted rows match peeled rows." << std::endl;
+
+	//a dent (local minimum) in the time field stops extraction below it; once peeling is past the dent,
+	// extraction should pick up again for the rows above it:
+	{
+		uint32_t const Around = 24;
+		ak::Model dented = make_tube(5.0f, 42.1f, Around, 34);
+		std::vector< float > dented_times;
+		for (auto const &v : dented.vertices) {
+			dented_times.emplace_back(v.z);
+		}
+		dented_times[17 * Around + 5] -= 4.0f;
+
+		ak::EmbeddedVertexCodec dented_codec(dented);
+		ak::RowColGraph graph;
+		std::vector< std::vector< ak::EmbeddedVertex > > active_chains, next_active_chains;
+		std::vector< std::vector< ak::Stitch > > active_stitches, next_active_stitches;
+		ak::find_first_active_chains(parameters, dented, dented_times, &active_chains, &active_stitches, &graph);
+
+		uint32_t below = ak::extract_rows(parameters, dented, dented_times, &active_chains, &active_stitches, &graph);
+		uint32_t rounds = 0;
+		uint32_t above = 0;
+		//peel single rounds (the tube is one component) until extraction works again:
+		while (above == 0 && !active_chains.empty() && rounds < 10) {
+			rounds += 1;
+			ak::Model slice;
+			std::vector< ak::EmbeddedVertex > slice_on_model;
+			std::vector< std::vector< uint32_t > > slice_active_chains, slice_next_chains;
+			std::vector< bool > slice_next_used_boundary;
+			ak::peel_slice(parameters, dented, active_chains, &slice, &slice_on_model, &slice_active_chains, &slice_next_chains, &slice_next_used_boundary);
+			std::vector< float > slice_times;
+			ak::interpolate_batch(slice_on_model, dented_times, &slice_times);
+			std::vector< std::vector< ak::Stitch > > next_stitches;
+			std::vector< ak::Link > links;
+			ak::link_chains(parameters, slice, slice_times, slice_active_chains, active_stitches, slice_next_chains, slice_next_used_boundary, &next_stitches, &links);
+			next_active_chains.clear();
+			next_active_stitches.clear();
+			ak::build_next_active_chains(slice, slice_on_model, dented_codec, slice_active_chains, active_stitches, slice_next_chains, next_stitches, slice_next_used_boundary, links, &next_active_chains, &next_active_stitches, &graph);
+			active_chains = std::move(next_active_chains);
+			active_stitches = std::move(next_active_stitches);
+			if (!active_chains.empty()) {
+				above = ak::extract_rows(parameters, dented, dented_times, &active_chains, &active_stitches, &graph);
+			}
+		}
+		std::cout << "Dented tube: extracted " << below << " rows, peeled " << rounds << " rounds, extracted " << above << " rows." << std::endl;
+		if (below == 0 || above == 0) {
+			std::cerr << "Row extraction didn't resume after peeling past the dent." << std::endl;
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -1,45 +1,206 @@
 #include <iostream>
 #include <cassert>
 #include <vector>
+#include <random>
+#include <chrono>
+#include <string>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <functional>
 
 //'flatten' is defined in ak-link_chains.cpp
 void flatten(std::vector< uint32_t > &closest, std::vector< float > const &lengths, bool is_loop);
 
+//condense a string into runs of symbols (with summed weights):
+std::vector< std::pair< uint32_t, float > > get_runs(std::vector< uint32_t > const &closest, std::vector< float > const &lengths) {
+	std::vector< std::pair< uint32_t, float > > runs;
+	for (uint32_t i = 0; i < closest.size(); ++i) {
+		if (runs.empty() || runs.back().first != closest[i]) runs.emplace_back(closest[i], 0.0f);
+		runs.back().second += lengths[i];
+	}
+	return runs;
+}
+
+//can every run be kept when expanding outward from just before runs[center], as flatten does?
+// (each step keeps the next run on either side if its symbol is the most recently kept one or hasn't been kept yet)
+bool flattenable_from(std::vector< std::pair< uint32_t, float > > const &runs, uint32_t center) {
+	uint32_t const m = runs.size();
+	std::vector< uint32_t > used;
+	std::function< bool(uint32_t, uint32_t, uint32_t, uint32_t) > expand = [&](uint32_t l, uint32_t r, uint32_t left, uint32_t current) {
+		if (left == 0) return true;
+		for (uint32_t side = 0; side < 2; ++side) {
+			uint32_t i = (side == 0 ? l : r);
+			uint32_t symb = runs[i].first;
+			bool is_used = std::find(used.begin(), used.end(), symb) != used.end();
+			if (symb != current && is_used) continue;
+			if (!is_used) used.emplace_back(symb);
+			bool ok = (side == 0 ? expand((l + m - 1) % m, r, left - 1, symb) : expand(l, (r + 1) % m, left - 1, symb));
+			if (!is_used) used.pop_back();
+			if (ok) return true;
+		}
+		return false;
+	};
+	return expand((center + m - 1) % m, center, m, -1U);
+}
+
+//(non-loops are expanded from their ends; loops may start anywhere)
+bool flattenable(std::vector< std::pair< uint32_t, float > > const &runs, bool is_loop) {
+	if (runs.empty()) return true;
+	for (uint32_t c = 0; c < (is_loop ? runs.size() : 1); ++c) {
+		if (flattenable_from(runs, c)) return true;
+	}
+	return false;
+}
+
+//cheapest total weight of runs to relabel so the rest is flattenable (brute force over subsets of runs):
+float best_cost(std::vector< std::pair< uint32_t, float > > const &runs, bool is_loop) {
+	assert(runs.size() < 20);
+	float best = std::numeric_limits< float >::infinity();
+	for (uint32_t keep = 1; keep < (1U << runs.size()); ++keep) {
+		std::vector< std::pair< uint32_t, float > > kept;
+		float cost = 0.0f;
+		for (uint32_t i = 0; i < runs.size(); ++i) {
+			if (keep & (1U << i)) kept.emplace_back(runs[i]);
+			else cost += runs[i].second;
+		}
+		if (cost < best && flattenable(kept, is_loop)) best = cost;
+	}
+	return best;
+}
+
 int main(int argc, char **argv) {
 
-	auto test = [](std::vector< uint32_t > closest, std::vector< float > lengths) {
+	//flatten, then check that the result is flattenable and (if expected_cost >= 0, or if the string is short enough to brute-force) optimal:
+	uint32_t checked = 0;
+	auto test = [&checked](std::vector< uint32_t > closest, std::vector< float > lengths, bool is_loop, float expected_cost, bool verbose) {
 		if (lengths.empty()) {
 			lengths.assign(closest.size(), 1.0f);
 		}
 		assert(lengths.size() == closest.size());
 
 		std::vector< uint32_t > before = closest;
-
-		std::cout << "Flatten from:";
-		for (auto c : closest) {
-			std::cout << ' ' << c;
+		auto print = [](char const *label, std::vector< uint32_t > const &c) {
+			std::cout << label;
+			for (auto s : c) {
+				std::cout << ' ' << s;
+			}
+			std::cout << std::endl;
 		};
-		std::cout << std::endl;
 
-		flatten(closest, lengths, true);
+		if (verbose) print("Flatten from:", before);
+		flatten(closest, lengths, is_loop);
+		if (verbose) print("          to:", closest);
 
-		std::cout << "          to:";
-		for (auto c : closest) {
-			std::cout << ' ' << c;
+		auto fail = [&](std::string const &why) {
+			print("Flatten from:", before);
+			print("          to:", closest);
+			std::cout << "     lengths:";
+			for (auto l : lengths) {
+				std::cout << ' ' << l;
+			}
+			std::cout << std::endl;
+			std::cerr << "FAILED (" << (is_loop ? "loop" : "chain") << "): " << why << std::endl;
+			exit(1);
 		};
-		std::cout << std::endl;
-		
+
+		if (closest.size() != before.size()) fail("length changed");
+		float cost = 0.0f;
+		for (uint32_t i = 0; i < closest.size(); ++i) {
+			if (closest[i] != before[i]) cost += lengths[i];
+		}
+		if (!flattenable(get_runs(closest, lengths), is_loop)) fail("result is not flattenable");
+
+		auto runs = get_runs(before, lengths);
+		if (expected_cost < 0.0f && runs.size() <= 12) expected_cost = best_cost(runs, is_loop);
+		if (expected_cost >= 0.0f && std::abs(cost - expected_cost) > 1e-4f * (1.0f + expected_cost)) {
+			fail("relabelled weight " + std::to_string(cost) + " instead of the best possible " + std::to_string(expected_cost));
+		}
+		++checked;
 	};
 
-	test(std::vector< uint32_t >{5,5,5,5,5,5}, std::vector< float >{});
-	test(std::vector< uint32_t >{5,5,5,2,2,5}, std::vector< float >{});
+	test(std::vector< uint32_t >{5,5,5,5,5,5}, std::vector< float >{}, true, 0.0f, true);
+	test(std::vector< uint32_t >{5,5,5,2,2,5}, std::vector< float >{}, true, 0.0f, true);
 	test(std::vector< uint32_t >{1,1,2,1,2,2,2,1},
-	        std::vector< float >{1,1,1,1,1,1,1,1});
+	        std::vector< float >{1,1,1,1,1,1,1,1}, true, 1.0f, true);
 
 	test(std::vector< uint32_t >{1,1,2,1,2,2,2,1},
-	        std::vector< float >{1,1,1,5,1,1,1,1});
-	
-	test(std::vector< uint32_t >{5,1,1,1,2,2,5,5,3,4,4,4,4,1,1,3,3,5,5,2,2,5}, std::vector< float >{});
+	        std::vector< float >{1,1,1,5,1,1,1,1}, true, 1.0f, true);
+
+	test(std::vector< uint32_t >{5,1,1,1,2,2,5,5,3,4,4,4,4,1,1,3,3,5,5,2,2,5}, std::vector< float >{}, true, -1.0f, true);
+
+	//more than 16 symbols (used to be the limit):
+	{
+		std::vector< uint32_t > closest;
+		for (uint32_t s = 0; s < 20; ++s) {
+			closest.emplace_back(s);
+			closest.emplace_back(s);
+		}
+		//a repeated symbol can be flattened (it ends up on the other side of the bed):
+		closest.emplace_back(3);
+		test(closest, std::vector< float >{}, true, 0.0f, true);
+
+		//...but two crossing repeats can't both be, so one of them is relabelled:
+		closest.pop_back();
+		closest.insert(closest.begin() + 34, 8); //after '16 16'
+		closest.insert(closest.begin() + 26, 5); //after '12 12'
+		test(closest, std::vector< float >{}, true, 1.0f, true);
+	}
+
+	//random short strings, checked against brute force:
+	{
+		std::mt19937 mt(0xbadf1a7);
+		for (uint32_t iter = 0; iter < 2000; ++iter) {
+			uint32_t symbols = 2 + mt() % 5;
+			uint32_t length = 2 + mt() % 12;
+			std::vector< uint32_t > closest;
+			std::vector< float > lengths;
+			for (uint32_t i = 0; i < length; ++i) {
+				closest.emplace_back(mt() % symbols);
+				lengths.emplace_back(0.5f + (mt() % 100) / 100.0f);
+			}
+			test(closest, lengths, (mt() % 4 != 0), -1.0f, false);
+		}
+	}
+	std::cout << "Checked " << checked << " flattens." << std::endl;
+
+	//throughput benchmark on random symbol strings:
+	// test_flatten [iterations [max symbols [string length]]]
+	uint32_t iterations = (argc > 1 ? std::atoi(argv[1]) : 200);
+	uint32_t max_symbols = (argc > 2 ? std::atoi(argv[2]) : 24);
+	uint32_t length = (argc > 3 ? std::atoi(argv[3]) : 60);
+
+	std::mt19937 mt(0xf1a77e4);
+	std::vector< double > seconds(max_symbols + 1, 0.0);
+	std::vector< uint32_t > counts(max_symbols + 1, 0);
+	for (uint32_t iter = 0; iter < iterations; ++iter) {
+		uint32_t symbols = 2 + (mt() % (max_symbols - 1));
+		//runs of symbols, with some repeats so that there is something to fix:
+		std::vector< uint32_t > closest;
+		std::vector< float > lengths;
+		while (closest.size() < length) {
+			uint32_t symb = mt() % symbols;
+			uint32_t run = 1 + mt() % 4;
+			for (uint32_t r = 0; r < run; ++r) {
+				closest.emplace_back(symb);
+				lengths.emplace_back(0.5f + (mt() % 100) / 100.0f);
+			}
+		}
+		bool is_loop = (mt() % 4 != 0);
+
+		auto before = std::chrono::high_resolution_clock::now();
+		flatten(closest, lengths, is_loop);
+		auto after = std::chrono::high_resolution_clock::now();
+
+		seconds[symbols] += std::chrono::duration< double >(after - before).count();
+		counts[symbols] += 1;
+	}
+	std::cout << "Random flatten (" << iterations << " strings of length " << length << "):" << std::endl;
+	for (uint32_t s = 0; s <= max_symbols; ++s) {
+		if (counts[s] == 0) continue;
+		std::cout << "  " << s << " symbols: " << counts[s] << " strings, " << (seconds[s] / counts[s]) * 1000.0 << " ms each." << std::endl;
+	}
 
 	return 0;
 }
@@ -0,0 +1,162 @@
+#include <glm/glm.hpp>
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+//'link_dtw' is defined in ak-link_chains.cpp
+bool link_dtw(
+	std::vector< glm::vec3 > const &active_locations,
+	std::vector< bool > const &active_linkones,
+	std::vector< glm::vec3 > const &next_locations,
+	std::vector< bool > const &next_linkones,
+	float row_height,
+	uint32_t roll_active, uint32_t roll_new,
+	std::vector< std::pair< uint32_t, uint32_t > > *links,
+	float *cost
+);
+
+//'count' stitches evenly spaced on a circle at height z, starting at angle 'start':
+std::vector< glm::vec3 > make_circle(uint32_t count, float radius, float z, float start) {
+	std::vector< glm::vec3 > ret;
+	for (uint32_t i = 0; i < count; ++i) {
+		float a = start + 2.0f * float(M_PI) * i / count;
+		ret.emplace_back(radius * std::cos(a), radius * std::sin(a), z);
+	}
+	return ret;
+}
+
+float const RowHeight = 1.0f;
+
+//link two circles and check the links are a valid alignment that respects the linkone flags:
+void check(std::string const &name, uint32_t A, uint32_t N, uint32_t linkone_every, uint32_t roll_active, uint32_t roll_new) {
+	std::vector< glm::vec3 > active = make_circle(A, 0.5f * A, 0.0f, 0.0f);
+	std::vector< glm::vec3 > next = make_circle(N, 0.5f * A, RowHeight, 0.0f);
+	//rotate so that the rolled stitches line up:
+	std::rotate(active.begin(), active.end() - roll_active, active.end());
+	std::rotate(next.begin(), next.end() - roll_new, next.end());
+
+	//only the side with fewer stitches gets linkone flags, so an alignment always exists:
+	std::vector< bool > active_linkones(A, false), next_linkones(N, false);
+	if (linkone_every) {
+		std::vector< bool > &linkones = (A <= N ? active_linkones : next_linkones);
+		for (uint32_t i = 0; i < linkones.size(); i += linkone_every) {
+			linkones[i] = true;
+		}
+	}
+
+	std::vector< std::pair< uint32_t, uint32_t > > links;
+	float cost = 0.0f;
+	auto fail = [&](std::string const &why) {
+		std::cerr << "FAILED " << name << " (" << A << " -> " << N << "): " << why << std::endl;
+		for (auto const &l : links) {
+			std::cerr << " " << l.first << "-" << l.second;
+		}
+		std::cerr << std::endl;
+		exit(1);
+	};
+
+	if (!link_dtw(active, active_linkones, next, next_linkones, RowHeight, roll_active, roll_new, &links, &cost)) {
+		fail("no alignment found");
+	}
+
+	//every stitch on the smaller side links to one or two stitches, so there is one link per stitch on the larger side:
+	if (links.size() != std::max(A, N)) fail("expected " + std::to_string(std::max(A, N)) + " links");
+	if (links[0] != std::make_pair(roll_active, roll_new)) fail("doesn't start at the rolled stitches");
+
+	std::vector< uint32_t > active_count(A, 0), next_count(N, 0);
+	float expected_cost = 0.0f;
+	uint32_t prev_step = 0; //0: diagonal, 1: increase, 2: decrease
+	for (uint32_t i = 0; i < links.size(); ++i) {
+		uint32_t a = links[i].first;
+		uint32_t n = links[i].second;
+		if (a >= A || n >= N) fail("link index out of range");
+		active_count[a] += 1;
+		next_count[n] += 1;
+		float len = glm::length(next[n] - active[a]);
+		expected_cost += (len - RowHeight) * (len - RowHeight);
+
+		if (i == 0) continue;
+		//steps (relative to the rolls) are diagonal, increase, or decrease; only a diagonal may follow the others:
+		uint32_t da = (a + A - links[i-1].first) % A;
+		uint32_t dn = (n + N - links[i-1].second) % N;
+		uint32_t step;
+		if (da == 1 && dn == 1) step = 0;
+		else if (da == 0 && dn == 1) step = 1;
+		else if (da == 1 && dn == 0) step = 2;
+		else fail("link " + std::to_string(i) + " doesn't step to a neighbor");
+		if (step != 0 && prev_step != 0) fail("two-link stitches are linked to each other");
+		prev_step = step;
+	}
+
+	for (uint32_t a = 0; a < A; ++a) {
+		uint32_t want_max = (A < N && !active_linkones[a] ? 2 : 1);
+		if (active_count[a] < 1 || active_count[a] > want_max) fail("active stitch " + std::to_string(a) + " has " + std::to_string(active_count[a]) + " links");
+	}
+	for (uint32_t n = 0; n < N; ++n) {
+		uint32_t want_max = (N < A && !next_linkones[n] ? 2 : 1);
+		if (next_count[n] < 1 || next_count[n] > want_max) fail("next stitch " + std::to_string(n) + " has " + std::to_string(next_count[n]) + " links");
+	}
+
+	if (!(std::abs(cost - expected_cost) <= 1e-3f * std::max(1.0f, expected_cost))) {
+		fail("reported cost " + std::to_string(cost) + " but links cost " + std::to_string(expected_cost));
+	}
+
+	std::cout << "  " << name << " (" << A << " -> " << N << "): " << links.size() << " links, cost " << cost << std::endl;
+}
+
+int main() {
+	//equal counts on lined-up circles link straight up, at exactly the row height:
+	{
+		uint32_t const A = 12;
+		std::vector< glm::vec3 > active = make_circle(A, 6.0f, 0.0f, 0.0f);
+		std::vector< glm::vec3 > next = make_circle(A, 6.0f, RowHeight, 0.0f);
+		std::vector< bool > linkones(A, false);
+		std::vector< std::pair< uint32_t, uint32_t > > links;
+		float cost;
+		if (!link_dtw(active, linkones, next, linkones, RowHeight, 0, 0, &links, &cost)) {
+			std::cerr << "FAILED: no alignment for equal counts." << std::endl;
+			return 1;
+		}
+		bool straight = (links.size() == A);
+		for (uint32_t i = 0; straight && i < links.size(); ++i) {
+			straight = (links[i] == std::make_pair(i, i));
+		}
+		if (!straight || !(cost < 1e-6f)) {
+			std::cerr << "FAILED: equal counts didn't link straight up (cost " << cost << ")." << std::endl;
+			return 1;
+		}
+		std::cout << "  equal counts: straight links, cost " << cost << std::endl;
+	}
+
+	//increases and decreases, with and without flags and rolls:
+	// (the larger cases have diagonals longer than eight cells, so cover the AVX2 kernel where it is used)
+	check("increase", 10, 14, 0, 0, 0);
+	check("increase, linkones", 10, 14, 3, 0, 0);
+	check("increase, rolled", 10, 14, 2, 4, 0);
+	check("decrease", 14, 10, 0, 0, 0);
+	check("decrease, linkones", 14, 10, 3, 0, 0);
+	check("decrease, rolled", 14, 10, 2, 0, 7);
+	check("large increase", 200, 260, 5, 17, 0);
+	check("large decrease", 260, 200, 5, 0, 33);
+
+	//when every stitch must link once, different counts can't be aligned:
+	{
+		std::vector< glm::vec3 > active = make_circle(10, 5.0f, 0.0f, 0.0f);
+		std::vector< glm::vec3 > next = make_circle(14, 5.0f, RowHeight, 0.0f);
+		std::vector< bool > active_linkones(10, true), next_linkones(14, true);
+		std::vector< std::pair< uint32_t, uint32_t > > links;
+		float cost;
+		if (link_dtw(active, active_linkones, next, next_linkones, RowHeight, 0, 0, &links, &cost)) {
+			std::cerr << "FAILED: aligned all-linkone chains of different lengths." << std::endl;
+			return 1;
+		}
+		std::cout << "  all linkones: no alignment (as expected)" << std::endl;
+	}
+
+	std::cout << "All link_dtw checks passed." << std::endl;
+	return 0;
+}